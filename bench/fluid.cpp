@@ -0,0 +1,480 @@
+/**********************************************************************
+File name: fluid.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ffengine/math/perlin.hpp"
+
+#include "ffengine/sim/fluid.hpp"
+#include "ffengine/sim/terrain.hpp"
+
+using namespace sim;
+
+
+static const unsigned int default_frames = 500;
+static const unsigned int default_blocks_per_axis = 4;
+
+typedef std::chrono::steady_clock bench_clock;
+
+
+/**
+ * Sum of the fluid height of all cells in the front buffer.
+ */
+static double total_volume(const FluidBlocks &blocks)
+{
+    double result = 0;
+    for (unsigned int y = 0; y < blocks.cells_per_axis(); ++y) {
+        for (unsigned int x = 0; x < blocks.cells_per_axis(); ++x) {
+            result += blocks.clamped_cell_front_value(x, y).fluid_height;
+        }
+    }
+    return result;
+}
+
+static void activate_all(FluidBlocks &blocks)
+{
+    for (unsigned int y = 0; y < blocks.blocks_per_axis(); ++y) {
+        for (unsigned int x = 0; x < blocks.blocks_per_axis(); ++x) {
+            blocks.block(x, y)->set_active(true);
+        }
+    }
+}
+
+
+/**
+ * A reproducible benchmark setup.
+ */
+class Scenario
+{
+public:
+    virtual ~Scenario()
+    {
+
+    }
+
+public:
+    virtual const char *name() const = 0;
+    virtual void setup_terrain(Terrain &terrain) = 0;
+
+    /**
+     * Initialise the fluid. This is called after the terrain has been
+     * synced to the fluid simulation.
+     */
+    virtual void setup_fluid(Fluid &fluid) = 0;
+
+    virtual void before_frame(Fluid &fluid,
+                              const unsigned int frame,
+                              const unsigned int frames)
+    {
+        (void)fluid;
+        (void)frame;
+        (void)frames;
+    }
+
+    /**
+     * Whether the scenario has neither ocean nor sources, so that the total
+     * volume must be conserved.
+     */
+    virtual bool conserves_volume() const
+    {
+        return false;
+    }
+};
+
+
+/**
+ * The ocean rises in eight steps from below the terrain to above most of
+ * it, flooding the map from the edges.
+ */
+class OceanRiseScenario: public Scenario
+{
+public:
+    const char *name() const override
+    {
+        return "ocean_rise";
+    }
+
+    void setup_terrain(Terrain &terrain) override
+    {
+        terrain.from_sincos(Vector3f(0.11f, 0.07f, 3.f));
+    }
+
+    void setup_fluid(Fluid &fluid) override
+    {
+        fluid.set_ocean_level(-4.f);
+        fluid.reset();
+    }
+
+    void before_frame(Fluid &fluid,
+                      const unsigned int frame,
+                      const unsigned int frames) override
+    {
+        const unsigned int step_frames = std::max(frames / 8, 1U);
+        if (frame % step_frames == 0) {
+            fluid.set_ocean_level(-4.f + 1.5f*(frame / step_frames));
+        }
+    }
+};
+
+
+/**
+ * A single strong source in the middle of a perlin noise terrain.
+ */
+class PointSourceScenario: public Scenario
+{
+public:
+    PointSourceScenario():
+        m_source(1, 0.f, 0.f, 4.f, 0.f, 1.f)
+    {
+
+    }
+
+private:
+    Fluid::Source m_source;
+
+public:
+    const char *name() const override
+    {
+        return "point_source";
+    }
+
+    void setup_terrain(Terrain &terrain) override
+    {
+        terrain.from_perlin(PerlinNoiseGenerator(Vector3(0, 0, 10),
+                                                 Vector3(1, 1, 20),
+                                                 0.45, 6, 128));
+    }
+
+    void setup_fluid(Fluid &fluid) override
+    {
+        fluid.set_ocean_level(-100.f);
+        fluid.reset();
+
+        const unsigned int center = fluid.blocks().cells_per_axis() / 2;
+        m_source.m_pos = Vector2f(center, center);
+        m_source.m_absolute_height =
+                fluid.blocks().cell_meta(center, center)->terrain_height + 10.f;
+        fluid.add_source(&m_source);
+    }
+};
+
+
+/**
+ * Dam break: the left third of the map is flooded up to a fixed absolute
+ * height, with nothing holding the water back. The ocean is below the
+ * terrain and there are no sources, so the volume must be conserved.
+ */
+class DamBreakScenario: public Scenario
+{
+public:
+    const char *name() const override
+    {
+        return "dam_break";
+    }
+
+    void setup_terrain(Terrain &terrain) override
+    {
+        terrain.from_sincos(Vector3f(0.11f, 0.07f, 3.f));
+    }
+
+    void setup_fluid(Fluid &fluid) override
+    {
+        static const FluidFloat dam_level = 8.f;
+
+        fluid.set_ocean_level(-10.f);
+        fluid.reset();
+
+        FluidBlocks &blocks = fluid.blocks();
+        const unsigned int dam_x = blocks.cells_per_axis() / 3;
+        for (unsigned int y = 0; y < blocks.cells_per_axis(); ++y) {
+            for (unsigned int x = 0; x < dam_x; ++x) {
+                const FluidFloat height = std::max(
+                            FluidFloat(0),
+                            dam_level - blocks.cell_meta(x, y)->terrain_height);
+                blocks.cell_front(x, y)->fluid_height = height;
+                blocks.cell_back(x, y)->fluid_height = height;
+            }
+        }
+        activate_all(blocks);
+    }
+
+    bool conserves_volume() const override
+    {
+        return true;
+    }
+};
+
+
+struct ScenarioResult
+{
+    std::string name;
+    unsigned int frames;
+    double mean_ms;
+    double p50_ms;
+    double p90_ms;
+    double p99_ms;
+    double max_ms;
+    double mean_active_blocks;
+    unsigned int max_active_blocks;
+    double mean_frontier_blocks;
+    double cells_per_second;
+    bool has_volume_drift;
+    double volume_drift;
+};
+
+
+/**
+ * Nearest-rank percentile of sorted values.
+ */
+static double percentile(const std::vector<double> &sorted, const double p)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    const std::size_t rank = std::min(
+                sorted.size()-1,
+                static_cast<std::size_t>(p / 100. * sorted.size()));
+    return sorted[rank];
+}
+
+static ScenarioResult run_scenario(Scenario &scenario,
+                                   const unsigned int blocks_per_axis,
+                                   const unsigned int frames)
+{
+    Terrain terrain(blocks_per_axis*IFluidSim::block_size+1);
+    scenario.setup_terrain(terrain);
+
+    Fluid fluid(terrain);
+    // the first frame syncs the terrain
+    terrain.notify_heightmap_changed();
+    fluid.start();
+    fluid.wait_for();
+
+    scenario.setup_fluid(fluid);
+    const double initial_volume = total_volume(fluid.blocks());
+
+    std::vector<double> frame_ms;
+    frame_ms.reserve(frames);
+    unsigned long long active_blocks = 0;
+    unsigned long long frontier_blocks = 0;
+    unsigned int max_active_blocks = 0;
+
+    const bench_clock::time_point t_start = bench_clock::now();
+    for (unsigned int frame = 0; frame < frames; ++frame) {
+        scenario.before_frame(fluid, frame, frames);
+
+        const bench_clock::time_point t0 = bench_clock::now();
+        fluid.start();
+        fluid.wait_for();
+        const bench_clock::time_point t1 = bench_clock::now();
+        frame_ms.push_back(
+                    std::chrono::duration<double, std::milli>(t1 - t0).count());
+
+        // the work lists are those of the frame which just completed
+        const FluidBlockCounts &counts = fluid.blocks().block_counts();
+        active_blocks += counts.active;
+        frontier_blocks += counts.frontier;
+        max_active_blocks = std::max(max_active_blocks, counts.active);
+    }
+    const double total_s = std::chrono::duration<double>(
+                bench_clock::now() - t_start).count();
+
+    ScenarioResult result;
+    result.name = scenario.name();
+    result.frames = frames;
+
+    std::vector<double> sorted(frame_ms);
+    std::sort(sorted.begin(), sorted.end());
+    double sum_ms = 0;
+    for (const double ms: frame_ms) {
+        sum_ms += ms;
+    }
+    result.mean_ms = (frames > 0 ? sum_ms / frames : 0);
+    result.p50_ms = percentile(sorted, 50);
+    result.p90_ms = percentile(sorted, 90);
+    result.p99_ms = percentile(sorted, 99);
+    result.max_ms = (sorted.empty() ? 0 : sorted.back());
+
+    result.mean_active_blocks = (frames > 0 ? double(active_blocks) / frames : 0);
+    result.max_active_blocks = max_active_blocks;
+    result.mean_frontier_blocks = (frames > 0 ? double(frontier_blocks) / frames : 0);
+
+    const double cells_per_block = IFluidSim::block_size*IFluidSim::block_size;
+    result.cells_per_second = (total_s > 0
+                               ? (active_blocks + frontier_blocks) * cells_per_block / total_s
+                               : 0);
+
+    result.has_volume_drift = scenario.conserves_volume();
+    result.volume_drift = 0;
+    if (result.has_volume_drift && initial_volume > 0) {
+        result.volume_drift = (total_volume(fluid.blocks()) - initial_volume)
+                / initial_volume;
+    }
+
+    return result;
+}
+
+static void print_text(std::ostream &out,
+                       const unsigned int blocks_per_axis,
+                       const std::vector<ScenarioResult> &results)
+{
+    const unsigned int cells_per_axis = blocks_per_axis*IFluidSim::block_size;
+    out << "precision: " << fluid_precision_name << std::endl
+        << "cells: " << cells_per_axis*cells_per_axis
+        << " (" << blocks_per_axis*blocks_per_axis << " blocks)" << std::endl
+        << "bytes/cell: " << 2*sizeof(FluidCell) + sizeof(FluidCellMeta)
+        << " (state: " << sizeof(FluidCell) << ")" << std::endl;
+
+    for (const ScenarioResult &result: results) {
+        out << std::endl
+            << "scenario: " << result.name << std::endl
+            << "  frames: " << result.frames << std::endl
+            << "  ms/frame: mean " << result.mean_ms
+            << ", p50 " << result.p50_ms
+            << ", p90 " << result.p90_ms
+            << ", p99 " << result.p99_ms
+            << ", max " << result.max_ms << std::endl
+            << "  active blocks: mean " << result.mean_active_blocks
+            << ", max " << result.max_active_blocks << std::endl
+            << "  frontier blocks: mean " << result.mean_frontier_blocks
+            << std::endl
+            << "  cells/s: " << result.cells_per_second << std::endl;
+        if (result.has_volume_drift) {
+            out << "  volume drift: " << result.volume_drift << std::endl;
+        }
+    }
+}
+
+static void print_json(std::ostream &out,
+                       const unsigned int blocks_per_axis,
+                       const std::vector<ScenarioResult> &results)
+{
+    out << "{\"precision\": \"" << fluid_precision_name << "\", "
+        << "\"blocks_per_axis\": " << blocks_per_axis << ", "
+        << "\"block_size\": " << IFluidSim::block_size << ", "
+        << "\"bytes_per_cell\": " << 2*sizeof(FluidCell) + sizeof(FluidCellMeta)
+        << ", \"scenarios\": [";
+
+    bool first = true;
+    for (const ScenarioResult &result: results) {
+        if (!first) {
+            out << ", ";
+        }
+        first = false;
+
+        out << "{\"name\": \"" << result.name << "\", "
+            << "\"frames\": " << result.frames << ", "
+            << "\"frame_ms\": {"
+            << "\"mean\": " << result.mean_ms << ", "
+            << "\"p50\": " << result.p50_ms << ", "
+            << "\"p90\": " << result.p90_ms << ", "
+            << "\"p99\": " << result.p99_ms << ", "
+            << "\"max\": " << result.max_ms << "}, "
+            << "\"active_blocks\": {"
+            << "\"mean\": " << result.mean_active_blocks << ", "
+            << "\"max\": " << result.max_active_blocks << "}, "
+            << "\"frontier_blocks\": {"
+            << "\"mean\": " << result.mean_frontier_blocks << "}, "
+            << "\"cells_per_second\": " << result.cells_per_second;
+        if (result.has_volume_drift) {
+            out << ", \"volume_drift\": " << result.volume_drift;
+        }
+        out << "}";
+    }
+
+    out << "]}" << std::endl;
+}
+
+static std::unique_ptr<Scenario> make_scenario(const std::string &name)
+{
+    if (name == "ocean_rise") {
+        return std::make_unique<OceanRiseScenario>();
+    } else if (name == "point_source") {
+        return std::make_unique<PointSourceScenario>();
+    } else if (name == "dam_break") {
+        return std::make_unique<DamBreakScenario>();
+    }
+    return nullptr;
+}
+
+static void print_usage(std::ostream &out, const char *argv0)
+{
+    out << "usage: " << argv0
+        << " [--json] [--frames N] [--blocks N] [--scenario NAME]..."
+        << std::endl
+        << "scenarios: ocean_rise, point_source, dam_break (default: all)"
+        << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int frames = default_frames;
+    unsigned int blocks_per_axis = default_blocks_per_axis;
+    bool json = false;
+    std::vector<std::string> scenario_names;
+
+    for (int i = 1; i < argc; ++i) {
+        const bool has_value = i+1 < argc;
+        if (std::strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (std::strcmp(argv[i], "--frames") == 0 && has_value) {
+            frames = std::stoul(argv[++i]);
+        } else if (std::strcmp(argv[i], "--blocks") == 0 && has_value) {
+            blocks_per_axis = std::stoul(argv[++i]);
+        } else if (std::strcmp(argv[i], "--scenario") == 0 && has_value) {
+            scenario_names.emplace_back(argv[++i]);
+        } else {
+            print_usage(std::cerr, argv[0]);
+            return 1;
+        }
+    }
+
+    if (scenario_names.empty()) {
+        scenario_names = {"ocean_rise", "point_source", "dam_break"};
+    }
+
+    std::vector<ScenarioResult> results;
+    for (const std::string &name: scenario_names) {
+        std::unique_ptr<Scenario> scenario = make_scenario(name);
+        if (!scenario) {
+            std::cerr << "unknown scenario: " << name << std::endl;
+            print_usage(std::cerr, argv[0]);
+            return 1;
+        }
+        results.emplace_back(run_scenario(*scenario, blocks_per_axis, frames));
+    }
+
+    if (json) {
+        print_json(std::cout, blocks_per_axis, results);
+    } else {
+        print_text(std::cout, blocks_per_axis, results);
+    }
+
+    return 0;
+}
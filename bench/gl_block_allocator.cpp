@@ -0,0 +1,553 @@
+/**********************************************************************
+File name: gl_block_allocator.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ffengine/gl/block_allocator.hpp"
+
+using namespace ffe;
+
+
+static const unsigned int default_slices = 1024;
+static const unsigned int default_churn = 64;
+static const unsigned int default_frames = 2000;
+static const unsigned int default_max_size = 24576;
+static const unsigned int default_seed = 1;
+
+typedef std::chrono::steady_clock bench_clock;
+typedef unsigned int RegionID;
+static const RegionID NO_REGION = 0;
+
+
+/**
+ * Common interface of the allocators under test.
+ */
+class AllocatorUnderTest
+{
+public:
+    virtual ~AllocatorUnderTest()
+    {
+
+    }
+
+public:
+    virtual std::string name() const = 0;
+    virtual RegionID allocate(unsigned int count) = 0;
+    virtual void release(RegionID id) = 0;
+    virtual unsigned int total_blocks() const = 0;
+    virtual std::size_t regions() const = 0;
+};
+
+/**
+ * The region list which GLArray used before GLBlockAllocator: released
+ * regions are only merged lazily, by a linear scan over all regions when an
+ * allocation is made. When nothing fits, the space is doubled.
+ */
+class LegacyAllocator: public AllocatorUnderTest
+{
+private:
+    struct Region
+    {
+        Region(RegionID id, unsigned int start, unsigned int count):
+            m_id(id),
+            m_start(start),
+            m_count(count),
+            m_in_use(false)
+        {
+
+        }
+
+        RegionID m_id;
+        unsigned int m_start;
+        unsigned int m_count;
+        bool m_in_use;
+    };
+
+    typedef std::vector<std::unique_ptr<Region> > region_container;
+
+public:
+    LegacyAllocator():
+        m_total_blocks(0),
+        m_region_id_ctr(0)
+    {
+
+    }
+
+private:
+    region_container m_regions;
+    std::unordered_map<RegionID, Region*> m_region_map;
+    unsigned int m_total_blocks;
+    RegionID m_region_id_ctr;
+
+private:
+    Region &append_region(unsigned int start, unsigned int count)
+    {
+        const RegionID id = ++m_region_id_ctr;
+        m_regions.emplace_back(new Region(id, start, count));
+        m_region_map[id] = m_regions.back().get();
+        return *m_regions.back();
+    }
+
+    void reserve(const unsigned int min_blocks)
+    {
+        const unsigned int old_blocks = m_total_blocks;
+        unsigned int new_blocks = std::max(old_blocks, 1u);
+        while (min_blocks > new_blocks) {
+            new_blocks *= 2;
+        }
+        if (new_blocks <= old_blocks) {
+            return;
+        }
+        m_total_blocks = new_blocks;
+
+        if (!m_regions.empty() && !m_regions.back()->m_in_use) {
+            m_regions.back()->m_count += new_blocks - old_blocks;
+            return;
+        }
+        append_region(old_blocks, new_blocks - old_blocks);
+    }
+
+    region_container::iterator compact_regions(
+            region_container::iterator iter,
+            const unsigned int nregions)
+    {
+        unsigned int total = 0;
+        unsigned int i = nregions;
+        do {
+            i -= 1;
+            --iter;
+            total += (*iter)->m_count;
+            m_region_map.erase((*iter)->m_id);
+        } while (i > 0);
+
+        (*iter)->m_count = total;
+        m_region_map[(*iter)->m_id] = iter->get();
+        return m_regions.erase(iter+1, iter+nregions);
+    }
+
+    bool merge_aggregated(region_container::iterator &iterator,
+                          region_container::iterator &best,
+                          const unsigned int aggregation_backlog,
+                          const unsigned int nblocks)
+    {
+        iterator = compact_regions(iterator, aggregation_backlog);
+        if ((*(iterator-1))->m_count >= nblocks) {
+            best = iterator-1;
+            return true;
+        }
+        return false;
+    }
+
+    region_container::iterator compact_or_expand(const unsigned int nblocks)
+    {
+        auto iterator = m_regions.begin();
+        unsigned int aggregation_backlog = 0;
+        bool found = false;
+        auto best = m_regions.end();
+
+        for (; iterator != m_regions.end(); iterator++)
+        {
+            Region &region = **iterator;
+            if (region.m_in_use) {
+                if (aggregation_backlog > 1) {
+                    if (merge_aggregated(iterator, best,
+                                         aggregation_backlog, nblocks)) {
+                        found = true;
+                        break;
+                    }
+                    if (iterator == m_regions.end()) {
+                        break;
+                    }
+                }
+                aggregation_backlog = 0;
+                continue;
+            }
+
+            if (region.m_count >= nblocks) {
+                if (!found || region.m_count < (*best)->m_count) {
+                    best = iterator;
+                    found = true;
+                }
+            }
+            aggregation_backlog += 1;
+        }
+
+        if (!found && aggregation_backlog > 1) {
+            found = merge_aggregated(iterator, best,
+                                     aggregation_backlog, nblocks);
+        }
+
+        if (found) {
+            return best;
+        }
+
+        unsigned int required_blocks = nblocks;
+        if (!m_regions.empty() && !m_regions.back()->m_in_use) {
+            required_blocks -= m_regions.back()->m_count;
+        }
+        reserve(m_total_blocks + required_blocks);
+        return m_regions.end() - 1;
+    }
+
+public:
+    std::string name() const override
+    {
+        return "legacy";
+    }
+
+    RegionID allocate(unsigned int count) override
+    {
+        auto iterator = compact_or_expand(count);
+        Region *region = iterator->get();
+        if (region->m_count > count) {
+            const RegionID id = ++m_region_id_ctr;
+            auto rest = m_regions.emplace(
+                        iterator+1,
+                        new Region(id,
+                                   region->m_start + count,
+                                   region->m_count - count));
+            m_region_map[id] = rest->get();
+            region = (rest-1)->get();
+            region->m_count = count;
+        }
+        region->m_in_use = true;
+        return region->m_id;
+    }
+
+    void release(RegionID id) override
+    {
+        m_region_map[id]->m_in_use = false;
+    }
+
+    unsigned int total_blocks() const override
+    {
+        return m_total_blocks;
+    }
+
+    std::size_t regions() const override
+    {
+        return m_regions.size();
+    }
+};
+
+class BlockAllocator: public AllocatorUnderTest
+{
+private:
+    GLBlockAllocator m_allocator;
+
+public:
+    std::string name() const override
+    {
+        return "block";
+    }
+
+    RegionID allocate(unsigned int count) override
+    {
+        RegionID id = m_allocator.allocate(count);
+        if (id == GLBlockAllocator::NO_REGION) {
+            // grow like GLArray::expand() does
+            const unsigned int min_blocks =
+                    m_allocator.total_blocks() + count
+                    - m_allocator.trailing_free_blocks();
+            unsigned int new_blocks = std::max(m_allocator.total_blocks(), 1u);
+            while (min_blocks > new_blocks) {
+                new_blocks *= 2;
+            }
+            m_allocator.grow(new_blocks);
+            id = m_allocator.allocate(count);
+        }
+        return id;
+    }
+
+    void release(RegionID id) override
+    {
+        m_allocator.release(id);
+    }
+
+    unsigned int total_blocks() const override
+    {
+        return m_allocator.total_blocks();
+    }
+
+    std::size_t regions() const override
+    {
+        return m_allocator.regions();
+    }
+};
+
+
+struct AllocatorResult
+{
+    std::string name;
+    unsigned int slices;
+    unsigned int churn;
+    unsigned int frames;
+    unsigned long long live_blocks;
+    unsigned int total_blocks;
+    std::size_t regions;
+    double mean_frame_us;
+    double p50_frame_us;
+    double p99_frame_us;
+    double max_frame_us;
+};
+
+
+/**
+ * Nearest-rank percentile of sorted values.
+ */
+static double percentile(const std::vector<double> &sorted, const double p)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    const std::size_t rank = std::min(
+                sorted.size()-1,
+                static_cast<std::size_t>(p / 100. * sorted.size()));
+    return sorted[rank];
+}
+
+/**
+ * Replay the churn of the fluid slice cache: a fixed number of slices is
+ * kept alive, and every frame a number of them is invalidated and rebuilt
+ * with a new index count.
+ */
+static AllocatorResult run_allocator(AllocatorUnderTest &allocator,
+                                     const unsigned int slices,
+                                     const unsigned int churn,
+                                     const unsigned int frames,
+                                     const unsigned int max_size,
+                                     const unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    // most slices are small (partially wet blocks), few are fully covered
+    std::exponential_distribution<double> size_dist(8.0);
+    std::uniform_int_distribution<unsigned int> slice_dist(0, slices-1);
+    auto random_size = [&]() -> unsigned int {
+        return std::min(max_size,
+                        6u + static_cast<unsigned int>(size_dist(rng)*max_size));
+    };
+
+    std::vector<RegionID> live(slices, NO_REGION);
+    std::vector<unsigned int> sizes(slices, 0);
+    for (unsigned int i = 0; i < slices; ++i) {
+        sizes[i] = random_size();
+        live[i] = allocator.allocate(sizes[i]);
+    }
+
+    std::vector<double> frame_us;
+    frame_us.reserve(frames);
+    for (unsigned int frame = 0; frame < frames; ++frame) {
+        std::vector<unsigned int> victims(churn);
+        std::vector<unsigned int> new_sizes(churn);
+        for (unsigned int i = 0; i < churn; ++i) {
+            victims[i] = slice_dist(rng);
+            new_sizes[i] = random_size();
+        }
+
+        const bench_clock::time_point t0 = bench_clock::now();
+        for (unsigned int i = 0; i < churn; ++i) {
+            const unsigned int victim = victims[i];
+            if (live[victim] != NO_REGION) {
+                allocator.release(live[victim]);
+                live[victim] = NO_REGION;
+            }
+        }
+        for (unsigned int i = 0; i < churn; ++i) {
+            const unsigned int victim = victims[i];
+            if (live[victim] == NO_REGION) {
+                sizes[victim] = new_sizes[i];
+                live[victim] = allocator.allocate(sizes[victim]);
+            }
+        }
+        const bench_clock::time_point t1 = bench_clock::now();
+        frame_us.push_back(
+                    std::chrono::duration<double, std::micro>(t1 - t0).count());
+    }
+
+    std::sort(frame_us.begin(), frame_us.end());
+    double sum_us = 0;
+    for (const double us: frame_us) {
+        sum_us += us;
+    }
+
+    AllocatorResult result;
+    result.name = allocator.name();
+    result.slices = slices;
+    result.churn = churn;
+    result.frames = frames;
+    result.live_blocks = 0;
+    for (const unsigned int size: sizes) {
+        result.live_blocks += size;
+    }
+    result.total_blocks = allocator.total_blocks();
+    result.regions = allocator.regions();
+    result.mean_frame_us = (frames > 0 ? sum_us / frames : 0);
+    result.p50_frame_us = percentile(frame_us, 50);
+    result.p99_frame_us = percentile(frame_us, 99);
+    result.max_frame_us = (frame_us.empty() ? 0 : frame_us.back());
+    return result;
+}
+
+static void print_text(std::ostream &out,
+                       const std::vector<AllocatorResult> &results)
+{
+    bool first = true;
+    for (const AllocatorResult &result: results) {
+        if (!first) {
+            out << std::endl;
+        }
+        first = false;
+
+        out << "allocator: " << result.name << std::endl
+            << "  slices: " << result.slices
+            << ", churn/frame: " << result.churn
+            << ", frames: " << result.frames << std::endl
+            << "  blocks: " << result.live_blocks << " live, "
+            << result.total_blocks << " total" << std::endl
+            << "  regions: " << result.regions << std::endl
+            << "  us/frame: mean " << result.mean_frame_us
+            << ", p50 " << result.p50_frame_us
+            << ", p99 " << result.p99_frame_us
+            << ", max " << result.max_frame_us << std::endl;
+    }
+}
+
+static void print_json(std::ostream &out,
+                       const std::vector<AllocatorResult> &results)
+{
+    out << "{\"allocators\": [";
+
+    bool first = true;
+    for (const AllocatorResult &result: results) {
+        if (!first) {
+            out << ", ";
+        }
+        first = false;
+
+        out << "{\"name\": \"" << result.name << "\", "
+            << "\"slices\": " << result.slices << ", "
+            << "\"churn\": " << result.churn << ", "
+            << "\"frames\": " << result.frames << ", "
+            << "\"live_blocks\": " << result.live_blocks << ", "
+            << "\"total_blocks\": " << result.total_blocks << ", "
+            << "\"regions\": " << result.regions << ", "
+            << "\"frame_us\": {"
+            << "\"mean\": " << result.mean_frame_us << ", "
+            << "\"p50\": " << result.p50_frame_us << ", "
+            << "\"p99\": " << result.p99_frame_us << ", "
+            << "\"max\": " << result.max_frame_us << "}}";
+    }
+
+    out << "]}" << std::endl;
+}
+
+static std::unique_ptr<AllocatorUnderTest> make_allocator(
+        const std::string &name)
+{
+    if (name == "legacy") {
+        return std::make_unique<LegacyAllocator>();
+    } else if (name == "block") {
+        return std::make_unique<BlockAllocator>();
+    }
+    return nullptr;
+}
+
+static void print_usage(std::ostream &out, const char *argv0)
+{
+    out << "usage: " << argv0
+        << " [--json] [--slices N] [--churn N] [--frames N]"
+           " [--max-size N] [--seed N] [--allocator NAME]..."
+        << std::endl
+        << "allocators: legacy, block (default: all)"
+        << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int slices = default_slices;
+    unsigned int churn = default_churn;
+    unsigned int frames = default_frames;
+    unsigned int max_size = default_max_size;
+    unsigned int seed = default_seed;
+    bool json = false;
+    std::vector<std::string> allocator_names;
+
+    for (int i = 1; i < argc; ++i) {
+        const bool has_value = i+1 < argc;
+        if (std::strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (std::strcmp(argv[i], "--slices") == 0 && has_value) {
+            slices = std::stoul(argv[++i]);
+        } else if (std::strcmp(argv[i], "--churn") == 0 && has_value) {
+            churn = std::stoul(argv[++i]);
+        } else if (std::strcmp(argv[i], "--frames") == 0 && has_value) {
+            frames = std::stoul(argv[++i]);
+        } else if (std::strcmp(argv[i], "--max-size") == 0 && has_value) {
+            max_size = std::stoul(argv[++i]);
+        } else if (std::strcmp(argv[i], "--seed") == 0 && has_value) {
+            seed = std::stoul(argv[++i]);
+        } else if (std::strcmp(argv[i], "--allocator") == 0 && has_value) {
+            allocator_names.emplace_back(argv[++i]);
+        } else {
+            print_usage(std::cerr, argv[0]);
+            return 1;
+        }
+    }
+
+    if (slices == 0 || max_size < 6) {
+        print_usage(std::cerr, argv[0]);
+        return 1;
+    }
+
+    if (allocator_names.empty()) {
+        allocator_names = {"legacy", "block"};
+    }
+
+    std::vector<AllocatorResult> results;
+    for (const std::string &name: allocator_names) {
+        std::unique_ptr<AllocatorUnderTest> allocator = make_allocator(name);
+        if (!allocator) {
+            std::cerr << "unknown allocator: " << name << std::endl;
+            print_usage(std::cerr, argv[0]);
+            return 1;
+        }
+        results.emplace_back(run_allocator(*allocator, slices, churn, frames,
+                                           max_size, seed));
+    }
+
+    if (json) {
+        print_json(std::cout, results);
+    } else {
+        print_text(std::cout, results);
+    }
+
+    return 0;
+}
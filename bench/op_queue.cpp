@@ -0,0 +1,390 @@
+/**********************************************************************
+File name: op_queue.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ffengine/sim/op_queue.hpp"
+
+using namespace sim;
+
+
+static const unsigned int default_producers = 4;
+static const unsigned int default_ops = 200000;
+static const unsigned int default_frame_us = 1000;
+
+typedef std::chrono::steady_clock bench_clock;
+
+
+class NullOperation: public WorldOperation
+{
+public:
+    WorldOperationResult execute(WorldState &) override
+    {
+        return NO_ERROR;
+    }
+
+};
+
+
+/**
+ * Common interface of the queue implementations under test.
+ */
+class QueueUnderTest
+{
+public:
+    virtual ~QueueUnderTest()
+    {
+
+    }
+
+public:
+    virtual std::string name() const = 0;
+    virtual void push(WorldOperationPtr &&op) = 0;
+    virtual std::size_t pop_all(std::vector<WorldOperationPtr> &dest) = 0;
+
+    /**
+     * Number of pushes which had to allocate memory for the queue itself.
+     */
+    virtual std::uint64_t overflows() const
+    {
+        return 0;
+    }
+};
+
+/**
+ * The mutex protected vector which Server used before the lock-free queue.
+ */
+class MutexQueue: public QueueUnderTest
+{
+private:
+    std::mutex m_mutex;
+    std::vector<WorldOperationPtr> m_queue;
+
+public:
+    std::string name() const override
+    {
+        return "mutex";
+    }
+
+    void push(WorldOperationPtr &&op) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.emplace_back(std::move(op));
+    }
+
+    std::size_t pop_all(std::vector<WorldOperationPtr> &dest) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const std::size_t count = m_queue.size();
+        std::move(m_queue.begin(), m_queue.end(), std::back_inserter(dest));
+        m_queue.clear();
+        return count;
+    }
+};
+
+class LockFreeQueue: public QueueUnderTest
+{
+public:
+    explicit LockFreeQueue(const std::size_t pool_size):
+        m_queue(pool_size)
+    {
+
+    }
+
+private:
+    WorldOperationQueue m_queue;
+
+public:
+    std::string name() const override
+    {
+        return "lockfree";
+    }
+
+    void push(WorldOperationPtr &&op) override
+    {
+        m_queue.push(std::move(op));
+    }
+
+    std::size_t pop_all(std::vector<WorldOperationPtr> &dest) override
+    {
+        return m_queue.pop_all(dest);
+    }
+
+    std::uint64_t overflows() const override
+    {
+        return m_queue.overflows();
+    }
+};
+
+
+struct QueueResult
+{
+    std::string name;
+    unsigned int producers;
+    unsigned long long ops;
+    unsigned long long overflows;
+    double ops_per_second;
+    double mean_push_ns;
+    double p50_push_ns;
+    double p99_push_ns;
+    double p999_push_ns;
+    double max_push_ns;
+};
+
+
+/**
+ * Nearest-rank percentile of sorted values.
+ */
+static double percentile(const std::vector<double> &sorted, const double p)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    const std::size_t rank = std::min(
+                sorted.size()-1,
+                static_cast<std::size_t>(p / 100. * sorted.size()));
+    return sorted[rank];
+}
+
+static QueueResult run_queue(QueueUnderTest &queue,
+                             const unsigned int producers,
+                             const unsigned int ops_per_producer,
+                             const unsigned int frame_us)
+{
+    // the operations are allocated up front, so that only the queue is
+    // measured
+    std::vector<std::vector<WorldOperationPtr> > inputs(producers);
+    for (auto &input: inputs) {
+        input.reserve(ops_per_producer);
+        for (unsigned int i = 0; i < ops_per_producer; ++i) {
+            input.emplace_back(std::make_unique<NullOperation>());
+        }
+    }
+
+    std::vector<std::vector<double> > push_ns(producers);
+    std::atomic_bool go(false);
+    std::atomic_uint running(producers);
+
+    std::vector<std::thread> threads;
+    for (unsigned int p = 0; p < producers; ++p) {
+        threads.emplace_back([&, p]()
+        {
+            std::vector<double> &latencies = push_ns[p];
+            latencies.reserve(ops_per_producer);
+            while (!go) {
+                std::this_thread::yield();
+            }
+            for (WorldOperationPtr &op: inputs[p]) {
+                const bench_clock::time_point t0 = bench_clock::now();
+                queue.push(std::move(op));
+                const bench_clock::time_point t1 = bench_clock::now();
+                latencies.push_back(
+                            std::chrono::duration<double, std::nano>(t1 - t0).count());
+            }
+            --running;
+        });
+    }
+
+    // the consumer behaves like the game thread: drain once per frame and
+    // "execute" the operations
+    std::vector<WorldOperationPtr> buffer;
+    unsigned long long consumed = 0;
+    const unsigned long long total = (unsigned long long)producers*ops_per_producer;
+
+    const bench_clock::time_point t_start = bench_clock::now();
+    go = true;
+    bench_clock::time_point tnext_frame = t_start;
+    while (consumed < total) {
+        consumed += queue.pop_all(buffer);
+        buffer.clear();
+        if (running > 0) {
+            tnext_frame += std::chrono::microseconds(frame_us);
+            std::this_thread::sleep_until(tnext_frame);
+        }
+    }
+    const double total_s = std::chrono::duration<double>(
+                bench_clock::now() - t_start).count();
+
+    for (std::thread &thread: threads) {
+        thread.join();
+    }
+
+    std::vector<double> sorted;
+    sorted.reserve(total);
+    for (const auto &latencies: push_ns) {
+        sorted.insert(sorted.end(), latencies.begin(), latencies.end());
+    }
+    std::sort(sorted.begin(), sorted.end());
+    double sum_ns = 0;
+    for (const double ns: sorted) {
+        sum_ns += ns;
+    }
+
+    QueueResult result;
+    result.name = queue.name();
+    result.producers = producers;
+    result.ops = total;
+    result.overflows = queue.overflows();
+    result.ops_per_second = (total_s > 0 ? total / total_s : 0);
+    result.mean_push_ns = (total > 0 ? sum_ns / total : 0);
+    result.p50_push_ns = percentile(sorted, 50);
+    result.p99_push_ns = percentile(sorted, 99);
+    result.p999_push_ns = percentile(sorted, 99.9);
+    result.max_push_ns = (sorted.empty() ? 0 : sorted.back());
+    return result;
+}
+
+static void print_text(std::ostream &out,
+                       const std::vector<QueueResult> &results)
+{
+    bool first = true;
+    for (const QueueResult &result: results) {
+        if (!first) {
+            out << std::endl;
+        }
+        first = false;
+
+        out << "queue: " << result.name << std::endl
+            << "  producers: " << result.producers << std::endl
+            << "  ops: " << result.ops << std::endl
+            << "  overflows: " << result.overflows << std::endl
+            << "  ops/s: " << result.ops_per_second << std::endl
+            << "  ns/push: mean " << result.mean_push_ns
+            << ", p50 " << result.p50_push_ns
+            << ", p99 " << result.p99_push_ns
+            << ", p99.9 " << result.p999_push_ns
+            << ", max " << result.max_push_ns << std::endl;
+    }
+}
+
+static void print_json(std::ostream &out,
+                       const std::vector<QueueResult> &results)
+{
+    out << "{\"queues\": [";
+
+    bool first = true;
+    for (const QueueResult &result: results) {
+        if (!first) {
+            out << ", ";
+        }
+        first = false;
+
+        out << "{\"name\": \"" << result.name << "\", "
+            << "\"producers\": " << result.producers << ", "
+            << "\"ops\": " << result.ops << ", "
+            << "\"overflows\": " << result.overflows << ", "
+            << "\"ops_per_second\": " << result.ops_per_second << ", "
+            << "\"push_ns\": {"
+            << "\"mean\": " << result.mean_push_ns << ", "
+            << "\"p50\": " << result.p50_push_ns << ", "
+            << "\"p99\": " << result.p99_push_ns << ", "
+            << "\"p99.9\": " << result.p999_push_ns << ", "
+            << "\"max\": " << result.max_push_ns << "}}";
+    }
+
+    out << "]}" << std::endl;
+}
+
+static std::unique_ptr<QueueUnderTest> make_queue(const std::string &name,
+                                                  const std::size_t pool_size)
+{
+    if (name == "mutex") {
+        return std::make_unique<MutexQueue>();
+    } else if (name == "lockfree") {
+        return std::make_unique<LockFreeQueue>(pool_size);
+    }
+    return nullptr;
+}
+
+static void print_usage(std::ostream &out, const char *argv0)
+{
+    out << "usage: " << argv0
+        << " [--json] [--producers N] [--ops N] [--frame-us N]"
+           " [--pool N] [--queue NAME]..."
+        << std::endl
+        << "queues: mutex, lockfree (default: all)"
+        << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int producers = default_producers;
+    unsigned int ops_per_producer = default_ops;
+    unsigned int frame_us = default_frame_us;
+    std::size_t pool_size = WorldOperationQueue::DEFAULT_POOL_SIZE;
+    bool json = false;
+    std::vector<std::string> queue_names;
+
+    for (int i = 1; i < argc; ++i) {
+        const bool has_value = i+1 < argc;
+        if (std::strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (std::strcmp(argv[i], "--producers") == 0 && has_value) {
+            producers = std::stoul(argv[++i]);
+        } else if (std::strcmp(argv[i], "--ops") == 0 && has_value) {
+            ops_per_producer = std::stoul(argv[++i]);
+        } else if (std::strcmp(argv[i], "--frame-us") == 0 && has_value) {
+            frame_us = std::stoul(argv[++i]);
+        } else if (std::strcmp(argv[i], "--pool") == 0 && has_value) {
+            pool_size = std::stoul(argv[++i]);
+        } else if (std::strcmp(argv[i], "--queue") == 0 && has_value) {
+            queue_names.emplace_back(argv[++i]);
+        } else {
+            print_usage(std::cerr, argv[0]);
+            return 1;
+        }
+    }
+
+    if (queue_names.empty()) {
+        queue_names = {"mutex", "lockfree"};
+    }
+
+    std::vector<QueueResult> results;
+    for (const std::string &name: queue_names) {
+        std::unique_ptr<QueueUnderTest> queue = make_queue(name, pool_size);
+        if (!queue) {
+            std::cerr << "unknown queue: " << name << std::endl;
+            print_usage(std::cerr, argv[0]);
+            return 1;
+        }
+        results.emplace_back(run_queue(*queue, producers, ops_per_producer,
+                                       frame_us));
+    }
+
+    if (json) {
+        print_json(std::cout, results);
+    } else {
+        print_text(std::cout, results);
+    }
+
+    return 0;
+}
@@ -0,0 +1,183 @@
+/**********************************************************************
+File name: savegame.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "ffengine/io/filestream.hpp"
+#include "ffengine/math/perlin.hpp"
+
+#include "ffengine/sim/savegame.hpp"
+#include "ffengine/sim/world.hpp"
+
+using namespace sim;
+
+
+static const unsigned int default_runs = 5;
+static const char *const default_path = "bench_savegame.ffeworld";
+
+typedef std::chrono::steady_clock bench_clock;
+
+
+struct Timings
+{
+    std::string name;
+    double p50_ms;
+    double max_ms;
+};
+
+
+/**
+ * Nearest-rank percentile of sorted values.
+ */
+static double percentile(const std::vector<double> &sorted, const double p)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    const std::size_t rank = std::min(
+                sorted.size()-1,
+                static_cast<std::size_t>(p / 100. * sorted.size()));
+    return sorted[rank];
+}
+
+static Timings summarise(const std::string &name, std::vector<double> &times)
+{
+    std::sort(times.begin(), times.end());
+    return Timings{name, percentile(times, 50), times.back()};
+}
+
+static double elapsed_ms(const bench_clock::time_point t0)
+{
+    return std::chrono::duration_cast<
+            std::chrono::duration<double, std::milli> >(
+                bench_clock::now() - t0).count();
+}
+
+static void generate(WorldState &state)
+{
+    state.terrain().from_perlin(PerlinNoiseGenerator(Vector3(0, 0, 10),
+                                                     Vector3(1, 1, 20),
+                                                     0.45, 6, 128));
+}
+
+static void print_text(std::ostream &out, const std::size_t file_size,
+                       const std::vector<Timings> &results)
+{
+    out << "file size: " << file_size << " bytes" << std::endl;
+    for (const Timings &result: results) {
+        out << result.name << ": p50 " << result.p50_ms
+            << " ms, max " << result.max_ms << " ms" << std::endl;
+    }
+}
+
+static void print_json(std::ostream &out, const std::size_t file_size,
+                       const std::vector<Timings> &results)
+{
+    out << "{\"file_size\": " << file_size << ", \"timings_ms\": {";
+
+    bool first = true;
+    for (const Timings &result: results) {
+        if (!first) {
+            out << ", ";
+        }
+        first = false;
+
+        out << "\"" << result.name << "\": {"
+            << "\"p50\": " << result.p50_ms << ", "
+            << "\"max\": " << result.max_ms << "}";
+    }
+
+    out << "}}" << std::endl;
+}
+
+static void print_usage(std::ostream &out, const char *argv0)
+{
+    out << "usage: " << argv0 << " [--json] [--runs N] [--path FILE]"
+        << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int runs = default_runs;
+    std::string path = default_path;
+    bool json = false;
+
+    for (int i = 1; i < argc; ++i) {
+        const bool has_value = i+1 < argc;
+        if (std::strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (std::strcmp(argv[i], "--runs") == 0 && has_value) {
+            runs = std::max(1ul, std::stoul(argv[++i]));
+        } else if (std::strcmp(argv[i], "--path") == 0 && has_value) {
+            path = argv[++i];
+        } else {
+            print_usage(std::cerr, argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<double> generate_times, save_times, load_times;
+    std::size_t file_size = 0;
+    for (unsigned int run = 0; run < runs; ++run) {
+        WorldState original;
+        bench_clock::time_point t0 = bench_clock::now();
+        generate(original);
+        generate_times.emplace_back(elapsed_ms(t0));
+
+        t0 = bench_clock::now();
+        {
+            io::FileStream stream(path, io::OpenMode::WRITE,
+                                  io::WriteMode::OVERWRITE);
+            save_world(stream, original);
+            file_size = stream.size();
+        }
+        save_times.emplace_back(elapsed_ms(t0));
+
+        // the world is constructed outside of the measurement, like the
+        // regenerated one
+        WorldState restored;
+        t0 = bench_clock::now();
+        load_world(path, restored);
+        load_times.emplace_back(elapsed_ms(t0));
+    }
+    std::remove(path.c_str());
+
+    std::vector<Timings> results;
+    results.emplace_back(summarise("generate", generate_times));
+    results.emplace_back(summarise("save", save_times));
+    results.emplace_back(summarise("load", load_times));
+
+    if (json) {
+        print_json(std::cout, file_size, results);
+    } else {
+        print_text(std::cout, file_size, results);
+    }
+
+    return 0;
+}
@@ -34,6 +34,7 @@ the AUTHORS file.
 #include "mainmenu.hpp"
 #include "terraform/terraform.hpp"
 
+#include "ffengine/common/scheduler.hpp"
 #include "ffengine/io/log.hpp"
 
 
@@ -61,6 +62,13 @@ int main(int argc, char *argv[])
 
     QSurfaceFormat::setDefaultFormat(format);
 
+    pre_app_settings.endGroup();
+    pre_app_settings.endGroup();
+
+    // 0 means one worker per hardware thread
+    ffe::configure_scheduler(
+                pre_app_settings.value("scheduler/workers", 0).toUInt());
+
     io::logging().attach_sink<io::LogAsynchronousSink>(
                 std::move(std::make_unique<io::LogTTYSink>())
                 )->set_synchronous(true);
@@ -75,6 +83,9 @@ int main(int argc, char *argv[])
     io::logging().get_logger("render.camera").set_level(io::LOG_WARNING);
 
     QApplication qapp(argc, argv);
+    // allow default-constructed QSettings in the application modes
+    QCoreApplication::setOrganizationName(organization);
+    QCoreApplication::setApplicationName(application);
     qapp.setStyle(QStyleFactory::create("fusion"));
     io::logging().log(io::LOG_INFO) << "QApplication initialized" << io::submit;
 
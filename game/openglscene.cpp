@@ -152,6 +152,7 @@ void OpenGLScene::paintGL()
         m_rendergraph->prepare();
     }
     emit after_gl_sync();
+    m_upload_stats = ffe::take_gl_array_upload_stats();
 
     glEnable(GL_CULL_FACE);
     glCullFace(GL_BACK);
@@ -188,7 +189,22 @@ void OpenGLScene::paintGL()
                 std::chrono::duration_cast<std::chrono::duration<float, std::ratio<1, 1> > >(t_now-m_previous_t).count();
         if (seconds_passed > 1.f) {
             m_previous_fps = m_frames / seconds_passed;
-            logger.logf(io::LOG_DEBUG, "%.0f FPS", m_previous_fps);
+            logger.logf(io::LOG_DEBUG, "%.0f FPS, last frame uploaded %zu "
+                                       "bytes (%zu dirty) in %u calls",
+                        m_previous_fps,
+                        m_upload_stats.bytes,
+                        m_upload_stats.dirty_bytes,
+                        m_upload_stats.uploads + m_upload_stats.reallocations);
+            if (m_rendergraph) {
+                for (auto &item: m_rendergraph->context().prepare_timings().entries())
+                {
+                    logger.logf(io::LOG_DEBUG, "  prepare %s: %u calls, %.2f ms",
+                                item.first.name(),
+                                item.second.calls,
+                                std::chrono::duration<float, std::milli>(
+                                    item.second.total).count());
+                }
+            }
             m_previous_t = t_now;
             m_frames = 0;
         }
@@ -30,6 +30,7 @@ the AUTHORS file.
 
 #include <QOpenGLWidget>
 
+#include "ffengine/gl/array.hpp"
 #include "ffengine/render/scenegraph.hpp"
 #include "ffengine/render/camera.hpp"
 #include "ffengine/render/renderpass.hpp"
@@ -59,6 +60,8 @@ private:
     double m_previous_fps;
     unsigned int m_frames;
 
+    ffe::GLArrayUploadStats m_upload_stats;
+
 signals:
     void advance(ffe::TimeInterval seconds);
     void after_gl_sync();
@@ -72,6 +75,15 @@ protected:
 
 public:
     double fps();
+
+    /**
+     * Buffer uploads of the last frame.
+     */
+    inline const ffe::GLArrayUploadStats &upload_stats() const
+    {
+        return m_upload_stats;
+    }
+
     void setup_scene(ffe::RenderGraph *rendergraph);
 
 };
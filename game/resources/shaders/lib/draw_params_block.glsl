@@ -0,0 +1,5 @@
+#version 330 core
+
+layout(std140) uniform DrawParamsBlock {
+   vec4 params[256];
+} draw_params;
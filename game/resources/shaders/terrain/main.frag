@@ -10,6 +10,7 @@ in TerrainData {
     vec2 global_lookup;
     vec2 local_lookup;
     vec3 normal;
+    flat float data_layer;
 } terraindata;
 
 uniform vec3 lod_viewpoint;
@@ -18,7 +19,6 @@ uniform sampler2D heightmap;
 
 #ifdef USE_WATER_DEPTH
 uniform sampler2DArray fluid_data;
-uniform float data_layer;
 #endif
 
 uniform sampler2D grass;
@@ -83,7 +83,7 @@ void main()
     vec3 color = lighting(normal, eyedir, base_colour, metallic, roughness);
 
 #ifdef USE_WATER_DEPTH
-    color *= fluidatten(textureLod(fluid_data, vec3(terraindata.local_lookup, data_layer), 0).y);
+    color *= fluidatten(textureLod(fluid_data, vec3(terraindata.local_lookup, terraindata.data_layer), 0).y);
 #endif
 
     outcolor = vec4(color, 1.0f);
@@ -1,9 +1,11 @@
 #version 330 core
 
 {% include ":/shaders/lib/matrix_block.glsl" %}
+{% include ":/shaders/lib/draw_params_block.glsl" %}
 
-uniform float chunk_size;
-uniform vec2 chunk_translation;
+/* set from the draw parameters */
+float chunk_size;
+vec2 chunk_translation;
 uniform sampler2D heightmap;
 uniform sampler2D normalt;
 uniform vec3 lod_viewpoint;
@@ -22,6 +24,7 @@ out TerrainData {
     vec2 global_lookup;
     vec2 local_lookup;
     vec3 normal;
+    flat float data_layer;
 };
 
 vec2 morph_vertex(vec2 grid_pos, vec2 vertex, float morph_k)
@@ -40,6 +43,11 @@ float morph_k(vec3 viewpoint, vec2 world_pos)
 }
 
 void main() {
+    vec4 chunk_params = draw_params.params[gl_InstanceID];
+    chunk_size = chunk_params.x;
+    chunk_translation = chunk_params.yz;
+    data_layer = chunk_params.w;
+
     vec2 model_vertex = position * chunk_size + chunk_translation;
     vec2 morphed = morph_vertex(position, model_vertex, morph_k(lod_viewpoint, model_vertex));
     /* vec2 morphed_object = (morphed - chunk_translation) / chunk_size; */
@@ -6,6 +6,7 @@ in TerrainData {
     vec2 global_lookup;
     vec2 local_lookup;
     vec3 normal;
+    flat float data_layer;
 } terraindata;
 
 uniform vec2 location;
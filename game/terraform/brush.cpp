@@ -190,16 +190,23 @@ BrushFrontend::BrushFrontend():
 }
 
 const std::vector<Brush::density_t> &BrushFrontend::sampled()
+{
+    return *shared_sampled();
+}
+
+const sim::SharedDensityMap &BrushFrontend::shared_sampled()
 {
     if (m_sampled_valid) {
         return m_sampled;
     }
-    if (!m_curr_brush) {
-        m_sampled.resize(0);
-        return m_sampled;
+    // operations may still refer to the previous buffer, so always allocate
+    // a fresh one
+    auto buffer = std::make_shared<std::vector<Brush::density_t> >();
+    if (m_curr_brush) {
+        m_curr_brush->preview_buffer(m_brush_size, *buffer);
+        m_sampled_valid = true;
     }
-    m_curr_brush->preview_buffer(m_brush_size, m_sampled);
-    m_sampled_valid = true;
+    m_sampled = std::move(buffer);
     return m_sampled;
 }
 
@@ -31,6 +31,8 @@ the AUTHORS file.
 
 #include <QImage>
 
+#include "ffengine/sim/brush_dictionary.hpp"
+
 #include "brush.pb.h"
 
 
@@ -209,7 +211,7 @@ private:
     float m_brush_strength;
 
     bool m_sampled_valid;
-    std::vector<Brush::density_t> m_sampled;
+    sim::SharedDensityMap m_sampled;
 
 public:
     inline Brush *curr_brush()
@@ -238,6 +240,19 @@ public:
      */
     const std::vector<Brush::density_t> &sampled();
 
+    /**
+     * Return the buffer returned by sampled() as shared, immutable density
+     * map.
+     *
+     * World operations can hold on to the returned map without copying it;
+     * when the brush or the size changes, a new buffer is allocated instead
+     * of overwriting the old one.
+     *
+     * @return Shared buffer holding the current brush rendered at the current
+     * size.
+     */
+    const sim::SharedDensityMap &shared_sampled();
+
     /**
      * Set the current brush
      *
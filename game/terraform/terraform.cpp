@@ -25,6 +25,7 @@ the AUTHORS file.
 #include "ui_terraform.h"
 
 #include <QMouseEvent>
+#include <QSettings>
 
 #include "ffengine/io/filesystem.hpp"
 
@@ -1242,6 +1243,14 @@ void TerraformMode::activate(QWidget &parent)
                                    Qt::DirectConnection);
 
     m_server = std::make_unique<sim::Server>();
+    {
+        QSettings settings;
+        settings.beginGroup("sim");
+        m_server->set_fluid_substeps(
+                    settings.value("fluid/substeps", 1).toUInt(),
+                    settings.value("fluid/adaptive", false).toBool());
+        settings.endGroup();
+    }
     m_terrain_interface = std::make_unique<ffe::FancyTerrainInterface>(m_server->state().terrain(), 61);
     m_server->state().terrain().notify_heightmap_changed();
 }
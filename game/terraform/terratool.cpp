@@ -129,9 +129,7 @@ std::pair<ffe::OctreeObject *, float> ToolBackend::hittest_octree_object(const R
 
 std::tuple<Vector3f, bool> ToolBackend::hittest_terrain(const Ray &ray)
 {
-    const sim::Terrain::Field *field;
-    auto lock = m_world.terrain().readonly_field(field);
-    return ffe::isect_terrain_ray(ray, m_world.terrain().size(), *field);
+    return ffe::isect_terrain_ray(ray, m_world.terrain().snapshot());
 }
 
 void ToolBackend::set_viewport_size(const Vector2f &size)
@@ -154,7 +152,7 @@ std::pair<bool, sim::Terrain::height_t> ToolBackend::lookup_height(
         return std::make_pair(false, 0);
     }
 
-    std::shared_lock<std::shared_timed_mutex> lock;
+    sim::Terrain::FieldLock lock;
     if (!field) {
         lock = m_world.terrain().readonly_field(field);
     }
@@ -220,11 +218,7 @@ Vector3f TerrainToolDrag::raycast(const Vector2f &viewport_pos)
     const Ray ray(m_camera.ray(viewport_pos, m_viewport_size));
     Vector3f pos;
     bool hit;
-    {
-        const sim::Terrain::Field *field;
-        auto lock = m_terrain.readonly_field(field);
-        std::tie(pos, hit) = ffe::isect_terrain_ray(ray, m_terrain.size(), *field);
-    }
+    std::tie(pos, hit) = ffe::isect_terrain_ray(ray, m_terrain.snapshot());
 
     if (hit) {
         return pos;
@@ -309,7 +303,7 @@ sim::WorldOperationPtr TerraRaiseLowerTool::primary_move(
     return std::make_unique<sim::ops::TerraformRaise>(
                 world_cursor[eX], world_cursor[eY],
                 m_backend.brush_frontend().brush_size(),
-                m_backend.brush_frontend().sampled(),
+                m_backend.brush_frontend().shared_sampled(),
                 m_backend.brush_frontend().brush_strength());
 }
 
@@ -323,7 +317,7 @@ sim::WorldOperationPtr TerraRaiseLowerTool::secondary_move(
     return std::make_unique<sim::ops::TerraformRaise>(
                 world_cursor[eX], world_cursor[eY],
                 m_backend.brush_frontend().brush_size(),
-                m_backend.brush_frontend().sampled(),
+                m_backend.brush_frontend().shared_sampled(),
                 -m_backend.brush_frontend().brush_strength());
 }
 
@@ -346,7 +340,7 @@ sim::WorldOperationPtr TerraLevelTool::primary_move(
     return std::make_unique<sim::ops::TerraformLevel>(
                 world_cursor[eX], world_cursor[eY],
                 m_backend.brush_frontend().brush_size(),
-                m_backend.brush_frontend().sampled(),
+                m_backend.brush_frontend().shared_sampled(),
                 m_backend.brush_frontend().brush_strength(),
                 m_reference_height);
 }
@@ -386,7 +380,7 @@ sim::WorldOperationPtr TerraSmoothTool::primary_move(
     return std::make_unique<sim::ops::TerraformSmooth>(
                 world_cursor[eX], world_cursor[eY],
                 m_backend.brush_frontend().brush_size(),
-                m_backend.brush_frontend().sampled(),
+                m_backend.brush_frontend().shared_sampled(),
                 m_backend.brush_frontend().brush_strength());
 }
 
@@ -423,7 +417,7 @@ sim::WorldOperationPtr TerraRampTool::primary_move(
     return std::make_unique<sim::ops::TerraformRamp>(
                 world_cursor[eX], world_cursor[eY],
                 m_backend.brush_frontend().brush_size(),
-                m_backend.brush_frontend().sampled(),
+                m_backend.brush_frontend().shared_sampled(),
                 m_backend.brush_frontend().brush_strength(),
                 Vector2f(m_source_point),
                 m_source_point[eZ],
@@ -457,7 +451,7 @@ sim::WorldOperationPtr TerraFluidRaiseTool::primary_move(
     return std::make_unique<sim::ops::FluidRaise>(
                 world_cursor[eX]-0.5, world_cursor[eY]-0.5,
                 m_backend.brush_frontend().brush_size(),
-                m_backend.brush_frontend().sampled(),
+                m_backend.brush_frontend().shared_sampled(),
                 m_backend.brush_frontend().brush_strength());
 }
 
@@ -472,7 +466,7 @@ sim::WorldOperationPtr TerraFluidRaiseTool::secondary_move(
     return std::make_unique<sim::ops::FluidRaise>(
                 world_cursor[eX]-0.5, world_cursor[eY]-0.5,
                 m_backend.brush_frontend().brush_size(),
-                m_backend.brush_frontend().sampled(),
+                m_backend.brush_frontend().shared_sampled(),
                 -m_backend.brush_frontend().brush_strength());
 }
 
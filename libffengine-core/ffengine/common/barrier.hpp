@@ -0,0 +1,100 @@
+/**********************************************************************
+File name: barrier.hpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#ifndef SCC_ENGINE_COMMON_BARRIER_HPP
+#define SCC_ENGINE_COMMON_BARRIER_HPP
+
+#include <atomic>
+#include <cstdint>
+
+namespace ffe {
+
+/**
+ * Default number of iterations to spin before blocking in the kernel.
+ */
+extern const unsigned int DEFAULT_SPIN_COUNT;
+
+/**
+ * Block while \a word equals \a value.
+ *
+ * The word is polled \a spin_count times first; after that, the thread is
+ * put to sleep until wake_all() is called on the word (using a futex on
+ * Linux). \a sleepers counts the threads which are about to sleep or are
+ * sleeping on the word; it must be the same counter for all waiters and
+ * wakers of the word.
+ */
+void wait_while_equal(const std::atomic<std::uint32_t> &word,
+                      const std::uint32_t value,
+                      std::atomic<std::uint32_t> &sleepers,
+                      const unsigned int spin_count = DEFAULT_SPIN_COUNT);
+
+/**
+ * Wake all threads blocked in wait_while_equal() on \a word. This must be
+ * called after the word has been changed. No system call is made if
+ * \a sleepers is zero.
+ */
+void wake_all(std::atomic<std::uint32_t> &word,
+              const std::atomic<std::uint32_t> &sleepers);
+
+
+/**
+ * Reusable barrier for a fixed number of participants, which spins for a
+ * while before blocking in the kernel.
+ *
+ * Arriving at the barrier does not take any lock.
+ */
+class SpinBarrier
+{
+public:
+    explicit SpinBarrier(const unsigned int participants,
+                         const unsigned int spin_count = DEFAULT_SPIN_COUNT);
+    SpinBarrier(const SpinBarrier &ref) = delete;
+    SpinBarrier &operator=(const SpinBarrier &ref) = delete;
+
+private:
+    const std::uint32_t m_participants;
+    const unsigned int m_spin_count;
+
+    std::atomic<std::uint32_t> m_arrived;
+    std::atomic<std::uint32_t> m_generation;
+    std::atomic<std::uint32_t> m_sleepers;
+
+public:
+    /**
+     * Wait until all participants have arrived.
+     *
+     * @return true for exactly one participant per round (the last one to
+     * arrive), false for all others.
+     */
+    bool arrive_and_wait();
+
+    inline unsigned int participants() const
+    {
+        return m_participants;
+    }
+
+};
+
+}
+
+#endif
@@ -0,0 +1,132 @@
+/**********************************************************************
+File name: epoch.hpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#ifndef SCC_ENGINE_COMMON_EPOCH_HPP
+#define SCC_ENGINE_COMMON_EPOCH_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace ffe {
+
+/**
+ * Epoch-based reclamation of objects shared with lock-free readers.
+ *
+ * Readers pin() the domain while they dereference shared pointers; pinning
+ * does not take a lock. Writers replace a shared pointer and retire() the
+ * old object; it is destroyed by collect() once no reader which pinned the
+ * domain before the object was retired is still pinned.
+ *
+ * At most MAX_READERS readers can be pinned at the same time; further
+ * readers spin until a slot is free.
+ */
+class EpochDomain
+{
+public:
+    static constexpr unsigned int MAX_READERS = 64;
+
+    /**
+     * RAII object which keeps the domain pinned; obtained from pin().
+     */
+    class Guard
+    {
+    public:
+        Guard();
+        Guard(Guard &&src);
+        Guard &operator=(Guard &&src);
+        Guard(const Guard &ref) = delete;
+        Guard &operator=(const Guard &ref) = delete;
+        ~Guard();
+
+    private:
+        explicit Guard(std::atomic<std::uint64_t> *slot);
+
+    private:
+        std::atomic<std::uint64_t> *m_slot;
+
+    public:
+        void release();
+
+        friend class EpochDomain;
+    };
+
+public:
+    EpochDomain();
+    EpochDomain(const EpochDomain &ref) = delete;
+    EpochDomain &operator=(const EpochDomain &ref) = delete;
+    ~EpochDomain();
+
+private:
+    struct Retired
+    {
+        std::uint64_t epoch;
+        std::function<void()> deleter;
+    };
+
+    std::atomic<std::uint64_t> m_epoch;
+    /**
+     * Epoch in which the reader using the slot pinned the domain, or zero if
+     * the slot is free.
+     */
+    mutable std::atomic<std::uint64_t> m_slots[MAX_READERS];
+
+    /* guarded by m_retired_mutex */
+    std::mutex m_retired_mutex;
+    std::vector<Retired> m_retired;
+
+public:
+    /**
+     * Pin the domain. Objects which are reachable while the returned guard
+     * is alive are not destroyed until the guard is released.
+     */
+    Guard pin() const;
+
+    /**
+     * Retire an object which has been made unreachable for new readers.
+     *
+     * @param deleter Function which destroys the object; it is called from
+     * collect() or the destructor of the domain.
+     */
+    void retire(std::function<void()> &&deleter);
+
+    /**
+     * Destroy all retired objects which cannot be referenced by any pinned
+     * reader anymore.
+     *
+     * @return Number of objects destroyed.
+     */
+    std::size_t collect();
+
+    /**
+     * Number of retired objects which have not been destroyed yet.
+     */
+    std::size_t pending();
+
+};
+
+}
+
+#endif
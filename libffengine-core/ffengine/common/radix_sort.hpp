@@ -0,0 +1,58 @@
+/**********************************************************************
+File name: radix_sort.hpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#ifndef SCC_ENGINE_COMMON_RADIX_SORT_H
+#define SCC_ENGINE_COMMON_RADIX_SORT_H
+
+#include <cstdint>
+#include <vector>
+
+namespace ffe {
+
+/**
+ * Entry for radix_sort(): a sort key and the index of the item it belongs to.
+ */
+struct RadixSortEntry
+{
+    std::uint64_t key;
+    std::uint32_t index;
+};
+
+/**
+ * Sort \a entries by ascending key, using a least-significant-digit radix
+ * sort over the eight bytes of the key.
+ *
+ * The sort is stable: entries with equal keys keep their relative order.
+ * Bytes which are equal in all keys are skipped, so keys which only use a
+ * few of their bits are cheap to sort.
+ *
+ * @param entries Entries to sort in place.
+ * @param scratch Buffer used during sorting. It is resized as needed; pass
+ * the same buffer on each call to avoid reallocations.
+ */
+void radix_sort(std::vector<RadixSortEntry> &entries,
+                std::vector<RadixSortEntry> &scratch);
+
+}
+
+#endif
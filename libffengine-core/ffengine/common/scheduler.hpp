@@ -0,0 +1,348 @@
+/**********************************************************************
+File name: scheduler.hpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#ifndef SCC_ENGINE_COMMON_SCHEDULER_HPP
+#define SCC_ENGINE_COMMON_SCHEDULER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ffengine/math/rect.hpp"
+
+namespace ffe {
+
+class TaskScheduler;
+
+
+/**
+ * A set of tasks submitted to a TaskScheduler which can be waited for
+ * collectively.
+ *
+ * Tasks in a group may add more tasks to the same group.
+ */
+class TaskGroup
+{
+public:
+    explicit TaskGroup(TaskScheduler &scheduler);
+    TaskGroup(const TaskGroup &ref) = delete;
+    TaskGroup &operator=(const TaskGroup &ref) = delete;
+
+    /**
+     * Wait for all tasks of the group. Exceptions thrown by the tasks are
+     * discarded.
+     */
+    ~TaskGroup();
+
+private:
+    TaskScheduler &m_scheduler;
+
+    std::atomic<unsigned int> m_pending;
+
+    /* guarded by m_state_mutex */
+    std::mutex m_state_mutex;
+    std::condition_variable m_done_wakeup;
+    std::exception_ptr m_exception;
+
+private:
+    void task_done(std::exception_ptr exc);
+
+public:
+    inline TaskScheduler &scheduler() const
+    {
+        return m_scheduler;
+    }
+
+    /**
+     * Submit a task as part of this group.
+     *
+     * This method is thread-safe.
+     */
+    void run(std::function<void()> &&task);
+
+    /**
+     * Wait until all tasks of the group have finished. While waiting, the
+     * calling thread executes pending tasks of this group (and only of this
+     * group), so waiting from within a task does not deadlock as long as the
+     * tasks of the group do not need locks held by the waiting thread.
+     * Tasks of other groups are never run by the waiting thread.
+     *
+     * If any of the tasks threw an exception, the first exception is
+     * rethrown after all tasks have finished.
+     */
+    void wait();
+
+    friend class TaskScheduler;
+};
+
+
+/**
+ * Utilisation counters of a single TaskScheduler worker.
+ */
+struct TaskWorkerStats
+{
+    TaskWorkerStats();
+
+    /**
+     * Number of tasks executed by the worker.
+     */
+    std::uint64_t tasks_executed;
+
+    /**
+     * Number of tasks the worker took from the queue of another worker.
+     */
+    std::uint64_t tasks_stolen;
+
+    /**
+     * Time spent executing tasks.
+     */
+    std::chrono::nanoseconds busy_time;
+
+    /**
+     * Time spent sleeping because no tasks were available.
+     */
+    std::chrono::nanoseconds idle_time;
+};
+
+
+/**
+ * Utilisation statistics of a TaskScheduler, since construction or the last
+ * call to TaskScheduler::reset_stats().
+ */
+struct TaskSchedulerStats
+{
+    std::vector<TaskWorkerStats> workers;
+
+    /**
+     * Number of tasks executed by threads which are not part of the pool,
+     * while waiting for a TaskGroup.
+     */
+    std::uint64_t tasks_executed_external;
+
+    /**
+     * Return the fraction of the time the workers were busy, in the range
+     * [0, 1].
+     */
+    float utilisation() const;
+};
+
+
+/**
+ * Work-stealing task scheduler.
+ *
+ * Each worker thread owns a task queue. Tasks submitted from a worker are
+ * pushed on the queue of that worker, which processes its own queue in LIFO
+ * order for locality. Idle workers steal the oldest tasks from the other
+ * queues. Tasks submitted from threads outside of the pool are distributed
+ * round-robin.
+ *
+ * Tasks are always submitted through a TaskGroup.
+ */
+class TaskScheduler
+{
+public:
+    /**
+     * Create a scheduler.
+     *
+     * @param workers Number of worker threads. If zero, the hardware
+     * concurrency is used.
+     */
+    explicit TaskScheduler(unsigned int workers = 0);
+    TaskScheduler(const TaskScheduler &ref) = delete;
+    TaskScheduler &operator=(const TaskScheduler &ref) = delete;
+    ~TaskScheduler();
+
+private:
+    struct Task
+    {
+        std::function<void()> func;
+        TaskGroup *group;
+    };
+
+    struct Worker
+    {
+        Worker();
+
+        std::mutex queue_mutex;
+        std::deque<Task> queue;
+
+        std::atomic<std::uint64_t> tasks_executed;
+        std::atomic<std::uint64_t> tasks_stolen;
+        std::atomic<std::int64_t> busy_ns;
+        std::atomic<std::int64_t> idle_ns;
+
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker> > m_workers;
+
+    std::atomic<unsigned int> m_queued_tasks;
+    std::atomic<unsigned int> m_next_worker;
+    std::atomic<std::uint64_t> m_tasks_executed_external;
+
+    /* guarded by m_sleep_mutex */
+    std::mutex m_sleep_mutex;
+    std::condition_variable m_sleep_wakeup;
+    bool m_terminate;
+
+private:
+    int current_worker() const;
+    static bool take_task(std::deque<Task> &queue,
+                          const bool newest,
+                          const TaskGroup *group,
+                          Task &task);
+    bool try_pop(const int worker_index, Task &task,
+                 const TaskGroup *group = nullptr);
+    void execute(const int worker_index, Task &task);
+    void submit(Task &&task);
+    void worker_impl(const unsigned int index);
+
+public:
+    /**
+     * Try to execute a single pending task on the calling thread.
+     *
+     * @param group If not null, only tasks belonging to this group are
+     * considered.
+     * @return true if a task was executed, false if no matching task was
+     * pending.
+     */
+    bool run_pending_task(const TaskGroup *group = nullptr);
+
+    /**
+     * Return a snapshot of the utilisation statistics.
+     */
+    TaskSchedulerStats stats() const;
+
+    /**
+     * Reset all utilisation statistics to zero.
+     */
+    void reset_stats();
+
+    inline unsigned int workers() const
+    {
+        return m_workers.size();
+    }
+
+    friend class TaskGroup;
+};
+
+
+/**
+ * Set the number of workers of the engine-wide scheduler.
+ *
+ * This must be called before the first call to scheduler(); otherwise,
+ * std::logic_error is thrown.
+ *
+ * @param workers Number of worker threads. If zero, the hardware concurrency
+ * is used.
+ */
+void configure_scheduler(unsigned int workers);
+
+/**
+ * The engine-wide task scheduler, which is shared by the simulation and
+ * the terrain workers. It is created on first use.
+ */
+TaskScheduler &scheduler();
+
+
+/**
+ * Execute \a func for each index in [\a begin, \a end), in parallel.
+ *
+ * The range is split into chunks of at most \a grain indices, each of which
+ * is submitted as separate task; \a func is called as func(chunk_begin,
+ * chunk_end). Returns when all chunks have been processed and rethrows the
+ * first exception thrown by \a func.
+ */
+template <typename func_t>
+void parallel_for(TaskScheduler &scheduler,
+                  const unsigned int begin,
+                  const unsigned int end,
+                  const unsigned int grain,
+                  const func_t &func)
+{
+    if (begin >= end) {
+        return;
+    }
+    const unsigned int step = (grain > 0 ? grain : 1);
+    if (end - begin <= step) {
+        func(begin, end);
+        return;
+    }
+
+    TaskGroup group(scheduler);
+    for (unsigned int chunk = begin; chunk < end; chunk += std::min(step, end - chunk))
+    {
+        const unsigned int chunk_end = chunk + std::min(step, end - chunk);
+        group.run([&func, chunk, chunk_end](){ func(chunk, chunk_end); });
+    }
+    group.wait();
+}
+
+/**
+ * Execute \a func for each tile of \a rect, in parallel.
+ *
+ * The rect is split into square tiles with an edge length of \a tile_size;
+ * tiles at the right and bottom edge may be smaller. \a func is called with
+ * each tile as argument. Returns when all tiles have been processed and
+ * rethrows the first exception thrown by \a func.
+ */
+template <typename func_t>
+void parallel_for_rect(TaskScheduler &scheduler,
+                       const GenericRect<unsigned int> &rect,
+                       const unsigned int tile_size,
+                       const func_t &func)
+{
+    if (rect.empty()) {
+        return;
+    }
+
+    const unsigned int size = (tile_size > 0 ? tile_size : 1);
+    const unsigned int tiles_x = (rect.x1() - rect.x0() + size - 1) / size;
+    const unsigned int tiles_y = (rect.y1() - rect.y0() + size - 1) / size;
+
+    parallel_for(scheduler, 0, tiles_x*tiles_y, 1,
+                 [&](const unsigned int first, const unsigned int last)
+    {
+        for (unsigned int i = first; i < last; ++i)
+        {
+            const unsigned int x0 = rect.x0() + (i % tiles_x) * size;
+            const unsigned int y0 = rect.y0() + (i / tiles_x) * size;
+            func(GenericRect<unsigned int>(x0, y0,
+                                           std::min(x0 + size, rect.x1()),
+                                           std::min(y0 + size, rect.y1())));
+        }
+    });
+}
+
+}
+
+#endif
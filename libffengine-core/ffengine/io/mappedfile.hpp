@@ -0,0 +1,84 @@
+/**********************************************************************
+File name: mappedfile.hpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#ifndef SCC_ENGINE_IO_MAPPEDFILE_H
+#define SCC_ENGINE_IO_MAPPEDFILE_H
+
+#include <cstdint>
+#include <string>
+
+namespace io {
+
+/**
+ * Read-only memory mapping of a whole file.
+ *
+ * Pages are faulted in by the operating system on first access, so only the
+ * parts of the file which are actually touched are read from disk.
+ */
+class MappedFile
+{
+public:
+    /**
+     * Map the file at \a filename.
+     *
+     * @throws std::system_error if the file cannot be opened or mapped.
+     */
+    explicit MappedFile(const std::string &filename);
+    MappedFile(MappedFile &&src);
+    MappedFile &operator=(MappedFile &&src);
+    MappedFile(const MappedFile &ref) = delete;
+    MappedFile &operator=(const MappedFile &ref) = delete;
+    ~MappedFile();
+
+private:
+    int m_fd;
+    const std::uint8_t *m_data;
+    std::size_t m_size;
+
+private:
+    void close();
+
+public:
+    inline const std::uint8_t *data() const
+    {
+        return m_data;
+    }
+
+    inline std::size_t size() const
+    {
+        return m_size;
+    }
+
+    /**
+     * Hint the operating system that the given range will be read soon, so
+     * that it can start reading it ahead asynchronously.
+     *
+     * Ranges outside of the file are clipped.
+     */
+    void will_need(std::size_t offset, std::size_t length) const;
+
+};
+
+}
+
+#endif
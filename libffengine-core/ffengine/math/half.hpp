@@ -0,0 +1,164 @@
+/**********************************************************************
+File name: half.hpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#ifndef SCC_ENGINE_MATH_HALF_H
+#define SCC_ENGINE_MATH_HALF_H
+
+#include <cstdint>
+#include <cstring>
+
+
+/**
+ * Convert a float to the bits of an IEEE 754 binary16 value, rounding to
+ * nearest even. Values too large for binary16 become infinity.
+ */
+inline std::uint16_t float_to_half_bits(const float value)
+{
+    std::uint32_t f;
+    std::memcpy(&f, &value, sizeof(f));
+
+    const std::uint16_t sign = (f >> 16) & 0x8000u;
+    const std::uint32_t abs = f & 0x7fffffffu;
+
+    if (abs >= 0x7f800000u) {
+        // infinity or NaN, keep NaN quiet
+        return sign | 0x7c00u | (abs > 0x7f800000u ? 0x200u : 0u);
+    }
+    if (abs >= 0x477ff000u) {
+        // rounds to 65536 or more
+        return sign | 0x7c00u;
+    }
+    if (abs >= 0x38800000u) {
+        // normal number: rebias the exponent and round the mantissa
+        const std::uint32_t rebiased = abs - 0x38000000u;
+        const std::uint32_t remainder = rebiased & 0x1fffu;
+        std::uint32_t result = rebiased >> 13;
+        if (remainder > 0x1000u || (remainder == 0x1000u && (result & 1))) {
+            result += 1;
+        }
+        return sign | result;
+    }
+    if (abs < 0x33000000u) {
+        // less than half of the smallest subnormal
+        return sign;
+    }
+
+    // subnormal number
+    const std::uint32_t exponent = abs >> 23;
+    const std::uint32_t mantissa = (abs & 0x7fffffu) | 0x800000u;
+    const std::uint32_t shift = 126 - exponent;
+    const std::uint32_t remainder = mantissa & ((1u << shift) - 1);
+    const std::uint32_t halfway = 1u << (shift - 1);
+    std::uint32_t result = mantissa >> shift;
+    if (remainder > halfway || (remainder == halfway && (result & 1))) {
+        result += 1;
+    }
+    return sign | result;
+}
+
+/**
+ * Convert the bits of an IEEE 754 binary16 value to float. This is exact.
+ */
+inline float half_bits_to_float(const std::uint16_t bits)
+{
+    const std::uint32_t sign = std::uint32_t(bits & 0x8000u) << 16;
+    const std::uint32_t exponent = (bits >> 10) & 0x1fu;
+    std::uint32_t mantissa = bits & 0x3ffu;
+
+    std::uint32_t f;
+    if (exponent == 0x1fu) {
+        f = sign | 0x7f800000u | (mantissa << 13);
+    } else if (exponent != 0) {
+        f = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    } else if (mantissa == 0) {
+        f = sign;
+    } else {
+        // subnormal, normalise the mantissa
+        std::uint32_t float_exponent = 113;
+        while (!(mantissa & 0x400u)) {
+            mantissa <<= 1;
+            float_exponent -= 1;
+        }
+        f = sign | (float_exponent << 23) | ((mantissa & 0x3ffu) << 13);
+    }
+
+    float result;
+    std::memcpy(&result, &f, sizeof(result));
+    return result;
+}
+
+
+/**
+ * Storage-only half precision float.
+ *
+ * Half converts implicitly from and to float, so that arithmetic is done in
+ * single precision and only the stored value is rounded.
+ */
+struct Half
+{
+    Half():
+        bits(0)
+    {
+
+    }
+
+    Half(const float value):
+        bits(float_to_half_bits(value))
+    {
+
+    }
+
+    std::uint16_t bits;
+
+    inline operator float() const
+    {
+        return half_bits_to_float(bits);
+    }
+
+    inline Half &operator+=(const float other)
+    {
+        *this = float(*this) + other;
+        return *this;
+    }
+
+    inline Half &operator-=(const float other)
+    {
+        *this = float(*this) - other;
+        return *this;
+    }
+
+    inline Half &operator*=(const float other)
+    {
+        *this = float(*this) * other;
+        return *this;
+    }
+
+    static inline Half from_bits(const std::uint16_t bits)
+    {
+        Half result;
+        result.bits = bits;
+        return result;
+    }
+};
+
+#endif
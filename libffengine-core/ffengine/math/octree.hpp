@@ -41,6 +41,8 @@ typedef GenericAABB<float> AABB;
 
 namespace ffe {
 
+class TaskScheduler;
+
 class Octree;
 class OctreeNode;
 
@@ -581,6 +583,27 @@ public:
         m_root.select_nodes_by_frustum(frustum, hitset);
     }
 
+    /**
+     * Select octree nodes using a frustum test, testing subtrees in
+     * parallel.
+     *
+     * The upper levels of the tree are tested serially until there are
+     * enough subtrees to distribute; those are then tested as tasks on
+     * \a scheduler, each into its own hit set. The hit sets are appended to
+     * \a hitset in tree order, so the result is the same as the one of the
+     * serial overload.
+     *
+     * The tree must not be modified during the call.
+     *
+     * @param frustum Frustum specification to test against
+     * @param hitset A vector to store the nodes which matched the query.
+     * @param scheduler Scheduler to run the subtree tests on.
+     */
+    void select_nodes_by_frustum(
+            const std::array<Plane, 6> &frustum,
+            std::vector<OctreeNode*> &hitset,
+            TaskScheduler &scheduler);
+
 };
 
 
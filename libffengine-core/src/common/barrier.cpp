@@ -0,0 +1,129 @@
+/**********************************************************************
+File name: barrier.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include "ffengine/common/barrier.hpp"
+
+#include <thread>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+namespace ffe {
+
+const unsigned int DEFAULT_SPIN_COUNT = 4000;
+
+static inline void cpu_relax()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#endif
+}
+
+void wait_while_equal(const std::atomic<std::uint32_t> &word,
+                      const std::uint32_t value,
+                      std::atomic<std::uint32_t> &sleepers,
+                      const unsigned int spin_count)
+{
+    // spinning is pointless if there is nobody to make progress
+    // concurrently
+    static const bool single_core = std::thread::hardware_concurrency() <= 1;
+    if (!single_core) {
+        for (unsigned int i = 0; i < spin_count; ++i) {
+            if (word.load(std::memory_order_acquire) != value) {
+                return;
+            }
+            cpu_relax();
+        }
+    }
+
+    // pairs with the fence in wake_all(): either the waker sees us as a
+    // sleeper, or we see the changed word
+    sleepers.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (word.load(std::memory_order_acquire) == value) {
+#if defined(__linux__)
+        static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t),
+                      "futex requires a plain 32 bit word");
+        syscall(SYS_futex,
+                reinterpret_cast<const std::uint32_t*>(&word),
+                FUTEX_WAIT_PRIVATE, value,
+                nullptr, nullptr, 0);
+#else
+        std::this_thread::yield();
+#endif
+    }
+    sleepers.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void wake_all(std::atomic<std::uint32_t> &word,
+              const std::atomic<std::uint32_t> &sleepers)
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+#if defined(__linux__)
+    syscall(SYS_futex,
+            reinterpret_cast<std::uint32_t*>(&word),
+            FUTEX_WAKE_PRIVATE, INT32_MAX,
+            nullptr, nullptr, 0);
+#else
+    (void)word;
+#endif
+}
+
+
+/* ffe::SpinBarrier */
+
+SpinBarrier::SpinBarrier(const unsigned int participants,
+                         const unsigned int spin_count):
+    m_participants(participants),
+    m_spin_count(spin_count),
+    m_arrived(0),
+    m_generation(0),
+    m_sleepers(0)
+{
+
+}
+
+bool SpinBarrier::arrive_and_wait()
+{
+    const std::uint32_t generation = m_generation.load(std::memory_order_acquire);
+    if (m_arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == m_participants)
+    {
+        // nobody can arrive for the next round before the generation changes
+        m_arrived.store(0, std::memory_order_relaxed);
+        m_generation.fetch_add(1, std::memory_order_release);
+        wake_all(m_generation, m_sleepers);
+        return true;
+    }
+
+    wait_while_equal(m_generation, generation, m_sleepers, m_spin_count);
+    return false;
+}
+
+}
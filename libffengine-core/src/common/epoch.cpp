@@ -0,0 +1,160 @@
+/**********************************************************************
+File name: epoch.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include "ffengine/common/epoch.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <thread>
+
+
+namespace ffe {
+
+/* ffe::EpochDomain::Guard */
+
+EpochDomain::Guard::Guard():
+    m_slot(nullptr)
+{
+
+}
+
+EpochDomain::Guard::Guard(std::atomic<std::uint64_t> *slot):
+    m_slot(slot)
+{
+
+}
+
+EpochDomain::Guard::Guard(Guard &&src):
+    m_slot(src.m_slot)
+{
+    src.m_slot = nullptr;
+}
+
+EpochDomain::Guard &EpochDomain::Guard::operator=(Guard &&src)
+{
+    if (&src == this) {
+        return *this;
+    }
+    release();
+    m_slot = src.m_slot;
+    src.m_slot = nullptr;
+    return *this;
+}
+
+EpochDomain::Guard::~Guard()
+{
+    release();
+}
+
+void EpochDomain::Guard::release()
+{
+    if (!m_slot) {
+        return;
+    }
+    m_slot->store(0, std::memory_order_release);
+    m_slot = nullptr;
+}
+
+
+/* ffe::EpochDomain */
+
+constexpr unsigned int EpochDomain::MAX_READERS;
+
+EpochDomain::EpochDomain():
+    // zero marks a free slot, so epochs start at one
+    m_epoch(1)
+{
+    for (auto &slot: m_slots) {
+        slot.store(0, std::memory_order_relaxed);
+    }
+}
+
+EpochDomain::~EpochDomain()
+{
+    for (Retired &retired: m_retired) {
+        retired.deleter();
+    }
+}
+
+EpochDomain::Guard EpochDomain::pin() const
+{
+    while (true) {
+        for (auto &slot: m_slots) {
+            // the pointer loads of the reader happen after this exchange;
+            // a retire() whose collect() did not see the slot thus happened
+            // before those loads (all operations are seq_cst)
+            std::uint64_t expected = 0;
+            const std::uint64_t epoch = m_epoch.load();
+            if (slot.compare_exchange_strong(expected, epoch)) {
+                return Guard(&slot);
+            }
+        }
+        std::this_thread::yield();
+    }
+}
+
+void EpochDomain::retire(std::function<void()> &&deleter)
+{
+    // readers which pinned in this epoch or before may still see the object
+    const std::uint64_t epoch = m_epoch.fetch_add(1);
+    std::lock_guard<std::mutex> lock(m_retired_mutex);
+    m_retired.emplace_back(Retired{epoch, std::move(deleter)});
+}
+
+std::size_t EpochDomain::collect()
+{
+    std::uint64_t min_pinned = UINT64_MAX;
+    for (auto &slot: m_slots) {
+        const std::uint64_t epoch = slot.load();
+        if (epoch != 0 && epoch < min_pinned) {
+            min_pinned = epoch;
+        }
+    }
+
+    std::vector<Retired> to_delete;
+    {
+        std::lock_guard<std::mutex> lock(m_retired_mutex);
+        auto keep_end = std::partition(
+                    m_retired.begin(), m_retired.end(),
+                    [min_pinned](const Retired &retired)
+                    {
+                        return retired.epoch >= min_pinned;
+                    });
+        std::move(keep_end, m_retired.end(), std::back_inserter(to_delete));
+        m_retired.erase(keep_end, m_retired.end());
+    }
+
+    // deleters run outside of the lock, they may be expensive
+    for (Retired &retired: to_delete) {
+        retired.deleter();
+    }
+    return to_delete.size();
+}
+
+std::size_t EpochDomain::pending()
+{
+    std::lock_guard<std::mutex> lock(m_retired_mutex);
+    return m_retired.size();
+}
+
+}
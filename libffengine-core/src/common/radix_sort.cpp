@@ -0,0 +1,82 @@
+/**********************************************************************
+File name: radix_sort.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include "ffengine/common/radix_sort.hpp"
+
+#include <array>
+
+
+namespace ffe {
+
+static const unsigned int RADIX_BITS = 8;
+static const unsigned int RADIX_SIZE = 1 << RADIX_BITS;
+static const unsigned int RADIX_DIGITS = 64 / RADIX_BITS;
+
+void radix_sort(std::vector<RadixSortEntry> &entries,
+                std::vector<RadixSortEntry> &scratch)
+{
+    const std::size_t n = entries.size();
+    if (n < 2) {
+        return;
+    }
+
+    // histograms of all digits are built in a single pass over the keys
+    std::array<std::array<std::size_t, RADIX_SIZE>, RADIX_DIGITS> counts{};
+    for (const RadixSortEntry &entry: entries) {
+        for (unsigned int digit = 0; digit < RADIX_DIGITS; ++digit) {
+            counts[digit][(entry.key >> (digit*RADIX_BITS)) & (RADIX_SIZE-1)] += 1;
+        }
+    }
+
+    scratch.resize(n);
+    std::vector<RadixSortEntry> *src = &entries;
+    std::vector<RadixSortEntry> *dest = &scratch;
+
+    for (unsigned int digit = 0; digit < RADIX_DIGITS; ++digit) {
+        std::array<std::size_t, RADIX_SIZE> &count = counts[digit];
+        const unsigned int shift = digit*RADIX_BITS;
+
+        // all keys share this digit; the pass would not change the order
+        if (count[((*src)[0].key >> shift) & (RADIX_SIZE-1)] == n) {
+            continue;
+        }
+
+        std::size_t offset = 0;
+        for (std::size_t &bucket: count) {
+            const std::size_t bucket_size = bucket;
+            bucket = offset;
+            offset += bucket_size;
+        }
+
+        for (const RadixSortEntry &entry: *src) {
+            (*dest)[count[(entry.key >> shift) & (RADIX_SIZE-1)]++] = entry;
+        }
+        std::swap(src, dest);
+    }
+
+    if (src != &entries) {
+        entries.swap(scratch);
+    }
+}
+
+}
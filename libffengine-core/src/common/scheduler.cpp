@@ -0,0 +1,427 @@
+/**********************************************************************
+File name: scheduler.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include "ffengine/common/scheduler.hpp"
+
+#include <iterator>
+#include <stdexcept>
+
+#include "ffengine/io/log.hpp"
+
+
+namespace ffe {
+
+static io::Logger &logger = io::logging().get_logger("common.scheduler");
+
+typedef std::chrono::steady_clock scheduler_clock;
+
+static thread_local const TaskScheduler *tls_scheduler = nullptr;
+static thread_local int tls_worker_index = -1;
+
+
+/* ffe::TaskGroup */
+
+TaskGroup::TaskGroup(TaskScheduler &scheduler):
+    m_scheduler(scheduler),
+    m_pending(0)
+{
+
+}
+
+TaskGroup::~TaskGroup()
+{
+    try {
+        wait();
+    } catch (...) {
+        // exceptions are only reported through wait()
+    }
+}
+
+void TaskGroup::task_done(std::exception_ptr exc)
+{
+    // the lock must be held while decrementing, otherwise wait() may return
+    // and destroy the group before we notify
+    std::lock_guard<std::mutex> lock(m_state_mutex);
+    if (exc && !m_exception) {
+        m_exception = exc;
+    }
+    if (--m_pending == 0) {
+        m_done_wakeup.notify_all();
+    }
+}
+
+void TaskGroup::run(std::function<void()> &&task)
+{
+    m_pending.fetch_add(1);
+    m_scheduler.submit(TaskScheduler::Task{std::move(task), this});
+}
+
+void TaskGroup::wait()
+{
+    while (m_pending.load() > 0) {
+        // only help with our own tasks: the caller may hold locks which
+        // unrelated tasks need, and it should not get stuck in long-running
+        // jobs submitted by somebody else
+        if (m_scheduler.run_pending_task(this)) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_state_mutex);
+        if (m_pending.load() == 0) {
+            break;
+        }
+        // wake up regularly to help out with tasks which were submitted in
+        // the meantime
+        m_done_wakeup.wait_for(lock, std::chrono::milliseconds(1));
+    }
+
+    std::exception_ptr exc;
+    {
+        std::lock_guard<std::mutex> lock(m_state_mutex);
+        std::swap(exc, m_exception);
+    }
+    if (exc) {
+        std::rethrow_exception(exc);
+    }
+}
+
+/* ffe::TaskWorkerStats */
+
+TaskWorkerStats::TaskWorkerStats():
+    tasks_executed(0),
+    tasks_stolen(0),
+    busy_time(0),
+    idle_time(0)
+{
+
+}
+
+/* ffe::TaskSchedulerStats */
+
+float TaskSchedulerStats::utilisation() const
+{
+    std::chrono::nanoseconds busy(0);
+    std::chrono::nanoseconds total(0);
+    for (const TaskWorkerStats &worker: workers) {
+        busy += worker.busy_time;
+        total += worker.busy_time + worker.idle_time;
+    }
+    if (total.count() == 0) {
+        return 0.f;
+    }
+    return float(busy.count()) / float(total.count());
+}
+
+/* ffe::TaskScheduler::Worker */
+
+TaskScheduler::Worker::Worker():
+    tasks_executed(0),
+    tasks_stolen(0),
+    busy_ns(0),
+    idle_ns(0)
+{
+
+}
+
+/* ffe::TaskScheduler */
+
+TaskScheduler::TaskScheduler(unsigned int workers):
+    m_queued_tasks(0),
+    m_next_worker(0),
+    m_tasks_executed_external(0),
+    m_terminate(false)
+{
+    if (workers == 0) {
+        workers = std::thread::hardware_concurrency();
+    }
+    if (workers == 0) {
+        workers = 2;
+        logger.logf(io::LOG_ERROR,
+                    "failed to determine hardware concurrency. "
+                    "giving it a try with %u",
+                    workers);
+    }
+
+    m_workers.reserve(workers);
+    for (unsigned int i = 0; i < workers; ++i) {
+        m_workers.emplace_back(new Worker());
+    }
+    for (unsigned int i = 0; i < workers; ++i) {
+        m_workers[i]->thread = std::thread(
+                    std::bind(&TaskScheduler::worker_impl, this, i));
+    }
+
+    logger.logf(io::LOG_INFO, "scheduler %p started with %u workers",
+                this, workers);
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+        m_terminate = true;
+    }
+    m_sleep_wakeup.notify_all();
+    for (auto &worker: m_workers) {
+        worker->thread.join();
+    }
+}
+
+int TaskScheduler::current_worker() const
+{
+    if (tls_scheduler == this) {
+        return tls_worker_index;
+    }
+    return -1;
+}
+
+bool TaskScheduler::take_task(std::deque<Task> &queue,
+                              const bool newest,
+                              const TaskGroup *group,
+                              Task &task)
+{
+    if (queue.empty()) {
+        return false;
+    }
+
+    if (!group) {
+        if (newest) {
+            task = std::move(queue.back());
+            queue.pop_back();
+        } else {
+            task = std::move(queue.front());
+            queue.pop_front();
+        }
+        return true;
+    }
+
+    if (newest) {
+        for (auto iter = queue.rbegin(); iter != queue.rend(); ++iter) {
+            if (iter->group == group) {
+                task = std::move(*iter);
+                queue.erase(std::next(iter).base());
+                return true;
+            }
+        }
+    } else {
+        for (auto iter = queue.begin(); iter != queue.end(); ++iter) {
+            if (iter->group == group) {
+                task = std::move(*iter);
+                queue.erase(iter);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool TaskScheduler::try_pop(const int worker_index, Task &task,
+                            const TaskGroup *group)
+{
+    if (m_queued_tasks.load(std::memory_order_relaxed) == 0) {
+        return false;
+    }
+
+    const unsigned int nworkers = m_workers.size();
+
+    if (worker_index >= 0) {
+        Worker &own = *m_workers[worker_index];
+        std::lock_guard<std::mutex> lock(own.queue_mutex);
+        if (take_task(own.queue, true, group, task)) {
+            m_queued_tasks.fetch_sub(1);
+            return true;
+        }
+    }
+
+    const unsigned int first_victim = (worker_index >= 0
+                                       ? worker_index + 1
+                                       : m_next_worker.load(std::memory_order_relaxed));
+    for (unsigned int i = 0; i < nworkers; ++i) {
+        const unsigned int victim_index = (first_victim + i) % nworkers;
+        if ((int)victim_index == worker_index) {
+            continue;
+        }
+
+        Worker &victim = *m_workers[victim_index];
+        std::lock_guard<std::mutex> lock(victim.queue_mutex);
+        if (take_task(victim.queue, false, group, task)) {
+            m_queued_tasks.fetch_sub(1);
+            if (worker_index >= 0) {
+                m_workers[worker_index]->tasks_stolen.fetch_add(
+                            1, std::memory_order_relaxed);
+            }
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void TaskScheduler::execute(const int worker_index, Task &task)
+{
+    const scheduler_clock::time_point t0 = scheduler_clock::now();
+
+    std::exception_ptr exc;
+    try {
+        task.func();
+    } catch (...) {
+        exc = std::current_exception();
+    }
+    // release captured state before the group is signalled, it may reference
+    // objects which die once the group is done
+    task.func = nullptr;
+
+    if (worker_index >= 0) {
+        Worker &worker = *m_workers[worker_index];
+        worker.busy_ns.fetch_add(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        scheduler_clock::now() - t0).count(),
+                    std::memory_order_relaxed);
+        worker.tasks_executed.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        m_tasks_executed_external.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    task.group->task_done(exc);
+}
+
+void TaskScheduler::submit(Task &&task)
+{
+    int worker_index = current_worker();
+    if (worker_index < 0) {
+        worker_index = m_next_worker.fetch_add(1, std::memory_order_relaxed)
+                % m_workers.size();
+    }
+
+    {
+        Worker &worker = *m_workers[worker_index];
+        std::lock_guard<std::mutex> lock(worker.queue_mutex);
+        worker.queue.emplace_back(std::move(task));
+        m_queued_tasks.fetch_add(1);
+    }
+
+    {
+        // taking the lock makes sure that no worker is between checking the
+        // queue counter and going to sleep
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+    }
+    m_sleep_wakeup.notify_one();
+}
+
+void TaskScheduler::worker_impl(const unsigned int index)
+{
+    tls_scheduler = this;
+    tls_worker_index = index;
+
+    Worker &self = *m_workers[index];
+
+    Task task;
+    while (true) {
+        if (try_pop(index, task)) {
+            execute(index, task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_sleep_mutex);
+        if (m_terminate) {
+            break;
+        }
+        const scheduler_clock::time_point t0 = scheduler_clock::now();
+        while (m_queued_tasks.load() == 0 && !m_terminate) {
+            m_sleep_wakeup.wait(lock);
+        }
+        self.idle_ns.fetch_add(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        scheduler_clock::now() - t0).count(),
+                    std::memory_order_relaxed);
+    }
+
+    tls_scheduler = nullptr;
+    tls_worker_index = -1;
+}
+
+bool TaskScheduler::run_pending_task(const TaskGroup *group)
+{
+    const int worker_index = current_worker();
+    Task task;
+    if (!try_pop(worker_index, task, group)) {
+        return false;
+    }
+    execute(worker_index, task);
+    return true;
+}
+
+TaskSchedulerStats TaskScheduler::stats() const
+{
+    TaskSchedulerStats result;
+    result.workers.resize(m_workers.size());
+    for (unsigned int i = 0; i < m_workers.size(); ++i) {
+        const Worker &worker = *m_workers[i];
+        TaskWorkerStats &dest = result.workers[i];
+        dest.tasks_executed = worker.tasks_executed.load(std::memory_order_relaxed);
+        dest.tasks_stolen = worker.tasks_stolen.load(std::memory_order_relaxed);
+        dest.busy_time = std::chrono::nanoseconds(
+                    worker.busy_ns.load(std::memory_order_relaxed));
+        dest.idle_time = std::chrono::nanoseconds(
+                    worker.idle_ns.load(std::memory_order_relaxed));
+    }
+    result.tasks_executed_external = m_tasks_executed_external.load(
+                std::memory_order_relaxed);
+    return result;
+}
+
+void TaskScheduler::reset_stats()
+{
+    for (auto &worker: m_workers) {
+        worker->tasks_executed.store(0, std::memory_order_relaxed);
+        worker->tasks_stolen.store(0, std::memory_order_relaxed);
+        worker->busy_ns.store(0, std::memory_order_relaxed);
+        worker->idle_ns.store(0, std::memory_order_relaxed);
+    }
+    m_tasks_executed_external.store(0, std::memory_order_relaxed);
+}
+
+
+static std::mutex global_scheduler_mutex;
+static unsigned int global_scheduler_workers = 0;
+static std::unique_ptr<TaskScheduler> global_scheduler;
+
+void configure_scheduler(unsigned int workers)
+{
+    std::lock_guard<std::mutex> lock(global_scheduler_mutex);
+    if (global_scheduler) {
+        throw std::logic_error("scheduler is already running");
+    }
+    global_scheduler_workers = workers;
+}
+
+TaskScheduler &scheduler()
+{
+    std::lock_guard<std::mutex> lock(global_scheduler_mutex);
+    if (!global_scheduler) {
+        global_scheduler.reset(new TaskScheduler(global_scheduler_workers));
+    }
+    return *global_scheduler;
+}
+
+}
@@ -0,0 +1,126 @@
+/**********************************************************************
+File name: mappedfile.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include "ffengine/io/mappedfile.hpp"
+
+#include <algorithm>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ffengine/common/utils.hpp"
+#include "ffengine/io/filestream.hpp"
+
+namespace io {
+
+MappedFile::MappedFile(const std::string &filename):
+    m_fd(check_fd(::open(filename.c_str(), O_RDONLY | O_CLOEXEC))),
+    m_data(nullptr),
+    m_size(0)
+{
+    struct stat st;
+    if (fstat(m_fd, &st) != 0) {
+        const int err = errno;
+        close();
+        errno = err;
+        ffe::raise_last_os_error();
+    }
+    m_size = st.st_size;
+
+    // mmap does not accept empty mappings
+    if (m_size == 0) {
+        return;
+    }
+
+    void *data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+    if (data == MAP_FAILED) {
+        const int err = errno;
+        close();
+        errno = err;
+        ffe::raise_last_os_error();
+    }
+    m_data = static_cast<const std::uint8_t*>(data);
+}
+
+MappedFile::MappedFile(MappedFile &&src):
+    m_fd(src.m_fd),
+    m_data(src.m_data),
+    m_size(src.m_size)
+{
+    src.m_fd = -1;
+    src.m_data = nullptr;
+    src.m_size = 0;
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&src)
+{
+    if (&src == this) {
+        return *this;
+    }
+    close();
+    m_fd = src.m_fd;
+    m_data = src.m_data;
+    m_size = src.m_size;
+    src.m_fd = -1;
+    src.m_data = nullptr;
+    src.m_size = 0;
+    return *this;
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+void MappedFile::close()
+{
+    if (m_data) {
+        munmap(const_cast<std::uint8_t*>(m_data), m_size);
+        m_data = nullptr;
+    }
+    m_size = 0;
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+void MappedFile::will_need(std::size_t offset, std::size_t length) const
+{
+    if (offset >= m_size) {
+        return;
+    }
+    length = std::min(length, m_size - offset);
+
+    // madvise requires page aligned addresses
+    static const std::size_t page_size = sysconf(_SC_PAGESIZE);
+    const std::size_t aligned_offset = offset - offset % page_size;
+    madvise(const_cast<std::uint8_t*>(m_data) + aligned_offset,
+            length + (offset - aligned_offset),
+            MADV_WILLNEED);
+}
+
+}
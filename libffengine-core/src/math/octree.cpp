@@ -27,6 +27,8 @@ the AUTHORS file.
 #include <cassert>
 #include <iostream>
 
+#include "ffengine/common/scheduler.hpp"
+
 #include "ffengine/math/intersect.hpp"
 
 
@@ -88,6 +90,12 @@ Octree *OctreeObject::octree()
 const unsigned int OctreeNode::SPLIT_THRESHOLD = 8*2;
 const unsigned int OctreeNode::STRADDLE_THRESHOLD_DIVISOR = 4;
 
+/**
+ * Number of subtrees at which the parallel frustum selection stops
+ * descending serially.
+ */
+static const std::size_t FRUSTUM_PARALLEL_SUBTREES = 32;
+
 OctreeNode::OctreeNode(Octree &tree):
     m_tree(tree),
     m_parent(nullptr),
@@ -520,4 +528,90 @@ void Octree::rebalance()
     }
 }
 
+void Octree::select_nodes_by_frustum(
+        const std::array<Plane, 6> &frustum,
+        std::vector<OctreeNode*> &hitset,
+        TaskScheduler &scheduler)
+{
+    enum FrustumTaskType {
+        SELECT_SELF,
+        SELECT_ALL,
+        SELECT_BY_FRUSTUM,
+    };
+
+    struct FrustumTask
+    {
+        OctreeNode *node;
+        FrustumTaskType type;
+    };
+
+    // expand the tasks level by level in the order of the serial traversal
+    std::vector<FrustumTask> tasks{FrustumTask{&m_root, SELECT_BY_FRUSTUM}};
+    std::vector<FrustumTask> next_tasks;
+    bool expanded = true;
+    while (expanded && tasks.size() < FRUSTUM_PARALLEL_SUBTREES) {
+        expanded = false;
+        next_tasks.clear();
+        for (const FrustumTask &task: tasks) {
+            FrustumTaskType child_type = task.type;
+            if (task.type == SELECT_SELF) {
+                next_tasks.push_back(task);
+                continue;
+            } else if (task.type == SELECT_BY_FRUSTUM) {
+                const PlaneSide side = isect_aabb_frustum(task.node->bounds(),
+                                                          frustum);
+                if (side == PlaneSide::NEGATIVE_NORMAL) {
+                    expanded = true;
+                    continue;
+                } else if (side == PlaneSide::POSITIVE_NORMAL) {
+                    child_type = SELECT_ALL;
+                }
+            }
+
+            expanded = true;
+            next_tasks.push_back(FrustumTask{task.node, SELECT_SELF});
+            for (auto &child: task.node->m_children) {
+                if (child) {
+                    next_tasks.push_back(FrustumTask{child.get(), child_type});
+                }
+            }
+        }
+        tasks.swap(next_tasks);
+    }
+
+    std::vector<std::vector<OctreeNode*> > partial_hitsets(tasks.size());
+    parallel_for(scheduler, 0, tasks.size(), 1,
+                 [&](const unsigned int first, const unsigned int last)
+    {
+        for (unsigned int i = first; i < last; ++i) {
+            const FrustumTask &task = tasks[i];
+            std::vector<OctreeNode*> &dest = partial_hitsets[i];
+            switch (task.type)
+            {
+            case SELECT_SELF:
+            {
+                if (!task.node->m_objects.empty()) {
+                    dest.push_back(task.node);
+                }
+                break;
+            }
+            case SELECT_ALL:
+            {
+                task.node->select_nodes_with_objects(dest);
+                break;
+            }
+            case SELECT_BY_FRUSTUM:
+            {
+                task.node->select_nodes_by_frustum(frustum, dest);
+                break;
+            }
+            }
+        }
+    });
+
+    for (const std::vector<OctreeNode*> &partial: partial_hitsets) {
+        hitset.insert(hitset.end(), partial.begin(), partial.end());
+    }
+}
+
 }
@@ -24,16 +24,19 @@ the AUTHORS file.
 #ifndef SCC_ENGINE_GL_HWELEMENTBUF_H
 #define SCC_ENGINE_GL_HWELEMENTBUF_H
 
+#include <algorithm>
 #include <iostream>
+#include <limits>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
 #include <cassert>
 
 #include <epoxy/gl.h>
 
+#include "ffengine/gl/block_allocator.hpp"
 #include "ffengine/gl/object.hpp"
+#include "ffengine/gl/range_set.hpp"
 #include "ffengine/gl/util.hpp"
 
 #include "ffengine/io/log.hpp"
@@ -42,31 +45,49 @@ namespace ffe {
 
 extern io::Logger &gl_array_logger;
 
-typedef unsigned int GLArrayRegionID;
+typedef GLBlockAllocator::RegionID GLArrayRegionID;
 
-class GLArrayRegion
+/**
+ * Counters of the uploads done by all GLArray instances.
+ *
+ * The counters are only updated from the thread which owns the GL context.
+ */
+struct GLArrayUploadStats
 {
-public:
-    GLArrayRegion(GLArrayRegionID id,
-                  unsigned int start,
-                  unsigned int count):
-        m_id(id),
-        m_start(start),
-        m_count(count),
-        m_in_use(false),
-        m_dirty(false)
-    {
-    }
-
-public:
-    GLArrayRegionID m_id;
-    unsigned int m_start;
-    unsigned int m_count;
-    bool m_in_use;
-    bool m_dirty;
-
+    GLArrayUploadStats();
+
+    /**
+     * Number of glBufferData calls which reallocated a buffer.
+     */
+    unsigned int reallocations;
+
+    /**
+     * Number of glBufferSubData calls.
+     */
+    unsigned int uploads;
+
+    /**
+     * Bytes transferred, including reallocations and the clean gaps which
+     * were merged into uploads.
+     */
+    std::size_t bytes;
+
+    /**
+     * Bytes which were actually marked dirty.
+     */
+    std::size_t dirty_bytes;
 };
 
+/**
+ * Counters accumulated since the last call to take_gl_array_upload_stats().
+ */
+GLArrayUploadStats &gl_array_upload_stats();
+
+/**
+ * Return the counters accumulated so far and reset them; call this once
+ * per frame to obtain per-frame counters.
+ */
+GLArrayUploadStats take_gl_array_upload_stats();
 
 template <typename _buffer_t>
 class GLArrayAllocation
@@ -207,7 +228,11 @@ class GLArray: public GLObject<gl_binding_type>
 public:
     typedef _element_t element_t;
     typedef GLArrayAllocation<buffer_t> allocation_t;
-    typedef std::vector<std::unique_ptr<GLArrayRegion> > region_container;
+
+    /**
+     * Default for set_upload_merge_gap(), in bytes.
+     */
+    static constexpr unsigned int DEFAULT_UPLOAD_MERGE_GAP = 4096;
 
 public:
     GLArray():
@@ -215,11 +240,10 @@ public:
         m_usage(GL_DYNAMIC_DRAW),
         m_block_length(0),
         m_local_buffer(),
-        m_regions(),
-        m_region_map(),
-        m_any_dirty(false),
-        m_remote_size(0),
-        m_region_id_ctr()
+        m_allocator(),
+        m_dirty_blocks(),
+        m_upload_merge_gap(DEFAULT_UPLOAD_MERGE_GAP),
+        m_remote_size(0)
     {
         glGenBuffers(1, &this->m_glid);
         glBindBuffer(gl_target, this->m_glid);
@@ -233,163 +257,23 @@ protected:
     unsigned int m_block_length;
 
     std::basic_string<element_t> m_local_buffer;
-    std::vector<std::unique_ptr<GLArrayRegion> > m_regions;
-    std::unordered_map<GLArrayRegionID, GLArrayRegion*> m_region_map;
-    bool m_any_dirty;
+    GLBlockAllocator m_allocator;
+
+    /**
+     * Blocks which have been marked dirty since the last upload.
+     */
+    GLBufferRangeSet m_dirty_blocks;
+    unsigned int m_upload_merge_gap;
+    std::vector<GLBufferRange> m_upload_ranges;
 
     unsigned int m_remote_size;
-    GLArrayRegionID m_region_id_ctr;
 
 protected:
-    GLArrayRegion &append_region(unsigned int start,
-                                 unsigned int count)
-    {
-        const GLArrayRegionID region_id = ++m_region_id_ctr;
-        m_regions.emplace_back(new GLArrayRegion(
-                                   region_id,
-                                   start,
-                                   count));
-        GLArrayRegion &new_region = **(m_regions.end() - 1);
-        m_region_map[region_id] = &new_region;
-        return new_region;
-    }
-
     inline unsigned int block_size() const
     {
         return m_block_length * sizeof(element_t);
     }
 
-    region_container::iterator compact_regions(
-            region_container::iterator iter,
-            const unsigned int nregions)
-    {
-        unsigned int total = 0;
-        unsigned int i = nregions;
-        do {
-            i -= 1;
-            --iter;
-            total += (*iter)->m_count;
-            assert(!(*iter)->m_in_use);
-        } while (i > 0);
-
-        (*iter)->m_count = total;
-        return m_regions.erase(iter+1, iter+nregions);
-    }
-
-    inline bool merge_aggregated(region_container::iterator &iterator,
-                                 region_container::iterator &best,
-                                 unsigned int &aggregation_backlog,
-                                 const unsigned int nblocks)
-    {
-        gl_array_logger.logf(io::LOG_DEBUG,
-                             "compacting %d regions",
-                             aggregation_backlog);
-        iterator = compact_regions(
-                    iterator,
-                    aggregation_backlog);
-        GLArrayRegion &merged = **(iterator-1);
-        gl_array_logger.logf(io::LOG_DEBUG,
-                             "resulting region (%d) has %d elements",
-                             merged.m_id,
-                             merged.m_count);
-        if (merged.m_count >= nblocks) {
-            gl_array_logger.logf(io::LOG_DEBUG,
-                                 "suggesting region %d",
-                                 merged.m_id);
-            best = iterator-1;
-            return true;
-        }
-
-        return false;
-    }
-
-    region_container::iterator compact_or_expand(
-            const unsigned int nblocks)
-    {
-        auto iterator = m_regions.begin();
-        unsigned int aggregation_backlog = 0;
-        bool found = false;
-        auto best = m_regions.end();
-
-        for (; iterator != m_regions.end(); iterator++)
-        {
-            GLArrayRegion &region = **iterator;
-            if (region.m_in_use)
-            {
-                if (aggregation_backlog > 1) {
-                    if (merge_aggregated(iterator, best,
-                                         aggregation_backlog, nblocks)) {
-                        found = true;
-                        break;
-                    }
-                    // iterator might point behind the list after erase
-                    if (iterator == m_regions.end()) {
-                        break;
-                    }
-                }
-                aggregation_backlog = 0;
-                continue;
-            } else {
-                // this is safe, we only erase during this loop, which only
-                // invalidates iterators *behind* the erasure
-                // in addition, if this region will be merged away, it will be
-                // a "best" region and found will be true.
-                if (region.m_count >= nblocks) {
-                    gl_array_logger.logf(io::LOG_DEBUG,
-                                         "candidate region (%p) %d: start=%u, in_use=%d, count=%u",
-                                         &region, region.m_id,
-                                         region.m_start,
-                                         region.m_in_use,
-                                         region.m_count);
-                    if (found && region.m_count < (*best)->m_count) {
-                        // use smaller region if possible
-                        // this is only a weak heuristic; merge_aggregated is
-                        // likely to use a larger region than we currently have
-                        best = iterator;
-                    } else if (!found) {
-                        best = iterator;
-                        found = true;
-                    }
-                }
-            }
-
-            aggregation_backlog += 1;
-        }
-
-        if (!found && aggregation_backlog > 1) {
-            found = merge_aggregated(iterator, best,
-                                     aggregation_backlog, nblocks);
-        }
-
-        if (found) {
-            gl_array_logger.logf(io::LOG_DEBUG,
-                                 "using region %d with %d elements",
-                                 (*best)->m_id,
-                                 (*best)->m_count);
-            return best;
-        }
-
-        unsigned int required_blocks = nblocks;
-        gl_array_logger.log(io::LOG_DEBUG,
-                            "out of luck, we have to reallocate");
-        if (m_regions.size() > 0) {
-            gl_array_logger.log(io::LOG_DEBUG, "but we have regions");
-            GLArrayRegion &last_region = **m_regions.rbegin();
-            if (!last_region.m_in_use) {
-                gl_array_logger.log(io::LOG_DEBUG, "and the last one is not in use");
-                assert(last_region.m_count < nblocks);
-                required_blocks -= last_region.m_count;
-            }
-        }
-
-        gl_array_logger.logf(io::LOG_DEBUG,
-                             "requesting expansion by %d (out of %d) blocks",
-                             required_blocks, nblocks);
-
-        expand(required_blocks);
-        return m_regions.end() - 1;
-    }
-
     void delete_globject() override
     {
         glDeleteBuffers(1, &this->m_glid);
@@ -412,6 +296,11 @@ protected:
             new_blocks = 1;
         }
         while (min_blocks > new_blocks) {
+            if (new_blocks > std::numeric_limits<unsigned int>::max() / 2) {
+                // doubling would overflow
+                new_blocks = min_blocks;
+                break;
+            }
             new_blocks *= 2;
         }
         if (new_blocks <= old_blocks) {
@@ -426,22 +315,7 @@ protected:
                              new_blocks);
 
         m_local_buffer.resize(new_size);
-        if (m_regions.size() > 0) {
-            GLArrayRegion &last_region = **(m_regions.end() - 1);
-            if (!last_region.m_in_use) {
-                gl_array_logger.logf(io::LOG_DEBUG,
-                                     "reserve: appending %d blocks to existing region", new_blocks - old_blocks);
-                last_region.m_count += new_blocks - old_blocks;
-                return;
-            }
-        }
-
-        GLArrayRegion &region = append_region(old_blocks, new_blocks - old_blocks);
-
-        gl_array_logger.logf(io::LOG_DEBUG,
-                             "reserve: created region %u with %u blocks",
-                             region.m_id,
-                             region.m_count);
+        m_allocator.grow(new_blocks);
     }
 
     bool reserve_remote()
@@ -462,29 +336,6 @@ protected:
         return true;
     }
 
-    GLArrayRegion &split_region(
-            region_container::iterator iter,
-            const unsigned int blocks_for_first)
-    {
-        GLArrayRegion *first_region = &**iter;
-
-        const GLArrayRegionID new_region_id = ++m_region_id_ctr;
-        auto new_region_iter = m_regions.emplace(
-                    iter+1,
-                    new GLArrayRegion(
-                        new_region_id,
-                        first_region->m_start + blocks_for_first,
-                        first_region->m_count - blocks_for_first)
-                    );
-        GLArrayRegion &new_region = **new_region_iter;
-        first_region = &**(new_region_iter-1);
-        m_region_map[new_region_id] = &new_region;
-
-        first_region->m_count = blocks_for_first;
-
-        return *first_region;
-    }
-
     void upload_dirty()
     {
         gl_array_logger.logf(io::LOG_DEBUG,
@@ -499,58 +350,43 @@ protected:
                         "remote reallocation took place, no need to retransfer"
                         );
             // reallocation took place, this uploads all data
-            for (auto &region: m_regions) {
-                region->m_dirty = false;
-            }
-            m_any_dirty = false;
+            GLArrayUploadStats &stats = gl_array_upload_stats();
+            stats.reallocations += 1;
+            stats.bytes += m_local_buffer.size() * sizeof(element_t);
+            stats.dirty_bytes += m_dirty_blocks.covered() * block_size();
+            m_dirty_blocks.clear();
             return;
         }
 
-        if (!m_any_dirty) {
+        if (m_dirty_blocks.empty()) {
             gl_array_logger.log(
                         io::LOG_DEBUG,
                         "not dirty, bailing out");
-            // std::cout << "nothing to upload (m_any_dirty=false)" << std::endl;
             return;
         }
 
-        unsigned int left_block = m_local_buffer.size();
-        unsigned int right_block = 0;
+        // only whole blocks of clean data fit into the gap
+        const unsigned int merge_gap_blocks =
+                m_upload_merge_gap / block_size();
+        m_dirty_blocks.coalesce(merge_gap_blocks, m_upload_ranges);
 
-        for (auto &region: m_regions)
+        GLArrayUploadStats &stats = gl_array_upload_stats();
+        stats.dirty_bytes += m_dirty_blocks.covered() * block_size();
+        for (const GLBufferRange &range: m_upload_ranges)
         {
-            if (!region->m_in_use || !region->m_dirty)
-            {
-                continue;
-            }
-
-            if (region->m_start < left_block)
-            {
-                left_block = region->m_start;
-            }
-            const unsigned int end = region->m_start + region->m_count;
-            if (end > right_block)
-            {
-                right_block = end;
-            }
-
-            region->m_dirty = false;
-        }
-
-        if (right_block > 0) {
-            const unsigned int offset = left_block * block_size();
-            const unsigned int size = (right_block - left_block) * block_size();
+            const unsigned int offset = range.first * block_size();
+            const unsigned int size = range.length() * block_size();
             gl_array_logger.log(io::LOG_DEBUG)
                     << "uploading "
                     << size << " bytes at offset "
                     << offset
                     << " (glid=" << this->m_glid << "; bound=" << gl_get_integer(gl_binding_type) << ")" << io::submit;
             glBufferSubData(gl_target, offset, size, m_local_buffer.data() + offset/sizeof(element_t));
-        } else {
-            // std::cout << "nothing to upload (right_block=0)" << std::endl;
+            stats.uploads += 1;
+            stats.bytes += size;
         }
 
-        m_any_dirty = false;
+        m_dirty_blocks.clear();
     }
 
 public:
@@ -561,83 +397,35 @@ public:
                              this->m_glid,
                              nblocks);
 
-        auto iterator = m_regions.end();
-        /*for (; iterator != m_regions.end(); ++iterator)
+        GLArrayRegionID region_id = m_allocator.allocate(nblocks);
+        if (region_id == GLBlockAllocator::NO_REGION)
         {
-            GLArrayRegion &region = **iterator;
+            // the free space at the end of the buffer is reused
+            const unsigned int wanted_blocks = std::max(nblocks, 1u);
+            const unsigned int trailing_blocks =
+                    m_allocator.trailing_free_blocks();
+            const unsigned int required_blocks =
+                    (wanted_blocks > trailing_blocks
+                     ? wanted_blocks - trailing_blocks
+                     : 0);
             gl_array_logger.logf(io::LOG_DEBUG,
-                                 "region (%p) %d: start=%d, in_use=%d, count=%d",
-                                 &region,
-                                 region.m_id,
-                                 region.m_start,
-                                 region.m_in_use,
-                                 region.m_count);
-            if (region.m_in_use) {
-                gl_array_logger.logf(io::LOG_DEBUG,
-                                     "region %d in use, skipping",
-                                     region.m_id);
-                continue;
-            }
-            if (region.m_count < nblocks) {
-                gl_array_logger.logf(io::LOG_DEBUG,
-                                     "region %d too small (%d), skipping",
-                                     region.m_id,
-                                     region.m_count);
-                continue;
-            }
-            gl_array_logger.logf(io::LOG_DEBUG,
-                                 "region %d looks suitable",
-                                 region.m_id);
-            break;
-        }*/
-
-        if (iterator == m_regions.end())
-        {
-            gl_array_logger.log(io::LOG_DEBUG,
-                                "always using compact_or_expand");
-            // out of memory
-            iterator = compact_or_expand(nblocks);
-            gl_array_logger.logf(io::LOG_DEBUG,
-                                 "compact_or_expand returned region %d (count=%d)",
-                                 (*iterator)->m_id,
-                                 (*iterator)->m_count);
-        }
-
-        GLArrayRegion *region_to_use = &**iterator;
-        if (region_to_use->m_count > nblocks)
-        {
-            // split region
-            gl_array_logger.logf(io::LOG_DEBUG,
-                                 "region %d too large, splitting",
-                                 region_to_use->m_id);
-            region_to_use = &split_region(iterator, nblocks);
-            gl_array_logger.logf(io::LOG_DEBUG,
-                                 "now using region %d (start=%d, count=%d)",
-                                 region_to_use->m_id,
-                                 region_to_use->m_start,
-                                 region_to_use->m_count);
+                                 "requesting expansion by %d (out of %d) blocks",
+                                 required_blocks, nblocks);
+            expand(required_blocks);
+            region_id = m_allocator.allocate(nblocks);
+            assert(region_id != GLBlockAllocator::NO_REGION);
         }
 
-        region_to_use->m_in_use = true;
-        region_to_use->m_dirty = false;
-
         gl_array_logger.logf(io::LOG_DEBUG,
-                             "allocated %d blocks to region %d",
+                             "allocated %d blocks to region %d (start=%d)",
                              nblocks,
-                             region_to_use->m_id);
-
-        gl_array_logger.logf(io::LOG_DEBUG,
-                             "region (%p) %d: start=%d, in_use=%d, count=%d",
-                             region_to_use,
-                             region_to_use->m_id,
-                             region_to_use->m_start,
-                             region_to_use->m_in_use,
-                             region_to_use->m_count);
+                             region_id,
+                             m_allocator.region_start(region_id));
 
         return allocation_t((buffer_t*)this,
                             m_block_length,
                             nblocks,
-                            region_to_use->m_id);
+                            region_id);
     }
 
     void dump_remote_raw()
@@ -664,13 +452,13 @@ public:
 
     element_t *region_get_ptr(const GLArrayRegionID region_id)
     {
-        return (&m_local_buffer.front()) + m_region_map[region_id]->m_start*m_block_length;
+        return (&m_local_buffer.front()) + m_allocator.region_start(region_id)*m_block_length;
     }
 
     void region_mark_dirty(const GLArrayRegionID region_id)
     {
-        m_region_map[region_id]->m_dirty = true;
-        m_any_dirty = true;
+        const unsigned int start = m_allocator.region_start(region_id);
+        m_dirty_blocks.add(start, start + m_allocator.region_count(region_id));
     }
 
     void region_release(const GLArrayRegionID region_id)
@@ -678,17 +466,17 @@ public:
         gl_array_logger.logf(io::LOG_DEBUG, "(glid=%d) region %d released",
                              this->m_glid,
                              region_id);
-        m_region_map[region_id]->m_in_use = false;
+        m_allocator.release(region_id);
     }
 
     std::size_t region_offset(const GLArrayRegionID region_id)
     {
-        return m_region_map[region_id]->m_start*m_block_length*sizeof(element_t);
+        return m_allocator.region_start(region_id)*m_block_length*sizeof(element_t);
     }
 
     unsigned int region_base(const GLArrayRegionID region_id)
     {
-        return m_region_map[region_id]->m_start;
+        return m_allocator.region_start(region_id);
     }
 
     std::size_t vertices() const
@@ -696,6 +484,24 @@ public:
         return m_local_buffer.size();
     }
 
+    /**
+     * Set the largest gap between two dirty ranges, in bytes, which is
+     * uploaded along with them instead of issuing a separate upload for
+     * each range.
+     *
+     * Zero uploads each dirty range separately; a gap as large as the buffer
+     * uploads one span covering all dirty ranges.
+     */
+    void set_upload_merge_gap(const unsigned int bytes)
+    {
+        m_upload_merge_gap = bytes;
+    }
+
+    inline unsigned int upload_merge_gap() const
+    {
+        return m_upload_merge_gap;
+    }
+
     void bind() override
     {
         glBindBuffer(gl_target, this->m_glid);
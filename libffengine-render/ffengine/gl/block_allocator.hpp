@@ -0,0 +1,172 @@
+/**********************************************************************
+File name: block_allocator.hpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#ifndef SCC_ENGINE_GL_BLOCK_ALLOCATOR_H
+#define SCC_ENGINE_GL_BLOCK_ALLOCATOR_H
+
+#include <cstdint>
+#include <vector>
+
+namespace ffe {
+
+/**
+ * Allocator for contiguous runs of blocks in a growable block space, as used
+ * by GLArray.
+ *
+ * Regions are kept in a flat pool and linked in address order, so that a
+ * released region is merged with its free neighbours immediately. Free
+ * regions are additionally kept in segregated lists, one per power-of-two
+ * size class, with a bit mask of the non-empty classes. Allocation and
+ * release therefore take constant time, independent of the number of
+ * regions.
+ *
+ * Region IDs are reused after the region has been released.
+ */
+class GLBlockAllocator
+{
+public:
+    typedef unsigned int RegionID;
+
+    /**
+     * Region ID which never refers to a region.
+     */
+    static constexpr RegionID NO_REGION = 0;
+
+    /**
+     * Number of regions of the smallest size class which are checked for a
+     * fit before a region from a larger class is taken. The remaining
+     * regions of the class are only checked if no larger region is free.
+     */
+    static constexpr unsigned int MAX_CLASS_SCAN = 8;
+
+public:
+    GLBlockAllocator();
+
+private:
+    static constexpr unsigned int SIZE_CLASSES = 32;
+
+    struct Region
+    {
+        unsigned int start;
+        unsigned int count;
+        bool in_use;
+        /* neighbours in address order */
+        RegionID prev;
+        RegionID next;
+        /* neighbours in the size class list, only for free regions */
+        RegionID prev_free;
+        RegionID next_free;
+    };
+
+    std::vector<Region> m_pool;
+    std::vector<RegionID> m_unused_ids;
+
+    RegionID m_free_heads[SIZE_CLASSES];
+    std::uint32_t m_nonempty_classes;
+
+    RegionID m_last;
+    unsigned int m_total_blocks;
+    unsigned int m_free_blocks;
+
+private:
+    static unsigned int size_class(const unsigned int count);
+
+    inline Region &region(const RegionID id)
+    {
+        return m_pool[id-1];
+    }
+
+    inline const Region &region(const RegionID id) const
+    {
+        return m_pool[id-1];
+    }
+
+    RegionID new_region(const unsigned int start, const unsigned int count);
+    void delete_region(const RegionID id);
+    void link_free(const RegionID id);
+    void unlink_free(const RegionID id);
+    RegionID find_free(const unsigned int count) const;
+
+public:
+    /**
+     * Allocate a region of \a count blocks.
+     *
+     * Zero-sized requests are served with a single block.
+     *
+     * @return ID of the new region, or NO_REGION if no free region is large
+     * enough; grow() the block space in that case.
+     */
+    RegionID allocate(unsigned int count);
+
+    /**
+     * Release a region returned by allocate(). It is merged with adjacent
+     * free regions.
+     */
+    void release(RegionID id);
+
+    /**
+     * Grow the block space to \a total_blocks. Does nothing if the space is
+     * already at least that large.
+     */
+    void grow(const unsigned int total_blocks);
+
+    inline unsigned int region_start(const RegionID id) const
+    {
+        return region(id).start;
+    }
+
+    inline unsigned int region_count(const RegionID id) const
+    {
+        return region(id).count;
+    }
+
+    inline unsigned int total_blocks() const
+    {
+        return m_total_blocks;
+    }
+
+    inline unsigned int free_blocks() const
+    {
+        return m_free_blocks;
+    }
+
+    /**
+     * Number of free blocks at the end of the block space; an allocation of
+     * \a n blocks which fails succeeds after growing the space by
+     * \a n minus this value.
+     */
+    unsigned int trailing_free_blocks() const;
+
+    /**
+     * Number of regions, free and in use.
+     */
+    inline std::size_t regions() const
+    {
+        return m_pool.size() - m_unused_ids.size();
+    }
+
+};
+
+}
+
+#endif
@@ -62,6 +62,15 @@ static inline void draw_elements_base_vertex(
     glDrawElementsBaseVertex(mode, std::min(alloc.length(), nmax), IBOAllocation::buffer_t::gl_type, (const GLvoid*)alloc.offset(), base_vertex);
 }
 
+static inline void draw_elements_instanced_base_vertex(
+        const IBOAllocation &alloc,
+        GLenum mode,
+        GLint base_vertex,
+        GLsizei instances)
+{
+    glDrawElementsInstancedBaseVertex(mode, alloc.length(), IBOAllocation::buffer_t::gl_type, (const GLvoid*)alloc.offset(), instances, base_vertex);
+}
+
 }
 
 #endif
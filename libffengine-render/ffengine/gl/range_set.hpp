@@ -0,0 +1,114 @@
+/**********************************************************************
+File name: range_set.hpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#ifndef SCC_ENGINE_GL_RANGE_SET_H
+#define SCC_ENGINE_GL_RANGE_SET_H
+
+#include <vector>
+
+namespace ffe {
+
+/**
+ * Half-open range [first, last) of buffer units.
+ */
+struct GLBufferRange
+{
+    unsigned int first;
+    unsigned int last;
+
+    inline unsigned int length() const
+    {
+        return last - first;
+    }
+
+    inline bool operator==(const GLBufferRange &other) const
+    {
+        return first == other.first && last == other.last;
+    }
+
+    inline bool operator!=(const GLBufferRange &other) const
+    {
+        return !(*this == other);
+    }
+};
+
+
+/**
+ * Sorted set of disjoint ranges, used to track the dirty parts of a buffer.
+ *
+ * Overlapping and adjacent ranges are merged on insertion, so the set
+ * always holds the minimal number of ranges covering the inserted units.
+ */
+class GLBufferRangeSet
+{
+public:
+    GLBufferRangeSet() = default;
+
+private:
+    std::vector<GLBufferRange> m_ranges;
+
+public:
+    /**
+     * Add the range [first, last) to the set. Empty ranges are ignored.
+     */
+    void add(const unsigned int first, const unsigned int last);
+
+    inline void clear()
+    {
+        m_ranges.clear();
+    }
+
+    inline bool empty() const
+    {
+        return m_ranges.empty();
+    }
+
+    inline const std::vector<GLBufferRange> &ranges() const
+    {
+        return m_ranges;
+    }
+
+    /**
+     * Total number of units covered by the set.
+     */
+    unsigned int covered() const;
+
+    /**
+     * Merge ranges which are separated by at most \a max_gap units and
+     * store the result in \a dest.
+     *
+     * Uploading a small gap along with its neighbours is cheaper than an
+     * additional upload call; \a max_gap trades the former for the latter.
+     *
+     * @param max_gap Maximum number of clean units between two ranges which
+     * are still merged.
+     * @param dest Vector to receive the merged ranges; it is cleared first.
+     */
+    void coalesce(const unsigned int max_gap,
+                  std::vector<GLBufferRange> &dest) const;
+
+};
+
+}
+
+#endif
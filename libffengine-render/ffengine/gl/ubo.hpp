@@ -24,6 +24,7 @@ the AUTHORS file.
 #ifndef SCC_ENGINE_GL_UBO_H
 #define SCC_ENGINE_GL_UBO_H
 
+#include <array>
 #include <tuple>
 #include <utility>
 
@@ -180,6 +181,60 @@ public:
     }
 };
 
+
+/**
+ * Uniform buffer for a std140 `vec4 name[N]` array, filled anew for each
+ * use, for example with per-draw parameters.
+ */
+template <std::size_t N>
+class Vector4fArrayUBO: public UBOBase
+{
+public:
+    static constexpr std::size_t length = N;
+
+    static_assert(sizeof(Vector4f) == 16,
+                  "Vector4f does not match the std140 array stride");
+
+public:
+    Vector4fArrayUBO():
+        UBOBase(sizeof(m_storage), &m_storage, GL_STREAM_DRAW),
+        m_storage()
+    {
+
+    }
+
+private:
+    std::array<Vector4f, N> m_storage;
+
+public:
+    inline Vector4f &operator[](const std::size_t i)
+    {
+        return m_storage[i];
+    }
+
+    inline const Vector4f &operator[](const std::size_t i) const
+    {
+        return m_storage[i];
+    }
+
+    /**
+     * Replace the contents of the bound buffer with the first \a count
+     * elements.
+     *
+     * The buffer storage is orphaned first, so that draw calls still reading
+     * the previous contents do not stall the upload.
+     */
+    inline void update_bound(const std::size_t count)
+    {
+        glBufferData(GL_UNIFORM_BUFFER, size(), nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0,
+                        count * sizeof(Vector4f), m_storage.data());
+    }
+};
+
+template <std::size_t N>
+constexpr std::size_t Vector4fArrayUBO<N>::length;
+
 }
 
 #endif
@@ -139,6 +139,10 @@ std::tuple<Vector3f, bool> isect_terrain_ray(
         const unsigned int size,
         const sim::Terrain::Field &field);
 
+std::tuple<Vector3f, bool> isect_terrain_ray(
+        const Ray &ray,
+        const sim::TerrainSnapshot &snapshot);
+
 }
 
 #endif
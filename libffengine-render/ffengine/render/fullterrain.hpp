@@ -159,8 +159,24 @@ private:
 private:
     int acquire_layer_for_slice(const TerrainSlice &slice);
 
+    enum class SliceSelection {
+        CULLED,
+        LEAF,
+        SPLIT
+    };
+
+    /**
+     * Decide whether the quadtree node at the given position is outside the
+     * frustum, rendered as a single slice or split into its four children.
+     */
+    SliceSelection classify_slice(const unsigned int invdepth,
+                                  const unsigned int relative_x,
+                                  const unsigned int relative_y,
+                                  const Vector3f &viewpoint,
+                                  const std::array<Plane, 6> &frustum) const;
+
     /**
-     * Generate TerrainSlice instances and fill the m_render_slices vector.
+     * Generate TerrainSlice instances and append them to *dest*.
      *
      * @param invdepth The inverse of the LOD tree depth. Start with
      * m_max_depth for a full tree.
@@ -173,7 +189,18 @@ private:
             const unsigned int relative_x,
             const unsigned int relative_y,
             const Vector3f &viewpoint,
-            const std::array<Plane, 6> &frustum);
+            const std::array<Plane, 6> &frustum) const;
+
+    /**
+     * Collect the slices for a full tree into *dest*.
+     *
+     * The upper levels of the quadtree are expanded serially, the resulting
+     * subtrees are culled in parallel on the global scheduler. The order of
+     * the slices is the same as with a plain collect_slices_recurse().
+     */
+    void collect_slices(Slices &dest,
+                        const Vector3f &viewpoint,
+                        const std::array<Plane, 6> &frustum) const;
 
     void touch_slice(const TerrainSlice &slice);
 
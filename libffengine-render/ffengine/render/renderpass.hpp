@@ -25,11 +25,15 @@ the AUTHORS file.
 #define SCC_RENDER_RENDERPASS_H
 
 #include <array>
+#include <cstdint>
 #include <functional>
 #include <unordered_map>
 
+#include "ffengine/common/radix_sort.hpp"
+
 #include "ffengine/gl/fbo.hpp"
 #include "ffengine/gl/texture.hpp"
+#include "ffengine/gl/ubo.hpp"
 
 #include "ffengine/render/scenegraph.hpp"
 
@@ -114,11 +118,13 @@ private:
     std::unordered_map<std::string, TextureAttachment> m_texture_bindings;
     std::vector<GLint> m_free_units;
     GLint m_base_free_unit;
+    std::uint64_t m_texture_key;
 
     std::unique_ptr<ffe::VAO> m_vao;
 
 private:
     GLint get_next_texture_unit();
+    void update_texture_key();
 
 protected:
     bool link();
@@ -149,6 +155,17 @@ public:
         return m_order;
     }
 
+    /**
+     * Key which groups instructions using this pass by the GL state they
+     * need, for PassInfo::sort_instructions().
+     *
+     * From the most significant bit: 16 bits of order(), 12 bits of the
+     * shader program name, 10 bits of the VAO name and 10 bits of a hash of
+     * the attached textures. The lowest 16 bits are zero and are used by
+     * PassInfo for the depth of the instruction.
+     */
+    std::uint64_t state_key() const;
+
 public:
     inline GLenum cull_face() const
     {
@@ -324,6 +341,13 @@ public:
 typedef std::function<void(MaterialPass&)> RenderSetupFunc;
 typedef std::function<void(MaterialPass&)> RenderTeardownFunc;
 
+/**
+ * Per-draw parameters of batched instructions, exposed to shaders as the
+ * DrawParamsBlock uniform block (see lib/draw_params_block.glsl). Within a
+ * batch, the parameters of a draw are at index gl_InstanceID.
+ */
+typedef Vector4fArrayUBO<256> DrawParamsUBO;
+
 
 struct PassRenderInstruction
 {
@@ -334,6 +358,12 @@ struct PassRenderInstruction
                           VBOAllocation &vbo_allocation,
                           const RenderSetupFunc &setup,
                           const RenderTeardownFunc &teardown);
+    PassRenderInstruction(const AABB &box,
+                          GLint mode,
+                          MaterialPass &mat,
+                          IBOAllocation &ibo_allocation,
+                          VBOAllocation &vbo_allocation,
+                          const Vector4f &draw_params);
     PassRenderInstruction(PassRenderInstruction &&src) = default;
     PassRenderInstruction& operator=(PassRenderInstruction &&src) = default;
 
@@ -344,26 +374,64 @@ struct PassRenderInstruction
     VBOAllocation *vbo_allocation;
     RenderSetupFunc setup;
     RenderTeardownFunc teardown;
+    bool batched;
+    Vector4f draw_params;
+
+    /**
+     * Whether \a other can be drawn in the same instanced draw call as this
+     * instruction.
+     */
+    bool batches_with(const PassRenderInstruction &other) const;
 };
 
 class PassInfo
 {
 private:
     std::vector<PassRenderInstruction> m_instructions;
+    std::vector<RadixSortEntry> m_sort_entries;
+    std::vector<RadixSortEntry> m_sort_scratch;
+    std::vector<PassRenderInstruction> m_sorted;
 
 public:
+    /**
+     * Add an instruction to the pass.
+     *
+     * The sort key of the instruction is computed here, from the state key
+     * of \a mat and the distance of \a box from \a viewpoint.
+     */
     void emplace_instruction(const AABB &box,
                              GLint mode,
                              MaterialPass &mat,
                              IBOAllocation &ibo_allocation,
                              VBOAllocation &vbo_allocation,
                              const RenderSetupFunc &setup,
-                             const RenderTeardownFunc &teardown);
+                             const RenderTeardownFunc &teardown,
+                             const Vector3f &viewpoint);
+
+    /**
+     * Add an instruction which may be batched with others.
+     *
+     * Consecutive batched instructions (after sorting) which use the same
+     * material pass, mode and geometry are drawn with a single instanced
+     * draw call; \a draw_params is made available to the shader in the
+     * DrawParamsBlock. Instructions which cannot be batched with their
+     * neighbours are drawn as a batch of one.
+     */
+    void emplace_batched_instruction(const AABB &box,
+                                     GLint mode,
+                                     MaterialPass &mat,
+                                     IBOAllocation &ibo_allocation,
+                                     VBOAllocation &vbo_allocation,
+                                     const Vector4f &draw_params,
+                                     const Vector3f &viewpoint);
 
     /**
      * Render all instructions as currently in the list.
+     *
+     * @param draw_params Buffer for the parameters of batched instructions,
+     * which must be bound at RenderContext::DRAW_PARAMS_BLOCK_UBO_SLOT.
      */
-    void render();
+    void render(DrawParamsUBO &draw_params);
 
     /**
      * Clear all stored data, but leave memory for storing data allocated.
@@ -371,12 +439,14 @@ public:
     void reset();
 
     /**
-     * Sort the render instructions according to the settings specified in the
-     * associated renderpass.
+     * Sort the render instructions by their sort key.
      *
-     * If the renderpass does not specify a Z order, the objects are grouped
-     * soley by material. If the renderpass specifies a Z order, the objects are
-     * ordered by the nearest Z coordinate of their bounding volume.
+     * Instructions are ordered by MaterialPass::order() first and grouped by
+     * the GL state of their material pass, so that render() switches state as
+     * rarely as possible. Within a group, instructions of passes which test
+     * and write depth are drawn front to back by the distance of their
+     * bounding volume from the viewpoint; all other instructions keep the
+     * order in which they were emplaced.
      */
     void sort_instructions();
 
@@ -518,13 +588,16 @@ public:
     typedef UBO<Matrix4f, Matrix4f, Vector4f, Vector3f, Vector4f, Vector3f> MatrixUBO;
     static constexpr GLint INV_MATRIX_BLOCK_UBO_SLOT = 1;
     typedef UBO<Matrix4f, Matrix4f, Vector2f> InvMatrixUBO;
+    static constexpr GLint DRAW_PARAMS_BLOCK_UBO_SLOT = 2;
 
 private:
     std::unordered_map<RenderPass*, PassInfo> m_passes;
     MatrixUBO m_matrix_ubo;
     InvMatrixUBO m_inv_matrix_ubo;
+    DrawParamsUBO m_draw_params_ubo;
     std::array<Plane, 6> m_frustum;
     Vector3f m_viewpoint;
+    PrepareTimings m_prepare_timings;
 
 public:
     inline const std::array<Plane, 6> &frustum() const
@@ -537,6 +610,19 @@ public:
         return m_viewpoint;
     }
 
+    /**
+     * Timings of the last SceneGraph::prepare() call for this context.
+     */
+    inline PrepareTimings &prepare_timings()
+    {
+        return m_prepare_timings;
+    }
+
+    inline const PrepareTimings &prepare_timings() const
+    {
+        return m_prepare_timings;
+    }
+
 public:
     void render_all(const AABB &box,
                     GLint mode,
@@ -553,7 +639,27 @@ public:
                      RenderSetupFunc setup = nullptr,
                      RenderTeardownFunc teardown = nullptr);
 
+    /**
+     * Like render_all(), but the draws may be batched with other draws of
+     * the same geometry; see PassInfo::emplace_batched_instruction().
+     *
+     * Shaders of the material read the \a draw_params of the draw from the
+     * DrawParamsBlock, instead of getting per-draw uniforms from a setup
+     * function.
+     */
+    void render_all_batched(const AABB &box,
+                            GLint mode,
+                            Material &material,
+                            ffe::IBOAllocation &indices,
+                            ffe::VBOAllocation &vertices,
+                            const Vector4f &draw_params);
+
 public:
+    inline DrawParamsUBO &draw_params_ubo()
+    {
+        return m_draw_params_ubo;
+    }
+
     PassInfo &pass_info(RenderPass *pass);
     void setup(const Camera &camera,
                const SceneGraph &scenegraph,
@@ -618,6 +724,11 @@ public:
     void render();
     void prepare();
 
+    inline const RenderContext &context() const
+    {
+        return m_context;
+    }
+
 };
 
 
@@ -24,7 +24,10 @@ the AUTHORS file.
 #ifndef SCC_ENGINE_SCENEGRAPH_H
 #define SCC_ENGINE_SCENEGRAPH_H
 
+#include <chrono>
 #include <stack>
+#include <typeindex>
+#include <unordered_map>
 #include <vector>
 
 #include "ffengine/common/types.hpp"
@@ -52,6 +55,65 @@ public:
 };
 
 
+/**
+ * Time spent in prepare() per type of scenegraph node or renderable octree
+ * object, collected by the scenegraph for a RenderContext.
+ *
+ * The times are exclusive: the time a node spends in the prepare() calls of
+ * its children is accounted to the children only, so the totals of all
+ * entries add up to the time of the whole prepare pass.
+ */
+class PrepareTimings
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    struct Entry
+    {
+        unsigned int calls;
+        clock::duration total;
+    };
+
+    typedef std::unordered_map<std::type_index, Entry> container_type;
+
+private:
+    container_type m_entries;
+    /**
+     * Time spent in nested prepare() calls of the call being timed.
+     */
+    clock::duration m_nested;
+
+public:
+    PrepareTimings();
+
+public:
+    inline const container_type &entries() const
+    {
+        return m_entries;
+    }
+
+    void clear();
+
+    /**
+     * Start timing a prepare() call which may contain nested timed calls.
+     *
+     * @return Token to pass to end().
+     */
+    clock::duration begin();
+
+    /**
+     * Finish timing a prepare() call of an object of type \a type which
+     * took \a duration in total, and record its exclusive time.
+     *
+     * @param outer The token returned by the matching begin().
+     */
+    void end(const std::type_info &type,
+             const clock::duration outer,
+             const clock::duration duration);
+
+};
+
+
 namespace scenegraph {
 
 /**
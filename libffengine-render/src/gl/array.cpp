@@ -28,4 +28,29 @@ namespace ffe {
 
 io::Logger &gl_array_logger = io::logging().get_logger("gl.array");
 
+static GLArrayUploadStats upload_stats;
+
+
+GLArrayUploadStats::GLArrayUploadStats():
+    reallocations(0),
+    uploads(0),
+    bytes(0),
+    dirty_bytes(0)
+{
+
+}
+
+
+GLArrayUploadStats &gl_array_upload_stats()
+{
+    return upload_stats;
+}
+
+GLArrayUploadStats take_gl_array_upload_stats()
+{
+    GLArrayUploadStats result = upload_stats;
+    upload_stats = GLArrayUploadStats();
+    return result;
+}
+
 }
@@ -0,0 +1,256 @@
+/**********************************************************************
+File name: block_allocator.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include "ffengine/gl/block_allocator.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+
+namespace ffe {
+
+constexpr GLBlockAllocator::RegionID GLBlockAllocator::NO_REGION;
+constexpr unsigned int GLBlockAllocator::MAX_CLASS_SCAN;
+constexpr unsigned int GLBlockAllocator::SIZE_CLASSES;
+
+
+GLBlockAllocator::GLBlockAllocator():
+    m_nonempty_classes(0),
+    m_last(NO_REGION),
+    m_total_blocks(0),
+    m_free_blocks(0)
+{
+    std::fill(std::begin(m_free_heads), std::end(m_free_heads), NO_REGION);
+}
+
+unsigned int GLBlockAllocator::size_class(const unsigned int count)
+{
+    assert(count > 0);
+    return 31 - __builtin_clz(count);
+}
+
+GLBlockAllocator::RegionID GLBlockAllocator::new_region(
+        const unsigned int start,
+        const unsigned int count)
+{
+    RegionID id;
+    if (!m_unused_ids.empty()) {
+        id = m_unused_ids.back();
+        m_unused_ids.pop_back();
+    } else {
+        m_pool.emplace_back();
+        id = m_pool.size();
+    }
+
+    Region &result = region(id);
+    result.start = start;
+    result.count = count;
+    result.in_use = false;
+    result.prev = NO_REGION;
+    result.next = NO_REGION;
+    result.prev_free = NO_REGION;
+    result.next_free = NO_REGION;
+    return id;
+}
+
+void GLBlockAllocator::delete_region(const RegionID id)
+{
+    m_unused_ids.emplace_back(id);
+}
+
+void GLBlockAllocator::link_free(const RegionID id)
+{
+    Region &r = region(id);
+    const unsigned int cls = size_class(r.count);
+    r.prev_free = NO_REGION;
+    r.next_free = m_free_heads[cls];
+    if (r.next_free != NO_REGION) {
+        region(r.next_free).prev_free = id;
+    }
+    m_free_heads[cls] = id;
+    m_nonempty_classes |= std::uint32_t(1) << cls;
+}
+
+void GLBlockAllocator::unlink_free(const RegionID id)
+{
+    Region &r = region(id);
+    const unsigned int cls = size_class(r.count);
+    if (r.prev_free != NO_REGION) {
+        region(r.prev_free).next_free = r.next_free;
+    } else {
+        assert(m_free_heads[cls] == id);
+        m_free_heads[cls] = r.next_free;
+        if (r.next_free == NO_REGION) {
+            m_nonempty_classes &= ~(std::uint32_t(1) << cls);
+        }
+    }
+    if (r.next_free != NO_REGION) {
+        region(r.next_free).prev_free = r.prev_free;
+    }
+    r.prev_free = NO_REGION;
+    r.next_free = NO_REGION;
+}
+
+GLBlockAllocator::RegionID GLBlockAllocator::find_free(
+        const unsigned int count) const
+{
+    const unsigned int cls = size_class(count);
+
+    // regions in the class of count may or may not be large enough
+    RegionID candidate = m_free_heads[cls];
+    for (unsigned int i = 0;
+         i < MAX_CLASS_SCAN && candidate != NO_REGION;
+         ++i)
+    {
+        if (region(candidate).count >= count) {
+            return candidate;
+        }
+        candidate = region(candidate).next_free;
+    }
+
+    // all regions in larger classes are large enough; take the smallest
+    const std::uint64_t larger_mask = ~((std::uint64_t(2) << cls) - 1);
+    const std::uint32_t larger = m_nonempty_classes & larger_mask;
+    if (larger != 0) {
+        return m_free_heads[__builtin_ctz(larger)];
+    }
+
+    // before failing, check the rest of the class; a fitting region may be
+    // further down the list than MAX_CLASS_SCAN
+    while (candidate != NO_REGION) {
+        if (region(candidate).count >= count) {
+            return candidate;
+        }
+        candidate = region(candidate).next_free;
+    }
+    return NO_REGION;
+}
+
+GLBlockAllocator::RegionID GLBlockAllocator::allocate(unsigned int count)
+{
+    count = std::max(count, 1u);
+
+    const RegionID id = find_free(count);
+    if (id == NO_REGION) {
+        return NO_REGION;
+    }
+    unlink_free(id);
+
+    const unsigned int remainder = region(id).count - count;
+    if (remainder > 0) {
+        // new_region() may reallocate the pool; do not hold references
+        const RegionID rest = new_region(region(id).start + count, remainder);
+        Region &r = region(id);
+        Region &rest_region = region(rest);
+        r.count = count;
+        rest_region.prev = id;
+        rest_region.next = r.next;
+        if (r.next != NO_REGION) {
+            region(r.next).prev = rest;
+        } else {
+            m_last = rest;
+        }
+        r.next = rest;
+        link_free(rest);
+    }
+
+    region(id).in_use = true;
+    m_free_blocks -= count;
+    return id;
+}
+
+void GLBlockAllocator::release(RegionID id)
+{
+    assert(region(id).in_use);
+    region(id).in_use = false;
+    m_free_blocks += region(id).count;
+
+    // merge with the previous region; the merged region keeps its ID
+    const RegionID prev = region(id).prev;
+    if (prev != NO_REGION && !region(prev).in_use) {
+        unlink_free(prev);
+        Region &p = region(prev);
+        Region &r = region(id);
+        p.count += r.count;
+        p.next = r.next;
+        if (r.next != NO_REGION) {
+            region(r.next).prev = prev;
+        } else {
+            m_last = prev;
+        }
+        delete_region(id);
+        id = prev;
+    }
+
+    const RegionID next = region(id).next;
+    if (next != NO_REGION && !region(next).in_use) {
+        unlink_free(next);
+        Region &r = region(id);
+        Region &n = region(next);
+        r.count += n.count;
+        r.next = n.next;
+        if (n.next != NO_REGION) {
+            region(n.next).prev = id;
+        } else {
+            m_last = id;
+        }
+        delete_region(next);
+    }
+
+    link_free(id);
+}
+
+void GLBlockAllocator::grow(const unsigned int total_blocks)
+{
+    if (total_blocks <= m_total_blocks) {
+        return;
+    }
+    const unsigned int added = total_blocks - m_total_blocks;
+
+    if (m_last != NO_REGION && !region(m_last).in_use) {
+        unlink_free(m_last);
+        region(m_last).count += added;
+        link_free(m_last);
+    } else {
+        const RegionID id = new_region(m_total_blocks, added);
+        region(id).prev = m_last;
+        if (m_last != NO_REGION) {
+            region(m_last).next = id;
+        }
+        m_last = id;
+        link_free(id);
+    }
+
+    m_total_blocks = total_blocks;
+    m_free_blocks += added;
+}
+
+unsigned int GLBlockAllocator::trailing_free_blocks() const
+{
+    if (m_last == NO_REGION || region(m_last).in_use) {
+        return 0;
+    }
+    return region(m_last).count;
+}
+
+}
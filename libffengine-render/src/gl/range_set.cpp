@@ -0,0 +1,84 @@
+/**********************************************************************
+File name: range_set.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include "ffengine/gl/range_set.hpp"
+
+#include <algorithm>
+
+
+namespace ffe {
+
+void GLBufferRangeSet::add(const unsigned int first, const unsigned int last)
+{
+    if (first >= last) {
+        return;
+    }
+
+    // first range which ends at or after first; it may touch the new range
+    auto begin = std::lower_bound(
+                m_ranges.begin(), m_ranges.end(), first,
+                [](const GLBufferRange &range, const unsigned int first)
+                {
+                    return range.last < first;
+                });
+    // first range which starts after last and does not touch it
+    auto end = std::upper_bound(
+                begin, m_ranges.end(), last,
+                [](const unsigned int last, const GLBufferRange &range)
+                {
+                    return last < range.first;
+                });
+
+    if (begin == end) {
+        m_ranges.insert(begin, GLBufferRange{first, last});
+        return;
+    }
+
+    begin->first = std::min(begin->first, first);
+    begin->last = std::max((end-1)->last, last);
+    m_ranges.erase(begin+1, end);
+}
+
+unsigned int GLBufferRangeSet::covered() const
+{
+    unsigned int result = 0;
+    for (const GLBufferRange &range: m_ranges) {
+        result += range.length();
+    }
+    return result;
+}
+
+void GLBufferRangeSet::coalesce(const unsigned int max_gap,
+                                std::vector<GLBufferRange> &dest) const
+{
+    dest.clear();
+    for (const GLBufferRange &range: m_ranges) {
+        if (!dest.empty() && range.first - dest.back().last <= max_gap) {
+            dest.back().last = range.last;
+        } else {
+            dest.emplace_back(range);
+        }
+    }
+}
+
+}
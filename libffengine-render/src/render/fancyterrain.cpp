@@ -158,14 +158,6 @@ void FancyTerrainNode::configure_materials()
     if (m_fluid_data) {
         m_material.attach_texture("fluid_data", m_fluid_data);
     }
-    {
-        MaterialPass &mat = m_material.make_pass_material(m_solid_pass);
-        mat.shader().bind();
-        glUniform2f(mat.shader().uniform_location("chunk_translation"),
-                    0.0, 0.0);
-
-    }
-
     raise_last_gl_error();
 
     for (auto &entry: m_overlays)
@@ -292,13 +284,11 @@ inline void render_slice(RenderContext &context,
     std::cout << "  translationx  = " << x << std::endl;
     std::cout << "  translationy  = " << y << std::endl;
     std::cout << "  scale         = " << scale << std::endl;*/
-    context.render_all(AABB{}, mode, material,
-                       ibo_allocation, vbo_allocation,
-                       [scale, x, y, data_layer](MaterialPass &pass){
-                           glUniform1f(pass.shader().uniform_location("chunk_size"), scale);
-                           glUniform2f(pass.shader().uniform_location("chunk_translation"), x, y);
-                           glUniform1f(pass.shader().uniform_location("data_layer"), data_layer);
-                       });
+    // all slices share the geometry; see terrain/main.vert for the layout of
+    // the draw parameters
+    context.render_all_batched(AABB{}, mode, material,
+                               ibo_allocation, vbo_allocation,
+                               Vector4f(scale, x, y, data_layer));
 }
 
 void FancyTerrainNode::render_all(RenderContext &context, Material &material,
@@ -519,22 +509,39 @@ void FancyTerrainNode::sync(const FullTerrainNode &fullterrain)
     }
     if (updated.is_a_rect())
     {
-        glPixelStorei(GL_UNPACK_ROW_LENGTH, m_terrain.size());
         m_heightmap.bind();
         {
-            const sim::Terrain::Field *heightfield = nullptr;
-            auto hf_lock = m_terrain.readonly_field(heightfield);
-
-            glTexSubImage2D(GL_TEXTURE_2D, 0,
-                            updated.x0(),
-                            updated.y0(),
-                            updated.x1() - updated.x0(),
-                            updated.y1() - updated.y0(),
-                            GL_RGB, GL_FLOAT,
-                            &heightfield->data()[updated.y0()*m_terrain.size()+updated.x0()].as_array);
-
+            // upload from the snapshot tiles, without blocking writers
+            const sim::TerrainSnapshot snapshot = m_terrain.snapshot();
+            const unsigned int tile_size = sim::Terrain::LOCK_TILE_SIZE;
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, tile_size);
+            for (unsigned int ty = updated.y0() / tile_size;
+                 ty*tile_size < updated.y1();
+                 ++ty)
+            {
+                for (unsigned int tx = updated.x0() / tile_size;
+                     tx*tile_size < updated.x1();
+                     ++tx)
+                {
+                    const sim::TerrainRect part =
+                            updated & sim::TerrainRect(tx*tile_size,
+                                                       ty*tile_size,
+                                                       (tx+1)*tile_size,
+                                                       (ty+1)*tile_size);
+                    const Vector3f *tile = snapshot.tile_data(tx, ty);
+                    glTexSubImage2D(GL_TEXTURE_2D, 0,
+                                    part.x0(),
+                                    part.y0(),
+                                    part.x1() - part.x0(),
+                                    part.y1() - part.y0(),
+                                    GL_RGB, GL_FLOAT,
+                                    tile[(part.y0()-ty*tile_size)*tile_size
+                                         + part.x0()-tx*tile_size].as_array);
+                }
+            }
         }
 
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, m_terrain.size());
         m_normalt.bind();
         {
             const NTMapGenerator::NTField *ntfield = nullptr;
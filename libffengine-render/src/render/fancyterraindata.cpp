@@ -88,7 +88,10 @@ void NTMapGenerator::worker_impl(const sim::TerrainRect &updated)
     // this worker really takes a long time, we will copy the source
     {
         const sim::Terrain::Field *heightmap = nullptr;
-        auto source_lock = m_source.readonly_field(heightmap);
+        auto source_lock = m_source.readonly_rect(
+                    sim::TerrainRect(src_x0, src_y0,
+                                     src_x0+src_width, src_y0+src_height),
+                    heightmap);
         for (unsigned int ysrc = src_y0, ylatch = 0;
              ylatch < src_height;
              ylatch++, ysrc++)
@@ -292,31 +295,32 @@ std::tuple<Vector3f, bool> FancyTerrainInterface::hittest(const Ray &ray)
     std::tuple<Vector3f, bool> result;
 #endif
     {
-        const sim::Terrain::Field *heightfield = nullptr;
-        auto height_lock = m_terrain.readonly_field(heightfield);
+        // the snapshot does not block the simulation while we march the ray
+        const sim::TerrainSnapshot snapshot = m_terrain.snapshot();
 #ifdef TIMELOG_HITTEST
         t_lock = timelog_clock::now();
         result =
 #else
         return
 #endif
-        isect_terrain_ray(ray, m_terrain.size(), *heightfield);
+        isect_terrain_ray(ray, snapshot);
     }
 #ifdef TIMELOG_HITTEST
     t_done = timelog_clock::now();
-    logger.logf(io::LOG_DEBUG, "hittest: time to lock: %.2f ms",
+    logger.logf(io::LOG_DEBUG, "hittest: time to snapshot: %.2f ms",
                 std::chrono::duration_cast<std::chrono::duration<float, std::ratio<1, 1000> > >(t_lock - t0).count());
-    logger.logf(io::LOG_DEBUG, "hittest: time from lock to hit: %.2f ms",
+    logger.logf(io::LOG_DEBUG, "hittest: time from snapshot to hit: %.2f ms",
                 std::chrono::duration_cast<std::chrono::duration<float, std::ratio<1, 1000> > >(t_done - t_lock).count());
     return result;
 #endif
 }
 
 
-std::tuple<Vector3f, bool> isect_terrain_ray(
+template <typename height_func_t>
+static std::tuple<Vector3f, bool> isect_terrain_ray_impl(
         const Ray &ray,
         const unsigned int size,
-        const sim::Terrain::Field &field)
+        const height_func_t &height_at)
 {
 #ifdef TIMELOG_HITTEST
     timelog_clock::time_point t0;
@@ -368,10 +372,10 @@ std::tuple<Vector3f, bool> isect_terrain_ray(
             continue;
         }
 
-        const Vector3f p0(x, y, field[y*size+x][sim::Terrain::HEIGHT_ATTR]);
-        const Vector3f p1(x, y+1, field[(y+1)*size+x][sim::Terrain::HEIGHT_ATTR]);
-        const Vector3f p2(x+1, y+1, field[(y+1)*size+x+1][sim::Terrain::HEIGHT_ATTR]);
-        const Vector3f p3(x+1, y, field[y*size+x+1][sim::Terrain::HEIGHT_ATTR]);
+        const Vector3f p0(x, y, height_at(x, y));
+        const Vector3f p1(x, y+1, height_at(x, y+1));
+        const Vector3f p2(x+1, y+1, height_at(x+1, y+1));
+        const Vector3f p3(x+1, y, height_at(x+1, y));
 
         float t;
         std::tie(t, hit) = isect_ray_triangle(ray, p0, p1, p2);
@@ -416,5 +420,30 @@ std::tuple<Vector3f, bool> isect_terrain_ray(
     return std::make_tuple(min, false);
 }
 
+std::tuple<Vector3f, bool> isect_terrain_ray(
+        const Ray &ray,
+        const unsigned int size,
+        const sim::Terrain::Field &field)
+{
+    return isect_terrain_ray_impl(
+                ray, size,
+                [&field, size](const unsigned int x, const unsigned int y)
+                {
+                    return field[y*size+x][sim::Terrain::HEIGHT_ATTR];
+                });
+}
+
+std::tuple<Vector3f, bool> isect_terrain_ray(
+        const Ray &ray,
+        const sim::TerrainSnapshot &snapshot)
+{
+    return isect_terrain_ray_impl(
+                ray, snapshot.size(),
+                [&snapshot](const unsigned int x, const unsigned int y)
+                {
+                    return snapshot.height(x, y);
+                });
+}
+
 
 }
@@ -705,20 +705,23 @@ void CPUFluid::sync(const FullTerrainNode &fullterrain)
     }
 
     m_render_slices.clear();
-    const sim::FluidBlock *block = m_fluidsim.blocks().block(0, 0);
-    for (unsigned int blocky = 0;
-         blocky < m_fluidsim.blocks().blocks_per_axis();
-         ++blocky)
     {
-        for (unsigned int blockx = 0;
-             blockx < m_fluidsim.blocks().blocks_per_axis();
-             ++blockx)
+        auto lock = m_fluidsim.blocks().read_frontbuffer();
+        const sim::FluidBlock *block = m_fluidsim.blocks().block(0, 0);
+        for (unsigned int blocky = 0;
+             blocky < m_fluidsim.blocks().blocks_per_axis();
+             ++blocky)
         {
-            if (block->front_meta().active) {
-                // invalidate caches for block
-                invalidate_caches(blockx, blocky);
+            for (unsigned int blockx = 0;
+                 blockx < m_fluidsim.blocks().blocks_per_axis();
+                 ++blockx)
+            {
+                if (block->front_meta().active) {
+                    // invalidate caches for block
+                    invalidate_caches(blockx, blocky);
+                }
+                ++block;
             }
-            ++block;
         }
     }
 
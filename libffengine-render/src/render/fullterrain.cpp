@@ -23,12 +23,19 @@ the AUTHORS file.
 **********************************************************************/
 #include "ffengine/render/fullterrain.hpp"
 
+#include "ffengine/common/scheduler.hpp"
 #include "ffengine/math/algo.hpp"
 #include "ffengine/math/intersect.hpp"
 
 
 namespace ffe {
 
+/**
+ * Number of quadtree levels which are expanded serially before the remaining
+ * subtrees are handed to the scheduler. Two levels give up to 16 subtrees.
+ */
+static const unsigned int TERRAIN_PARALLEL_EXPAND_LEVELS = 2;
+
 /* engine::TerrainSlice */
 
 TerrainSlice::TerrainSlice():
@@ -128,13 +135,12 @@ int FullTerrainNode::acquire_layer_for_slice(const TerrainSlice &slice)
     return -1;
 }
 
-void FullTerrainNode::collect_slices_recurse(
-        Slices &dest,
+FullTerrainNode::SliceSelection FullTerrainNode::classify_slice(
         const unsigned int invdepth,
         const unsigned int relative_x,
         const unsigned int relative_y,
         const Vector3f &viewpoint,
-        const std::array<Plane, 6> &frustum)
+        const std::array<Plane, 6> &frustum) const
 {
     const float min = 0.;
     const float max = 0.;
@@ -150,7 +156,7 @@ void FullTerrainNode::collect_slices_recurse(
     PlaneSide side = isect_aabb_frustum(box, frustum);
     if (side == PlaneSide::NEGATIVE_NORMAL) {
         // outside frustum
-        return;
+        return SliceSelection::CULLED;
     }
 
     const float next_range_radius = m_lod_range_base * (1u<<invdepth);
@@ -158,12 +164,39 @@ void FullTerrainNode::collect_slices_recurse(
             !isect_aabb_sphere(box, Sphere{viewpoint, next_range_radius}))
     {
         // next LOD not required, insert node
-        dest.emplace_back(absolute_x, absolute_y, size);
-        touch_slice(dest.back());
-        return;
+        return SliceSelection::LEAF;
     }
 
     // some children will need higher LOD
+    return SliceSelection::SPLIT;
+}
+
+void FullTerrainNode::collect_slices_recurse(
+        Slices &dest,
+        const unsigned int invdepth,
+        const unsigned int relative_x,
+        const unsigned int relative_y,
+        const Vector3f &viewpoint,
+        const std::array<Plane, 6> &frustum) const
+{
+    switch (classify_slice(invdepth, relative_x, relative_y,
+                           viewpoint, frustum))
+    {
+    case SliceSelection::CULLED:
+    {
+        return;
+    }
+    case SliceSelection::LEAF:
+    {
+        const unsigned int size = (1u << invdepth)*(m_grid_size-1);
+        dest.emplace_back(relative_x * size, relative_y * size, size);
+        return;
+    }
+    case SliceSelection::SPLIT:
+    {
+        break;
+    }
+    }
 
     for (unsigned int offsy = 0; offsy < 2; offsy++) {
         for (unsigned int offsx = 0; offsx < 2; offsx++) {
@@ -178,6 +211,73 @@ void FullTerrainNode::collect_slices_recurse(
     }
 }
 
+void FullTerrainNode::collect_slices(
+        Slices &dest,
+        const Vector3f &viewpoint,
+        const std::array<Plane, 6> &frustum) const
+{
+    struct Subtree
+    {
+        unsigned int invdepth;
+        unsigned int relative_x;
+        unsigned int relative_y;
+    };
+
+    // expand the upper levels serially until there is enough work to hand
+    // out; splitting a node in place keeps the depth-first order intact, so
+    // that concatenating the per-subtree results matches the serial walk
+    std::vector<Subtree> subtrees{Subtree{m_max_depth, 0, 0}};
+    for (unsigned int level = 0;
+         level < TERRAIN_PARALLEL_EXPAND_LEVELS;
+         ++level)
+    {
+        std::vector<Subtree> next;
+        next.reserve(subtrees.size()*4);
+        for (const Subtree &subtree: subtrees) {
+            const SliceSelection selection = classify_slice(
+                        subtree.invdepth,
+                        subtree.relative_x,
+                        subtree.relative_y,
+                        viewpoint,
+                        frustum);
+            if (selection == SliceSelection::CULLED) {
+                continue;
+            }
+            if (selection == SliceSelection::LEAF) {
+                next.push_back(subtree);
+                continue;
+            }
+            for (unsigned int offsy = 0; offsy < 2; offsy++) {
+                for (unsigned int offsx = 0; offsx < 2; offsx++) {
+                    next.push_back(Subtree{subtree.invdepth-1,
+                                           subtree.relative_x*2+offsx,
+                                           subtree.relative_y*2+offsy});
+                }
+            }
+        }
+        subtrees = std::move(next);
+    }
+
+    std::vector<Slices> partial(subtrees.size());
+    parallel_for(scheduler(), 0, subtrees.size(), 1,
+                 [&](const unsigned int first, const unsigned int last)
+    {
+        for (unsigned int i = first; i < last; ++i) {
+            const Subtree &subtree = subtrees[i];
+            collect_slices_recurse(partial[i],
+                                   subtree.invdepth,
+                                   subtree.relative_x,
+                                   subtree.relative_y,
+                                   viewpoint,
+                                   frustum);
+        }
+    });
+
+    for (Slices &slices: partial) {
+        dest.insert(dest.end(), slices.begin(), slices.end());
+    }
+}
+
 void FullTerrainNode::touch_slice(const TerrainSlice &slice)
 {
     if (!slice) {
@@ -226,11 +326,17 @@ void FullTerrainNode::advance(TimeInterval seconds)
 
 void FullTerrainNode::prepare(RenderContext &context)
 {
-    collect_slices_recurse(
-                m_render_slices[&context],
-                m_max_depth, 0, 0,
-                context.viewpoint()/*fake_viewpoint*/,
-                context.frustum());
+    Slices &slices = m_render_slices[&context];
+    const std::size_t first_new = slices.size();
+    collect_slices(slices,
+                   context.viewpoint()/*fake_viewpoint*/,
+                   context.frustum());
+
+    // bookkeeping allocates texture layers and must see the slices in tree
+    // order, so it stays out of the parallel part
+    for (std::size_t i = first_new; i < slices.size(); ++i) {
+        touch_slice(slices[i]);
+    }
 
     for (auto &renderer: m_renderers) {
         renderer->prepare(context, *this, m_render_slices[&context]);
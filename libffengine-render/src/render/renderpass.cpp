@@ -23,6 +23,8 @@ the AUTHORS file.
 **********************************************************************/
 #include "ffengine/render/renderpass.hpp"
 
+#include <cstring>
+
 namespace ffe {
 
 static io::Logger &logger = io::logging().get_logger("renderpass");
@@ -48,7 +50,8 @@ MaterialPass::MaterialPass(Material &material, RenderPass &pass):
     m_point_size(0.f),
     m_cull_face(GL_BACK),
     m_colour_mask_all(true),
-    m_base_free_unit(0)
+    m_base_free_unit(0),
+    m_texture_key(0)
 {
 
 }
@@ -64,6 +67,17 @@ GLint MaterialPass::get_next_texture_unit()
     return m_base_free_unit++;
 }
 
+void MaterialPass::update_texture_key()
+{
+    // the bindings are unordered, so the combination must be commutative
+    std::uint64_t key = 0;
+    for (const auto &binding: m_texture_bindings) {
+        key += (std::uint64_t(binding.second.texture_obj->glid()) << 8
+                | binding.second.texture_unit) * 0x9e3779b97f4a7c15ULL;
+    }
+    m_texture_key = key >> 54;
+}
+
 bool MaterialPass::link()
 {
     if (is_linked()) {
@@ -117,6 +131,7 @@ bool MaterialPass::attach_texture(const std::string &name, Texture *tex)
     }
 
     m_texture_bindings.emplace(name, TextureAttachment{name, unit, tex});
+    update_texture_key();
 
     return true;
 }
@@ -142,6 +157,7 @@ void MaterialPass::detach_texture(const std::string &name)
     m_free_units.push_back(iter->second.texture_unit);
 
     m_texture_bindings.erase(iter);
+    update_texture_key();
 }
 
 void MaterialPass::set_order(int order)
@@ -149,6 +165,17 @@ void MaterialPass::set_order(int order)
     m_order = order;
 }
 
+std::uint64_t MaterialPass::state_key() const
+{
+    const std::int64_t order = std::max<std::int64_t>(
+                INT16_MIN, std::min<std::int64_t>(m_order, INT16_MAX));
+    const std::uint64_t vao = (m_vao ? m_vao->glid() : 0);
+    return (std::uint64_t(order - INT16_MIN) << 48)
+            | (std::uint64_t(m_shader.glid() & 0xfff) << 36)
+            | ((vao & 0x3ff) << 26)
+            | (m_texture_key << 16);
+}
+
 void MaterialPass::setup()
 {
     bind();
@@ -354,30 +381,122 @@ PassRenderInstruction::PassRenderInstruction(
     ibo_allocation(&ibo_allocation),
     vbo_allocation(&vbo_allocation),
     setup(setup),
-    teardown(teardown)
+    teardown(teardown),
+    batched(false)
 {
 
 }
 
+PassRenderInstruction::PassRenderInstruction(
+        const AABB &box,
+        GLint mode,
+        MaterialPass &mat,
+        IBOAllocation &ibo_allocation,
+        VBOAllocation &vbo_allocation,
+        const Vector4f &draw_params):
+    box(box),
+    mode(mode),
+    material_pass(&mat),
+    ibo_allocation(&ibo_allocation),
+    vbo_allocation(&vbo_allocation),
+    setup(),
+    teardown(),
+    batched(true),
+    draw_params(draw_params)
+{
+
+}
+
+bool PassRenderInstruction::batches_with(
+        const PassRenderInstruction &other) const
+{
+    return batched && other.batched &&
+            material_pass == other.material_pass &&
+            mode == other.mode &&
+            ibo_allocation->offset() == other.ibo_allocation->offset() &&
+            ibo_allocation->length() == other.ibo_allocation->length() &&
+            vbo_allocation->base() == other.vbo_allocation->base();
+}
+
 /* ffe::PassInfo */
 
+/**
+ * Quantise the distance between \a box and \a viewpoint to 16 bits,
+ * preserving its order.
+ */
+static std::uint64_t depth_key(const AABB &box, const Vector3f &viewpoint)
+{
+    if (box.empty()) {
+        return 0;
+    }
+
+    float dist_sq = 0.f;
+    for (unsigned int i = 0; i < 3; ++i) {
+        const float d = std::max(0.f, std::max(
+                                     box.min.as_array[i] - viewpoint.as_array[i],
+                                     viewpoint.as_array[i] - box.max.as_array[i]));
+        dist_sq += d*d;
+    }
+
+    // non-negative floats compare like their bit patterns; the sign bit is
+    // zero, so this keeps the eight exponent bits and the upper eight bits
+    // of the mantissa
+    std::uint32_t bits;
+    std::memcpy(&bits, &dist_sq, sizeof(bits));
+    return bits >> 15;
+}
+
 void PassInfo::emplace_instruction(const AABB &box,
                                    GLint mode,
                                    MaterialPass &mat,
                                    IBOAllocation &ibo_allocation,
                                    VBOAllocation &vbo_allocation,
                                    const RenderSetupFunc &setup,
-                                   const RenderTeardownFunc &teardown)
+                                   const RenderTeardownFunc &teardown,
+                                   const Vector3f &viewpoint)
 {
+    std::uint64_t key = mat.state_key();
+    // blended geometry depends on the submission order; only geometry which
+    // writes depth benefits from early depth testing
+    if (mat.depth_test() && mat.depth_mask()) {
+        key |= depth_key(box, viewpoint);
+    }
+
+    m_sort_entries.push_back(RadixSortEntry{
+                                 key,
+                                 static_cast<std::uint32_t>(m_instructions.size())});
     m_instructions.emplace_back(box, mode, mat,
                                 ibo_allocation, vbo_allocation,
                                 setup, teardown);
 }
 
-void PassInfo::render()
+void PassInfo::emplace_batched_instruction(const AABB &box,
+                                           GLint mode,
+                                           MaterialPass &mat,
+                                           IBOAllocation &ibo_allocation,
+                                           VBOAllocation &vbo_allocation,
+                                           const Vector4f &draw_params,
+                                           const Vector3f &viewpoint)
+{
+    std::uint64_t key = mat.state_key();
+    if (mat.depth_test() && mat.depth_mask()) {
+        key |= depth_key(box, viewpoint);
+    }
+
+    m_sort_entries.push_back(RadixSortEntry{
+                                 key,
+                                 static_cast<std::uint32_t>(m_instructions.size())});
+    m_instructions.emplace_back(box, mode, mat,
+                                ibo_allocation, vbo_allocation,
+                                draw_params);
+}
+
+void PassInfo::render(DrawParamsUBO &draw_params)
 {
     MaterialPass *prev = nullptr;
-    for (PassRenderInstruction &instruction: m_instructions) {
+    auto iter = m_instructions.begin();
+    while (iter != m_instructions.end()) {
+        PassRenderInstruction &instruction = *iter;
         MaterialPass *curr = instruction.material_pass;
         if (curr != prev) {
             if (prev) {
@@ -386,6 +505,25 @@ void PassInfo::render()
             curr->setup();
             prev = curr;
         }
+
+        if (instruction.batched) {
+            std::size_t count = 0;
+            do {
+                draw_params[count++] = iter->draw_params;
+                ++iter;
+            } while (iter != m_instructions.end() &&
+                     count < DrawParamsUBO::length &&
+                     instruction.batches_with(*iter));
+
+            draw_params.bind();
+            draw_params.update_bound(count);
+            draw_elements_instanced_base_vertex(*instruction.ibo_allocation,
+                                                instruction.mode,
+                                                instruction.vbo_allocation->base(),
+                                                count);
+            continue;
+        }
+
         if (instruction.setup) {
             instruction.setup(*curr);
         }
@@ -395,6 +533,7 @@ void PassInfo::render()
         if (instruction.teardown) {
             instruction.teardown(*curr);
         }
+        ++iter;
     }
     if (prev) {
         prev->teardown();
@@ -405,13 +544,22 @@ void PassInfo::render()
 void PassInfo::reset()
 {
     m_instructions.clear();
+    m_sort_entries.clear();
 }
 
 void PassInfo::sort_instructions()
 {
-    std::sort(m_instructions.begin(),
-              m_instructions.end(),
-              [](const PassRenderInstruction &a, const PassRenderInstruction &b){ return a.material_pass->order() < b.material_pass->order(); });
+    radix_sort(m_sort_entries, m_sort_scratch);
+
+    m_sorted.clear();
+    m_sorted.reserve(m_instructions.size());
+    // the entries are kept in sync with the reordered instructions
+    for (RadixSortEntry &entry: m_sort_entries) {
+        m_sorted.emplace_back(std::move(m_instructions[entry.index]));
+        entry.index = m_sorted.size() - 1;
+    }
+    m_instructions.swap(m_sorted);
+    m_sorted.clear();
 }
 
 /* ffe::RenderNode */
@@ -490,7 +638,7 @@ void RenderPass::render(RenderContext &context)
 
     PassInfo &info = context.pass_info(this);
     info.sort_instructions();
-    info.render();
+    info.render(context.draw_params_ubo());
 }
 
 /* ffe::RenderContext */
@@ -522,7 +670,28 @@ void RenderContext::render_pass(const AABB &box,
     PassInfo &info = pass_info(&material_pass.pass());
     info.emplace_instruction(box, mode, material_pass,
                              indices, vertices,
-                             setup, teardown);
+                             setup, teardown,
+                             m_viewpoint);
+}
+
+void RenderContext::render_all_batched(const AABB &box,
+                                       GLint mode,
+                                       Material &material,
+                                       IBOAllocation &indices,
+                                       VBOAllocation &vertices,
+                                       const Vector4f &draw_params)
+{
+    for (auto iter = material.cbegin();
+         iter != material.cend();
+         ++iter)
+    {
+        MaterialPass &material_pass = *iter->second;
+        PassInfo &info = pass_info(&material_pass.pass());
+        info.emplace_batched_instruction(box, mode, material_pass,
+                                         indices, vertices,
+                                         draw_params,
+                                         m_viewpoint);
+    }
 }
 
 PassInfo &RenderContext::pass_info(RenderPass *pass)
@@ -571,6 +740,7 @@ void RenderContext::start_render()
     m_inv_matrix_ubo.bind_at(INV_MATRIX_BLOCK_UBO_SLOT);
     m_matrix_ubo.bind();
     m_matrix_ubo.bind_at(MATRIX_BLOCK_UBO_SLOT);
+    m_draw_params_ubo.bind_at(DRAW_PARAMS_BLOCK_UBO_SLOT);
 }
 
 void RenderContext::configure_shader(ShaderProgram &shader)
@@ -583,6 +753,9 @@ void RenderContext::configure_shader(ShaderProgram &shader)
         shader.check_uniform_block<InvMatrixUBO>("InvMatrixBlock");
         shader.bind_uniform_block("InvMatrixBlock", INV_MATRIX_BLOCK_UBO_SLOT);
     }
+    if (shader.uniform_block_location("DrawParamsBlock") >= 0) {
+        shader.bind_uniform_block("DrawParamsBlock", DRAW_PARAMS_BLOCK_UBO_SLOT);
+    }
 }
 
 /* ffe::RenderGraph */
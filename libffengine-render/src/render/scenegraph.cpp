@@ -23,6 +23,8 @@ the AUTHORS file.
 **********************************************************************/
 #include "ffengine/render/scenegraph.hpp"
 
+#include "ffengine/common/scheduler.hpp"
+
 #include "ffengine/gl/ibo.hpp"
 
 #include "ffengine/io/log.hpp"
@@ -34,6 +36,52 @@ namespace ffe {
 
 static io::Logger &logger = io::logging().get_logger("render.scenegraph");
 
+/**
+ * Call prepare() on \a obj and record the time it took, without the time of
+ * nested timed calls, in the timings of \a context.
+ */
+template <typename object_t>
+static inline void timed_prepare(object_t &obj, RenderContext &context)
+{
+    PrepareTimings &timings = context.prepare_timings();
+    const PrepareTimings::clock::duration outer = timings.begin();
+    const PrepareTimings::clock::time_point t0 = PrepareTimings::clock::now();
+    obj.prepare(context);
+    timings.end(typeid(obj), outer, PrepareTimings::clock::now() - t0);
+}
+
+/* ffe::PrepareTimings */
+
+PrepareTimings::PrepareTimings():
+    m_nested(clock::duration::zero())
+{
+
+}
+
+void PrepareTimings::clear()
+{
+    m_entries.clear();
+    m_nested = clock::duration::zero();
+}
+
+PrepareTimings::clock::duration PrepareTimings::begin()
+{
+    const clock::duration outer = m_nested;
+    m_nested = clock::duration::zero();
+    return outer;
+}
+
+void PrepareTimings::end(const std::type_info &type,
+                         const clock::duration outer,
+                         const clock::duration duration)
+{
+    auto iter = m_entries.emplace(std::type_index(type),
+                                  Entry{0, clock::duration::zero()}).first;
+    iter->second.calls += 1;
+    iter->second.total += duration - m_nested;
+    m_nested = outer + duration;
+}
+
 namespace scenegraph {
 
 Node::Node()
@@ -132,7 +180,7 @@ void Group::render(RenderContext &context)
 void Group::prepare(RenderContext &context)
 {
     for (Node *child: m_to_render) {
-        child->prepare(context);
+        timed_prepare(*child, context);
     }
 }
 
@@ -237,7 +285,7 @@ void ParentNode::prepare(RenderContext &context)
 {
     if (m_child_to_render)
     {
-        m_child_to_render->prepare(context);
+        timed_prepare(*m_child_to_render, context);
     }
 }
 
@@ -464,7 +512,8 @@ void OctreeGroup::advance(TimeInterval seconds)
 void OctreeGroup::prepare(RenderContext &context)
 {
     m_hitset.clear();
-    m_octree.select_nodes_by_frustum(context.frustum(), m_hitset);
+    m_octree.select_nodes_by_frustum(context.frustum(), m_hitset,
+                                     ffe::scheduler());
 
     std::vector<RenderableOctreeObject*> &to_render = m_to_render[&context];
     to_render.clear();
@@ -485,7 +534,7 @@ void OctreeGroup::prepare(RenderContext &context)
             assert(renderable);
 #endif
             to_render.push_back(renderable);
-            renderable->prepare(context);
+            timed_prepare(*renderable, context);
         }
     }
     m_selected_objects = to_render.size();
@@ -518,7 +567,8 @@ SceneGraph::SceneGraph():
 
 void SceneGraph::prepare(RenderContext &context)
 {
-    m_root.prepare(context);
+    context.prepare_timings().clear();
+    timed_prepare(m_root, context);
 }
 
 void SceneGraph::render(RenderContext &context)
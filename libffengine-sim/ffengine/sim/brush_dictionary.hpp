@@ -0,0 +1,141 @@
+/**********************************************************************
+File name: brush_dictionary.hpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#ifndef SCC_SIM_BRUSH_DICTIONARY_H
+#define SCC_SIM_BRUSH_DICTIONARY_H
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace sim {
+
+/**
+ * Immutable density map of a brush, shared between all operations using the
+ * brush.
+ */
+typedef std::shared_ptr<const std::vector<float> > SharedDensityMap;
+
+typedef std::uint32_t BrushID;
+
+
+/**
+ * Interned, immutable brush density maps, addressed by an ID.
+ *
+ * Clients register a brush once and refer to it by its ID in subsequent
+ * strokes, instead of sending the density map with each stroke. Registering
+ * a density map which is already known returns the existing ID.
+ *
+ * When the dictionary is full, registering a new brush evicts the least
+ * recently used one (registrations and lookups count as use), so that no
+ * client can lock the others out by filling the dictionary. A command
+ * referring to an evicted brush fails to resolve, and the client has to
+ * register the brush again. Operations which already resolved the brush keep
+ * its density map alive.
+ *
+ * The BrushDictionary is thread-safe.
+ */
+class BrushDictionary
+{
+public:
+    /**
+     * ID which is never assigned to a brush.
+     */
+    static constexpr BrushID INVALID_BRUSH_ID = 0;
+
+    /**
+     * Maximum number of brushes kept; further registrations evict the least
+     * recently used brush.
+     */
+    static constexpr std::size_t MAX_BRUSHES = 4096;
+
+    /**
+     * Maximum edge length of a brush.
+     */
+    static constexpr unsigned int MAX_BRUSH_SIZE = 1024;
+
+    struct Brush
+    {
+        unsigned int size;
+        SharedDensityMap density_map;
+    };
+
+public:
+    BrushDictionary();
+
+private:
+    struct Entry
+    {
+        Brush brush;
+        std::size_t hash;
+        /**
+         * Position in m_lru.
+         */
+        std::list<BrushID>::iterator lru_pos;
+    };
+
+    /* guarded by m_mutex */
+    mutable std::mutex m_mutex;
+    BrushID m_next_id;
+    std::unordered_map<BrushID, Entry> m_brushes;
+    std::unordered_multimap<std::size_t, BrushID> m_ids_by_hash;
+    /**
+     * IDs of all brushes, most recently used first.
+     */
+    mutable std::list<BrushID> m_lru;
+
+private:
+    void evict_lru();
+    void touch(const Entry &entry) const;
+
+public:
+    /**
+     * Register a brush.
+     *
+     * @param size Edge length of the brush.
+     * @param density_map Density values of the brush; must have \a size
+     * times \a size entries.
+     * @return The ID of the brush, or INVALID_BRUSH_ID if the brush is
+     * invalid.
+     */
+    BrushID intern(const unsigned int size, std::vector<float> &&density_map);
+
+    /**
+     * Look up a brush by its ID.
+     *
+     * @param id ID of the brush.
+     * @param dest Brush to store the result in.
+     * @return true if the brush was found, false otherwise.
+     */
+    bool lookup(const BrushID id, Brush &dest) const;
+
+    std::size_t size() const;
+
+};
+
+}
+
+#endif
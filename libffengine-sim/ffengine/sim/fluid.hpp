@@ -104,6 +104,9 @@ private:
     sigc::connection m_terrain_update_conn;
 
 private:
+    /**
+     * The caller must hold FluidBlocks::read_frontbuffer().
+     */
     void copy_from_block(Vector4f *dest,
                          const sim::FluidBlock &src,
                          const unsigned int x0,
@@ -240,6 +243,16 @@ public:
      */
     void reset();
 
+    /**
+     * Change the number of simulation steps run per start().
+     *
+     * The change takes effect with the next frame. This method is
+     * thread-safe.
+     *
+     * @see FluidStepConfig
+     */
+    void set_step_config(const FluidStepConfig &config);
+
 public:
     /**
      * @name Extracting data rects
@@ -254,7 +267,9 @@ public:
      * being, from x to w: terrain height, fluid height, flow x, flow y.
      *
      * This function must not be called concurrently with start(), but it is
-     * safe to use after start has returned.
+     * safe to use after start has returned. It holds
+     * FluidBlocks::read_frontbuffer() while copying, because the simulation
+     * may collapse, expand or swap blocks at any time.
      *
      * @param dest Pointer to the first element to write.
      * @param x0 The start x coordinate
@@ -24,14 +24,42 @@ the AUTHORS file.
 #ifndef SCC_SIM_FLUID_BASE_H
 #define SCC_SIM_FLUID_BASE_H
 
+#include <cassert>
+#include <chrono>
+#include <mutex>
 #include <shared_mutex>
 #include <vector>
 
+#include "ffengine/sim/fluid_precision.hpp"
 #include "ffengine/sim/terrain.hpp"
 
 namespace sim {
 
-typedef float FluidFloat;
+/**
+ * Configuration of the number of simulation steps run per fluid frame.
+ */
+struct FluidStepConfig
+{
+    FluidStepConfig();
+
+    /**
+     * Number of steps run back-to-back per frame. In adaptive mode, this is
+     * the maximum number of steps per frame.
+     */
+    unsigned int substeps;
+
+    /**
+     * If true, the number of steps per frame is reduced while frames take
+     * longer than frame_budget, and increased again while there is time to
+     * spare.
+     */
+    bool adaptive;
+
+    /**
+     * Wall clock time available for one frame in adaptive mode.
+     */
+    std::chrono::microseconds frame_budget;
+};
 
 
 class IFluidSim
@@ -111,6 +139,17 @@ public:
      */
     virtual void set_ocean_level(const FluidFloat level) = 0;
 
+    /**
+     * Change the number of simulation steps run per frame.
+     *
+     * The change is queued until the next frame starts.
+     *
+     * This method is thread-safe, but not neccessarily reentrant.
+     *
+     * @param config
+     */
+    virtual void set_step_config(const FluidStepConfig &config) = 0;
+
     /**
      * Wait until the previously started frame has completed.
      *
@@ -147,9 +186,23 @@ struct FluidCellMeta
 };
 
 
-struct FluidCell
+/**
+ * Fluid state of a single cell.
+ *
+ * @param storage_t Type used to store the values. Computations on the
+ * values are done in FluidFloat.
+ */
+template <typename storage_t>
+struct GenericFluidCell
 {
-    FluidCell();
+    typedef storage_t storage_type;
+
+    GenericFluidCell():
+        fluid_height(0.f),
+        fluid_flow{0.f, 0.f}
+    {
+
+    }
 
     /**
      * Height of the fluid *above* the terrain in the cell. Thus, a cell with
@@ -158,18 +211,18 @@ struct FluidCell
      *
      * The fluid and terrain heights are in Length Units (LU).
      */
-    FluidFloat fluid_height;
+    storage_t fluid_height;
 
     /**
      * Fluid flow in the cell.
      *
      * The flow is in units of Length Unit / Time Unit.
      */
-    FluidFloat fluid_flow[2];
+    storage_t fluid_flow[2];
 
     inline bool wet() const
     {
-        return fluid_height > 1e-5;
+        return FluidFloat(fluid_height) > 1e-5;
     }
 
 };
@@ -228,6 +281,12 @@ public:
     static const FluidFloat REACTIVATION_THRESHOLD;
     static const FluidFloat CHANGE_TRANSFER_FACTOR;
 
+    /**
+     * Maximum deviation of fluid height and flow of any cell from the proxy
+     * value for a block to be collapsed.
+     */
+    static const FluidFloat COLLAPSE_TOLERANCE;
+
 public:
     FluidBlock(const unsigned int x,
                const unsigned int y);
@@ -243,6 +302,20 @@ private:
     std::vector<FluidCell> m_back_cells;
     std::vector<FluidCell> m_front_cells;
 
+    /**
+     * If true, the cell buffers are released and all cells are described by
+     * m_proxy_absolute_height.
+     */
+    bool m_collapsed;
+
+    /**
+     * Whether try_collapse() has already been called since the last change
+     * of the block.
+     */
+    bool m_collapse_checked;
+
+    FluidFloat m_proxy_absolute_height;
+
 public:
     inline unsigned int x() const
     {
@@ -257,21 +330,37 @@ public:
     inline FluidCell *local_cell_back(const unsigned int x,
                                       const unsigned int y)
     {
+        assert(!m_collapsed);
         return &m_back_cells[y*IFluidSim::block_size+x];
     }
 
     inline FluidCell *local_cell_front(const unsigned int x,
                                        const unsigned int y)
     {
+        assert(!m_collapsed);
         return &m_front_cells[y*IFluidSim::block_size+x];
     }
 
     inline const FluidCell *local_cell_front(const unsigned int x,
                                              const unsigned int y) const
     {
+        assert(!m_collapsed);
         return &m_front_cells[y*IFluidSim::block_size+x];
     }
 
+    /**
+     * Return a copy of a front buffer cell. Unlike local_cell_front(), this
+     * can also be used on collapsed blocks.
+     */
+    inline FluidCell local_cell_front_value(const unsigned int x,
+                                            const unsigned int y) const
+    {
+        if (m_collapsed) {
+            return proxy_cell(x, y);
+        }
+        return m_front_cells[y*IFluidSim::block_size+x];
+    }
+
     inline FluidCellMeta *local_cell_meta(const unsigned int x,
                                        const unsigned int y)
     {
@@ -317,14 +406,88 @@ public:
 
     inline void swap_buffers()
     {
+        assert(!m_collapsed);
         m_back_cells.swap(m_front_cells);
         *m_front_meta = *m_back_meta;
+        m_collapse_checked = false;
+    }
+
+    /**
+     * Whether the block is collapsed into a single-value proxy. The cell
+     * buffers of collapsed blocks must not be accessed, except through
+     * local_cell_front_value().
+     */
+    inline bool collapsed() const
+    {
+        return m_collapsed;
+    }
+
+    /**
+     * The cell as described by the proxy of a collapsed block: the fluid
+     * fills the block up to the proxy height, without any flow.
+     */
+    inline FluidCell proxy_cell(const unsigned int x,
+                                const unsigned int y) const
+    {
+        FluidCell result;
+        result.fluid_height = std::max(
+                    FluidFloat(0),
+                    m_proxy_absolute_height - local_cell_meta(x, y)->terrain_height);
+        return result;
     }
 
+    /**
+     * Collapse the block into a single-value proxy and release the cell
+     * buffers, if the block is inactive and the proxy describes all cells
+     * within COLLAPSE_TOLERANCE.
+     *
+     * The check is only done once until the block is swapped or expanded
+     * again.
+     *
+     * @return true if the block is collapsed.
+     */
+    bool try_collapse();
+
+    /**
+     * Restore the cell buffers of a collapsed block from the proxy. Does
+     * nothing if the block is not collapsed.
+     */
+    void expand();
+
     void reset(const float ocean_level);
 };
 
 
+/**
+ * Number of blocks in each scheduling class during a fluid frame.
+ */
+struct FluidBlockCounts
+{
+    FluidBlockCounts();
+
+    /**
+     * Blocks which are actively simulated.
+     */
+    unsigned int active;
+
+    /**
+     * Inactive blocks which are adjacent to at least one active block; only
+     * their seams are checked for reactivation.
+     */
+    unsigned int frontier;
+
+    /**
+     * Inactive blocks without active neighbours, which are skipped entirely.
+     */
+    unsigned int idle;
+
+    /**
+     * Idle blocks which are collapsed into a proxy.
+     */
+    unsigned int collapsed;
+};
+
+
 struct FluidBlocks
 {
 public:
@@ -335,8 +498,29 @@ private:
     const unsigned int m_cells_per_axis;
     std::vector<FluidBlock> m_blocks;
 
+    /**
+     * Number of active four-neighbours of each block, based on the front
+     * meta. This is updated whenever a block changes its activity in
+     * swap_active_blocks().
+     */
+    std::vector<uint8_t> m_active_neighbours;
+
+    /* rebuilt by swap_active_blocks() */
+    std::vector<FluidBlock*> m_active_blocks;
+    std::vector<FluidBlock*> m_frontier_blocks;
+    FluidBlockCounts m_counts;
+
     mutable std::shared_timed_mutex m_frontbuffer_mutex;
 
+private:
+    void add_active_neighbour(const unsigned int blockx,
+                              const unsigned int blocky,
+                              const int delta);
+    void recount_active_neighbours();
+    bool has_active_diagonal(const unsigned int blockx,
+                             const unsigned int blocky) const;
+    void rebuild_work_lists();
+
 public:
     inline unsigned int blocks_per_axis() const
     {
@@ -368,6 +552,14 @@ public:
         return block(blockx, blocky);
     }
 
+    inline const FluidBlock *block_for_cell(const unsigned int cellx,
+                                            const unsigned int celly) const
+    {
+        const unsigned int blockx = cellx / IFluidSim::block_size;
+        const unsigned int blocky = celly / IFluidSim::block_size;
+        return block(blockx, blocky);
+    }
+
     inline FluidCell *cell_back(const unsigned int x, const unsigned int y)
     {
         const unsigned int blockx = x / IFluidSim::block_size;
@@ -413,6 +605,26 @@ public:
         return cell_front(clamped_x, clamped_y);
     }
 
+    /**
+     * Return a copy of a front buffer cell, clamping the coordinates to the
+     * valid range. This can also be used on collapsed blocks.
+     */
+    inline FluidCell clamped_cell_front_value(const int x,
+                                              const int y) const
+    {
+        unsigned int clamped_x = 0;
+        unsigned int clamped_y = 0;
+        if (x >= 0) {
+            clamped_x = std::min((unsigned int)x, m_cells_per_axis-1);
+        }
+        if (y >= 0) {
+            clamped_y = std::min((unsigned int)y, m_cells_per_axis-1);
+        }
+        return block_for_cell(clamped_x, clamped_y)->local_cell_front_value(
+                    clamped_x % IFluidSim::block_size,
+                    clamped_y % IFluidSim::block_size);
+    }
+
     inline FluidCellMeta *cell_meta(const unsigned int x, const unsigned int y)
     {
         const unsigned int blockx = x / IFluidSim::block_size;
@@ -508,26 +720,80 @@ public:
         }
     }
 
-    inline void swap_active_blocks()
+    /**
+     * Swap the buffers of all blocks which are or were active and rebuild
+     * the lists of active and frontier blocks.
+     */
+    void swap_active_blocks();
+
+    /**
+     * Blocks which are active in the current frame.
+     *
+     * Only valid between swap_active_blocks() calls.
+     */
+    inline const std::vector<FluidBlock*> &active_blocks() const
     {
-        // we need to hold the frontbuffer lock to be safe -- this will ensure
-        // that no user who is accessing the frontbuffer will suddenly be using
-        // the backbuffer
-        std::unique_lock<std::shared_timed_mutex> lock(m_frontbuffer_mutex);
-        for (FluidBlock &block: m_blocks)
-        {
-            if (block.back_meta().active || block.front_meta().active)
-            {
-                block.swap_buffers();
-            }
-        }
+        return m_active_blocks;
+    }
+
+    /**
+     * Inactive blocks in the current frame which have at least one active
+     * four-neighbour.
+     *
+     * Only valid between swap_active_blocks() calls.
+     */
+    inline const std::vector<FluidBlock*> &frontier_blocks() const
+    {
+        return m_frontier_blocks;
+    }
+
+    /**
+     * Block counts of the current frame, as determined by the last call to
+     * swap_active_blocks().
+     */
+    inline const FluidBlockCounts &block_counts() const
+    {
+        return m_counts;
     }
 
+    /**
+     * Lock the front buffers for reading.
+     *
+     * Everything outside of the simulation which reads front cells or front
+     * meta must hold this lock: swap_active_blocks(), expand_all(),
+     * expand_cells() and reset() swap, free or reallocate the cell storage
+     * of blocks and may run on the simulation thread at any time.
+     */
     inline std::shared_lock<std::shared_timed_mutex> read_frontbuffer() const
     {
         return std::shared_lock<std::shared_timed_mutex>(m_frontbuffer_mutex);
     }
 
+    /**
+     * Lock the front buffers for writing.
+     *
+     * Writers outside of the simulation which modify front cells must hold
+     * this lock. expand_all(), expand_cells() and reset() take it
+     * themselves and must not be called while it is held; use
+     * FluidBlock::expand() instead.
+     */
+    inline std::unique_lock<std::shared_timed_mutex> write_frontbuffer()
+    {
+        return std::unique_lock<std::shared_timed_mutex>(m_frontbuffer_mutex);
+    }
+
+    /**
+     * Expand all collapsed blocks.
+     */
+    void expand_all();
+
+    /**
+     * Expand all collapsed blocks which overlap the given rectangle of
+     * cells. This must be called before writing to cells outside of the
+     * simulation.
+     */
+    void expand_cells(const TerrainRect &cells);
+
     void reset(const float ocean_level);
 };
 
@@ -25,27 +25,141 @@ the AUTHORS file.
 #define SCC_SIM_FLUID_NATIVE_H
 
 #include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <thread>
 
+#include "ffengine/common/barrier.hpp"
+#include "ffengine/common/scheduler.hpp"
+
 #include "ffengine/sim/fluid_base.hpp"
+#include "ffengine/sim/fluid_tile.hpp"
 
 namespace sim {
 
+/**
+ * Implementation of the per-block update used by NativeFluidSim.
+ */
+enum class FluidKernel
+{
+    /**
+     * Update cell by cell on the array-of-structs block layout, looking up
+     * the neighbourhood of each cell.
+     */
+    SCALAR,
+
+    /**
+     * Copy each block together with the seams of its neighbours into a
+     * padded FluidTile and run a branch-free stencil over it, one cell at a
+     * time. This avoids the per-cell neighbourhood lookups of SCALAR and is
+     * supported on all targets.
+     */
+    HALO,
+
+    /**
+     * Like HALO, but compute whole rows using SSE2 or AVX2, whichever is
+     * supported. Falls back to HALO if no vectorised kernel is available.
+     */
+    SIMD
+};
+
+
+/**
+ * How NativeFluidSim distributes the blocks of a frame to threads.
+ */
+enum class FluidDispatch
+{
+    /**
+     * Submit chunks of blocks to the engine-wide task scheduler.
+     */
+    SCHEDULER,
+
+    /**
+     * Use dedicated worker threads which wait for a frame epoch counter to
+     * change and meet at a SpinBarrier at the end of the frame. No mutex is
+     * taken for dispatching.
+     *
+     * Unless the number of dedicated threads is passed to NativeFluidSim,
+     * they only use the cores not covered by the engine-wide scheduler, so
+     * this mode is meant to be combined with a pool which has been reduced
+     * with ffe::configure_scheduler(). If no core is left for a dedicated
+     * thread, SCHEDULER is used instead.
+     */
+    EPOCH
+};
+
+
+/**
+ * Timings of the dispatch of a single fluid frame, summed over all steps of
+ * the frame.
+ */
+struct FluidFrameTimings
+{
+    FluidFrameTimings();
+
+    /**
+     * Time from publishing the frame to the workers until the first block
+     * update started.
+     */
+    std::chrono::nanoseconds dispatch;
+
+    /**
+     * Time from the start of the first block update until the end of the
+     * last block update.
+     */
+    std::chrono::nanoseconds work;
+
+    /**
+     * Time from the end of the last block update until the coordinator
+     * resumed.
+     */
+    std::chrono::nanoseconds drain;
+
+    inline std::chrono::nanoseconds sync_overhead() const
+    {
+        return dispatch + drain;
+    }
+};
+
+
 class NativeFluidSim: public IFluidSim
 {
 public:
+    /**
+     * @param epoch_workers Number of dedicated threads for
+     * FluidDispatch::EPOCH, in addition to the coordinator. Zero picks the
+     * number of cores left over by the engine-wide scheduler.
+     */
     NativeFluidSim(FluidBlocks &blocks,
-                   const Terrain &terrain);
+                   const Terrain &terrain,
+                   const FluidKernel kernel = FluidKernel::SCALAR,
+                   const FluidDispatch dispatch = FluidDispatch::SCHEDULER,
+                   const unsigned int epoch_workers = 0);
     ~NativeFluidSim() override;
 
+private:
+    struct BlockStats;
+
 private:
     FluidBlocks &m_blocks;
     const Terrain &m_terrain;
-    const unsigned int m_worker_count;
+    ffe::TaskScheduler &m_scheduler;
+    const FluidTileKernel m_tile_kernel;
+    const FluidKernel m_kernel;
+    const unsigned int m_epoch_workers;
+    const FluidDispatch m_dispatch;
 
     /* guarded by m_terrain_update_mutex */
     std::mutex m_terrain_update_mutex;
-    TerrainRect m_terrain_update;
+    /**
+     * One flag per block, set if the terrain of the block needs to be
+     * synced.
+     */
+    std::vector<std::uint8_t> m_terrain_dirty;
+    /**
+     * Indices of the blocks whose flag in m_terrain_dirty is set.
+     */
+    std::vector<unsigned int> m_terrain_dirty_blocks;
 
     /* guarded by m_ocean_level_update_mutex */
     std::mutex m_ocean_level_update_mutex;
@@ -56,51 +170,128 @@ private:
     std::mutex m_control_mutex;
     std::condition_variable m_control_wakeup;
     bool m_run;
+    FluidStepConfig m_step_config;
 
     /* guarded by m_done_mutex */
     std::mutex m_done_mutex;
     std::condition_variable m_done_wakeup;
     bool m_done;
 
-    /* guarded by m_worker_task_mutex */
-    std::mutex m_worker_task_mutex;
-    std::condition_variable m_worker_wakeup;
-    unsigned int m_worker_to_start;
-    bool m_worker_terminate;
-
-    /* guarded by m_worker_done_mutex */
-    std::mutex m_worker_done_mutex;
-    std::condition_variable m_worker_done_wakeup;
-    unsigned int m_worker_stopped;
+    /* guarded by m_tile_pool_mutex */
+    std::mutex m_tile_pool_mutex;
+    std::vector<std::unique_ptr<FluidTile> > m_tile_pool;
 
     /* atomic */
-    std::atomic<unsigned int> m_worker_block_ctr;
     std::atomic_bool m_terminated;
+    std::atomic<std::int64_t> m_first_work_start;
+    std::atomic<std::int64_t> m_last_work_end;
+
+    /* used by FluidDispatch::EPOCH */
+    std::atomic<std::uint32_t> m_frame_epoch;
+    std::atomic<std::uint32_t> m_frame_epoch_sleepers;
+    std::atomic<unsigned int> m_worker_block_ctr;
+    unsigned int m_worker_block_count;
+    std::unique_ptr<ffe::SpinBarrier> m_frame_barrier;
+    std::vector<std::thread> m_worker_threads;
 
     std::thread m_coordinator_thread;
 
     /* owned by m_coordinator_thread */
-    std::vector<std::thread> m_worker_threads;
     FluidFloat m_ocean_level;
     bool m_ocean_level_changed;
+    std::vector<unsigned int> m_terrain_sync_blocks;
+    FluidFrameTimings m_last_frame_timings;
+    std::chrono::nanoseconds m_last_frame_duration;
+    unsigned int m_last_frame_steps;
+    unsigned int m_adaptive_steps;
+    std::chrono::steady_clock::time_point m_report_start;
+    unsigned int m_report_frames;
+    unsigned int m_report_steps;
 
 protected:
     void coordinator_impl();
     void coordinator_run_workers();
+    unsigned int coordinator_adapt_steps(const FluidStepConfig &config,
+                                         const unsigned int steps,
+                                         const std::chrono::nanoseconds duration);
+    void coordinator_report_steps(const FluidStepConfig &config,
+                                  const unsigned int steps);
+    void dispatch_scheduler(const unsigned int block_count);
+    void dispatch_epoch(const unsigned int block_count);
+    void note_work_start();
+    void note_work_end();
+    void run_claimed_blocks(FluidTile *tile);
+    void worker_impl();
 
-    void sync_terrain(TerrainRect rect);
+    void sync_terrain();
+    void sync_terrain_block(FluidBlock &block);
 
-    void update_active_block(FluidBlock &block);
+    void update_active_block(FluidBlock &block, FluidTile *tile);
+    void update_active_block_scalar(FluidBlock &block, BlockStats &stats);
+    void update_active_block_tile(FluidBlock &block, FluidTile &tile,
+                                  BlockStats &stats);
     void update_inactive_block(FluidBlock &block);
+    void update_block(const unsigned int index, FluidTile *tile);
 
-    void worker_impl();
+    std::unique_ptr<FluidTile> acquire_tile();
+    void release_tile(std::unique_ptr<FluidTile> &&tile);
 
 public:
     void start_frame() override;
     void terrain_update(TerrainRect r) override;
     void set_ocean_level(const FluidFloat level) override;
+    void set_step_config(const FluidStepConfig &config) override;
     void wait_for_frame() override;
 
+public:
+    /**
+     * The kernel which is actually used. This may differ from the kernel
+     * requested at construction time if the requested kernel is not
+     * supported.
+     */
+    inline FluidKernel kernel() const
+    {
+        return m_kernel;
+    }
+
+    /**
+     * The dispatch mode which is actually used. This may differ from the
+     * mode requested at construction time if no core is left for
+     * FluidDispatch::EPOCH.
+     */
+    inline FluidDispatch dispatch() const
+    {
+        return m_dispatch;
+    }
+
+    /**
+     * Timings of the last completed frame. Only valid between a call to
+     * wait_for_frame() and the next call to start_frame().
+     */
+    inline const FluidFrameTimings &last_frame_timings() const
+    {
+        return m_last_frame_timings;
+    }
+
+    /**
+     * Number of steps run in the last completed frame. Only valid between a
+     * call to wait_for_frame() and the next call to start_frame().
+     */
+    inline unsigned int last_frame_steps() const
+    {
+        return m_last_frame_steps;
+    }
+
+    /**
+     * Wall clock time taken by the last completed frame, excluding the time
+     * waiting for start_frame(). Only valid between a call to
+     * wait_for_frame() and the next call to start_frame().
+     */
+    inline std::chrono::nanoseconds last_frame_duration() const
+    {
+        return m_last_frame_duration;
+    }
+
 };
 
 }
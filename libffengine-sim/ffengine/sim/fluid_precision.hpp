@@ -0,0 +1,71 @@
+/**********************************************************************
+File name: fluid_precision.hpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#ifndef SCC_SIM_FLUID_PRECISION_H
+#define SCC_SIM_FLUID_PRECISION_H
+
+#include "ffengine/math/half.hpp"
+
+namespace sim {
+
+/**
+ * @name Fluid precision
+ *
+ * The precision of the fluid simulation is selected at build time, using
+ * the FFENGINE_FLUID_PRECISION CMake option:
+ *
+ * * `single` (default): cells are stored and computed in float.
+ * * `double`: cells are stored and computed in double. The tile kernels
+ *   only support float and are not available.
+ * * `half`: cells are stored as Half and computed in float, halving the
+ *   memory bandwidth needed per cell.
+ */
+
+/**@{*/
+
+#if defined(FFENGINE_FLUID_DOUBLE)
+typedef double FluidFloat;
+typedef double FluidStorageFloat;
+#elif defined(FFENGINE_FLUID_HALF)
+typedef float FluidFloat;
+typedef Half FluidStorageFloat;
+#else
+typedef float FluidFloat;
+typedef float FluidStorageFloat;
+#endif
+
+/**
+ * Name of the fluid precision selected at build time.
+ */
+extern const char *const fluid_precision_name;
+
+/**@}*/
+
+template <typename storage_t>
+struct GenericFluidCell;
+
+typedef GenericFluidCell<FluidStorageFloat> FluidCell;
+
+}
+
+#endif
@@ -0,0 +1,161 @@
+/**********************************************************************
+File name: fluid_tile.hpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#ifndef SCC_SIM_FLUID_TILE_H
+#define SCC_SIM_FLUID_TILE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "ffengine/sim/fluid_base.hpp"
+
+namespace sim {
+
+/**
+ * Structure-of-arrays copy of a single fluid block, padded with a one-cell
+ * halo which holds the adjacent cells of the neighbouring blocks.
+ *
+ * The tile is used as scratch space by the tile fluid kernels: the
+ * front buffer of a block and its seams are loaded into the tile, the kernel
+ * computes whole rows of the new state into the output planes and the result
+ * is then written back into the back buffer of the block.
+ *
+ * Cell (x, y) of the block lives at index (y+1)*row_stride()+(x+1) in each
+ * plane. Rows are padded so that a kernel may compute lanes() cells per row,
+ * which may be more than IFluidSim::block_size; the results for the excess
+ * lanes are garbage and must be ignored.
+ *
+ * The planes are always single precision, independent of FluidFloat and
+ * FluidStorageFloat; values are converted when loading and storing.
+ */
+class FluidTile
+{
+public:
+    FluidTile();
+    FluidTile(const FluidTile &ref) = delete;
+    FluidTile &operator=(const FluidTile &ref) = delete;
+
+private:
+    const unsigned int m_lanes;
+    const unsigned int m_row_stride;
+    const unsigned int m_plane_size;
+
+    std::vector<float> m_storage;
+
+public:
+    /* input planes */
+    float *const fluid_height;
+    float *const fluid_flow_x;
+    float *const fluid_flow_y;
+    float *const terrain_height;
+    float *const source_height;
+    float *const source_capacity;
+
+    /* output planes */
+    float *const new_fluid_height;
+    float *const new_fluid_flow_x;
+    float *const new_fluid_flow_y;
+
+    /**
+     * Per-column lane masks (all bits set or all bits cleared) which tell
+     * whether the cell in that column has a left or right neighbour,
+     * respectively. Column x of the block is at index x.
+     */
+    std::vector<uint32_t> left_valid;
+    std::vector<uint32_t> right_valid;
+
+    /**
+     * Whether the first row has a top neighbour and whether the last row has
+     * a bottom neighbour.
+     */
+    bool top_valid;
+    bool bottom_valid;
+
+public:
+    /**
+     * Number of cells per row computed by the kernels. This is
+     * IFluidSim::block_size, rounded up to a multiple of the widest vector
+     * width supported.
+     */
+    inline unsigned int lanes() const
+    {
+        return m_lanes;
+    }
+
+    inline unsigned int row_stride() const
+    {
+        return m_row_stride;
+    }
+
+    inline unsigned int index(const unsigned int x, const unsigned int y) const
+    {
+        return (y+1)*m_row_stride+(x+1);
+    }
+
+public:
+    /**
+     * Load the front buffer of \a block and the seams of its neighbours into
+     * the tile.
+     *
+     * @param blocks The fluid blocks \a block belongs to.
+     * @param block The block to load.
+     */
+    void load(const FluidBlocks &blocks, const FluidBlock &block);
+
+};
+
+
+typedef void (*FluidTileKernel)(FluidTile &tile,
+                                const FluidFloat ocean_level);
+
+/**
+ * Portable implementation of the fluid kernel, computing one cell at a time.
+ * It shares the branch-free code with the vectorised kernels and is
+ * available on all targets.
+ */
+void fluid_tile_step_portable(FluidTile &tile, const FluidFloat ocean_level);
+
+/**
+ * SSE2 implementation of the fluid kernel. This is only available on x86
+ * targets.
+ */
+void fluid_tile_step_sse2(FluidTile &tile, const FluidFloat ocean_level);
+
+/**
+ * AVX2 implementation of the fluid kernel. This is only available if the
+ * compiler supports AVX2; the CPU support must be checked at runtime.
+ */
+void fluid_tile_step_avx2(FluidTile &tile, const FluidFloat ocean_level);
+
+/**
+ * Select the best vectorised fluid kernel supported by the compiler and the
+ * CPU.
+ *
+ * @return The kernel function or nullptr if no vectorised kernel is
+ * available.
+ */
+FluidTileKernel select_fluid_tile_kernel();
+
+}
+
+#endif
@@ -0,0 +1,291 @@
+/**********************************************************************
+File name: fluid_tile_kernel.inc.hpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+/*
+ * Generic row kernel for the fluid simulation, operating on a FluidTile.
+ *
+ * This file is included by the translation units which implement the kernel
+ * for a specific instruction set. Before including it, they have to define a
+ * vector traits type which provides the operations used below; see
+ * fluid_tile.cpp for an example. Everything in here must have internal
+ * linkage, as the including translation units may enable different
+ * instruction sets for it.
+ *
+ * The kernel must compute exactly the same values as the scalar
+ * implementation in fluid_native.cpp. In particular, the argument order of
+ * min/max, the order of operations and the treatment of signed zeros match
+ * the scalar code.
+ */
+
+#include <cmath>
+#include <limits>
+
+namespace sim {
+namespace {
+
+/**
+ * Return the largest float which is strictly less than \a threshold. For a
+ * float v, v < threshold is equivalent to v <= float_below(threshold).
+ */
+inline float float_below(const double threshold)
+{
+    float result = threshold;
+    while (double(result) >= threshold) {
+        result = std::nextafter(result, -std::numeric_limits<float>::infinity());
+    }
+    return result;
+}
+
+/**
+ * Return the smallest float which is strictly greater than \a threshold. For
+ * a float v, v > threshold is equivalent to v >= float_above(threshold).
+ */
+inline float float_above(const double threshold)
+{
+    float result = threshold;
+    while (double(result) <= threshold) {
+        result = std::nextafter(result, std::numeric_limits<float>::infinity());
+    }
+    return result;
+}
+
+template <typename V>
+struct FluidTileKernelConstants
+{
+    FluidTileKernelConstants():
+        zero(V::set1(0.f)),
+        quarter_divisor(V::set1(4.f)),
+        damping(V::set1(IFluidSim::flow_damping)),
+        one_minus_damping(V::set1(FluidFloat(1.0) - IFluidSim::flow_damping)),
+        friction(V::set1(IFluidSim::flow_friction)),
+        min_height(V::set1(float_below(1e-6))),
+        min_flow_out(V::set1(float_below(1e-4))),
+        min_flow_in(V::set1(float_above(-1e-4))),
+        all_set(V::all_set())
+    {
+
+    }
+
+    const typename V::vec zero;
+    const typename V::vec quarter_divisor;
+    const typename V::vec damping;
+    const typename V::vec one_minus_damping;
+    const typename V::vec friction;
+    const typename V::vec min_height;
+    const typename V::vec min_flow_out;
+    const typename V::vec min_flow_in;
+    const typename V::vec all_set;
+};
+
+/**
+ * Vectorised equivalent of flow<dir, flow_sign>() in fluid_native.cpp.
+ *
+ * @param height Fluid height of the cells.
+ * @param terrain Terrain height of the cells.
+ * @param neigh_height Fluid height of the neighbouring cells.
+ * @param neigh_terrain Terrain height of the neighbouring cells.
+ * @param signed_source Flow of the flow source, already multiplied with the
+ * flow sign.
+ * @param applied Receives the mask of lanes for which the flow has to be
+ * subtracted from the fluid height.
+ * @return The applicable flow.
+ */
+template <typename V>
+inline typename V::vec tile_flow(
+        const FluidTileKernelConstants<V> &c,
+        const typename V::vec height,
+        const typename V::vec terrain,
+        const typename V::vec neigh_height,
+        const typename V::vec neigh_terrain,
+        const typename V::vec signed_source,
+        typename V::vec &applied)
+{
+    typedef typename V::vec vec;
+
+    const vec dheight = V::sub(height, neigh_height);
+    const vec dterrain_height = V::sub(terrain, neigh_terrain);
+    const vec height_flow = V::mul(V::add(dheight, dterrain_height), c.friction);
+
+    const vec flow = V::add(V::mul(signed_source, c.damping),
+                            V::mul(height_flow, c.one_minus_damping));
+
+    // clamp(flow, -neigh_height / 4, height / 4)
+    const vec applicable_flow = V::max(
+                V::div(V::neg(neigh_height), c.quarter_divisor),
+                V::min(V::div(height, c.quarter_divisor), flow));
+
+    // we can’t go up there
+    const vec uphill_out = V::and_(
+                V::cmpgt(applicable_flow, c.zero),
+                V::cmplt(V::add(height, terrain), neigh_terrain));
+    // it can’t go up here
+    const vec uphill_in = V::and_(
+                V::cmplt(applicable_flow, c.zero),
+                V::cmpgt(terrain, V::add(neigh_height, neigh_terrain)));
+    // minimum height for fluid
+    const vec dry_out = V::and_(
+                V::cmple(neigh_height, c.min_height),
+                V::cmple(applicable_flow, c.min_flow_out));
+    const vec dry_in = V::and_(
+                V::cmple(height, c.min_height),
+                V::cmpge(applicable_flow, c.min_flow_in));
+
+    applied = V::andnot(V::or_(V::or_(uphill_out, uphill_in),
+                               V::or_(dry_out, dry_in)),
+                        c.all_set);
+
+    return applicable_flow;
+}
+
+template <typename V>
+inline typename V::vec tile_clamp_negative(
+        const FluidTileKernelConstants<V> &c,
+        const typename V::vec height)
+{
+    // the scalar code uses if (h < 0) { h = 0; }, which keeps -0
+    return V::andnot(V::cmplt(height, c.zero), height);
+}
+
+template <typename V>
+void fluid_tile_step(FluidTile &tile, const FluidFloat ocean_level)
+{
+    typedef typename V::vec vec;
+
+    const FluidTileKernelConstants<V> c;
+    const vec ocean = V::set1(ocean_level);
+    const vec ocean_capacity = V::set1(0.1f);
+    const vec capacity_scale = V::set1(IFluidSim::source_capacity_scale);
+
+    const unsigned int stride = tile.row_stride();
+    const unsigned int lanes = tile.lanes();
+
+    for (unsigned int y = 0; y < IFluidSim::block_size; ++y)
+    {
+        const vec top_valid = (y > 0 || tile.top_valid
+                               ? c.all_set
+                               : c.zero);
+        const vec bottom_valid = (y < IFluidSim::block_size-1 || tile.bottom_valid
+                                  ? c.all_set
+                                  : c.zero);
+
+        const unsigned int row = tile.index(0, y);
+
+        for (unsigned int x = 0; x < lanes; x += V::width)
+        {
+            const unsigned int i = row + x;
+
+            const vec height = V::load(&tile.fluid_height[i]);
+            const vec terrain = V::load(&tile.terrain_height[i]);
+
+            vec applied;
+            vec new_height = height;
+
+            {
+                const vec left_valid = V::load_mask(&tile.left_valid[x]);
+                const vec right_valid = V::load_mask(&tile.right_valid[x]);
+
+                const vec left_flow = tile_flow<V>(
+                            c, height, terrain,
+                            V::load(&tile.fluid_height[i-1]),
+                            V::load(&tile.terrain_height[i-1]),
+                            V::neg(V::load(&tile.fluid_flow_x[i-1])),
+                            applied);
+                new_height = V::select(V::and_(applied, left_valid),
+                                       V::sub(new_height, left_flow),
+                                       new_height);
+
+                const vec right_flow = tile_flow<V>(
+                            c, height, terrain,
+                            V::load(&tile.fluid_height[i+1]),
+                            V::load(&tile.terrain_height[i+1]),
+                            V::load(&tile.fluid_flow_x[i]),
+                            applied);
+                new_height = V::select(V::and_(applied, right_valid),
+                                       V::sub(new_height, right_flow),
+                                       new_height);
+                V::store(&tile.new_fluid_flow_x[i], right_flow);
+
+                new_height = tile_clamp_negative<V>(c, new_height);
+            }
+
+            {
+                const vec top_flow = tile_flow<V>(
+                            c, height, terrain,
+                            V::load(&tile.fluid_height[i-stride]),
+                            V::load(&tile.terrain_height[i-stride]),
+                            V::neg(V::load(&tile.fluid_flow_y[i-stride])),
+                            applied);
+                new_height = V::select(V::and_(applied, top_valid),
+                                       V::sub(new_height, top_flow),
+                                       new_height);
+
+                const vec bottom_flow = tile_flow<V>(
+                            c, height, terrain,
+                            V::load(&tile.fluid_height[i+stride]),
+                            V::load(&tile.terrain_height[i+stride]),
+                            V::load(&tile.fluid_flow_y[i]),
+                            applied);
+                new_height = V::select(V::and_(applied, bottom_valid),
+                                       V::sub(new_height, bottom_flow),
+                                       new_height);
+                V::store(&tile.new_fluid_flow_y[i], bottom_flow);
+
+                new_height = tile_clamp_negative<V>(c, new_height);
+            }
+
+            {
+                const vec capacity = V::load(&tile.source_capacity[i]);
+                const vec is_ocean = V::cmplt(terrain, ocean);
+                const vec has_source = V::or_(
+                            V::cmpgt(capacity, c.zero),
+                            is_ocean);
+
+                // ocean is really just a very strong source/sink
+                const vec source_height = V::select(
+                            is_ocean,
+                            ocean,
+                            V::load(&tile.source_height[i]));
+                const vec source_capacity = V::mul(
+                            V::select(is_ocean, ocean_capacity, capacity),
+                            capacity_scale);
+
+                const vec source_fluid_height = V::sub(source_height, terrain);
+                const vec source_flow = V::max(
+                            V::neg(source_capacity),
+                            V::min(source_capacity,
+                                   V::sub(source_fluid_height, new_height)));
+
+                new_height = V::select(
+                            has_source,
+                            tile_clamp_negative<V>(
+                                c, V::add(new_height, source_flow)),
+                            new_height);
+            }
+
+            V::store(&tile.new_fluid_height[i], new_height);
+        }
+    }
+}
+
+}
+}
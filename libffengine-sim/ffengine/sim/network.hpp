@@ -355,6 +355,11 @@ private:
     const ExitRecord *record_for_bundle(const PhysicalEdgeBundle &bundle) const;
 
 public:
+    inline const EdgeClass &edge_class() const
+    {
+        return m_class;
+    }
+
     inline const Vector3f &position() const
     {
         return m_position;
@@ -411,19 +416,50 @@ private:
     mutable EdgeBundleSignal m_edge_bundle_reshaped;
     mutable NodeSignal m_node_created;
 
-private:
+public:
+    /**
+     * Create a single edge bundle between two nodes, without splitting the
+     * curve into segments as construct_curve() does.
+     *
+     * @param object_id Object::ID to use for the bundle; if it is
+     * Object::NULL_OBJECT_ID, a new ID is allocated.
+     */
     PhysicalEdgeBundle &create_bundle(PhysicalNode &start_node,
                                       const Vector3f &control_point,
                                       PhysicalNode &end_node,
-                                      const EdgeType &type);
-
-public:
+                                      const EdgeType &type,
+                                      const Object::ID object_id = Object::NULL_OBJECT_ID);
     void construct_curve(PhysicalNode &start_node,
                          const Vector3f &control_point,
                          PhysicalNode &end_node,
                          const EdgeType &type);
+    /**
+     * Create a node.
+     *
+     * @param object_id Object::ID to use for the node; if it is
+     * Object::NULL_OBJECT_ID, a new ID is allocated.
+     */
     PhysicalNode &create_node(const EdgeClass &class_,
-                              const Vector3f &position);
+                              const Vector3f &position,
+                              const Object::ID object_id = Object::NULL_OBJECT_ID);
+
+public:
+    /**
+     * Nodes of the graph. Entries may be dead until the next reshape().
+     */
+    inline const std::vector<object_ptr<PhysicalNode> > &nodes() const
+    {
+        return m_nodes;
+    }
+
+    /**
+     * Edge bundles of the graph. Entries may be dead until the next
+     * reshape().
+     */
+    inline const std::vector<object_ptr<PhysicalEdgeBundle> > &bundles() const
+    {
+        return m_bundles;
+    }
 
 public:
     inline EdgeBundleSignal &edge_bundle_created() const
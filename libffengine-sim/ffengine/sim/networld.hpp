@@ -36,6 +36,8 @@ the AUTHORS file.
 #include "ffengine/sim/server.hpp"
 
 #include "netserver_control.pb.h"
+#include "world_command.pb.h"
+#include "world_snapshot.pb.h"
 
 namespace sim {
 
@@ -57,7 +59,22 @@ enum NetMessageClass: uint32_t {
     /**
      * A world command maps directly to the corresponding protobuf.
      */
-    MSGCLASS_WORLD_COMMAND
+    MSGCLASS_WORLD_COMMAND,
+
+    /**
+     * A world command response maps directly to the corresponding protobuf.
+     */
+    MSGCLASS_WORLD_COMMAND_RESPONSE,
+
+    /**
+     * A chunk of a world snapshot, as sent to joining clients.
+     */
+    MSGCLASS_WORLD_SNAPSHOT_CHUNK,
+
+    /**
+     * A change of the terrain heights, as replicated by the server.
+     */
+    MSGCLASS_TERRAIN_DELTA
 };
 
 
@@ -74,6 +91,18 @@ enum NetMessageClass: uint32_t {
  * written(), NetMessageParser evaluates the buffer contents (if all required
  * data has been received) and fires events according to what has been found.
  *
+ * All data is received into a ring buffer which is allocated once on
+ * construction; payloads are parsed directly from the ring buffer through a
+ * ZeroCopyInputStream. In BUFFER_TO_BARRIER mode, next_buffer() never returns
+ * more space than is needed to complete the current header or payload, and
+ * at most one of them is processed per written() call. In BUFFER_STREAM
+ * mode, next_buffer() returns all contiguous free space, so that a single
+ * read may deliver several back-to-back messages, which are then all
+ * processed during the written() call.
+ *
+ * Message objects which are returned using recycle() are reused for later
+ * messages of the same type instead of allocating new ones.
+ *
  * The \a link_control_cb function is called when a
  * NetMessageClass::MSGCLASS_LINK_CONTROL is received; otherwise, the
  * IMessageHandler set using set_message_handler() receives the parsed
@@ -93,11 +122,23 @@ public:
     // and a uint32_t which denotes the class.
     static constexpr int64_t HEADER_SIZE = sizeof(NetMessageClass)+sizeof(uint32_t);
 
+    // one full message always fits, plus room for the next message to
+    // arrive while the previous one is parsed
+    static constexpr uint64_t RING_BUFFER_SIZE = 2*(MAX_MESSAGE_SIZE+HEADER_SIZE);
+
+    // maximum number of spare message objects kept per message class
+    static constexpr std::size_t MAX_SPARE_MESSAGES = 16;
+
     enum ReceptionState {
         RECV_WAIT_FOR_HEADER,
         RECV_PAYLOAD
     };
 
+    enum BufferMode {
+        BUFFER_TO_BARRIER,
+        BUFFER_STREAM
+    };
+
     using LinkControlCallback = std::function<void(std::unique_ptr<messages::NetWorldControl>&&)>;
     using ErrorCallback = std::function<void()>;
 
@@ -112,24 +153,34 @@ public:
      * message arrives.
      * @param error_cb The callback to call when an error occurs.
      * @param id The connection ID; this is only used for logging.
+     * @param mode The buffer mode to use; see NetMessageParser.
      */
     NetMessageParser(LinkControlCallback &&link_control_cb,
                      ErrorCallback &&error_cb,
-                     const NetConnectionID &id);
+                     const NetConnectionID &id,
+                     const BufferMode mode = BUFFER_TO_BARRIER);
 
 private:
     const NetConnectionID m_id;
+    const BufferMode m_mode;
 
     LinkControlCallback m_link_control_cb;
     ErrorCallback m_error_cb;
     std::atomic<IMessageHandler*> m_message_handler;
-    std::string m_recv_buffer;
+    std::unique_ptr<char[]> m_ring;
+    uint64_t m_ring_read;
+    uint64_t m_ring_filled;
     ReceptionState m_recv_state;
     uint64_t m_recv_barrier;
-    uint64_t m_written_up_to;
 
     NetMessageClass m_curr_class;
 
+    std::vector<std::unique_ptr<messages::NetWorldControl> > m_spare_link_control;
+    std::vector<std::unique_ptr<messages::WorldCommand> > m_spare_world_command;
+    std::vector<std::unique_ptr<messages::WorldCommandResponse> > m_spare_world_command_response;
+    std::vector<std::unique_ptr<messages::WorldSnapshotChunk> > m_spare_world_snapshot_chunk;
+    std::vector<std::unique_ptr<messages::TerrainDelta> > m_spare_terrain_delta;
+
 private:
     /**
      * Call reset() and emit the error_cb.
@@ -137,7 +188,13 @@ private:
     void fail();
 
     /**
-     * Parse the current buffer contents into the given message \a dest.
+     * Consume \a bytes bytes from the front of the ring buffer.
+     */
+    void consume(uint64_t bytes);
+
+    /**
+     * Parse the current payload from the ring buffer into the given message
+     * \a dest.
      *
      * @param dest A protobuf message to parse the buffer into.
      * @return true if parsing succeeded and false otherwise.
@@ -160,16 +217,36 @@ private:
      */
     void received_to_barrier();
 
+    template <typename message_t>
+    static std::unique_ptr<message_t> take_spare(
+            std::vector<std::unique_ptr<message_t> > &spares);
+
+    template <typename message_t>
+    static void put_spare(std::vector<std::unique_ptr<message_t> > &spares,
+                          std::unique_ptr<message_t> &&msg);
+
 public:
     /**
      * Reset the NetMessageParser.
      *
-     * This releases most memory which has been dynamically allocated for
-     * parsing and resets the parser into a state suitable for starting to
-     * parse.
+     * This discards any partially received data and resets the parser into a
+     * state suitable for starting to parse. The ring buffer is kept.
      */
     void reset();
 
+    /**
+     * Return a message object which has been passed out by the parser (or
+     * any other message object of the same type), so that it can be reused
+     * for future messages.
+     *
+     * @param msg The message to reuse; may be nullptr.
+     */
+    void recycle(std::unique_ptr<messages::NetWorldControl> &&msg);
+    void recycle(std::unique_ptr<messages::WorldCommand> &&msg);
+    void recycle(std::unique_ptr<messages::WorldCommandResponse> &&msg);
+    void recycle(std::unique_ptr<messages::WorldSnapshotChunk> &&msg);
+    void recycle(std::unique_ptr<messages::TerrainDelta> &&msg);
+
     /**
      * Request a pointer to write data to.
      *
@@ -216,6 +293,118 @@ public:
 };
 
 
+/**
+ * Statistics on the data sent through a NetMessageWriter.
+ */
+struct NetSendStats
+{
+    /**
+     * Number of flushes which had data to send.
+     */
+    uint64_t flushes;
+
+    /**
+     * Total number of messages and bytes sent.
+     */
+    uint64_t messages;
+    uint64_t bytes;
+
+    /**
+     * Number of messages and bytes sent by the most recent flush which had
+     * data to send.
+     */
+    uint64_t last_flush_messages;
+    uint64_t last_flush_bytes;
+};
+
+
+/**
+ * A NetMessageWriter frames and buffers outgoing messages in the shim protocol
+ * read by NetMessageParser.
+ *
+ * Messages are serialised, header and payload, directly into a chain of
+ * preallocated chunks, without intermediate copies. flush() passes all chunks
+ * accumulated since the previous flush to a write callback in one go; the
+ * chunks are kept for reuse afterwards.
+ *
+ * append() is thread-safe. flush() and clear() must not be called
+ * concurrently with each other.
+ */
+class NetMessageWriter
+{
+public:
+    // large enough for a game frame worth of small messages
+    static constexpr std::size_t CHUNK_SIZE = 64*1024;
+
+    // maximum number of unused chunks kept for reuse
+    static constexpr std::size_t MAX_SPARE_CHUNKS = 4;
+
+    /**
+     * Write a buffer to the peer; return false if not all of it could be
+     * written.
+     */
+    using WriteCallback = std::function<bool(const char*, std::size_t)>;
+
+private:
+    struct Chunk
+    {
+        std::unique_ptr<char[]> data;
+        std::size_t capacity;
+        std::size_t size;
+    };
+
+public:
+    NetMessageWriter();
+
+private:
+    /* guarded by m_pending_mutex */
+    std::mutex m_pending_mutex;
+    std::vector<Chunk> m_pending;
+    std::vector<Chunk> m_spare;
+    uint64_t m_pending_messages;
+    NetSendStats m_stats;
+
+    /* used only during flush() */
+    std::vector<Chunk> m_flushing;
+
+private:
+    Chunk &chunk_for(std::size_t bytes);
+
+public:
+    /**
+     * Frame and buffer a message for sending.
+     *
+     * @param msgclass The class of the message.
+     * @param msg The message to send.
+     * @return false if the message exceeds
+     * NetMessageParser::MAX_MESSAGE_SIZE and has not been buffered, true
+     * otherwise.
+     */
+    bool append(NetMessageClass msgclass,
+                const google::protobuf::Message &msg);
+
+    /**
+     * Discard all buffered messages.
+     */
+    void clear();
+
+    /**
+     * Pass all buffered data to \a write, chunk by chunk.
+     *
+     * @param write The callback which writes the data to the peer.
+     * @return false if \a write failed; the remaining data is discarded in
+     * that case.
+     */
+    bool flush(const WriteCallback &write);
+
+    /**
+     * Return the statistics of all flushes so far.
+     */
+    NetSendStats stats();
+
+};
+
+
 class NetServerClient: public ServerClientBase
 {
 public:
@@ -232,7 +421,7 @@ private:
     const uint64_t m_connection_id;
     bool m_terminated;
     QTcpSocket &m_socket;
-    std::string m_send_buffer;
+    NetMessageWriter m_message_writer;
     sigc::signal<void> m_sig_disconnected;
     NetMessageParser m_message_parser;
 
@@ -253,17 +442,36 @@ public slots:
     void terminate() override;
 
 public:
+    bool msg_world_command(
+            std::unique_ptr<messages::WorldCommand> &&cmd) override;
+    bool msg_world_command_response(
+            std::unique_ptr<messages::WorldCommandResponse> &&resp) override;
+    bool msg_world_snapshot_chunk(
+            std::unique_ptr<messages::WorldSnapshotChunk> &&chunk) override;
+    bool msg_terrain_delta(
+            std::unique_ptr<messages::TerrainDelta> &&delta) override;
     void set_message_handler(IMessageHandler *handler) override;
 
+    /**
+     * Return the statistics of the data sent to the peer so far.
+     */
+    NetSendStats send_stats();
+
 };
 
 
+/**
+ * Accept TCP connections and register a NetServerClient for each of them
+ * with a Server. The clients are unregistered again when they disconnect.
+ */
 class NetServer: public QThread
 {
 public:
-    NetServer();
+    explicit NetServer(Server &server);
+    ~NetServer() override;
 
 private:
+    Server &m_server;
     QTcpServer m_tcp_server;
     std::vector<std::unique_ptr<NetServerClient> > m_clients;
 
@@ -0,0 +1,147 @@
+/**********************************************************************
+File name: op_queue.hpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#ifndef SCC_SIM_OP_QUEUE_H
+#define SCC_SIM_OP_QUEUE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "ffengine/sim/world.hpp"
+
+
+namespace sim {
+
+/**
+ * Multi-producer, single-consumer queue of world operations.
+ *
+ * Pushing never takes a lock: the queue is an intrusive linked list with a
+ * stub node (after Dmitry Vyukov), so that a push is a single atomic
+ * exchange plus a store. Queue nodes are taken from a bounded pool of
+ * preallocated nodes; the pool is a lock-free stack with tagged indices to
+ * avoid the ABA problem. If the pool is exhausted, a node is allocated on
+ * the heap instead, so that producers never wait for the consumer.
+ *
+ * Any number of threads may call push() concurrently; only a single thread
+ * at a time may call pop_all().
+ */
+class WorldOperationQueue
+{
+public:
+    static constexpr std::size_t DEFAULT_POOL_SIZE = 1024;
+
+public:
+    explicit WorldOperationQueue(const std::size_t pool_size = DEFAULT_POOL_SIZE);
+    WorldOperationQueue(const WorldOperationQueue &ref) = delete;
+    WorldOperationQueue &operator=(const WorldOperationQueue &ref) = delete;
+    ~WorldOperationQueue();
+
+private:
+    static constexpr std::uint32_t NO_NODE = 0xffffffffU;
+
+    struct Node
+    {
+        std::atomic<Node*> next;
+        /**
+         * Index of the next node in the free list; only meaningful while
+         * the node is in the free list.
+         */
+        std::atomic<std::uint32_t> next_free;
+        /**
+         * Index of the node in the pool, or NO_NODE for heap allocated
+         * nodes.
+         */
+        std::uint32_t index;
+        WorldOperationPtr op;
+    };
+
+    std::unique_ptr<Node[]> m_pool;
+    const std::size_t m_pool_size;
+
+    /**
+     * Head of the free list: the low 32 bits hold the node index, the high
+     * 32 bits a tag which is incremented on each modification.
+     */
+    std::atomic<std::uint64_t> m_free_head;
+
+    Node m_stub;
+
+    /**
+     * The node which was pushed last; written by the producers.
+     */
+    std::atomic<Node*> m_head;
+
+    /* owned by the consumer */
+    Node *m_tail;
+
+    std::atomic<std::uint64_t> m_overflows;
+
+private:
+    Node *acquire_node();
+    void release_node(Node *node);
+    void push_node(Node *node);
+    Node *pop_node();
+
+public:
+    /**
+     * Enqueue an operation. This is thread-safe and lock-free.
+     *
+     * @param op Operation to enqueue.
+     */
+    void push(WorldOperationPtr &&op);
+
+    /**
+     * Move all operations which are currently in the queue to the end of
+     * \a dest, in the order in which they were pushed.
+     *
+     * Operations whose push() has not completed yet may be left in the
+     * queue; they will be returned by the next call.
+     *
+     * This must only be called from a single thread at a time.
+     *
+     * @param dest Vector to append the operations to.
+     * @return Number of operations appended.
+     */
+    std::size_t pop_all(std::vector<WorldOperationPtr> &dest);
+
+    /**
+     * Number of pushes so far which had to allocate a node on the heap
+     * because the pool was exhausted.
+     */
+    inline std::uint64_t overflows() const
+    {
+        return m_overflows.load(std::memory_order_relaxed);
+    }
+
+    inline std::size_t pool_size() const
+    {
+        return m_pool_size;
+    }
+
+};
+
+}
+
+#endif
@@ -0,0 +1,110 @@
+/**********************************************************************
+File name: savegame.hpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#ifndef SCC_SIM_SAVEGAME_H
+#define SCC_SIM_SAVEGAME_H
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#include "ffengine/io/mappedfile.hpp"
+#include "ffengine/io/stream.hpp"
+
+namespace sim {
+
+class WorldState;
+
+
+class SaveGameError: public std::runtime_error
+{
+public:
+    SaveGameError(const std::string &message);
+    SaveGameError(const char *message);
+
+};
+
+
+/**
+ * Version of the save format written by save_world(). Files with a
+ * different version are rejected by load_world().
+ */
+extern const std::uint32_t SAVEGAME_VERSION;
+
+
+/**
+ * Write the persistent part of a world state to a stream.
+ *
+ * The file starts with a fixed header and a table of sections, followed by
+ * the sections themselves, each aligned to a 4 KiB boundary:
+ *
+ * * terrain: the field in Terrain::LOCK_TILE_SIZE squared tiles, raw
+ *   vertices in tile order;
+ * * fluid: per-block metadata, followed by the front buffer cells of each
+ *   IFluidSim::block_size squared block;
+ * * fluid sources and physical graph nodes and edge bundles, with their
+ *   object IDs.
+ *
+ * All values are stored in host byte order; loading on a machine with a
+ * different byte order is rejected.
+ *
+ * The terrain is read from a Terrain::snapshot() and does not block the
+ * simulation. The fluid front buffer is read block by block under its
+ * lock. Objects and the graph are read without locking, so this must not
+ * run concurrently with world operations.
+ *
+ * @param dest Stream to write to; it does not need to be seekable.
+ * @param state World state to save.
+ */
+void save_world(io::Stream &dest, const WorldState &state);
+
+/**
+ * Restore a world state saved with save_world() from a memory mapped file.
+ *
+ * The terrain and fluid sections are copied straight from the mapping in
+ * parallel, so only the page cache sits between the file and the world
+ * state. The file is validated completely before \a state is touched.
+ *
+ * \a state must be freshly constructed, with the terrain size of the saved
+ * world, and the simulation must not be running. Terrain changes are
+ * announced through Terrain::notify_heightmap_changed(), new fluid sources
+ * through WorldState::fluid_source_added() and graph objects through the
+ * PhysicalGraph signals.
+ *
+ * @param src Mapped save file.
+ * @param state World state to restore into.
+ * @throws SaveGameError if the file is malformed or does not match
+ * \a state.
+ */
+void load_world(const io::MappedFile &src, WorldState &state);
+
+/**
+ * Map the file at \a filename and restore it into \a state.
+ *
+ * @see load_world(const io::MappedFile&, WorldState&)
+ */
+void load_world(const std::string &filename, WorldState &state);
+
+}
+
+#endif
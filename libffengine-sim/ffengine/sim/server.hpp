@@ -26,6 +26,7 @@ the AUTHORS file.
 
 #include <sigc++/sigc++.h>
 
+#include <chrono>
 #include <memory>
 #include <shared_mutex>
 
@@ -33,6 +34,9 @@ the AUTHORS file.
 
 #include <QObject>
 
+#include "ffengine/sim/brush_dictionary.hpp"
+#include "ffengine/sim/op_queue.hpp"
+#include "ffengine/sim/snapshot.hpp"
 #include "ffengine/sim/world.hpp"
 
 
@@ -43,6 +47,9 @@ typedef std::unique_ptr<google::protobuf::Message> AbstractMessagePtr;
 namespace messages {
 
 class WorldCommand;
+class TerrainDelta;
+class WorldCommandResponse;
+class WorldSnapshotChunk;
 
 }
 
@@ -80,6 +87,30 @@ public:
      */
     virtual bool msg_world_command(std::unique_ptr<messages::WorldCommand> &&cmd);
 
+    /**
+     * Handle a messages::WorldCommandResponse message.
+     *
+     * @param resp The response message.
+     */
+    virtual bool msg_world_command_response(
+            std::unique_ptr<messages::WorldCommandResponse> &&resp);
+
+    /**
+     * Handle a messages::WorldSnapshotChunk message.
+     *
+     * @param chunk The snapshot chunk.
+     */
+    virtual bool msg_world_snapshot_chunk(
+            std::unique_ptr<messages::WorldSnapshotChunk> &&chunk);
+
+    /**
+     * Handle a messages::TerrainDelta message.
+     *
+     * @param delta The terrain delta.
+     */
+    virtual bool msg_terrain_delta(
+            std::unique_ptr<messages::TerrainDelta> &&delta);
+
 };
 
 
@@ -162,27 +193,50 @@ class Server
 public:
     typedef std::shared_lock<std::shared_timed_mutex> SyncSafeLock;
 
+    /**
+     * Wall clock duration of a single game frame.
+     */
+    static const std::chrono::microseconds game_frame_duration;
+
+    /**
+     * Number of snapshot chunks sent per game frame and client.
+     */
+    static const unsigned int snapshot_chunks_per_frame;
+
 public:
     Server();
     ~Server();
 
 private:
     WorldState m_state;
+    BrushDictionary m_brushes;
+
+    struct SnapshotStream
+    {
+        ServerClientBase *client;
+        std::unique_ptr<WorldSnapshotEncoder> encoder;
+    };
 
     /* guarded by m_clients_mutex */
     std::mutex m_clients_mutex;
     std::vector<ServerClientBase*> m_client_interfaces;
+    std::vector<SnapshotStream> m_snapshot_streams;
 
-    /* guarded by m_op_queue_mutex */
-    std::mutex m_op_queue_mutex;
-    std::vector<std::unique_ptr<WorldOperation> > m_op_queue;
+    WorldOperationQueue m_op_queue;
 
     std::atomic_bool m_terminated;
     std::thread m_game_thread;
 
     /* owned by m_game_thread */
     std::vector<std::unique_ptr<WorldOperation> > m_op_buffer;
+    std::vector<WorldOperationFootprint> m_op_footprints;
+    std::vector<unsigned int> m_op_waves;
+    std::vector<std::size_t> m_wave_offsets;
+    std::vector<std::size_t> m_wave_order;
+    std::vector<WorldOperationResult> m_op_results;
     Sandifier m_sandifier;
+    TerrainJournal m_terrain_journal;
+    std::vector<messages::TerrainDelta> m_terrain_deltas;
 
     /**
      * This mutex is used to put the Server into a state which is safe for
@@ -191,8 +245,18 @@ private:
     std::shared_timed_mutex m_interframe_mutex;
 
 protected:
+    /**
+     * Execute the operations in m_op_buffer.
+     *
+     * The operations are partitioned into waves of operations with
+     * non-conflicting footprints (see partition_into_waves()). The waves are
+     * executed in order, the operations within a wave concurrently.
+     */
+    void execute_ops();
     void game_frame();
     void game_thread();
+    void replicate_terrain();
+    void stream_snapshots();
 
 public:
     inline WorldState &state()
@@ -205,9 +269,16 @@ public:
         return m_state;
     }
 
+    inline BrushDictionary &brushes()
+    {
+        return m_brushes;
+    }
+
     /**
      * Thread-safely enqueue a world operation for the next game frame.
      *
+     * This does not block, not even while a game frame is running.
+     *
      * There won’t be any feedback on the operation. This is generally not
      * useful for actual client-server usage, but for local terraforming it
      * is quite handy.
@@ -216,6 +287,70 @@ public:
      */
     void enqueue_op(std::unique_ptr<WorldOperation> &&op);
 
+    /**
+     * Thread-safely process a world command received from a client.
+     *
+     * Brush registrations are handled immediately and the ID of the brush is
+     * stored in \a response. Other commands are converted using
+     * WorldOperation::from_message() and enqueued for the next game frame.
+     *
+     * @param cmd Command to process.
+     * @param response Response to fill in; the token is copied from \a cmd
+     * and the result is set if the command was rejected or fully handled.
+     * @return INVALID_ARGUMENT if the command was rejected, NO_ERROR
+     * otherwise.
+     */
+    WorldOperationResult submit_command(
+            const messages::WorldCommand &cmd,
+            messages::WorldCommandResponse &response);
+
+    /**
+     * Register a client interface with the server.
+     *
+     * At the end of each game frame, flush() is invoked on all registered
+     * clients, so that all messages produced during a frame are sent
+     * together.
+     *
+     * @param client The client interface; it must stay valid until it is
+     * removed using remove_client().
+     */
+    void add_client(ServerClientBase *client);
+
+    /**
+     * Unregister a client interface previously registered with add_client().
+     *
+     * This also cancels a snapshot which is being sent to the client.
+     *
+     * @param client The client interface to remove.
+     */
+    void remove_client(ServerClientBase *client);
+
+    /**
+     * Start streaming a snapshot of the terrain and fluid state to a client
+     * registered with add_client().
+     *
+     * The snapshot is encoded and sent in chunks, at most
+     * snapshot_chunks_per_frame per game frame, so that a joining client
+     * does not stall the game loop. Messages sent to the client in the
+     * meantime are interleaved with the chunks.
+     *
+     * @param client The client to send the snapshot to.
+     */
+    void send_snapshot(ServerClientBase *client);
+
+    /**
+     * Set the number of fluid simulation steps run per game frame.
+     *
+     * In adaptive mode, fewer steps are run while the fluid simulation does
+     * not finish within game_frame_duration.
+     *
+     * @param substeps Number of steps per game frame; the maximum in
+     * adaptive mode.
+     * @param adaptive Enable adaptive mode.
+     */
+    void set_fluid_substeps(const unsigned int substeps,
+                            const bool adaptive = false);
+
     /**
      * Return a lock object on the WorldState and ensure that simulations are
      * in a state where their front buffers / data can be read safely.
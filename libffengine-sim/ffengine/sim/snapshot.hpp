@@ -0,0 +1,243 @@
+/**********************************************************************
+File name: snapshot.hpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#ifndef SCC_SIM_SNAPSHOT_H
+#define SCC_SIM_SNAPSHOT_H
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ffengine/sim/fluid_base.hpp"
+#include "ffengine/sim/terrain.hpp"
+
+namespace sim {
+
+namespace messages {
+
+class TerrainDelta;
+class WorldSnapshotChunk;
+
+}
+
+
+/**
+ * Encode the terrain and fluid state into a stream of
+ * messages::WorldSnapshotChunk messages, for a client joining a running game.
+ *
+ * The state is split into chunks of IFluidSim::block_size squared vertices
+ * (terrain) or cells (fluid). Each plane of a chunk (terrain height and
+ * sand, fluid height and flow) is quantised to a fixed step, encoded as the
+ * residual against the median edge detector prediction from its left, upper
+ * and upper-left neighbours, and the whole chunk is compressed with zlib.
+ *
+ * The chunks are encoded lazily, one per encode_next() call, so that the
+ * encoding can be interleaved with the game frames. Each chunk reflects the
+ * state at the time it is encoded.
+ */
+class WorldSnapshotEncoder
+{
+public:
+    /**
+     * Quantisation steps of the different planes.
+     */
+    static const float TERRAIN_HEIGHT_STEP;
+    static const float TERRAIN_SAND_STEP;
+    static const float FLUID_HEIGHT_STEP;
+    static const float FLUID_FLOW_STEP;
+
+public:
+    WorldSnapshotEncoder(const Terrain &terrain, const FluidBlocks &fluid);
+
+private:
+    const Terrain &m_terrain;
+    const FluidBlocks &m_fluid;
+    const unsigned int m_terrain_blocks_per_axis;
+    const unsigned int m_chunk_count;
+    unsigned int m_next_chunk;
+
+    std::vector<std::int32_t> m_plane;
+    std::string m_raw;
+
+private:
+    void encode_terrain_block(const unsigned int x, const unsigned int y);
+    void encode_fluid_block(const unsigned int x, const unsigned int y);
+
+public:
+    inline unsigned int chunk_count() const
+    {
+        return m_chunk_count;
+    }
+
+    inline unsigned int chunks_encoded() const
+    {
+        return m_next_chunk;
+    }
+
+    inline bool done() const
+    {
+        return m_next_chunk >= m_chunk_count;
+    }
+
+    /**
+     * Encode the next chunk of the snapshot.
+     *
+     * This takes the terrain and fluid front buffer locks for reading while
+     * the chunk is encoded.
+     *
+     * @param dest Message to store the chunk in.
+     * @return false if all chunks have been encoded already, true otherwise.
+     */
+    bool encode_next(messages::WorldSnapshotChunk &dest);
+
+};
+
+
+/**
+ * Apply the chunks produced by a WorldSnapshotEncoder to a terrain and fluid
+ * state of matching size.
+ */
+class WorldSnapshotDecoder
+{
+public:
+    WorldSnapshotDecoder(Terrain &terrain, FluidBlocks &fluid);
+    ~WorldSnapshotDecoder();
+
+private:
+    Terrain &m_terrain;
+    FluidBlocks &m_fluid;
+    const unsigned int m_terrain_blocks_per_axis;
+    unsigned int m_chunks_applied;
+    unsigned int m_chunk_count;
+
+    // terrain written by snapshot chunks which has not been published to
+    // Terrain::snapshot() yet
+    TerrainRect m_unpublished;
+
+    std::vector<std::int32_t> m_plane;
+    std::string m_raw;
+
+private:
+    bool decode_terrain_block(const unsigned int x, const unsigned int y);
+    bool decode_fluid_block(const unsigned int x, const unsigned int y);
+    void publish_terrain();
+
+public:
+    /**
+     * Apply a chunk to the terrain or fluid.
+     *
+     * Terrain changes are published to Terrain::snapshot() only once the
+     * snapshot is complete (or the decoder is destroyed), instead of once
+     * per chunk. They are announced through
+     * Terrain::notify_heightmap_changed() after they have been published,
+     * so that handlers see them in the snapshot. Fluid blocks are written
+     * to both buffers and activated.
+     *
+     * @param chunk The chunk to apply.
+     * @return false if the chunk is malformed or does not match the terrain
+     * and fluid sizes; nothing is changed in that case.
+     */
+    bool apply(const messages::WorldSnapshotChunk &chunk);
+
+    /**
+     * Apply a terrain delta produced by a TerrainJournal.
+     *
+     * Deltas are relative to the quantised terrain heights. A delta which
+     * arrives before the snapshot chunk of its block is overwritten by that
+     * chunk, so deltas may be applied at any time during the snapshot
+     * transfer.
+     *
+     * @param delta The delta to apply.
+     * @return false if the delta is malformed or does not match the terrain
+     * size; nothing is changed in that case.
+     */
+    bool apply(const messages::TerrainDelta &delta);
+
+    /**
+     * Whether all chunks of the snapshot have been applied.
+     */
+    inline bool complete() const
+    {
+        return m_chunk_count > 0 && m_chunks_applied >= m_chunk_count;
+    }
+
+};
+
+
+
+/**
+ * Record the terrain changes of each game frame and encode them as compact
+ * height deltas.
+ *
+ * The journal listens to Terrain::heightmap_updated() and tracks the
+ * changed area of each block of IFluidSim::block_size squared vertices. On
+ * collect(), one messages::TerrainDelta is produced per changed block: the
+ * difference between the current and the previously replicated quantised
+ * heights within the changed area, encoded like the planes of a snapshot.
+ * Any number of strokes on the same block between two collect() calls thus
+ * end up in a single delta.
+ *
+ * The journal starts out with the current terrain as replicated state,
+ * which matches what a WorldSnapshotEncoder sends to joining clients.
+ */
+class TerrainJournal
+{
+public:
+    explicit TerrainJournal(const Terrain &terrain);
+    ~TerrainJournal();
+
+private:
+    const Terrain &m_terrain;
+    const unsigned int m_blocks_per_axis;
+
+    /* guarded by m_dirty_mutex */
+    std::mutex m_dirty_mutex;
+    std::vector<TerrainRect> m_dirty_rects;
+    std::vector<unsigned int> m_dirty_blocks;
+
+    /* owned by the collect() caller */
+    std::vector<unsigned int> m_collect_blocks;
+    std::vector<TerrainRect> m_collect_rects;
+    std::vector<std::int32_t> m_replicated;
+    std::vector<std::int32_t> m_plane;
+    std::string m_raw;
+
+    sigc::connection m_heightmap_updated_conn;
+
+private:
+    void heightmap_updated(TerrainRect r);
+
+public:
+    /**
+     * Encode the changes since the previous call.
+     *
+     * @param dest Vector to append the deltas to.
+     * @return The number of deltas appended.
+     */
+    unsigned int collect(std::vector<messages::TerrainDelta> &dest);
+
+};
+
+}
+
+#endif
@@ -24,9 +24,12 @@ the AUTHORS file.
 #ifndef SCC_SIM_TERRAIN_H
 #define SCC_SIM_TERRAIN_H
 
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
 #include <cstdint>
+#include <memory>
+#include <mutex>
 #include <shared_mutex>
 #include <string>
 #include <thread>
@@ -34,6 +37,8 @@ the AUTHORS file.
 
 #include <sigc++/sigc++.h>
 
+#include "ffengine/common/epoch.hpp"
+#include "ffengine/common/scheduler.hpp"
 #include "ffengine/common/utils.hpp"
 #include "ffengine/io/log.hpp"
 
@@ -41,6 +46,8 @@ the AUTHORS file.
 #include "ffengine/math/vector.hpp"
 #include "ffengine/math/rect.hpp"
 
+#include "ffengine/sim/fluid_precision.hpp"
+
 
 namespace sim {
 
@@ -48,6 +55,9 @@ extern io::Logger &lod_logger;
 
 typedef GenericRect<unsigned int> TerrainRect;
 
+struct TerrainVersion;
+class TerrainSnapshot;
+
 
 class Terrain
 {
@@ -61,17 +71,72 @@ public:
     static const vector_component_x_t HEIGHT_ATTR;
     static const vector_component_y_t SAND_ATTR;
 
+    /**
+     * Edge length of the square tiles of the field which are locked
+     * individually.
+     */
+    static constexpr unsigned int LOCK_TILE_SIZE = 64;
+
+    /**
+     * Lock on a set of tiles of the terrain field, obtained from
+     * readonly_rect(), writable_rect() and friends.
+     *
+     * The lock is released when the object is destroyed or unlock() is
+     * called. Tiles are always locked in row-major order, so that two rect
+     * locks cannot deadlock each other. A thread must not acquire a second
+     * lock on the same terrain while a FieldLock for writing is held.
+     */
+    class FieldLock
+    {
+    public:
+        FieldLock();
+        FieldLock(FieldLock &&src);
+        FieldLock &operator=(FieldLock &&src);
+        FieldLock(const FieldLock &ref) = delete;
+        FieldLock &operator=(const FieldLock &ref) = delete;
+        ~FieldLock();
+
+    private:
+        FieldLock(const Terrain &terrain,
+                  const TerrainRect &tiles,
+                  const bool exclusive,
+                  const bool publish);
+
+    private:
+        const Terrain *m_terrain;
+        TerrainRect m_tiles;
+        bool m_exclusive;
+        bool m_publish;
+
+    public:
+        inline bool owns_lock() const
+        {
+            return m_terrain != nullptr;
+        }
+
+        void unlock();
+
+        friend class Terrain;
+    };
+
 public:
     Terrain(const unsigned int size);
     ~Terrain();
 
 private:
     const unsigned int m_size;
+    const unsigned int m_tiles_per_axis;
 
-    // guarded by m_heightmap_mutex
-    mutable std::shared_timed_mutex m_field_mutex;
+    // one lock per LOCK_TILE_SIZE x LOCK_TILE_SIZE tile of m_field
+    mutable std::unique_ptr<std::shared_timed_mutex[]> m_tile_mutexes;
     Field m_field;
 
+    // immutable copies of the tiles for lock-free readers; a new version is
+    // published whenever a writable lock is released
+    mutable ffe::EpochDomain m_version_epochs;
+    mutable std::mutex m_publish_mutex;
+    mutable std::atomic<const std::shared_ptr<const TerrainVersion>*> m_current_version;
+
     mutable sigc::signal<void, TerrainRect> m_heightmap_updated;
     mutable sigc::signal<void, TerrainRect> m_attributes_updated;
 
@@ -95,10 +160,78 @@ public:
     void notify_heightmap_changed() const;
     void notify_heightmap_changed(TerrainRect at) const;
     void notify_attributes_changed(TerrainRect at) const;
-    std::shared_lock<std::shared_timed_mutex> readonly_field(
-            const Field *&heightmap) const;
-    std::unique_lock<std::shared_timed_mutex> writable_field(
-            Field *&heightmap);
+
+    /**
+     * Lock the whole field for reading.
+     *
+     * @param heightmap Receives a pointer to the field.
+     * @return Lock object; the field may be accessed while it is held.
+     */
+    FieldLock readonly_field(const Field *&heightmap) const;
+
+    /**
+     * Lock the whole field for writing.
+     *
+     * @param heightmap Receives a pointer to the field.
+     * @return Lock object; the field may be accessed while it is held.
+     */
+    FieldLock writable_field(Field *&heightmap);
+
+    /**
+     * Lock the part of the field covered by \a rect for reading.
+     *
+     * Only the vertices inside \a rect may be accessed through
+     * \a heightmap while the lock is held. Readers and writers of other
+     * parts of the field are not blocked, unless they touch the same
+     * LOCK_TILE_SIZE tiles.
+     *
+     * @param rect Rect of vertices to lock; it is clipped to the field.
+     * @param heightmap Receives a pointer to the field.
+     * @return Lock object.
+     */
+    FieldLock readonly_rect(const TerrainRect &rect,
+                            const Field *&heightmap) const;
+
+    /**
+     * Lock the part of the field covered by \a rect for writing.
+     *
+     * When the lock is released, the locked tiles are published as a new
+     * version for snapshot(). They are copied after the exclusive lock has
+     * been dropped, under a shared lock. Writers which fill the field piece
+     * by piece pass \a publish as false and call publish_rect() once at the
+     * end, so that the tiles are not copied for every piece.
+     *
+     * @see readonly_rect
+     */
+    FieldLock writable_rect(const TerrainRect &rect,
+                            Field *&heightmap,
+                            const bool publish = true);
+
+    /**
+     * Publish the tiles covered by \a rect as a new version, for writes
+     * which were made under a lock obtained with publish set to false.
+     *
+     * The tiles are locked for reading while they are copied.
+     */
+    void publish_rect(const TerrainRect &rect) const;
+
+    /**
+     * Return an immutable snapshot of the most recently published version
+     * of the field.
+     *
+     * This does not take any lock and never waits for writers. Versions are
+     * published when a writable lock is released; the snapshot shares all
+     * tiles with the field versions before and after it which have not
+     * changed in between.
+     *
+     * @return Reference counted handle on the snapshot.
+     */
+    TerrainSnapshot snapshot() const;
+
+private:
+    TerrainRect tiles_for_rect(const TerrainRect &rect) const;
+    void publish_rect_tiles(const TerrainRect &tiles) const;
+    void publish_tiles(const TerrainRect &tiles) const;
 
 public:
     void from_perlin(const PerlinNoiseGenerator &gen);
@@ -107,6 +240,98 @@ public:
 };
 
 
+/**
+ * Immutable version of the terrain field, split into LOCK_TILE_SIZE x
+ * LOCK_TILE_SIZE tiles. Unchanged tiles are shared between versions.
+ */
+struct TerrainVersion
+{
+    typedef std::vector<Vector3f> Tile;
+
+    std::uint64_t serial;
+    unsigned int size;
+    unsigned int tiles_per_axis;
+    std::vector<std::shared_ptr<const Tile> > tiles;
+};
+
+
+/**
+ * Handle on an immutable version of the terrain field, obtained from
+ * Terrain::snapshot().
+ *
+ * Snapshots are cheap to copy and can be read from any thread without
+ * locking; the data is freed when the last handle to it is destroyed.
+ */
+class TerrainSnapshot
+{
+public:
+    TerrainSnapshot();
+    explicit TerrainSnapshot(std::shared_ptr<const TerrainVersion> version);
+
+private:
+    std::shared_ptr<const TerrainVersion> m_version;
+
+public:
+    inline bool valid() const
+    {
+        return bool(m_version);
+    }
+
+    inline unsigned int size() const
+    {
+        return m_version->size;
+    }
+
+    /**
+     * Number which increases with each published version of the field.
+     */
+    inline std::uint64_t serial() const
+    {
+        return m_version->serial;
+    }
+
+    inline unsigned int tiles_per_axis() const
+    {
+        return m_version->tiles_per_axis;
+    }
+
+    inline const Vector3f &vertex(const unsigned int x,
+                                  const unsigned int y) const
+    {
+        const TerrainVersion::Tile &tile = *m_version->tiles[
+                (y / Terrain::LOCK_TILE_SIZE)*m_version->tiles_per_axis
+                + x / Terrain::LOCK_TILE_SIZE];
+        return tile[(y % Terrain::LOCK_TILE_SIZE)*Terrain::LOCK_TILE_SIZE
+                + x % Terrain::LOCK_TILE_SIZE];
+    }
+
+    inline Terrain::height_t height(const unsigned int x,
+                                    const unsigned int y) const
+    {
+        return vertex(x, y)[Terrain::HEIGHT_ATTR];
+    }
+
+    /**
+     * Data of a tile, in row-major order with a row length of
+     * Terrain::LOCK_TILE_SIZE. Tiles at the far edges of the field are
+     * only partially used.
+     */
+    inline const Vector3f *tile_data(const unsigned int tx,
+                                     const unsigned int ty) const
+    {
+        return m_version->tiles[ty*m_version->tiles_per_axis+tx]->data();
+    }
+
+};
+
+
+/**
+ * Base class for workers which derive data from the terrain.
+ *
+ * Updates are processed by tasks on the engine-wide scheduler. At most one
+ * task per worker is in flight; rects notified while the task is running are
+ * merged and processed by the same task afterwards.
+ */
 class TerrainWorker
 {
 public:
@@ -114,14 +339,16 @@ public:
     virtual ~TerrainWorker();
 
 private:
+    /* guarded by m_state_mutex */
     std::mutex m_state_mutex;
     TerrainRect m_updated_rect;
-    bool m_terminated;
-    std::condition_variable m_wakeup;
+    bool m_running;
+    bool m_task_scheduled;
 
-    std::thread m_worker_thread;
+    ffe::TaskGroup m_tasks;
 
 private:
+    void schedule_task(std::unique_lock<std::mutex> &state_lock);
     void worker();
 
 protected:
@@ -136,7 +363,6 @@ public:
 
 
 class Fluid;
-struct FluidCell;
 
 class Sandifier
 {
@@ -144,6 +370,11 @@ public:
     static const float SAND_FILTER_CONSTANT;
     static const float SAND_FILTER_CUTOFF;
 
+    /**
+     * Maximum number of rows processed per run_steps() call.
+     */
+    static const unsigned int MAX_ROWS_PER_RUN;
+
 public:
     Sandifier(Terrain &terrain,
               const Fluid &fluid);
@@ -154,9 +385,18 @@ private:
 
     unsigned int m_curr_y;
 
-    std::array<std::vector<Vector3f>, 3> m_rows;
+    /**
+     * Copy of the row above m_curr_y, as it was before it was updated.
+     */
+    std::vector<Vector3f> m_prev_row;
+
+    /**
+     * Source rows of the current run, including the rows above and below.
+     */
+    std::vector<std::vector<Vector3f> > m_rows;
 
-    std::vector<float> m_dest_row;
+    std::vector<std::vector<float> > m_dest_rows;
+    std::vector<std::tuple<unsigned int, unsigned int> > m_changed_ranges;
 
 private:
     void fetch_fluid_info(const unsigned int x,
@@ -164,9 +404,16 @@ private:
     void fetch_row(const unsigned int y,
                    const Terrain::Field &src,
                    std::vector<Vector3f> &height_dest);
-    std::tuple<unsigned int, unsigned int> step();
+    std::tuple<unsigned int, unsigned int> step(
+            const unsigned int y,
+            const std::vector<Vector3f> *rows,
+            std::vector<float> &dest_row) const;
 
 public:
+    /**
+     * Update the sandiness of the next few rows of the terrain. The rows are
+     * computed in parallel on the engine-wide scheduler.
+     */
     void run_steps();
 
 };
@@ -45,6 +45,8 @@ class WorldCommandResponse;
 
 }
 
+class BrushDictionary;
+
 typedef std::chrono::steady_clock WorldClock;
 
 
@@ -146,6 +148,46 @@ public:
  * Abstract base class for operations modifying the game state using a
  * WorldMutator.
  */
+/**
+ * Describes which parts of the world state a WorldOperation touches.
+ *
+ * Operations whose footprints do not conflict may be executed concurrently.
+ * A default constructed footprint is exclusive, that is, it conflicts with
+ * any other footprint.
+ */
+struct WorldOperationFootprint
+{
+    WorldOperationFootprint();
+
+    /**
+     * If true, the operation may touch any part of the world state and is
+     * never executed concurrently with other operations.
+     */
+    bool exclusive;
+
+    /**
+     * Terrain vertices the operation reads or writes.
+     *
+     * After the operation has executed successfully, the executor emits
+     * Terrain::heightmap_updated() for this rect; non-exclusive operations
+     * must not emit it themselves.
+     */
+    TerrainRect terrain;
+
+    /**
+     * Fluid cells the operation reads or writes. As fluid blocks carry
+     * per-block state, this must be aligned to whole fluid blocks.
+     */
+    TerrainRect fluid;
+
+    /**
+     * Test whether two footprints conflict, i.e. whether the operations
+     * have to be executed in order.
+     */
+    bool conflicts_with(const WorldOperationFootprint &other) const;
+};
+
+
 class WorldOperation
 {
 public:
@@ -156,11 +198,25 @@ public:
      * Execute the world operation against the world which is mutated by the
      * given \a mutator.
      *
+     * If the footprint() of the operation is not exclusive, this may be
+     * called concurrently with other operations whose footprints do not
+     * conflict.
+     *
      * @param state World state to manipulate.
      * @return The result of the operation, as returned by the mutator.
      */
     virtual WorldOperationResult execute(WorldState &state) = 0;
 
+    /**
+     * Return the part of \a state the operation touches when executed.
+     *
+     * The default implementation returns an exclusive footprint.
+     *
+     * @param state World state the operation will be executed against.
+     * @return Footprint of the operation.
+     */
+    virtual WorldOperationFootprint footprint(const WorldState &state) const;
+
 public:
     /**
      * Use the given \a msg to recover a world command which can be applied
@@ -169,17 +225,42 @@ public:
      * If the message has more than one command payload, which one is chosen
      * is unspecified.
      *
+     * Brushes referred to by ID are resolved using \a brushes.
+     *
      * @param msg A valid message containing a world command.
+     * @param brushes Dictionary of the brushes registered with the server.
      * @return A new WorldOperation instance which executes the world command
-     * described by the given message.
+     * described by the given message, or nullptr if the message does not
+     * describe a valid world operation (e.g. if it refers to an unknown
+     * brush or carries no operation at all).
      */
     static std::unique_ptr<WorldOperation> from_message(
-            const sim::messages::WorldCommand &msg);
+            const sim::messages::WorldCommand &msg,
+            const BrushDictionary &brushes);
 };
 
 typedef std::unique_ptr<WorldOperation> WorldOperationPtr;
 
 
+/**
+ * Partition a sequence of operations into waves of operations which can be
+ * executed concurrently.
+ *
+ * Each operation is assigned to the earliest wave after the waves of all
+ * preceding operations it conflicts with. Executing the waves in order thus
+ * preserves the order of conflicting operations, while no two operations in
+ * the same wave conflict. Operations with exclusive footprints always end
+ * up alone in their wave.
+ *
+ * @param footprints Footprints of the operations, in execution order.
+ * @param waves Receives the wave index for each operation.
+ * @return Number of waves.
+ */
+unsigned int partition_into_waves(
+        const std::vector<WorldOperationFootprint> &footprints,
+        std::vector<unsigned int> &waves);
+
+
 class AbstractClient
 {
 public:
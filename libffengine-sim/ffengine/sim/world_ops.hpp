@@ -26,6 +26,7 @@ the AUTHORS file.
 
 #include "ffengine/math/curve.hpp"
 
+#include "ffengine/sim/brush_dictionary.hpp"
 #include "ffengine/sim/world.hpp"
 
 
@@ -40,14 +41,40 @@ public:
             const unsigned int brush_size,
             const std::vector<float> &density_map,
             const float brush_strength);
+    /**
+     * Construct the operation from a shared density map, e.g. one interned
+     * in a BrushDictionary. The density map is not copied.
+     */
+    BrushWorldOperation(
+            const float xc, const float yc,
+            const unsigned int brush_size,
+            SharedDensityMap density_map,
+            const float brush_strength);
 
 protected:
     const float m_xc;
     const float m_yc;
     const unsigned int m_brush_size;
-    const std::vector<float> m_density_map;
+    const SharedDensityMap m_density_map;
     const float m_brush_strength;
 
+protected:
+    /**
+     * Rect of a grid of \a grid_size times \a grid_size cells which is
+     * covered by the brush, grown by \a margin on each side and clipped to
+     * the grid.
+     */
+    TerrainRect brush_rect(const unsigned int grid_size,
+                           const unsigned int margin = 0) const;
+
+    /**
+     * Non-exclusive footprint covering the terrain below the brush, grown
+     * by \a margin.
+     */
+    WorldOperationFootprint terrain_footprint(
+            const WorldState &state,
+            const unsigned int margin = 0) const;
+
 };
 
 
@@ -84,6 +111,7 @@ public:
 
 public:
     WorldOperationResult execute(WorldState &state) override;
+    WorldOperationFootprint footprint(const WorldState &state) const override;
 
 };
 
@@ -116,17 +144,31 @@ public:
             const float brush_strength,
             const float reference_height
             );
+    TerraformLevel(
+            const float xc, const float yc,
+            const unsigned int brush_size,
+            SharedDensityMap density_map,
+            const float brush_strength,
+            const float reference_height
+            );
 
 private:
     const float m_reference_height;
 
 public:
     WorldOperationResult execute(WorldState &state) override;
+    WorldOperationFootprint footprint(const WorldState &state) const override;
 
 };
 
 class TerraformSmooth: public BrushWorldOperation
 {
+public:
+    /**
+     * Radius of the neighbourhood which is averaged for each vertex.
+     */
+    static constexpr unsigned int parzen_radius = 3;
+
 public:
     using BrushWorldOperation::BrushWorldOperation;
 
@@ -139,6 +181,7 @@ protected:
 
 public:
     WorldOperationResult execute(WorldState &state) override;
+    WorldOperationFootprint footprint(const WorldState &state) const override;
 
 };
 
@@ -154,6 +197,15 @@ public:
             const Terrain::height_t source_height,
             const Vector2f destination_point,
             const Terrain::height_t destination_height);
+    TerraformRamp(
+            const float xc, const float yc,
+            const unsigned int brush_size,
+            SharedDensityMap density_map,
+            const float brush_strength,
+            const Vector2f source_point,
+            const Terrain::height_t source_height,
+            const Vector2f destination_point,
+            const Terrain::height_t destination_height);
 
 private:
     const Vector2f m_source_point;
@@ -163,6 +215,7 @@ private:
 
 public:
     WorldOperationResult execute(WorldState &state) override;
+    WorldOperationFootprint footprint(const WorldState &state) const override;
 
 };
 
@@ -174,6 +227,7 @@ public:
 
 public:
     WorldOperationResult execute(WorldState &state) override;
+    WorldOperationFootprint footprint(const WorldState &state) const override;
 
 };
 
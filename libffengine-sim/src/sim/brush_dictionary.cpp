@@ -0,0 +1,147 @@
+/**********************************************************************
+File name: brush_dictionary.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include "ffengine/sim/brush_dictionary.hpp"
+
+#include <cstring>
+
+
+namespace sim {
+
+static std::size_t hash_density_map(const unsigned int size,
+                                    const std::vector<float> &density_map)
+{
+    // FNV-1a over the raw bytes; identical brushes are sampled identically,
+    // so bitwise equality is what we are after
+    std::uint64_t hash = 14695981039346656037ULL;
+    auto feed = [&hash](const void *data, std::size_t bytes)
+    {
+        const std::uint8_t *ptr = static_cast<const std::uint8_t*>(data);
+        for (std::size_t i = 0; i < bytes; ++i) {
+            hash = (hash ^ ptr[i]) * 1099511628211ULL;
+        }
+    };
+    feed(&size, sizeof(size));
+    feed(density_map.data(), density_map.size()*sizeof(float));
+    return std::size_t(hash);
+}
+
+
+/* sim::BrushDictionary */
+
+constexpr BrushID BrushDictionary::INVALID_BRUSH_ID;
+constexpr std::size_t BrushDictionary::MAX_BRUSHES;
+constexpr unsigned int BrushDictionary::MAX_BRUSH_SIZE;
+
+BrushDictionary::BrushDictionary():
+    m_next_id(INVALID_BRUSH_ID+1)
+{
+
+}
+
+BrushID BrushDictionary::intern(const unsigned int size,
+                                std::vector<float> &&density_map)
+{
+    if (size == 0 || size > MAX_BRUSH_SIZE ||
+            density_map.size() != size*size)
+    {
+        return INVALID_BRUSH_ID;
+    }
+
+    const std::size_t hash = hash_density_map(size, density_map);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto range = m_ids_by_hash.equal_range(hash);
+    for (auto iter = range.first; iter != range.second; ++iter) {
+        const Entry &candidate = m_brushes.at(iter->second);
+        if (candidate.brush.size == size &&
+                std::memcmp(candidate.brush.density_map->data(),
+                            density_map.data(),
+                            density_map.size()*sizeof(float)) == 0)
+        {
+            touch(candidate);
+            return iter->second;
+        }
+    }
+
+    if (m_brushes.size() >= MAX_BRUSHES) {
+        evict_lru();
+    }
+
+    // IDs are only reused after wrapping around, and never while in use
+    BrushID id;
+    do {
+        id = m_next_id++;
+    } while (id == INVALID_BRUSH_ID || m_brushes.count(id) > 0);
+
+    m_lru.push_front(id);
+    m_brushes.emplace(id, Entry{
+                          Brush{size,
+                                std::make_shared<const std::vector<float> >(
+                                    std::move(density_map))},
+                          hash,
+                          m_lru.begin()});
+    m_ids_by_hash.emplace(hash, id);
+    return id;
+}
+
+void BrushDictionary::evict_lru()
+{
+    const BrushID id = m_lru.back();
+    m_lru.pop_back();
+
+    auto iter = m_brushes.find(id);
+    auto range = m_ids_by_hash.equal_range(iter->second.hash);
+    for (auto hash_iter = range.first; hash_iter != range.second; ++hash_iter) {
+        if (hash_iter->second == id) {
+            m_ids_by_hash.erase(hash_iter);
+            break;
+        }
+    }
+    m_brushes.erase(iter);
+}
+
+void BrushDictionary::touch(const Entry &entry) const
+{
+    m_lru.splice(m_lru.begin(), m_lru, entry.lru_pos);
+}
+
+bool BrushDictionary::lookup(const BrushID id, Brush &dest) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto iter = m_brushes.find(id);
+    if (iter == m_brushes.end()) {
+        return false;
+    }
+    touch(iter->second);
+    dest = iter->second.brush;
+    return true;
+}
+
+std::size_t BrushDictionary::size() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_brushes.size();
+}
+
+}
@@ -62,7 +62,7 @@ Fluid::Source::Source(Object::ID object_id,
 
 Fluid::Fluid(const Terrain &terrain):
     m_blocks((terrain.size()-1) / IFluidSim::block_size),
-    m_impl(new NativeFluidSim(m_blocks, terrain)),
+    m_impl(new NativeFluidSim(m_blocks, terrain, FluidKernel::SIMD)),
     m_sources_invalidated(false),
     m_terrain_update_conn(terrain.heightmap_updated().connect(
                               sigc::mem_fun(*this, &Fluid::terrain_updated)))
@@ -91,6 +91,22 @@ void Fluid::copy_from_block(Vector4f *dest,
                             const unsigned int row_stride,
                             const unsigned int step) const
 {
+    if (src.collapsed()) {
+        for (unsigned int y = y0; y < y0 + height; y += step) {
+            for (unsigned int x = x0; x < x0 + width; x += step) {
+                const sim::FluidCell cell = src.proxy_cell(x, y);
+                *dest++ = Vector4f(
+                            src.local_cell_meta(x, y)->terrain_height,
+                            cell.fluid_height,
+                            cell.fluid_flow[0],
+                            cell.fluid_flow[1]);
+            }
+
+            dest += row_stride;
+        }
+        return;
+    }
+
     for (unsigned int y = y0; y < y0 + height; y += step) {
         const sim::FluidCell *cell = src.local_cell_front(x0, y);
         const sim::FluidCellMeta *meta = src.local_cell_meta(x0, y);
@@ -248,6 +264,11 @@ void Fluid::set_ocean_level(const float level)
     m_impl->set_ocean_level(level);
 }
 
+void Fluid::set_step_config(const FluidStepConfig &config)
+{
+    m_impl->set_step_config(config);
+}
+
 void Fluid::reset()
 {
     m_blocks.reset(m_ocean_level);
@@ -271,6 +292,8 @@ void Fluid::copy_block(Vector4f *dest,
 
     used_active = false;
 
+    auto lock = m_blocks.read_frontbuffer();
+
     while (ybase < y0 + oversampled_height) {
         const unsigned int blocky = ybase / IFluidSim::block_size;
         const unsigned int celly = ybase % IFluidSim::block_size;
@@ -23,8 +23,20 @@ the AUTHORS file.
 **********************************************************************/
 #include "ffengine/sim/fluid_base.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 namespace sim {
 
+#if defined(FFENGINE_FLUID_DOUBLE)
+const char *const fluid_precision_name = "double";
+#elif defined(FFENGINE_FLUID_HALF)
+const char *const fluid_precision_name = "half";
+#else
+const char *const fluid_precision_name = "single";
+#endif
+
 const FluidFloat IFluidSim::flow_damping = 0.995;
 /* const FluidFloat Fluid::flow_damping = 0.1; */
 const FluidFloat IFluidSim::flow_friction = 0.6;
@@ -32,6 +44,16 @@ const FluidFloat IFluidSim::visualization_threshold = 1e-6;
 const FluidFloat IFluidSim::source_capacity_scale = 0.5;
 const unsigned int IFluidSim::block_size = 60;
 
+/* sim::FluidStepConfig */
+
+FluidStepConfig::FluidStepConfig():
+    substeps(1),
+    adaptive(false),
+    frame_budget(16000)
+{
+
+}
+
 /* sim::IFluidSim */
 
 IFluidSim::~IFluidSim()
@@ -50,13 +72,6 @@ FluidCellMeta::FluidCellMeta():
 }
 
 
-FluidCell::FluidCell():
-    fluid_height(0.f),
-    fluid_flow{0.f, 0.f}
-{
-
-}
-
 /* sim::FluidBlockMeta */
 
 FluidBlockMeta::FluidBlockMeta():
@@ -74,6 +89,7 @@ const FluidFloat FluidBlock::CHANGE_BACKLOG_FILTER_CONSTANT = 0.9f;
 const FluidFloat FluidBlock::CHANGE_BACKLOG_THRESHOLD  = 0.0001f;
 const FluidFloat FluidBlock::REACTIVATION_THRESHOLD = 0.00012f;
 const FluidFloat FluidBlock::CHANGE_TRANSFER_FACTOR = 1.f;
+const FluidFloat FluidBlock::COLLAPSE_TOLERANCE = 1e-3f;
 
 
 FluidBlock::FluidBlock(const unsigned int x,
@@ -84,11 +100,86 @@ FluidBlock::FluidBlock(const unsigned int x,
     m_back_meta(new FluidBlockMeta()),
     m_meta_cells(IFluidSim::block_size*IFluidSim::block_size),
     m_back_cells(m_meta_cells.size()),
-    m_front_cells(m_meta_cells.size())
+    m_front_cells(m_meta_cells.size()),
+    m_collapsed(false),
+    m_collapse_checked(false),
+    m_proxy_absolute_height(0)
 {
 
 }
 
+bool FluidBlock::try_collapse()
+{
+    if (m_collapsed) {
+        return true;
+    }
+    if (m_collapse_checked) {
+        return false;
+    }
+    m_collapse_checked = true;
+
+    if (m_front_meta->active || m_back_meta->active) {
+        return false;
+    }
+
+    bool wet = false;
+    for (const FluidCell &cell: m_front_cells)
+    {
+        if (cell.fluid_height > IFluidSim::visualization_threshold) {
+            wet = true;
+            break;
+        }
+    }
+
+    FluidFloat proxy_height = std::numeric_limits<FluidFloat>::lowest();
+    if (wet) {
+        if (!m_front_meta->flat) {
+            return false;
+        }
+        proxy_height = m_front_meta->flat_absolute_height;
+    }
+
+    for (unsigned int i = 0; i < m_meta_cells.size(); ++i)
+    {
+        const FluidCell &cell = m_front_cells[i];
+        const FluidFloat height = std::max(
+                    FluidFloat(0),
+                    proxy_height - m_meta_cells[i].terrain_height);
+        if (std::fabs(cell.fluid_height - height) > COLLAPSE_TOLERANCE ||
+                std::fabs(cell.fluid_flow[0]) > COLLAPSE_TOLERANCE ||
+                std::fabs(cell.fluid_flow[1]) > COLLAPSE_TOLERANCE)
+        {
+            return false;
+        }
+    }
+
+    m_proxy_absolute_height = proxy_height;
+    m_collapsed = true;
+    std::vector<FluidCell>().swap(m_front_cells);
+    std::vector<FluidCell>().swap(m_back_cells);
+    return true;
+}
+
+void FluidBlock::expand()
+{
+    if (!m_collapsed) {
+        return;
+    }
+
+    m_front_cells.resize(m_meta_cells.size());
+    m_back_cells.resize(m_meta_cells.size());
+    for (unsigned int i = 0; i < m_meta_cells.size(); ++i)
+    {
+        FluidCell &front = m_front_cells[i];
+        front = proxy_cell(i % IFluidSim::block_size,
+                           i / IFluidSim::block_size);
+        m_back_cells[i] = front;
+    }
+
+    m_collapsed = false;
+    m_collapse_checked = false;
+}
+
 void FluidBlock::reset(const float ocean_level)
 {
     m_front_meta = std::make_unique<FluidBlockMeta>();
@@ -97,6 +188,8 @@ void FluidBlock::reset(const float ocean_level)
     m_back_meta->flat_absolute_height = ocean_level;
     m_front_cells = std::vector<FluidCell>(m_meta_cells.size());
     m_back_cells = std::vector<FluidCell>(m_meta_cells.size());
+    m_collapsed = false;
+    m_collapse_checked = false;
 
     for (unsigned int i = 0; i < m_meta_cells.size(); ++i)
     {
@@ -105,7 +198,7 @@ void FluidBlock::reset(const float ocean_level)
         FluidCell &back = m_back_cells[i];
         front.fluid_flow[0] = 0;
         front.fluid_flow[1] = 0;
-        front.fluid_height = std::max(0.f, ocean_level - meta.terrain_height);
+        front.fluid_height = std::max(FluidFloat(0), ocean_level - meta.terrain_height);
         back = front;
     }
 
@@ -113,12 +206,24 @@ void FluidBlock::reset(const float ocean_level)
     set_active(false);
 }
 
+/* sim::FluidBlockCounts */
+
+FluidBlockCounts::FluidBlockCounts():
+    active(0),
+    frontier(0),
+    idle(0),
+    collapsed(0)
+{
+
+}
+
 /* sim::FluidBlocks */
 
 FluidBlocks::FluidBlocks(const unsigned int block_count_per_axis):
     m_blocks_per_axis(block_count_per_axis),
     m_cells_per_axis(IFluidSim::block_size*m_blocks_per_axis),
-    m_blocks()
+    m_blocks(),
+    m_active_neighbours(m_blocks_per_axis*m_blocks_per_axis, 0)
 {
     m_blocks.reserve(m_blocks_per_axis*m_blocks_per_axis);
     for (unsigned int y = 0; y < m_blocks_per_axis; ++y)
@@ -128,14 +233,150 @@ FluidBlocks::FluidBlocks(const unsigned int block_count_per_axis):
             m_blocks.emplace_back(x, y);
         }
     }
+    m_active_blocks.reserve(m_blocks.size());
+    m_frontier_blocks.reserve(m_blocks.size());
+    recount_active_neighbours();
+    rebuild_work_lists();
+}
+
+void FluidBlocks::add_active_neighbour(const unsigned int blockx,
+                                       const unsigned int blocky,
+                                       const int delta)
+{
+    if (blockx > 0) {
+        m_active_neighbours[blocky*m_blocks_per_axis+blockx-1] += delta;
+    }
+    if (blockx < m_blocks_per_axis-1) {
+        m_active_neighbours[blocky*m_blocks_per_axis+blockx+1] += delta;
+    }
+    if (blocky > 0) {
+        m_active_neighbours[(blocky-1)*m_blocks_per_axis+blockx] += delta;
+    }
+    if (blocky < m_blocks_per_axis-1) {
+        m_active_neighbours[(blocky+1)*m_blocks_per_axis+blockx] += delta;
+    }
+}
+
+void FluidBlocks::recount_active_neighbours()
+{
+    std::fill(m_active_neighbours.begin(), m_active_neighbours.end(), 0);
+    for (FluidBlock &block: m_blocks)
+    {
+        if (block.front_meta().active) {
+            add_active_neighbour(block.x(), block.y(), 1);
+        }
+    }
+}
+
+bool FluidBlocks::has_active_diagonal(const unsigned int blockx,
+                                      const unsigned int blocky) const
+{
+    const bool left = blockx > 0;
+    const bool right = blockx < m_blocks_per_axis-1;
+    const bool top = blocky > 0;
+    const bool bottom = blocky < m_blocks_per_axis-1;
+    return (left && top && block(blockx-1, blocky-1)->front_meta().active) ||
+            (right && top && block(blockx+1, blocky-1)->front_meta().active) ||
+            (left && bottom && block(blockx-1, blocky+1)->front_meta().active) ||
+            (right && bottom && block(blockx+1, blocky+1)->front_meta().active);
+}
+
+void FluidBlocks::rebuild_work_lists()
+{
+    m_active_blocks.clear();
+    m_frontier_blocks.clear();
+    m_counts.collapsed = 0;
+    for (unsigned int i = 0; i < m_blocks.size(); ++i)
+    {
+        FluidBlock &block = m_blocks[i];
+        if (block.front_meta().active) {
+            m_active_blocks.push_back(&block);
+        } else if (m_active_neighbours[i] > 0) {
+            // frontier blocks get their seams written by the simulation
+            block.expand();
+            m_frontier_blocks.push_back(&block);
+        } else if (has_active_diagonal(block.x(), block.y())) {
+            // the corner cells are read by the neighbourhood of the active
+            // block, which needs the cell buffers
+            block.expand();
+        } else if (block.try_collapse()) {
+            m_counts.collapsed += 1;
+        }
+    }
+
+    m_counts.active = m_active_blocks.size();
+    m_counts.frontier = m_frontier_blocks.size();
+    m_counts.idle = m_blocks.size() - m_counts.active - m_counts.frontier;
+}
+
+void FluidBlocks::swap_active_blocks()
+{
+    // we need to hold the frontbuffer lock to be safe -- this will ensure
+    // that no user who is accessing the frontbuffer will suddenly be using
+    // the backbuffer
+    std::unique_lock<std::shared_timed_mutex> lock(m_frontbuffer_mutex);
+    for (FluidBlock &block: m_blocks)
+    {
+        const bool was_active = block.front_meta().active;
+        if (block.back_meta().active || was_active)
+        {
+            block.expand();
+            block.swap_buffers();
+            const bool is_active = block.front_meta().active;
+            if (is_active != was_active) {
+                add_active_neighbour(block.x(), block.y(),
+                                     is_active ? 1 : -1);
+            }
+        }
+    }
+    rebuild_work_lists();
+}
+
+void FluidBlocks::expand_all()
+{
+    std::unique_lock<std::shared_timed_mutex> lock(m_frontbuffer_mutex);
+    for (FluidBlock &block: m_blocks)
+    {
+        block.expand();
+    }
+}
+
+void FluidBlocks::expand_cells(const TerrainRect &cells)
+{
+    if (cells.empty()) {
+        return;
+    }
+
+    const unsigned int x0 = std::min(cells.x0() / IFluidSim::block_size,
+                                     m_blocks_per_axis-1);
+    const unsigned int y0 = std::min(cells.y0() / IFluidSim::block_size,
+                                     m_blocks_per_axis-1);
+    const unsigned int x1 = std::min((cells.x1() + IFluidSim::block_size - 1)
+                                     / IFluidSim::block_size,
+                                     m_blocks_per_axis);
+    const unsigned int y1 = std::min((cells.y1() + IFluidSim::block_size - 1)
+                                     / IFluidSim::block_size,
+                                     m_blocks_per_axis);
+
+    std::unique_lock<std::shared_timed_mutex> lock(m_frontbuffer_mutex);
+    for (unsigned int y = y0; y < y1; ++y)
+    {
+        for (unsigned int x = x0; x < x1; ++x)
+        {
+            block(x, y)->expand();
+        }
+    }
 }
 
 void FluidBlocks::reset(const float ocean_level)
 {
+    std::unique_lock<std::shared_timed_mutex> lock(m_frontbuffer_mutex);
     for (FluidBlock &block: m_blocks)
     {
         block.reset(ocean_level);
     }
+    recount_active_neighbours();
+    rebuild_work_lists();
 }
 
 }
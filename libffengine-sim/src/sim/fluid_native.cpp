@@ -42,6 +42,8 @@ static io::Logger &logger = io::logging().get_logger("sim.fluid.native");
 
 static const FluidCell null_cell;
 
+typedef GenericFluidCell<FluidFloat> FluidComputeCell;
+
 template <typename T>
 T first(T v1, T v2)
 {
@@ -59,45 +61,179 @@ constexpr bool is_close(float_t base_value, float_t other_value, float_t relativ
     return std::abs(base_value - other_value) < relative_factor*std::abs(base_value);
 }
 
-static unsigned int determine_worker_count()
+static FluidTileKernel determine_tile_kernel(const FluidKernel kernel)
+{
+#ifdef FFENGINE_FLUID_DOUBLE
+    if (kernel != FluidKernel::SCALAR) {
+        logger.logf(io::LOG_WARNING,
+                    "tile fluid kernels only support single precision, "
+                    "falling back to scalar implementation");
+    }
+    return nullptr;
+#else
+    switch (kernel)
+    {
+    case FluidKernel::SCALAR:
+        return nullptr;
+    case FluidKernel::HALO:
+        return &fluid_tile_step_portable;
+    case FluidKernel::SIMD:
+    {
+        FluidTileKernel result = select_fluid_tile_kernel();
+        if (!result) {
+            logger.logf(io::LOG_WARNING,
+                        "no vectorised fluid kernel available, "
+                        "falling back to portable implementation");
+            return &fluid_tile_step_portable;
+        }
+        return result;
+    }
+    }
+    return nullptr;
+#endif
+}
+
+/* sim::NativeFluidSim::BlockStats */
+
+struct NativeFluidSim::BlockStats
 {
-    unsigned int thread_count = std::thread::hardware_concurrency();
-    if (thread_count == 0) {
-        thread_count = 2;
-        logger.logf(io::LOG_ERROR,
-                    "failed to determine hardware concurrency. "
-                    "giving it a try with %u",
-                    thread_count);
+    BlockStats():
+        change_accum(0.f),
+        wet_cells(0.f),
+        average_height(0.f),
+        min_abs_height(std::numeric_limits<FluidFloat>::max()),
+        max_abs_height(std::numeric_limits<FluidFloat>::lowest())
+    {
+
+    }
+
+    FluidFloat change_accum;
+    FluidFloat wet_cells;
+
+    FluidFloat average_height;
+    FluidFloat min_abs_height;
+    FluidFloat max_abs_height;
+
+    inline void accum_cell(const FluidCell &back,
+                           const FluidCell &front,
+                           const FluidCellMeta &meta)
+    {
+        change_accum += std::abs(back.fluid_height - front.fluid_height);
+        if (back.fluid_height > IFluidSim::visualization_threshold ||
+                front.fluid_height > IFluidSim::visualization_threshold)
+        {
+            wet_cells += 1.f;
+
+            const FluidFloat abs_height = back.fluid_height + meta.terrain_height;
+            average_height += abs_height;
+            max_abs_height = std::max(abs_height, max_abs_height);
+            min_abs_height = std::min(abs_height, min_abs_height);
+        }
     }
-    return thread_count;
+};
+
+/* sim::FluidFrameTimings */
+
+FluidFrameTimings::FluidFrameTimings():
+    dispatch(0),
+    work(0),
+    drain(0)
+{
+
 }
 
 /* sim::NativeFluidSim */
 
+static const std::int64_t no_work_start = std::numeric_limits<std::int64_t>::max();
+static const std::int64_t no_work_end = std::numeric_limits<std::int64_t>::min();
+
+static unsigned int determine_epoch_workers(const FluidDispatch dispatch,
+                                            const unsigned int requested,
+                                            const ffe::TaskScheduler &scheduler)
+{
+    if (dispatch != FluidDispatch::EPOCH) {
+        return 0;
+    }
+    if (requested > 0) {
+        return requested;
+    }
+
+    // the dedicated threads spin while waiting, so they must only use
+    // cores which are not already covered by the shared pool; the
+    // coordinator takes part in the work itself and needs one of them
+    unsigned int hardware_threads = std::thread::hardware_concurrency();
+    if (hardware_threads == 0) {
+        hardware_threads = scheduler.workers();
+    }
+    const unsigned int spare_threads =
+            (hardware_threads > scheduler.workers()
+             ? hardware_threads - scheduler.workers()
+             : 0);
+    return (spare_threads > 1 ? spare_threads - 1 : 0);
+}
+
+static inline std::int64_t dispatch_clock_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 NativeFluidSim::NativeFluidSim(FluidBlocks &blocks,
-                               const Terrain &terrain):
+                               const Terrain &terrain,
+                               const FluidKernel kernel,
+                               const FluidDispatch dispatch,
+                               const unsigned int epoch_workers):
     m_blocks(blocks),
     m_terrain(terrain),
-    m_worker_count(determine_worker_count()),
+    m_scheduler(ffe::scheduler()),
+    m_tile_kernel(determine_tile_kernel(kernel)),
+    m_kernel(!m_tile_kernel
+             ? FluidKernel::SCALAR
+             : (m_tile_kernel == &fluid_tile_step_portable
+                ? FluidKernel::HALO
+                : kernel)),
+    m_epoch_workers(determine_epoch_workers(dispatch, epoch_workers,
+                                            m_scheduler)),
+    m_dispatch(m_epoch_workers == 0 ? FluidDispatch::SCHEDULER : dispatch),
+    m_terrain_dirty(m_blocks.blocks_per_axis()*m_blocks.blocks_per_axis(), 0),
+    m_ocean_level_update(0),
+    m_ocean_level_update_set(false),
     m_run(false),
     m_done(false),
-    m_worker_to_start(0),
-    m_worker_terminate(false),
-    m_worker_stopped(m_worker_count),
-    m_worker_block_ctr(0),
     m_terminated(false),
+    m_first_work_start(no_work_start),
+    m_last_work_end(no_work_end),
+    m_frame_epoch(0),
+    m_frame_epoch_sleepers(0),
+    m_worker_block_ctr(0),
+    m_worker_block_count(0),
     m_coordinator_thread(std::bind(&NativeFluidSim::coordinator_impl,
-                                   this))
+                                   this)),
+    m_ocean_level(0),
+    m_ocean_level_changed(false),
+    m_last_frame_duration(0),
+    m_last_frame_steps(0),
+    m_adaptive_steps(std::numeric_limits<unsigned int>::max()),
+    m_report_start(std::chrono::steady_clock::now()),
+    m_report_frames(0),
+    m_report_steps(0)
 {
-    if (!std::atomic_is_lock_free(&m_worker_block_ctr)) {
-        logger.logf(io::LOG_WARNING, "fluid sim counter is not lock-free.");
-    } else {
-        logger.logf(io::LOG_INFO, "fluid sim counter is lock-free.");
+    if (dispatch == FluidDispatch::EPOCH &&
+            m_dispatch != FluidDispatch::EPOCH) {
+        logger.logf(io::LOG_WARNING,
+                    "fluidsim: no cores left next to the %u scheduler "
+                    "workers, falling back to scheduler dispatch. reduce "
+                    "the pool with configure_scheduler()",
+                    m_scheduler.workers());
     }
 
-    m_worker_threads.reserve(m_worker_count);
-    for (unsigned int i = 0; i < m_worker_count; i++) {
-        m_worker_threads.emplace_back(std::bind(&NativeFluidSim::worker_impl, this));
+    if (m_dispatch == FluidDispatch::EPOCH) {
+        m_frame_barrier = std::make_unique<ffe::SpinBarrier>(m_epoch_workers+1);
+        m_worker_threads.reserve(m_epoch_workers);
+        for (unsigned int i = 0; i < m_epoch_workers; ++i) {
+            m_worker_threads.emplace_back(std::bind(&NativeFluidSim::worker_impl,
+                                                    this));
+        }
     }
 }
 
@@ -106,6 +242,9 @@ NativeFluidSim::~NativeFluidSim()
     m_terminated = true;
     m_control_wakeup.notify_all();
     m_coordinator_thread.join();
+
+    m_frame_epoch.fetch_add(1, std::memory_order_release);
+    ffe::wake_all(m_frame_epoch, m_frame_epoch_sleepers);
     for (auto &thread: m_worker_threads) {
         thread.join();
     }
@@ -116,6 +255,7 @@ void NativeFluidSim::coordinator_impl()
     logger.logf(io::LOG_INFO, "fluidsim: %u cells in %u blocks",
                 m_blocks.cells_per_axis()*m_blocks.cells_per_axis(),
                 m_blocks.blocks_per_axis()*m_blocks.blocks_per_axis());
+    FluidStepConfig config;
     while (!m_terminated) {
         {
             std::unique_lock<std::mutex> control_lock(m_control_mutex);
@@ -129,24 +269,16 @@ void NativeFluidSim::coordinator_impl()
                 break;
             }
             m_run = false;
+            config = m_step_config;
         }
+        const std::chrono::steady_clock::time_point t_frame_start =
+                std::chrono::steady_clock::now();
 
 #ifdef TIMELOG_FLUIDSIM
         const timelog_clock::time_point t0 = timelog_clock::now();
         timelog_clock::time_point t_sync, t_sim;
 #endif
-        // sync terrain
-        TerrainRect updated_rect;
-        {
-            std::lock_guard<std::mutex> lock(m_terrain_update_mutex);
-            updated_rect = m_terrain_update;
-            m_terrain_update = NotARect;
-        }
-        if (!updated_rect.empty()) {
-            logger.logf(io::LOG_INFO, "terrain to sync (%u vertices)",
-                        updated_rect.area());
-            sync_terrain(updated_rect);
-        }
+        sync_terrain();
 
         {
             std::lock_guard<std::mutex> lock(m_ocean_level_update_mutex);
@@ -156,11 +288,38 @@ void NativeFluidSim::coordinator_impl()
                 m_ocean_level_changed = true;
             }
         }
+        if (m_ocean_level_changed) {
+            // all blocks get simulated
+            m_blocks.expand_all();
+        }
 
 #ifdef TIMELOG_FLUIDSIM
         t_sync = timelog_clock::now();
 #endif
-        coordinator_run_workers();
+        unsigned int steps = std::max(config.substeps, 1U);
+        if (config.adaptive) {
+            steps = std::min(std::max(m_adaptive_steps, 1U), steps);
+        }
+
+        m_last_frame_timings = FluidFrameTimings();
+        for (unsigned int step = 0; step < steps; ++step) {
+            if (step > 0) {
+                // the sub-steps run back-to-back, without waiting for
+                // start_frame(); readers outside the simulation are kept out
+                // by the front buffer lock which the swap takes
+                m_blocks.swap_active_blocks();
+            }
+            coordinator_run_workers();
+            m_ocean_level_changed = false;
+        }
+
+        m_last_frame_duration = std::chrono::steady_clock::now() - t_frame_start;
+        m_last_frame_steps = steps;
+        if (config.adaptive) {
+            m_adaptive_steps = coordinator_adapt_steps(config, steps,
+                                                       m_last_frame_duration);
+        }
+        coordinator_report_steps(config, steps);
 
         {
             std::lock_guard<std::mutex> done_lock(m_done_mutex);
@@ -169,84 +328,294 @@ void NativeFluidSim::coordinator_impl()
         }
         m_done_wakeup.notify_all();
 
-        m_ocean_level_changed = false;
-
 #ifdef TIMELOG_FLUIDSIM
         t_sim = timelog_clock::now();
         logger.logf(io::LOG_DEBUG, "fluid: sync time: %.2f ms",
                     TIMELOG_ms(t_sync - t0));
         logger.logf(io::LOG_DEBUG, "fluid: sim time: %.2f ms",
                     TIMELOG_ms(t_sim - t_sync));
+        logger.logf(io::LOG_DEBUG, "fluid: dispatch: %.3f ms, work: %.3f ms, "
+                                   "drain: %.3f ms",
+                    TIMELOG_ms(m_last_frame_timings.dispatch),
+                    TIMELOG_ms(m_last_frame_timings.work),
+                    TIMELOG_ms(m_last_frame_timings.drain));
+        logger.logf(io::LOG_DEBUG, "fluid: blocks: %u active, %u frontier, "
+                                   "%u idle (%u collapsed)",
+                    m_blocks.block_counts().active,
+                    m_blocks.block_counts().frontier,
+                    m_blocks.block_counts().idle,
+                    m_blocks.block_counts().collapsed);
 #endif
     }
-    {
-        std::lock_guard<std::mutex> lock(m_worker_task_mutex);
-        m_worker_terminate = true;
-    }
-    m_worker_wakeup.notify_all();
 }
 
 void NativeFluidSim::coordinator_run_workers()
 {
+    unsigned int block_count;
+    if (m_ocean_level_changed) {
+        // all blocks get activated, the work lists are useless
+        block_count = m_blocks.blocks_per_axis()*m_blocks.blocks_per_axis();
+    } else {
+        block_count = m_blocks.active_blocks().size() +
+                m_blocks.frontier_blocks().size();
+    }
+
+    m_first_work_start.store(no_work_start, std::memory_order_relaxed);
+    m_last_work_end.store(no_work_end, std::memory_order_relaxed);
+    const std::int64_t t_publish = dispatch_clock_ns();
+
+    switch (m_dispatch)
+    {
+    case FluidDispatch::SCHEDULER:
     {
-        std::lock_guard<std::mutex> lock(m_worker_done_mutex);
-        assert(m_worker_stopped == m_worker_count);
-        m_worker_stopped = 0;
+        dispatch_scheduler(block_count);
+        break;
     }
+    case FluidDispatch::EPOCH:
     {
-        std::lock_guard<std::mutex> lock(m_worker_task_mutex);
-        assert(m_worker_to_start == 0);
-        m_worker_to_start = m_worker_count;
-        // make sure all blocks run, we don’t need memory ordering, the mutex
-        // implicitly orders
-        m_worker_block_ctr.store(0, std::memory_order_relaxed);
+        dispatch_epoch(block_count);
+        break;
+    }
+    }
+
+    const std::int64_t t_resumed = dispatch_clock_ns();
+    const std::int64_t t_first = m_first_work_start.load(std::memory_order_relaxed);
+    const std::int64_t t_last = m_last_work_end.load(std::memory_order_relaxed);
+    if (t_first == no_work_start) {
+        m_last_frame_timings.dispatch += std::chrono::nanoseconds(t_resumed - t_publish);
+    } else {
+        m_last_frame_timings.dispatch += std::chrono::nanoseconds(t_first - t_publish);
+        m_last_frame_timings.work += std::chrono::nanoseconds(t_last - t_first);
+        m_last_frame_timings.drain += std::chrono::nanoseconds(t_resumed - t_last);
+    }
+}
+
+unsigned int NativeFluidSim::coordinator_adapt_steps(
+        const FluidStepConfig &config,
+        const unsigned int steps,
+        const std::chrono::nanoseconds duration)
+{
+    const std::chrono::nanoseconds budget = config.frame_budget;
+    unsigned int new_steps = steps;
+    if (duration > budget) {
+        // scale down proportionally to the overrun
+        new_steps = std::max(
+                    1U,
+                    static_cast<unsigned int>(steps * budget.count() /
+                                              duration.count()));
+    } else if (steps < config.substeps &&
+               duration + duration / steps <= budget) {
+        // one more step still fits into the budget
+        new_steps = steps + 1;
+    }
+
+    if (new_steps != steps) {
+        logger.logf(io::LOG_DEBUG,
+                    "adapting steps per frame from %u to %u "
+                    "(frame took %.2f ms, budget is %.2f ms)",
+                    steps, new_steps,
+                    std::chrono::duration<float, std::milli>(duration).count(),
+                    std::chrono::duration<float, std::milli>(budget).count());
+    }
+    return new_steps;
+}
+
+void NativeFluidSim::coordinator_report_steps(const FluidStepConfig &config,
+                                              const unsigned int steps)
+{
+    static const std::chrono::seconds report_interval(10);
+
+    m_report_frames += 1;
+    m_report_steps += steps;
+
+    const std::chrono::steady_clock::time_point now =
+            std::chrono::steady_clock::now();
+    const std::chrono::duration<float> elapsed = now - m_report_start;
+    if (elapsed < report_interval) {
+        return;
     }
-    // start all workers
-    m_worker_wakeup.notify_all();
 
-    // wait for all workers to finish
+    logger.logf(io::LOG_INFO,
+                "%.1f steps/s in %.1f frames/s "
+                "(budget: %u steps per frame%s, %.2f ms per frame)",
+                m_report_steps / elapsed.count(),
+                m_report_frames / elapsed.count(),
+                config.substeps,
+                (config.adaptive ? " max" : ""),
+                std::chrono::duration<float, std::milli>(config.frame_budget).count());
+
+    m_report_start = now;
+    m_report_frames = 0;
+    m_report_steps = 0;
+}
+
+void NativeFluidSim::dispatch_scheduler(const unsigned int block_count)
+{
+    // a few chunks per worker, so that stealing can even out the difference
+    // in cost between active and frontier blocks
+    const unsigned int grain = std::max(
+                1U, block_count / (m_scheduler.workers()*4));
+
+    ffe::parallel_for(m_scheduler, 0, block_count, grain,
+                      [this](const unsigned int first, const unsigned int last)
     {
-        std::unique_lock<std::mutex> lock(m_worker_done_mutex);
-        while (m_worker_stopped < m_worker_count) {
-            m_worker_done_wakeup.wait(lock);
+        note_work_start();
+        std::unique_ptr<FluidTile> tile = acquire_tile();
+        for (unsigned int i = first; i < last; ++i) {
+            update_block(i, tile.get());
         }
-        assert(m_worker_stopped == m_worker_count);
+        release_tile(std::move(tile));
+        note_work_end();
+    });
+}
+
+void NativeFluidSim::dispatch_epoch(const unsigned int block_count)
+{
+    m_worker_block_count = block_count;
+    m_worker_block_ctr.store(0, std::memory_order_relaxed);
+    // the release publishes the block count and the state of the frame
+    m_frame_epoch.fetch_add(1, std::memory_order_release);
+    ffe::wake_all(m_frame_epoch, m_frame_epoch_sleepers);
+
+    std::unique_ptr<FluidTile> tile = acquire_tile();
+    run_claimed_blocks(tile.get());
+    release_tile(std::move(tile));
+
+    m_frame_barrier->arrive_and_wait();
+}
+
+void NativeFluidSim::note_work_start()
+{
+    const std::int64_t now = dispatch_clock_ns();
+    std::int64_t curr = m_first_work_start.load(std::memory_order_relaxed);
+    while (now < curr &&
+           !m_first_work_start.compare_exchange_weak(
+               curr, now, std::memory_order_relaxed));
+}
+
+void NativeFluidSim::note_work_end()
+{
+    const std::int64_t now = dispatch_clock_ns();
+    std::int64_t curr = m_last_work_end.load(std::memory_order_relaxed);
+    while (now > curr &&
+           !m_last_work_end.compare_exchange_weak(
+               curr, now, std::memory_order_relaxed));
+}
+
+void NativeFluidSim::run_claimed_blocks(FluidTile *tile)
+{
+    bool started = false;
+    while (true) {
+        const unsigned int my_block = m_worker_block_ctr.fetch_add(
+                    1, std::memory_order_relaxed);
+        if (my_block >= m_worker_block_count) {
+            break;
+        }
+        if (!started) {
+            note_work_start();
+            started = true;
+        }
+        update_block(my_block, tile);
+    }
+    if (started) {
+        note_work_end();
+    }
+}
+
+void NativeFluidSim::worker_impl()
+{
+    std::unique_ptr<FluidTile> tile = acquire_tile();
+
+    std::uint32_t seen_epoch = 0;
+    while (true) {
+        ffe::wait_while_equal(m_frame_epoch, seen_epoch,
+                              m_frame_epoch_sleepers);
+        seen_epoch = m_frame_epoch.load(std::memory_order_acquire);
+        if (m_terminated) {
+            break;
+        }
+
+        run_claimed_blocks(tile.get());
+
+        m_frame_barrier->arrive_and_wait();
     }
-    // some assertions
-    assert(m_worker_block_ctr.load(std::memory_order_relaxed) >=
-           m_blocks.blocks_per_axis()*m_blocks.blocks_per_axis());
-    assert(m_worker_to_start == 0);
 }
 
-void NativeFluidSim::sync_terrain(TerrainRect rect)
+void NativeFluidSim::sync_terrain()
 {
-    if (rect.x1() == m_terrain.size()) {
-        rect.set_x1(m_terrain.size()-1);
+    {
+        std::lock_guard<std::mutex> lock(m_terrain_update_mutex);
+        m_terrain_sync_blocks.swap(m_terrain_dirty_blocks);
+        for (const unsigned int index: m_terrain_sync_blocks) {
+            m_terrain_dirty[index] = 0;
+        }
     }
-    if (rect.y1() == m_terrain.size()) {
-        rect.set_y1(m_terrain.size()-1);
+    if (m_terrain_sync_blocks.empty()) {
+        return;
+    }
+
+    logger.logf(io::LOG_INFO, "terrain to sync (%u blocks)",
+                (unsigned int)m_terrain_sync_blocks.size());
+
+    // the fluid height of collapsed blocks would follow the new terrain
+    // height, so they have to be expanded first
+    for (const unsigned int index: m_terrain_sync_blocks) {
+        const unsigned int x = index % m_blocks.blocks_per_axis();
+        const unsigned int y = index / m_blocks.blocks_per_axis();
+        m_blocks.expand_cells(TerrainRect(x*IFluidSim::block_size,
+                                          y*IFluidSim::block_size,
+                                          (x+1)*IFluidSim::block_size,
+                                          (y+1)*IFluidSim::block_size));
     }
 
+    ffe::parallel_for(m_scheduler, 0, m_terrain_sync_blocks.size(), 1,
+                      [this](const unsigned int first,
+                             const unsigned int last)
+    {
+        for (unsigned int i = first; i < last; ++i) {
+            const unsigned int index = m_terrain_sync_blocks[i];
+            sync_terrain_block(
+                        *m_blocks.block(index % m_blocks.blocks_per_axis(),
+                                        index / m_blocks.blocks_per_axis()));
+        }
+    });
+
+    m_terrain_sync_blocks.clear();
+}
+
+void NativeFluidSim::sync_terrain_block(FluidBlock &block)
+{
     const unsigned int terrain_size = m_terrain.size();
-    const Terrain::Field *field = nullptr;
-    auto lock = m_terrain.readonly_field(field);
-    for (unsigned int y = rect.y0(); y < rect.y1(); y++) {
-        for (unsigned int x = rect.x0(); x < rect.x1(); x++) {
-            FluidCellMeta *meta_ptr = m_blocks.cell_meta(x, y);
+    const unsigned int x0 = block.x()*IFluidSim::block_size;
+    const unsigned int y0 = block.y()*IFluidSim::block_size;
+
+    // each cell samples the four vertices around it
+    const Terrain::Field *field_ptr = nullptr;
+    auto lock = m_terrain.readonly_rect(
+                TerrainRect(x0, y0,
+                            x0+IFluidSim::block_size+1,
+                            y0+IFluidSim::block_size+1),
+                field_ptr);
+    const Terrain::Field &field = *field_ptr;
+    for (unsigned int y = 0; y < IFluidSim::block_size; y++) {
+        FluidCellMeta *meta_ptr = block.local_cell_meta(0, y);
+        const unsigned int row = (y0+y)*terrain_size;
+        for (unsigned int x = x0; x < x0 + IFluidSim::block_size; x++) {
             const Terrain::height_t hsum =
-                    (*field)[y*terrain_size+x][Terrain::HEIGHT_ATTR]+
-                    (*field)[y*terrain_size+x+1][Terrain::HEIGHT_ATTR]+
-                    (*field)[(y+1)*terrain_size+x][Terrain::HEIGHT_ATTR]+
-                    (*field)[(y+1)*terrain_size+x+1][Terrain::HEIGHT_ATTR];
+                    field[row+x][Terrain::HEIGHT_ATTR]+
+                    field[row+x+1][Terrain::HEIGHT_ATTR]+
+                    field[row+terrain_size+x][Terrain::HEIGHT_ATTR]+
+                    field[row+terrain_size+x+1][Terrain::HEIGHT_ATTR];
             meta_ptr->terrain_height = hsum / 4.f;
-            m_blocks.block_for_cell(x, y)->set_active(true);
+            ++meta_ptr;
         }
     }
+    block.set_active(true);
 }
 
-template <unsigned int dir, int flow_sign>
+template <unsigned int dir, int flow_sign, typename cell_t>
 static inline FluidFloat flow(
-        FluidCell &back,
+        cell_t &back,
         const FluidCell &front,
         const FluidCellMeta &meta,
         const FluidCell &neigh_front,
@@ -294,9 +663,9 @@ static inline FluidFloat flow(
     return applicable_flow;
 }
 
-template <unsigned int dir>
+template <unsigned int dir, typename cell_t>
 static inline void full_flow(
-        FluidCell &back,
+        cell_t &back,
         const FluidCell &front,
         const FluidCellMeta &meta,
         const FluidCell &left_front,
@@ -321,7 +690,8 @@ static inline void full_flow(
     }
 }
 
-void NativeFluidSim::update_active_block(FluidBlock &block)
+void NativeFluidSim::update_active_block_scalar(FluidBlock &block,
+                                                BlockStats &stats)
 {
     const unsigned int cy0 = block.y()*IFluidSim::block_size;
     const unsigned int cy1 = (block.y()+1)*IFluidSim::block_size;
@@ -331,13 +701,6 @@ void NativeFluidSim::update_active_block(FluidBlock &block)
     std::array<const FluidCell*, 8> neigh;
     std::array<const FluidCellMeta*, 8> neigh_meta;
 
-    float change_accum = 0.f;
-    float wet_cells = 0.f;
-
-    float average_height = 0.f;
-    float min_abs_height = std::numeric_limits<float>::max();
-    float max_abs_height = std::numeric_limits<float>::lowest();
-
     FluidCell *back = block.local_cell_back(0, 0);
     const FluidCell *front = block.local_cell_front(0, 0);
     const FluidCellMeta *meta = block.local_cell_meta(0, 0);
@@ -347,7 +710,11 @@ void NativeFluidSim::update_active_block(FluidBlock &block)
         {
             m_blocks.cell_front_neighbourhood(cx, cy, neigh, neigh_meta);
 
-            back->fluid_height = front->fluid_height;
+            // compute in FluidFloat and round to the storage type only once
+            FluidComputeCell next;
+            next.fluid_height = front->fluid_height;
+            next.fluid_flow[0] = back->fluid_flow[0];
+            next.fluid_flow[1] = back->fluid_flow[1];
 
             {
                 const FluidCell *left = first(neigh[Left], &null_cell);
@@ -355,7 +722,7 @@ void NativeFluidSim::update_active_block(FluidBlock &block)
                 const FluidCellMeta *left_meta = neigh_meta[Left];
                 const FluidCellMeta *right_meta = neigh_meta[Right];
                 full_flow<0>(
-                            *back, *front,
+                            next, *front,
                             *meta,
                             *left, left_meta,
                             *right, right_meta);
@@ -366,15 +733,15 @@ void NativeFluidSim::update_active_block(FluidBlock &block)
                 const FluidCellMeta *left_meta = neigh_meta[Top];
                 const FluidCellMeta *right_meta = neigh_meta[Bottom];
                 full_flow<1>(
-                            *back, *front,
+                            next, *front,
                             *meta,
                             *left, left_meta,
                             *right, right_meta);
             }
 
             if (meta->source_capacity > 0 || meta->terrain_height < m_ocean_level) {
-                float source_height;
-                float source_capacity;
+                FluidFloat source_height;
+                FluidFloat source_capacity;
                 if (meta->terrain_height < m_ocean_level) {
                     // ocean is really just a very strong source/sink
                     source_height = m_ocean_level;
@@ -386,39 +753,88 @@ void NativeFluidSim::update_active_block(FluidBlock &block)
 
                 source_capacity *= source_capacity_scale;
 
-                const float source_fluid_height = source_height - meta->terrain_height;
-                const float source_flow = clamp(
-                            source_fluid_height - back->fluid_height,
+                const FluidFloat source_fluid_height = source_height - meta->terrain_height;
+                const FluidFloat source_flow = clamp(
+                            source_fluid_height - next.fluid_height,
                             -source_capacity,
                             source_capacity);
 
-                back->fluid_height += source_flow;
-                if (back->fluid_height < 0) {
-                    back->fluid_height = 0;
+                next.fluid_height += source_flow;
+                if (next.fluid_height < 0) {
+                    next.fluid_height = 0;
                 }
             }
 
-            change_accum += std::abs(back->fluid_height - front->fluid_height);
-            if (back->fluid_height > IFluidSim::visualization_threshold ||
-                    front->fluid_height > IFluidSim::visualization_threshold)
-            {
-                wet_cells += 1.f;
+            back->fluid_height = next.fluid_height;
+            back->fluid_flow[0] = next.fluid_flow[0];
+            back->fluid_flow[1] = next.fluid_flow[1];
+
+            stats.accum_cell(*back, *front, *meta);
+
+            ++back;
+            ++front;
+            ++meta;
+        }
+    }
+}
 
-                const FluidFloat abs_height = back->fluid_height + meta->terrain_height;
-                average_height += abs_height;
-                max_abs_height = std::max(abs_height, max_abs_height);
-                min_abs_height = std::min(abs_height, min_abs_height);
+void NativeFluidSim::update_active_block_tile(FluidBlock &block,
+                                              FluidTile &tile,
+                                              BlockStats &stats)
+{
+    tile.load(m_blocks, block);
+    m_tile_kernel(tile, m_ocean_level);
+
+    // cells without right/bottom neighbour keep their flow, just like in the
+    // scalar implementation
+    const bool last_row_has_flow_y = tile.bottom_valid;
+
+    for (unsigned int y = 0; y < IFluidSim::block_size; ++y)
+    {
+        FluidCell *back = block.local_cell_back(0, y);
+        const FluidCell *front = block.local_cell_front(0, y);
+        const FluidCellMeta *meta = block.local_cell_meta(0, y);
+        const bool has_flow_y = (y < IFluidSim::block_size-1 ||
+                                 last_row_has_flow_y);
+        const unsigned int row = tile.index(0, y);
+
+        for (unsigned int x = 0; x < IFluidSim::block_size; ++x)
+        {
+            back->fluid_height = tile.new_fluid_height[row+x];
+            if (tile.right_valid[x]) {
+                back->fluid_flow[0] = tile.new_fluid_flow_x[row+x];
             }
+            if (has_flow_y) {
+                back->fluid_flow[1] = tile.new_fluid_flow_y[row+x];
+            }
+
+            stats.accum_cell(*back, *front, *meta);
 
             ++back;
             ++front;
             ++meta;
         }
     }
+}
 
-    if (wet_cells > 0.f) {
-        change_accum /= wet_cells;
-        average_height /= wet_cells;
+void NativeFluidSim::update_active_block(FluidBlock &block, FluidTile *tile)
+{
+    BlockStats stats;
+
+    if (tile) {
+        update_active_block_tile(block, *tile, stats);
+    } else {
+        update_active_block_scalar(block, stats);
+    }
+
+    float change_accum = stats.change_accum;
+    float average_height = stats.average_height;
+    float min_abs_height = stats.min_abs_height;
+    float max_abs_height = stats.max_abs_height;
+
+    if (stats.wet_cells > 0.f) {
+        change_accum /= stats.wet_cells;
+        average_height /= stats.wet_cells;
     } else {
         average_height = -1.f;
         min_abs_height = -1.f;
@@ -625,56 +1041,52 @@ void NativeFluidSim::update_inactive_block(FluidBlock &block)
     }
 }
 
-void NativeFluidSim::worker_impl()
+void NativeFluidSim::update_block(const unsigned int index,
+                                  FluidTile *tile)
 {
-    const unsigned int out_of_tasks_limit = m_blocks.blocks_per_axis()*m_blocks.blocks_per_axis();
-
-    std::unique_lock<std::mutex> wakeup_lock(m_worker_task_mutex);
-    while (!m_worker_terminate)
-    {
-        while (m_worker_to_start == 0 &&
-               !m_worker_terminate)
-        {
-            m_worker_wakeup.wait(wakeup_lock);
-        }
-        if (m_worker_terminate) {
-            return;
-        }
-        --m_worker_to_start;
-        wakeup_lock.unlock();
+    if (m_ocean_level_changed) {
+        const unsigned int x = index % m_blocks.blocks_per_axis();
+        const unsigned int y = index / m_blocks.blocks_per_axis();
+        FluidBlock &block = *m_blocks.block(x, y);
+        block.set_active(true);
+        update_active_block(block, tile);
+        return;
+    }
 
-        while (1) {
-            const unsigned int my_block = m_worker_block_ctr.fetch_add(
-                        1,
-                        std::memory_order_relaxed);
-            if (my_block >= out_of_tasks_limit)
-            {
-                break;
-            }
+    // blocks which are neither active nor adjacent to an active block are
+    // not dispatched at all; update_inactive_block would not touch them
+    const std::vector<FluidBlock*> &active = m_blocks.active_blocks();
+    if (index < active.size()) {
+        update_active_block(*active[index], tile);
+    } else {
+        update_inactive_block(*m_blocks.frontier_blocks()[index - active.size()]);
+    }
+}
 
-            const unsigned int x = my_block % m_blocks.blocks_per_axis();
-            const unsigned int y = my_block / m_blocks.blocks_per_axis();
-            FluidBlock &block = *m_blocks.block(x, y);
-            /*logger.logf(io::LOG_DEBUG, "fluid: %p got %u %u, active = %d",
-                        this, x, y, block.front_meta().active);*/
-            if (m_ocean_level_changed) {
-                block.set_active(true);
-            }
-            if (block.front_meta().active || m_ocean_level_changed) {
-                update_active_block(block);
-            } else {
-                update_inactive_block(block);
-            }
-        }
+std::unique_ptr<FluidTile> NativeFluidSim::acquire_tile()
+{
+    if (!m_tile_kernel) {
+        return nullptr;
+    }
 
-        {
-            std::lock_guard<std::mutex> lock(m_worker_done_mutex);
-            m_worker_stopped += 1;
+    {
+        std::lock_guard<std::mutex> lock(m_tile_pool_mutex);
+        if (!m_tile_pool.empty()) {
+            std::unique_ptr<FluidTile> result = std::move(m_tile_pool.back());
+            m_tile_pool.pop_back();
+            return result;
         }
-        m_worker_done_wakeup.notify_all();
+    }
+    return std::make_unique<FluidTile>();
+}
 
-        wakeup_lock.lock();
+void NativeFluidSim::release_tile(std::unique_ptr<FluidTile> &&tile)
+{
+    if (!tile) {
+        return;
     }
+    std::lock_guard<std::mutex> lock(m_tile_pool_mutex);
+    m_tile_pool.emplace_back(std::move(tile));
 }
 
 void NativeFluidSim::start_frame()
@@ -690,8 +1102,33 @@ void NativeFluidSim::start_frame()
 
 void NativeFluidSim::terrain_update(TerrainRect r)
 {
+    if (r.empty()) {
+        return;
+    }
+
+    // a cell depends on the vertices at its corners, so a changed vertex
+    // also affects the cells left of and above it
+    const unsigned int cells = m_blocks.cells_per_axis();
+    const unsigned int x0 = std::min(std::max(r.x0(), 1U) - 1, cells - 1);
+    const unsigned int y0 = std::min(std::max(r.y0(), 1U) - 1, cells - 1);
+    const unsigned int x1 = std::min(r.x1(), cells);
+    const unsigned int y1 = std::min(r.y1(), cells);
+
+    const unsigned int bx0 = x0 / IFluidSim::block_size;
+    const unsigned int by0 = y0 / IFluidSim::block_size;
+    const unsigned int bx1 = (std::max(x1, x0+1) - 1) / IFluidSim::block_size + 1;
+    const unsigned int by1 = (std::max(y1, y0+1) - 1) / IFluidSim::block_size + 1;
+
     std::lock_guard<std::mutex> lock(m_terrain_update_mutex);
-    m_terrain_update = bounds(r, m_terrain_update);
+    for (unsigned int by = by0; by < by1; ++by) {
+        for (unsigned int bx = bx0; bx < bx1; ++bx) {
+            const unsigned int index = by*m_blocks.blocks_per_axis()+bx;
+            if (!m_terrain_dirty[index]) {
+                m_terrain_dirty[index] = 1;
+                m_terrain_dirty_blocks.push_back(index);
+            }
+        }
+    }
 }
 
 void NativeFluidSim::set_ocean_level(const FluidFloat level)
@@ -701,6 +1138,12 @@ void NativeFluidSim::set_ocean_level(const FluidFloat level)
     m_ocean_level_update_set = true;
 }
 
+void NativeFluidSim::set_step_config(const FluidStepConfig &config)
+{
+    std::lock_guard<std::mutex> lock(m_control_mutex);
+    m_step_config = config;
+}
+
 void NativeFluidSim::wait_for_frame()
 {
     {
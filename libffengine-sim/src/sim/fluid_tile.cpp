@@ -0,0 +1,476 @@
+/**********************************************************************
+File name: fluid_tile.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include "ffengine/sim/fluid_tile.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+namespace sim {
+
+static const unsigned int widest_vector = 8;
+
+static unsigned int round_up(const unsigned int value,
+                             const unsigned int multiple)
+{
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+/* sim::FluidTile */
+
+FluidTile::FluidTile():
+    m_lanes(round_up(IFluidSim::block_size, widest_vector)),
+    m_row_stride(round_up(m_lanes + 2, widest_vector)),
+    m_plane_size(m_row_stride*(IFluidSim::block_size+2)),
+    m_storage(m_plane_size*9),
+    fluid_height(&m_storage[0]),
+    fluid_flow_x(&m_storage[m_plane_size]),
+    fluid_flow_y(&m_storage[m_plane_size*2]),
+    terrain_height(&m_storage[m_plane_size*3]),
+    source_height(&m_storage[m_plane_size*4]),
+    source_capacity(&m_storage[m_plane_size*5]),
+    new_fluid_height(&m_storage[m_plane_size*6]),
+    new_fluid_flow_x(&m_storage[m_plane_size*7]),
+    new_fluid_flow_y(&m_storage[m_plane_size*8]),
+    left_valid(m_lanes, ~uint32_t(0)),
+    right_valid(m_lanes, ~uint32_t(0)),
+    top_valid(true),
+    bottom_valid(true)
+{
+
+}
+
+void FluidTile::load(const FluidBlocks &blocks, const FluidBlock &block)
+{
+    const unsigned int size = IFluidSim::block_size;
+
+    for (unsigned int y = 0; y < size; ++y)
+    {
+        const FluidCell *cell = block.local_cell_front(0, y);
+        const FluidCellMeta *meta = block.local_cell_meta(0, y);
+        const unsigned int row = index(0, y);
+        for (unsigned int x = 0; x < size; ++x)
+        {
+            fluid_height[row+x] = cell->fluid_height;
+            fluid_flow_x[row+x] = cell->fluid_flow[0];
+            fluid_flow_y[row+x] = cell->fluid_flow[1];
+            terrain_height[row+x] = meta->terrain_height;
+            source_height[row+x] = meta->source_height;
+            source_capacity[row+x] = meta->source_capacity;
+            ++cell;
+            ++meta;
+        }
+    }
+
+    // the seams of the neighbours; missing neighbours are masked out by the
+    // kernel, we zero them anyways to avoid computing on garbage.
+
+    left_valid[0] = (block.x() > 0 ? ~uint32_t(0) : 0);
+    right_valid[size-1] = (block.x() < blocks.blocks_per_axis()-1
+                           ? ~uint32_t(0)
+                           : 0);
+    top_valid = block.y() > 0;
+    bottom_valid = block.y() < blocks.blocks_per_axis()-1;
+
+    const FluidBlock *left = (left_valid[0]
+                              ? blocks.block(block.x()-1, block.y())
+                              : nullptr);
+    const FluidBlock *right = (right_valid[size-1]
+                               ? blocks.block(block.x()+1, block.y())
+                               : nullptr);
+    for (unsigned int y = 0; y < size; ++y)
+    {
+        const unsigned int left_i = index(0, y) - 1;
+        const unsigned int right_i = index(size-1, y) + 1;
+        if (left) {
+            const FluidCell *cell = left->local_cell_front(size-1, y);
+            fluid_height[left_i] = cell->fluid_height;
+            fluid_flow_x[left_i] = cell->fluid_flow[0];
+            fluid_flow_y[left_i] = cell->fluid_flow[1];
+            terrain_height[left_i] = left->local_cell_meta(size-1, y)->terrain_height;
+        } else {
+            fluid_height[left_i] = 0.f;
+            fluid_flow_x[left_i] = 0.f;
+            fluid_flow_y[left_i] = 0.f;
+            terrain_height[left_i] = 0.f;
+        }
+        if (right) {
+            const FluidCell *cell = right->local_cell_front(0, y);
+            fluid_height[right_i] = cell->fluid_height;
+            fluid_flow_x[right_i] = cell->fluid_flow[0];
+            fluid_flow_y[right_i] = cell->fluid_flow[1];
+            terrain_height[right_i] = right->local_cell_meta(0, y)->terrain_height;
+        } else {
+            fluid_height[right_i] = 0.f;
+            fluid_flow_x[right_i] = 0.f;
+            fluid_flow_y[right_i] = 0.f;
+            terrain_height[right_i] = 0.f;
+        }
+    }
+
+    const FluidBlock *top = (top_valid
+                             ? blocks.block(block.x(), block.y()-1)
+                             : nullptr);
+    const FluidBlock *bottom = (bottom_valid
+                                ? blocks.block(block.x(), block.y()+1)
+                                : nullptr);
+    {
+        const unsigned int top_row = index(0, 0) - m_row_stride;
+        const unsigned int bottom_row = index(0, size-1) + m_row_stride;
+        for (unsigned int x = 0; x < size; ++x)
+        {
+            if (top) {
+                const FluidCell *cell = top->local_cell_front(x, size-1);
+                fluid_height[top_row+x] = cell->fluid_height;
+                fluid_flow_x[top_row+x] = cell->fluid_flow[0];
+                fluid_flow_y[top_row+x] = cell->fluid_flow[1];
+                terrain_height[top_row+x] = top->local_cell_meta(x, size-1)->terrain_height;
+            } else {
+                fluid_height[top_row+x] = 0.f;
+                fluid_flow_x[top_row+x] = 0.f;
+                fluid_flow_y[top_row+x] = 0.f;
+                terrain_height[top_row+x] = 0.f;
+            }
+            if (bottom) {
+                const FluidCell *cell = bottom->local_cell_front(x, 0);
+                fluid_height[bottom_row+x] = cell->fluid_height;
+                fluid_flow_x[bottom_row+x] = cell->fluid_flow[0];
+                fluid_flow_y[bottom_row+x] = cell->fluid_flow[1];
+                terrain_height[bottom_row+x] = bottom->local_cell_meta(x, 0)->terrain_height;
+            } else {
+                fluid_height[bottom_row+x] = 0.f;
+                fluid_flow_x[bottom_row+x] = 0.f;
+                fluid_flow_y[bottom_row+x] = 0.f;
+                terrain_height[bottom_row+x] = 0.f;
+            }
+        }
+    }
+}
+
+}
+
+
+namespace sim {
+namespace {
+
+/**
+ * Vector traits for the portable kernel, operating on one cell at a time.
+ *
+ * Masks are represented as floats with all bits set or cleared, so that the
+ * kernel stays free of branches.
+ */
+struct ScalarVector
+{
+    typedef float vec;
+    static constexpr unsigned int width = 1;
+
+    static inline uint32_t bits(const vec v)
+    {
+        uint32_t result;
+        std::memcpy(&result, &v, sizeof(result));
+        return result;
+    }
+
+    static inline vec from_bits(const uint32_t v)
+    {
+        vec result;
+        std::memcpy(&result, &v, sizeof(result));
+        return result;
+    }
+
+    static inline vec from_bool(const bool v)
+    {
+        return from_bits(-uint32_t(v));
+    }
+
+    static inline vec load(const float *src)
+    {
+        return *src;
+    }
+
+    static inline vec load_mask(const uint32_t *src)
+    {
+        return from_bits(*src);
+    }
+
+    static inline void store(float *dest, const vec v)
+    {
+        *dest = v;
+    }
+
+    static inline vec set1(const float v)
+    {
+        return v;
+    }
+
+    static inline vec all_set()
+    {
+        return from_bits(~uint32_t(0));
+    }
+
+    static inline vec add(const vec a, const vec b)
+    {
+        return a + b;
+    }
+
+    static inline vec sub(const vec a, const vec b)
+    {
+        return a - b;
+    }
+
+    static inline vec mul(const vec a, const vec b)
+    {
+        return a * b;
+    }
+
+    static inline vec div(const vec a, const vec b)
+    {
+        return a / b;
+    }
+
+    static inline vec neg(const vec a)
+    {
+        return -a;
+    }
+
+    /* a < b ? a : b */
+    static inline vec min(const vec a, const vec b)
+    {
+        return a < b ? a : b;
+    }
+
+    /* a > b ? a : b */
+    static inline vec max(const vec a, const vec b)
+    {
+        return a > b ? a : b;
+    }
+
+    static inline vec cmplt(const vec a, const vec b)
+    {
+        return from_bool(a < b);
+    }
+
+    static inline vec cmple(const vec a, const vec b)
+    {
+        return from_bool(a <= b);
+    }
+
+    static inline vec cmpgt(const vec a, const vec b)
+    {
+        return from_bool(a > b);
+    }
+
+    static inline vec cmpge(const vec a, const vec b)
+    {
+        return from_bool(a >= b);
+    }
+
+    static inline vec and_(const vec a, const vec b)
+    {
+        return from_bits(bits(a) & bits(b));
+    }
+
+    /* ~a & b */
+    static inline vec andnot(const vec a, const vec b)
+    {
+        return from_bits(~bits(a) & bits(b));
+    }
+
+    static inline vec or_(const vec a, const vec b)
+    {
+        return from_bits(bits(a) | bits(b));
+    }
+
+    static inline vec select(const vec mask, const vec a, const vec b)
+    {
+        const uint32_t m = bits(mask);
+        return from_bits((m & bits(a)) | (~m & bits(b)));
+    }
+};
+
+}
+}
+
+
+#if defined(__SSE2__)
+
+namespace sim {
+namespace {
+
+struct SSE2Vector
+{
+    typedef __m128 vec;
+    static constexpr unsigned int width = 4;
+
+    static inline vec load(const float *src)
+    {
+        return _mm_loadu_ps(src);
+    }
+
+    static inline vec load_mask(const uint32_t *src)
+    {
+        return _mm_castsi128_ps(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(src)));
+    }
+
+    static inline void store(float *dest, const vec v)
+    {
+        _mm_storeu_ps(dest, v);
+    }
+
+    static inline vec set1(const float v)
+    {
+        return _mm_set1_ps(v);
+    }
+
+    static inline vec all_set()
+    {
+        return _mm_castsi128_ps(_mm_set1_epi32(-1));
+    }
+
+    static inline vec add(const vec a, const vec b)
+    {
+        return _mm_add_ps(a, b);
+    }
+
+    static inline vec sub(const vec a, const vec b)
+    {
+        return _mm_sub_ps(a, b);
+    }
+
+    static inline vec mul(const vec a, const vec b)
+    {
+        return _mm_mul_ps(a, b);
+    }
+
+    static inline vec div(const vec a, const vec b)
+    {
+        return _mm_div_ps(a, b);
+    }
+
+    static inline vec neg(const vec a)
+    {
+        return _mm_xor_ps(a, _mm_set1_ps(-0.f));
+    }
+
+    /* a < b ? a : b */
+    static inline vec min(const vec a, const vec b)
+    {
+        return _mm_min_ps(a, b);
+    }
+
+    /* a > b ? a : b */
+    static inline vec max(const vec a, const vec b)
+    {
+        return _mm_max_ps(a, b);
+    }
+
+    static inline vec cmplt(const vec a, const vec b)
+    {
+        return _mm_cmplt_ps(a, b);
+    }
+
+    static inline vec cmple(const vec a, const vec b)
+    {
+        return _mm_cmple_ps(a, b);
+    }
+
+    static inline vec cmpgt(const vec a, const vec b)
+    {
+        return _mm_cmpgt_ps(a, b);
+    }
+
+    static inline vec cmpge(const vec a, const vec b)
+    {
+        return _mm_cmpge_ps(a, b);
+    }
+
+    static inline vec and_(const vec a, const vec b)
+    {
+        return _mm_and_ps(a, b);
+    }
+
+    /* ~a & b */
+    static inline vec andnot(const vec a, const vec b)
+    {
+        return _mm_andnot_ps(a, b);
+    }
+
+    static inline vec or_(const vec a, const vec b)
+    {
+        return _mm_or_ps(a, b);
+    }
+
+    static inline vec select(const vec mask, const vec a, const vec b)
+    {
+        return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    }
+};
+
+}
+}
+
+#endif
+
+#include "ffengine/sim/fluid_tile_kernel.inc.hpp"
+
+
+namespace sim {
+
+void fluid_tile_step_portable(FluidTile &tile, const FluidFloat ocean_level)
+{
+    fluid_tile_step<ScalarVector>(tile, ocean_level);
+}
+
+void fluid_tile_step_sse2(FluidTile &tile, const FluidFloat ocean_level)
+{
+#if defined(__SSE2__)
+    fluid_tile_step<SSE2Vector>(tile, ocean_level);
+#else
+    (void)tile;
+    (void)ocean_level;
+    throw std::logic_error("fluid_tile_step_sse2 not supported on this target");
+#endif
+}
+
+FluidTileKernel select_fluid_tile_kernel()
+{
+#if defined(SCC_FLUID_AVX2)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return &fluid_tile_step_avx2;
+    }
+#endif
+#if defined(__SSE2__)
+    return &fluid_tile_step_sse2;
+#else
+    return nullptr;
+#endif
+}
+
+}
@@ -0,0 +1,195 @@
+/**********************************************************************
+File name: fluid_tile_avx2.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+/*
+ * The AVX2 kernel is enabled per function with a target pragma instead of
+ * compiling this translation unit with -mavx2. All headers are included
+ * before the pragma, so inline functions from shared headers and the
+ * standard library templates used here are emitted for the baseline target;
+ * only the code between the pragmas, which has internal linkage except for
+ * fluid_tile_step_avx2(), uses AVX2. Nothing in there may be called without
+ * checking for CPU support first.
+ */
+#include "ffengine/sim/fluid_tile.hpp"
+
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#if defined(SCC_FLUID_AVX2)
+#include <immintrin.h>
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+
+namespace sim {
+namespace {
+
+struct AVX2Vector
+{
+    typedef __m256 vec;
+    static constexpr unsigned int width = 8;
+
+    static inline vec load(const float *src)
+    {
+        return _mm256_loadu_ps(src);
+    }
+
+    static inline vec load_mask(const uint32_t *src)
+    {
+        return _mm256_castsi256_ps(
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src)));
+    }
+
+    static inline void store(float *dest, const vec v)
+    {
+        _mm256_storeu_ps(dest, v);
+    }
+
+    static inline vec set1(const float v)
+    {
+        return _mm256_set1_ps(v);
+    }
+
+    static inline vec all_set()
+    {
+        return _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    }
+
+    static inline vec add(const vec a, const vec b)
+    {
+        return _mm256_add_ps(a, b);
+    }
+
+    static inline vec sub(const vec a, const vec b)
+    {
+        return _mm256_sub_ps(a, b);
+    }
+
+    static inline vec mul(const vec a, const vec b)
+    {
+        return _mm256_mul_ps(a, b);
+    }
+
+    static inline vec div(const vec a, const vec b)
+    {
+        return _mm256_div_ps(a, b);
+    }
+
+    static inline vec neg(const vec a)
+    {
+        return _mm256_xor_ps(a, _mm256_set1_ps(-0.f));
+    }
+
+    /* a < b ? a : b */
+    static inline vec min(const vec a, const vec b)
+    {
+        return _mm256_min_ps(a, b);
+    }
+
+    /* a > b ? a : b */
+    static inline vec max(const vec a, const vec b)
+    {
+        return _mm256_max_ps(a, b);
+    }
+
+    static inline vec cmplt(const vec a, const vec b)
+    {
+        return _mm256_cmp_ps(a, b, _CMP_LT_OQ);
+    }
+
+    static inline vec cmple(const vec a, const vec b)
+    {
+        return _mm256_cmp_ps(a, b, _CMP_LE_OQ);
+    }
+
+    static inline vec cmpgt(const vec a, const vec b)
+    {
+        return _mm256_cmp_ps(a, b, _CMP_GT_OQ);
+    }
+
+    static inline vec cmpge(const vec a, const vec b)
+    {
+        return _mm256_cmp_ps(a, b, _CMP_GE_OQ);
+    }
+
+    static inline vec and_(const vec a, const vec b)
+    {
+        return _mm256_and_ps(a, b);
+    }
+
+    /* ~a & b */
+    static inline vec andnot(const vec a, const vec b)
+    {
+        return _mm256_andnot_ps(a, b);
+    }
+
+    static inline vec or_(const vec a, const vec b)
+    {
+        return _mm256_or_ps(a, b);
+    }
+
+    static inline vec select(const vec mask, const vec a, const vec b)
+    {
+        return _mm256_blendv_ps(b, a, mask);
+    }
+};
+
+}
+}
+
+#include "ffengine/sim/fluid_tile_kernel.inc.hpp"
+
+namespace sim {
+
+void fluid_tile_step_avx2(FluidTile &tile, const FluidFloat ocean_level)
+{
+    fluid_tile_step<AVX2Vector>(tile, ocean_level);
+}
+
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#else
+
+namespace sim {
+
+void fluid_tile_step_avx2(FluidTile &tile, const FluidFloat ocean_level)
+{
+    (void)tile;
+    (void)ocean_level;
+    throw std::logic_error("fluid_tile_step_avx2 not supported on this target");
+}
+
+}
+
+#endif
@@ -575,9 +575,11 @@ PhysicalEdgeBundle &PhysicalGraph::create_bundle(
         PhysicalNode &start_node,
         const Vector3f &control_point,
         PhysicalNode &end_node,
-        const EdgeType &type)
+        const EdgeType &type,
+        const Object::ID object_id)
 {
-    PhysicalEdgeBundle &bundle = m_objects.allocate<PhysicalEdgeBundle>(
+    PhysicalEdgeBundle &bundle = m_objects.emplace<PhysicalEdgeBundle>(
+                object_id,
                 type,
                 m_objects.share(start_node),
                 m_objects.share(end_node),
@@ -630,9 +632,11 @@ void PhysicalGraph::construct_curve(
 }
 
 PhysicalNode &PhysicalGraph::create_node(const EdgeClass &class_,
-                                         const Vector3f &position)
+                                         const Vector3f &position,
+                                         const Object::ID object_id)
 {
-    PhysicalNode &node = m_objects.allocate<PhysicalNode>(class_, position);
+    PhysicalNode &node = m_objects.emplace<PhysicalNode>(object_id,
+                                                         class_, position);
     object_ptr<PhysicalNode> node_ptr(m_objects.share(node));
     m_nodes.emplace_back(node_ptr);
     m_node_created(node_ptr);
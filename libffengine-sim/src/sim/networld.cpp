@@ -30,6 +30,7 @@ the AUTHORS file.
 
 #include "world_command.pb.h"
 
+#include <cassert>
 #include <iostream>
 
 
@@ -39,20 +40,107 @@ static io::Logger &logger = io::logging().get_logger("sim.networld");
 
 static RejectingMessageHandler default_message_handler;
 
+/**
+ * Read-only ZeroCopyInputStream over a range of a ring buffer.
+ *
+ * The range may wrap around the end of the ring, in which case it is
+ * exposed as two consecutive chunks.
+ */
+class RingBufferInputStream: public google::protobuf::io::ZeroCopyInputStream
+{
+public:
+    RingBufferInputStream(const char *ring,
+                          const uint64_t ring_size,
+                          const uint64_t offset,
+                          const uint64_t length):
+        m_ring(ring),
+        m_ring_size(ring_size),
+        m_offset(offset),
+        m_remaining(length),
+        m_last_chunk(0),
+        m_byte_count(0)
+    {
+
+    }
+
+private:
+    const char *const m_ring;
+    const uint64_t m_ring_size;
+    uint64_t m_offset;
+    uint64_t m_remaining;
+    uint64_t m_last_chunk;
+    google::protobuf::int64 m_byte_count;
+
+public:
+    bool Next(const void **data, int *size) override
+    {
+        if (m_remaining == 0) {
+            m_last_chunk = 0;
+            return false;
+        }
+        const uint64_t chunk = std::min(m_remaining, m_ring_size - m_offset);
+        *data = &m_ring[m_offset];
+        *size = chunk;
+        m_offset = (m_offset + chunk) % m_ring_size;
+        m_remaining -= chunk;
+        m_last_chunk = chunk;
+        m_byte_count += chunk;
+        return true;
+    }
+
+    void BackUp(int count) override
+    {
+        assert(count >= 0 && uint64_t(count) <= m_last_chunk);
+        m_offset = (m_offset + m_ring_size - count) % m_ring_size;
+        m_remaining += count;
+        m_last_chunk -= count;
+        m_byte_count -= count;
+    }
+
+    bool Skip(int count) override
+    {
+        if (count < 0) {
+            return false;
+        }
+        const uint64_t to_skip = std::min(uint64_t(count), m_remaining);
+        m_offset = (m_offset + to_skip) % m_ring_size;
+        m_remaining -= to_skip;
+        m_last_chunk = 0;
+        m_byte_count += to_skip;
+        return to_skip == uint64_t(count);
+    }
+
+    google::protobuf::int64 ByteCount() const override
+    {
+        return m_byte_count;
+    }
+
+};
+
+
 /* sim::NetMessageParser */
 
+constexpr uint32_t NetMessageParser::MAX_MESSAGE_SIZE;
+constexpr int64_t NetMessageParser::HEADER_SIZE;
+constexpr uint64_t NetMessageParser::RING_BUFFER_SIZE;
+constexpr std::size_t NetMessageParser::MAX_SPARE_MESSAGES;
+
 NetMessageParser::NetMessageParser(LinkControlCallback &&link_control_cb,
                                    ErrorCallback &&error_cb,
-                                   const NetConnectionID &id):
+                                   const NetConnectionID &id,
+                                   const BufferMode mode):
     m_id(id),
+    m_mode(mode),
     m_link_control_cb(std::move(link_control_cb)),
     m_error_cb(std::move(error_cb)),
     m_message_handler(&default_message_handler),
+    m_ring(new char[RING_BUFFER_SIZE]),
+    m_ring_read(0),
+    m_ring_filled(0),
     m_recv_state(RECV_WAIT_FOR_HEADER),
-    m_recv_barrier(HEADER_SIZE),
-    m_written_up_to(0)
+    m_recv_barrier(HEADER_SIZE)
 {
-    m_recv_buffer.resize(m_recv_barrier);
+
 }
 
 void NetMessageParser::fail()
@@ -61,14 +149,30 @@ void NetMessageParser::fail()
     m_error_cb();
 }
 
+void NetMessageParser::consume(uint64_t bytes)
+{
+    assert(bytes <= m_ring_filled);
+    m_ring_read = (m_ring_read + bytes) % RING_BUFFER_SIZE;
+    m_ring_filled -= bytes;
+    if (m_ring_filled == 0) {
+        // keep the free space contiguous for as long as possible
+        m_ring_read = 0;
+    }
+}
+
 bool NetMessageParser::parse(google::protobuf::Message &dest)
 {
-    return dest.ParseFromArray(m_recv_buffer.data(), m_recv_buffer.size());
+    RingBufferInputStream stream(m_ring.get(), RING_BUFFER_SIZE,
+                                 m_ring_read, m_recv_barrier);
+    return dest.ParseFromZeroCopyStream(&stream);
 }
 
 void NetMessageParser::received_header()
 {
-    const uint8_t *buffer = reinterpret_cast<const uint8_t*>(m_recv_buffer.data());
+    uint8_t buffer[HEADER_SIZE];
+    for (unsigned int i = 0; i < HEADER_SIZE; ++i) {
+        buffer[i] = m_ring[(m_ring_read + i) % RING_BUFFER_SIZE];
+    }
 
     uint32_t msgclass = 0;
     uint32_t msgsize = 0;
@@ -97,6 +201,7 @@ void NetMessageParser::received_header()
         return;
     }
 
+    consume(HEADER_SIZE);
     m_recv_barrier = msgsize;
     m_recv_state = RECV_PAYLOAD;
     m_curr_class = NetMessageClass(msgclass);
@@ -109,7 +214,7 @@ void NetMessageParser::received_payload()
     {
     case MSGCLASS_LINK_CONTROL:
     {
-        auto protobuf = std::make_unique<messages::NetWorldControl>();
+        auto protobuf = take_spare(m_spare_link_control);
         if (!parse(*protobuf)) {
             fail();
             return;
@@ -120,7 +225,7 @@ void NetMessageParser::received_payload()
     }
     case MSGCLASS_WORLD_COMMAND:
     {
-        auto protobuf = std::make_unique<messages::WorldCommand>();
+        auto protobuf = take_spare(m_spare_world_command);
         if (!parse(*protobuf)) {
             fail();
             return;
@@ -128,6 +233,38 @@ void NetMessageParser::received_payload()
         pass = (*m_message_handler).msg_world_command(std::move(protobuf));
         break;
     }
+    case MSGCLASS_WORLD_COMMAND_RESPONSE:
+    {
+        auto protobuf = take_spare(m_spare_world_command_response);
+        if (!parse(*protobuf)) {
+            fail();
+            return;
+        }
+        pass = (*m_message_handler).msg_world_command_response(
+                    std::move(protobuf));
+        break;
+    }
+    case MSGCLASS_WORLD_SNAPSHOT_CHUNK:
+    {
+        auto protobuf = take_spare(m_spare_world_snapshot_chunk);
+        if (!parse(*protobuf)) {
+            fail();
+            return;
+        }
+        pass = (*m_message_handler).msg_world_snapshot_chunk(
+                    std::move(protobuf));
+        break;
+    }
+    case MSGCLASS_TERRAIN_DELTA:
+    {
+        auto protobuf = take_spare(m_spare_terrain_delta);
+        if (!parse(*protobuf)) {
+            fail();
+            return;
+        }
+        pass = (*m_message_handler).msg_terrain_delta(std::move(protobuf));
+        break;
+    }
     }
 
     if (!pass) {
@@ -135,6 +272,7 @@ void NetMessageParser::received_payload()
         return;
     }
 
+    consume(m_recv_barrier);
     m_recv_state = RECV_WAIT_FOR_HEADER;
     m_recv_barrier = HEADER_SIZE;
 }
@@ -154,23 +292,78 @@ void NetMessageParser::received_to_barrier()
         break;
     }
     }
-    m_written_up_to = 0;
-    m_recv_buffer.resize(m_recv_barrier);
+}
+
+template <typename message_t>
+std::unique_ptr<message_t> NetMessageParser::take_spare(
+        std::vector<std::unique_ptr<message_t> > &spares)
+{
+    if (spares.empty()) {
+        return std::make_unique<message_t>();
+    }
+    std::unique_ptr<message_t> result(std::move(spares.back()));
+    spares.pop_back();
+    return result;
+}
+
+template <typename message_t>
+void NetMessageParser::put_spare(
+        std::vector<std::unique_ptr<message_t> > &spares,
+        std::unique_ptr<message_t> &&msg)
+{
+    if (!msg || spares.size() >= MAX_SPARE_MESSAGES) {
+        return;
+    }
+    // parsing clears the message anyways, but this drops references to
+    // possibly large payloads early
+    msg->Clear();
+    spares.emplace_back(std::move(msg));
 }
 
 void NetMessageParser::reset()
 {
-    m_recv_buffer.clear();
-    m_recv_buffer.shrink_to_fit();
+    m_ring_read = 0;
+    m_ring_filled = 0;
     m_recv_state = RECV_WAIT_FOR_HEADER;
     m_recv_barrier = HEADER_SIZE;
-    m_written_up_to = 0;
+}
+
+void NetMessageParser::recycle(std::unique_ptr<messages::NetWorldControl> &&msg)
+{
+    put_spare(m_spare_link_control, std::move(msg));
+}
+
+void NetMessageParser::recycle(std::unique_ptr<messages::WorldCommand> &&msg)
+{
+    put_spare(m_spare_world_command, std::move(msg));
+}
+
+void NetMessageParser::recycle(
+        std::unique_ptr<messages::WorldCommandResponse> &&msg)
+{
+    put_spare(m_spare_world_command_response, std::move(msg));
+}
+
+void NetMessageParser::recycle(
+        std::unique_ptr<messages::WorldSnapshotChunk> &&msg)
+{
+    put_spare(m_spare_world_snapshot_chunk, std::move(msg));
+}
+
+void NetMessageParser::recycle(std::unique_ptr<messages::TerrainDelta> &&msg)
+{
+    put_spare(m_spare_terrain_delta, std::move(msg));
 }
 
 std::pair<char *, size_t> NetMessageParser::next_buffer()
 {
-    size_t to_recv = m_recv_barrier - m_written_up_to;
-    return std::make_pair(&m_recv_buffer[m_written_up_to], to_recv);
+    const uint64_t write_pos = (m_ring_read + m_ring_filled) % RING_BUFFER_SIZE;
+    uint64_t to_recv = std::min(RING_BUFFER_SIZE - m_ring_filled,
+                                RING_BUFFER_SIZE - write_pos);
+    if (m_mode == BUFFER_TO_BARRIER) {
+        to_recv = std::min(to_recv, m_recv_barrier - m_ring_filled);
+    }
+    return std::make_pair(&m_ring[write_pos], to_recv);
 }
 
 void NetMessageParser::set_message_handler(IMessageHandler *handler)
@@ -184,17 +377,145 @@ void NetMessageParser::set_message_handler(IMessageHandler *handler)
 
 void NetMessageParser::written(size_t bytes)
 {
-    m_written_up_to += bytes;
-    if (m_written_up_to > m_recv_barrier) {
+    if (bytes > next_buffer().second) {
         throw std::logic_error("NetMessageParser user wrote more bytes than allowed");
     }
+    m_ring_filled += bytes;
+
+    if (m_mode == BUFFER_TO_BARRIER) {
+        if (m_ring_filled == m_recv_barrier) {
+            received_to_barrier();
+        }
+        return;
+    }
 
-    if (m_written_up_to == m_recv_barrier) {
+    // fail() empties the buffer, which also ends the loop
+    while (m_ring_filled >= m_recv_barrier) {
         received_to_barrier();
     }
 }
 
 
+/* sim::NetMessageWriter */
+
+constexpr std::size_t NetMessageWriter::CHUNK_SIZE;
+constexpr std::size_t NetMessageWriter::MAX_SPARE_CHUNKS;
+
+NetMessageWriter::NetMessageWriter():
+    m_pending_messages(0),
+    m_stats()
+{
+
+}
+
+NetMessageWriter::Chunk &NetMessageWriter::chunk_for(std::size_t bytes)
+{
+    if (!m_pending.empty()) {
+        Chunk &last = m_pending.back();
+        if (last.capacity - last.size >= bytes) {
+            return last;
+        }
+    }
+
+    for (auto iter = m_spare.begin(); iter != m_spare.end(); ++iter) {
+        if (iter->capacity >= bytes) {
+            m_pending.emplace_back(std::move(*iter));
+            m_spare.erase(iter);
+            m_pending.back().size = 0;
+            return m_pending.back();
+        }
+    }
+
+    const std::size_t capacity = std::max(CHUNK_SIZE, bytes);
+    m_pending.emplace_back(Chunk{std::unique_ptr<char[]>(new char[capacity]),
+                                 capacity,
+                                 0});
+    return m_pending.back();
+}
+
+bool NetMessageWriter::append(NetMessageClass msgclass,
+                              const google::protobuf::Message &msg)
+{
+    const std::size_t payload_size = msg.ByteSizeLong();
+    if (payload_size > NetMessageParser::MAX_MESSAGE_SIZE) {
+        logger.log(io::LOG_ERROR) << "refusing to send too large message ("
+                                  << payload_size << " bytes, max is "
+                                  << NetMessageParser::MAX_MESSAGE_SIZE << ")"
+                                  << io::submit;
+        return false;
+    }
+    const std::size_t total_size = NetMessageParser::HEADER_SIZE + payload_size;
+
+    std::lock_guard<std::mutex> lock(m_pending_mutex);
+    Chunk &chunk = chunk_for(total_size);
+    uint8_t *dest = reinterpret_cast<uint8_t*>(&chunk.data[chunk.size]);
+    dest = google::protobuf::io::CodedOutputStream::WriteLittleEndian32ToArray(
+                msgclass, dest);
+    dest = google::protobuf::io::CodedOutputStream::WriteLittleEndian32ToArray(
+                payload_size, dest);
+    msg.SerializeWithCachedSizesToArray(dest);
+    chunk.size += total_size;
+    m_pending_messages += 1;
+    return true;
+}
+
+void NetMessageWriter::clear()
+{
+    std::lock_guard<std::mutex> lock(m_pending_mutex);
+    m_pending.clear();
+    m_spare.clear();
+    m_pending_messages = 0;
+}
+
+bool NetMessageWriter::flush(const WriteCallback &write)
+{
+    uint64_t messages;
+    {
+        std::lock_guard<std::mutex> lock(m_pending_mutex);
+        if (m_pending.empty()) {
+            return true;
+        }
+        m_flushing.swap(m_pending);
+        messages = m_pending_messages;
+        m_pending_messages = 0;
+    }
+
+    // write without holding the lock, so that appending can continue
+    bool success = true;
+    uint64_t bytes = 0;
+    for (const Chunk &chunk: m_flushing) {
+        if (!write(chunk.data.get(), chunk.size)) {
+            success = false;
+            break;
+        }
+        bytes += chunk.size;
+    }
+
+    std::lock_guard<std::mutex> lock(m_pending_mutex);
+    m_stats.flushes += 1;
+    m_stats.messages += messages;
+    m_stats.bytes += bytes;
+    m_stats.last_flush_messages = messages;
+    m_stats.last_flush_bytes = bytes;
+
+    for (Chunk &chunk: m_flushing) {
+        if (m_spare.size() >= MAX_SPARE_CHUNKS) {
+            break;
+        }
+        m_spare.emplace_back(std::move(chunk));
+    }
+    m_flushing.clear();
+
+    return success;
+}
+
+NetSendStats NetMessageWriter::stats()
+{
+    std::lock_guard<std::mutex> lock(m_pending_mutex);
+    return m_stats;
+}
+
+
 /* sim::TCPServerClient */
 
 std::atomic<uint64_t> NetServerClient::m_connection_id_ctr(0);
@@ -209,7 +530,8 @@ NetServerClient::NetServerClient(QTcpSocket &socket, QObject *parent):
                                std::placeholders::_1),
                      std::bind(&NetServerClient::fail,
                                this),
-                     m_connection_id)
+                     m_connection_id,
+                     NetMessageParser::BUFFER_STREAM)
 {
     logger.log(io::LOG_INFO) << "new connection with id" << m_connection_id << io::submit;
     connect(&m_socket, static_cast<void(QAbstractSocket::*)(QAbstractSocket::SocketError)>(&QTcpSocket::error),
@@ -256,21 +578,27 @@ void NetServerClient::fail()
     terminate();
     // emit the signal as it won’t be emitted due to terminate()ion
     m_sig_disconnected.emit();
+    Q_EMIT(disconnected());
 }
 
 void NetServerClient::link_control_received(std::unique_ptr<messages::NetWorldControl> &&msg)
 {
-
+    m_message_parser.recycle(std::move(msg));
 }
 
 void NetServerClient::on_data_received()
 {
+    // the parser is in streaming mode, so each read fills as much of the
+    // ring buffer as possible and all complete messages are parsed in place
     char *dest;
     size_t size;
     while (m_socket.bytesAvailable() > 0) {
         std::tie(dest, size) = m_message_parser.next_buffer();
         if (size > 0) {
             int64_t bytes_read = m_socket.read(dest, size);
+            if (bytes_read < 0) {
+                break;
+            }
             m_message_parser.written(bytes_read);
         } else {
             m_message_parser.written(0);
@@ -284,6 +612,7 @@ void NetServerClient::on_disconnected()
                              << " disconnected" << io::submit;
     if (!m_terminated) {
         m_sig_disconnected.emit();
+        Q_EMIT(disconnected());
     }
 }
 
@@ -310,6 +639,20 @@ void NetServerClient::flush()
                 << io::submit;
         return;
     }
+
+    // all messages buffered since the last flush go out together
+    const bool success = m_message_writer.flush(
+                [this](const char *data, std::size_t size)
+    {
+        return m_socket.write(data, size) == int64_t(size);
+    });
+    if (!success) {
+        logger.log(io::LOG_ERROR)
+                << "failed to write to connection " << m_connection_id
+                << io::submit;
+        fail();
+        return;
+    }
     m_socket.flush();
 }
 
@@ -318,14 +661,37 @@ bool NetServerClient::msg_unhandled(AbstractMessagePtr &&)
     return false;
 }
 
+bool NetServerClient::msg_world_command(
+        std::unique_ptr<messages::WorldCommand> &&cmd)
+{
+    return m_message_writer.append(MSGCLASS_WORLD_COMMAND, *cmd);
+}
+
+bool NetServerClient::msg_world_command_response(
+        std::unique_ptr<messages::WorldCommandResponse> &&resp)
+{
+    return m_message_writer.append(MSGCLASS_WORLD_COMMAND_RESPONSE, *resp);
+}
+
+bool NetServerClient::msg_world_snapshot_chunk(
+        std::unique_ptr<messages::WorldSnapshotChunk> &&chunk)
+{
+    return m_message_writer.append(MSGCLASS_WORLD_SNAPSHOT_CHUNK, *chunk);
+}
+
+bool NetServerClient::msg_terrain_delta(
+        std::unique_ptr<messages::TerrainDelta> &&delta)
+{
+    return m_message_writer.append(MSGCLASS_TERRAIN_DELTA, *delta);
+}
+
 void NetServerClient::terminate()
 {
     if (m_terminated) {
         return;
     }
 
-    m_send_buffer.clear();
-    m_send_buffer.shrink_to_fit();
+    m_message_writer.clear();
     m_message_parser.reset();
     m_socket.close();
     m_terminated = true;
@@ -336,18 +702,42 @@ void NetServerClient::set_message_handler(IMessageHandler *handler)
     m_message_parser.set_message_handler(handler);
 }
 
+NetSendStats NetServerClient::send_stats()
+{
+    return m_message_writer.stats();
+}
+
 /* sim::TCPServer */
 
-NetServer::NetServer():
+NetServer::NetServer(Server &server):
     QThread(),
+    m_server(server),
     m_tcp_server(nullptr)
 {
+    connect(&m_tcp_server, &QTcpServer::newConnection,
+            [this](){ on_incoming_connection(); });
+}
 
+NetServer::~NetServer()
+{
+    for (auto &client: m_clients) {
+        m_server.remove_client(client.get());
+    }
 }
 
 void NetServer::on_incoming_connection()
 {
-    m_clients.emplace_back(new NetServerClient(*m_tcp_server.nextPendingConnection()));
+    while (m_tcp_server.hasPendingConnections()) {
+        m_clients.emplace_back(new NetServerClient(*m_tcp_server.nextPendingConnection()));
+        NetServerClient *client = m_clients.back().get();
+        // the server only flushes registered clients at the end of each game
+        // frame; remove_client() is thread-safe, so a direct connection is
+        // fine here
+        connect(client, &ServerClientBase::disconnected,
+                [this, client](){ m_server.remove_client(client); });
+        m_server.add_client(client);
+        m_server.send_snapshot(client);
+    }
 }
 
 void NetServer::run()
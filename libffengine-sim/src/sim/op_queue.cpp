@@ -0,0 +1,184 @@
+/**********************************************************************
+File name: op_queue.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include "ffengine/sim/op_queue.hpp"
+
+#include <cassert>
+
+
+namespace sim {
+
+static inline std::uint64_t make_free_head(const std::uint32_t tag,
+                                           const std::uint32_t index)
+{
+    return (std::uint64_t(tag) << 32) | index;
+}
+
+static inline std::uint32_t free_head_index(const std::uint64_t head)
+{
+    return std::uint32_t(head);
+}
+
+static inline std::uint32_t free_head_tag(const std::uint64_t head)
+{
+    return std::uint32_t(head >> 32);
+}
+
+
+/* sim::WorldOperationQueue */
+
+constexpr std::size_t WorldOperationQueue::DEFAULT_POOL_SIZE;
+constexpr std::uint32_t WorldOperationQueue::NO_NODE;
+
+WorldOperationQueue::WorldOperationQueue(const std::size_t pool_size):
+    m_pool(new Node[pool_size]),
+    m_pool_size(pool_size),
+    m_free_head(make_free_head(0, pool_size > 0 ? 0 : NO_NODE)),
+    m_head(&m_stub),
+    m_tail(&m_stub),
+    m_overflows(0)
+{
+    assert(pool_size < NO_NODE);
+    for (std::size_t i = 0; i < pool_size; ++i) {
+        Node &node = m_pool[i];
+        node.index = i;
+        node.next_free.store(i+1 < pool_size ? i+1 : NO_NODE,
+                             std::memory_order_relaxed);
+        node.next.store(nullptr, std::memory_order_relaxed);
+    }
+    m_stub.index = NO_NODE;
+    m_stub.next.store(nullptr, std::memory_order_relaxed);
+}
+
+WorldOperationQueue::~WorldOperationQueue()
+{
+    // free heap allocated nodes which are still queued
+    std::vector<WorldOperationPtr> remaining;
+    pop_all(remaining);
+}
+
+WorldOperationQueue::Node *WorldOperationQueue::acquire_node()
+{
+    std::uint64_t head = m_free_head.load(std::memory_order_acquire);
+    while (free_head_index(head) != NO_NODE) {
+        Node &node = m_pool[free_head_index(head)];
+        // the node may be taken by another producer in the meantime, in
+        // which case next_free is garbage; the tag makes the CAS fail then
+        const std::uint64_t new_head = make_free_head(
+                    free_head_tag(head)+1,
+                    node.next_free.load(std::memory_order_relaxed));
+        if (m_free_head.compare_exchange_weak(head, new_head,
+                                              std::memory_order_acquire,
+                                              std::memory_order_acquire))
+        {
+            return &node;
+        }
+    }
+
+    m_overflows.fetch_add(1, std::memory_order_relaxed);
+    Node *node = new Node;
+    node->index = NO_NODE;
+    return node;
+}
+
+void WorldOperationQueue::release_node(Node *node)
+{
+    node->op = nullptr;
+    if (node->index == NO_NODE) {
+        delete node;
+        return;
+    }
+
+    std::uint64_t head = m_free_head.load(std::memory_order_relaxed);
+    std::uint64_t new_head;
+    do {
+        node->next_free.store(free_head_index(head),
+                              std::memory_order_relaxed);
+        new_head = make_free_head(free_head_tag(head)+1, node->index);
+    } while (!m_free_head.compare_exchange_weak(head, new_head,
+                                                std::memory_order_release,
+                                                std::memory_order_relaxed));
+}
+
+void WorldOperationQueue::push_node(Node *node)
+{
+    node->next.store(nullptr, std::memory_order_relaxed);
+    Node *prev = m_head.exchange(node, std::memory_order_acq_rel);
+    // between the exchange and this store, the list is disconnected; the
+    // consumer treats that as the end of the queue
+    prev->next.store(node, std::memory_order_release);
+}
+
+WorldOperationQueue::Node *WorldOperationQueue::pop_node()
+{
+    Node *tail = m_tail;
+    Node *next = tail->next.load(std::memory_order_acquire);
+    if (tail == &m_stub) {
+        if (!next) {
+            return nullptr;
+        }
+        m_tail = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+
+    if (next) {
+        m_tail = next;
+        return tail;
+    }
+
+    if (tail != m_head.load(std::memory_order_acquire)) {
+        // a producer is in the middle of a push
+        return nullptr;
+    }
+
+    // tail is the last node; put the stub behind it so that it can be
+    // unlinked
+    push_node(&m_stub);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next) {
+        m_tail = next;
+        return tail;
+    }
+    return nullptr;
+}
+
+void WorldOperationQueue::push(WorldOperationPtr &&op)
+{
+    Node *node = acquire_node();
+    node->op = std::move(op);
+    push_node(node);
+}
+
+std::size_t WorldOperationQueue::pop_all(std::vector<WorldOperationPtr> &dest)
+{
+    std::size_t count = 0;
+    while (Node *node = pop_node()) {
+        dest.emplace_back(std::move(node->op));
+        release_node(node);
+        ++count;
+    }
+    return count;
+}
+
+}
@@ -0,0 +1,794 @@
+/**********************************************************************
+File name: savegame.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include "ffengine/sim/savegame.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "ffengine/common/scheduler.hpp"
+#include "ffengine/io/log.hpp"
+
+#include "ffengine/sim/world.hpp"
+
+
+namespace sim {
+
+static io::Logger &logger = io::logging().get_logger("sim.savegame");
+
+
+const std::uint32_t SAVEGAME_VERSION = 1;
+
+static const char SAVEGAME_MAGIC[8] = {'F', 'F', 'E', 'W', 'O', 'R', 'L', 'D'};
+static const std::uint32_t SAVEGAME_BYTE_ORDER = 0x01020304;
+static const std::size_t SECTION_ALIGNMENT = 4096;
+
+enum SectionTag: std::uint32_t
+{
+    SECTION_TERRAIN = 1,
+    SECTION_FLUID = 2,
+    SECTION_FLUID_SOURCES = 3,
+    SECTION_GRAPH = 4,
+};
+
+struct FileHeader
+{
+    char magic[8];
+    std::uint32_t byte_order;
+    std::uint32_t version;
+    std::uint32_t section_count;
+    std::uint32_t terrain_size;
+    std::uint32_t terrain_tile_size;
+    std::uint32_t fluid_block_size;
+    std::uint32_t fluid_blocks_per_axis;
+    std::uint32_t reserved;
+};
+
+struct SectionEntry
+{
+    std::uint32_t tag;
+    std::uint32_t reserved;
+    std::uint64_t offset;
+    std::uint64_t length;
+};
+
+struct FluidHeader
+{
+    float ocean_level;
+    std::uint32_t reserved;
+};
+
+struct FluidBlockRecord
+{
+    std::uint8_t active;
+    std::uint8_t reserved[3];
+    float change;
+};
+
+struct FluidCellRecord
+{
+    float fluid_height;
+    float fluid_flow[2];
+};
+
+struct CountHeader
+{
+    std::uint32_t first;
+    std::uint32_t second;
+};
+
+struct FluidSourceRecord
+{
+    std::uint64_t object_id;
+    float x, y;
+    float radius;
+    float absolute_height;
+    float capacity;
+    std::uint32_t reserved;
+};
+
+struct NodeRecord
+{
+    std::uint64_t object_id;
+    std::uint32_t edge_class;
+    float x, y, z;
+};
+
+struct BundleRecord
+{
+    std::uint64_t object_id;
+    std::uint64_t start_node;
+    std::uint64_t end_node;
+    std::uint32_t edge_type;
+    float cx, cy, cz;
+};
+
+static_assert(sizeof(FileHeader) == 40, "unexpected FileHeader padding");
+static_assert(sizeof(SectionEntry) == 24, "unexpected SectionEntry padding");
+static_assert(sizeof(FluidBlockRecord) == 8, "unexpected FluidBlockRecord padding");
+static_assert(sizeof(FluidCellRecord) == 12, "unexpected FluidCellRecord padding");
+static_assert(sizeof(FluidSourceRecord) == 32, "unexpected FluidSourceRecord padding");
+static_assert(sizeof(NodeRecord) == 24, "unexpected NodeRecord padding");
+static_assert(sizeof(BundleRecord) == 40, "unexpected BundleRecord padding");
+static_assert(sizeof(Vector3f) == 3*sizeof(float),
+              "terrain vertices are written as raw floats");
+
+/**
+ * Edge classes and types are identified by their address at runtime; in the
+ * file, they are identified by their index in these tables.
+ */
+static const EdgeClass *const EDGE_CLASSES[] = {
+    &EDGE_CLASS_ROAD,
+};
+
+static const EdgeType *const EDGE_TYPES[] = {
+    &EDGE_TYPE_BIDIRECTIONAL_ONE_LANE,
+    &EDGE_TYPE_BIDIRECTIONAL_THREE_LANES,
+};
+
+template <typename T, std::size_t N>
+static std::uint32_t table_index(const T *const (&table)[N], const T &entry)
+{
+    for (std::size_t i = 0; i < N; ++i) {
+        if (table[i] == &entry) {
+            return i;
+        }
+    }
+    throw SaveGameError("edge class or type cannot be saved");
+}
+
+static inline std::size_t align_section(const std::size_t offset)
+{
+    return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT
+            * SECTION_ALIGNMENT;
+}
+
+static inline std::size_t terrain_tile_bytes()
+{
+    return Terrain::LOCK_TILE_SIZE*Terrain::LOCK_TILE_SIZE*sizeof(Vector3f);
+}
+
+static inline std::size_t fluid_block_bytes()
+{
+    return IFluidSim::block_size*IFluidSim::block_size*sizeof(FluidCellRecord);
+}
+
+/**
+ * Offset of the first block's cells within the fluid section; the cells
+ * start on their own page.
+ */
+static inline std::size_t fluid_cells_offset(const unsigned int block_count)
+{
+    return align_section(sizeof(FluidHeader) +
+                         block_count*sizeof(FluidBlockRecord));
+}
+
+template <typename T>
+static void write_record(io::Stream &dest, const T &record)
+{
+    const std::size_t written = dest.write(&record, sizeof(T));
+    if (written < sizeof(T)) {
+        throw io::StreamWriteError("short write while saving world");
+    }
+}
+
+static void write_bytes(io::Stream &dest, const void *data,
+                        const std::size_t length)
+{
+    const std::size_t written = dest.write(data, length);
+    if (written < length) {
+        throw io::StreamWriteError("short write while saving world");
+    }
+}
+
+static void write_padding(io::Stream &dest, std::size_t length)
+{
+    static const char zeros[256] = {};
+    while (length > 0) {
+        const std::size_t chunk = std::min(length, sizeof(zeros));
+        write_bytes(dest, zeros, chunk);
+        length -= chunk;
+    }
+}
+
+
+/* saving */
+
+static void save_terrain(io::Stream &dest, const TerrainSnapshot &snapshot)
+{
+    const unsigned int tiles_per_axis = snapshot.tiles_per_axis();
+    for (unsigned int ty = 0; ty < tiles_per_axis; ++ty) {
+        for (unsigned int tx = 0; tx < tiles_per_axis; ++tx) {
+            write_bytes(dest, snapshot.tile_data(tx, ty),
+                        terrain_tile_bytes());
+        }
+    }
+}
+
+static void save_fluid(io::Stream &dest, const Fluid &fluid)
+{
+    const FluidBlocks &blocks = fluid.blocks();
+    const unsigned int blocks_per_axis = blocks.blocks_per_axis();
+    const unsigned int block_count = blocks_per_axis*blocks_per_axis;
+    const unsigned int size = IFluidSim::block_size;
+
+    FluidHeader header{};
+    header.ocean_level = fluid.ocean_level();
+    write_record(dest, header);
+
+    {
+        auto lock = blocks.read_frontbuffer();
+        for (unsigned int y = 0; y < blocks_per_axis; ++y) {
+            for (unsigned int x = 0; x < blocks_per_axis; ++x) {
+                const FluidBlockMeta &meta = blocks.block(x, y)->front_meta();
+                FluidBlockRecord record{};
+                record.active = meta.active ? 1 : 0;
+                record.change = meta.change;
+                write_record(dest, record);
+            }
+        }
+    }
+    write_padding(dest, fluid_cells_offset(block_count) -
+                  (sizeof(FluidHeader) + block_count*sizeof(FluidBlockRecord)));
+
+    std::vector<FluidCellRecord> cells(size*size);
+    for (unsigned int y = 0; y < blocks_per_axis; ++y) {
+        for (unsigned int x = 0; x < blocks_per_axis; ++x) {
+            {
+                // the cell values of collapsed blocks are only available by
+                // value
+                auto lock = blocks.read_frontbuffer();
+                const FluidBlock &block = *blocks.block(x, y);
+                for (unsigned int yl = 0; yl < size; ++yl) {
+                    for (unsigned int xl = 0; xl < size; ++xl) {
+                        const FluidCell cell = block.local_cell_front_value(xl, yl);
+                        FluidCellRecord &record = cells[yl*size+xl];
+                        record.fluid_height = FluidFloat(cell.fluid_height);
+                        record.fluid_flow[0] = FluidFloat(cell.fluid_flow[0]);
+                        record.fluid_flow[1] = FluidFloat(cell.fluid_flow[1]);
+                    }
+                }
+            }
+            write_bytes(dest, cells.data(), fluid_block_bytes());
+        }
+    }
+}
+
+static void save_fluid_sources(io::Stream &dest,
+                               const std::vector<Fluid::Source*> &sources)
+{
+    write_record(dest, CountHeader{std::uint32_t(sources.size()), 0});
+    for (const Fluid::Source *source: sources) {
+        FluidSourceRecord record{};
+        record.object_id = source->object_id();
+        record.x = source->m_pos[eX];
+        record.y = source->m_pos[eY];
+        record.radius = source->m_radius;
+        record.absolute_height = source->m_absolute_height;
+        record.capacity = source->m_capacity;
+        write_record(dest, record);
+    }
+}
+
+static void save_graph(io::Stream &dest,
+                       const std::vector<const PhysicalNode*> &nodes,
+                       const std::vector<const PhysicalEdgeBundle*> &bundles)
+{
+    write_record(dest, CountHeader{std::uint32_t(nodes.size()),
+                                   std::uint32_t(bundles.size())});
+    for (const PhysicalNode *node: nodes) {
+        NodeRecord record{};
+        record.object_id = node->object_id();
+        record.edge_class = table_index(EDGE_CLASSES, node->edge_class());
+        record.x = node->position()[eX];
+        record.y = node->position()[eY];
+        record.z = node->position()[eZ];
+        write_record(dest, record);
+    }
+    for (const PhysicalEdgeBundle *bundle: bundles) {
+        BundleRecord record{};
+        record.object_id = bundle->object_id();
+        record.start_node = bundle->start_node().object_id();
+        record.end_node = bundle->end_node().object_id();
+        record.edge_type = table_index(EDGE_TYPES, bundle->type());
+        record.cx = bundle->control_point()[eX];
+        record.cy = bundle->control_point()[eY];
+        record.cz = bundle->control_point()[eZ];
+        write_record(dest, record);
+    }
+}
+
+void save_world(io::Stream &dest, const WorldState &state)
+{
+    const TerrainSnapshot terrain = state.terrain().snapshot();
+    const FluidBlocks &fluid_blocks = state.fluid().blocks();
+    const unsigned int fluid_block_count =
+            fluid_blocks.blocks_per_axis()*fluid_blocks.blocks_per_axis();
+    const std::vector<Fluid::Source*> sources = state.fluid().sources();
+
+    std::vector<const PhysicalNode*> nodes;
+    for (const auto &node: state.graph().nodes()) {
+        if (node) {
+            nodes.emplace_back(node.get());
+        }
+    }
+    std::vector<const PhysicalEdgeBundle*> bundles;
+    for (const auto &bundle: state.graph().bundles()) {
+        if (bundle) {
+            bundles.emplace_back(bundle.get());
+        }
+    }
+
+    // the section sizes are known up front, so that the table can be
+    // written before the sections and the stream need not be seekable
+    SectionEntry sections[4] = {};
+    sections[0].tag = SECTION_TERRAIN;
+    sections[0].length = std::uint64_t(terrain.tiles_per_axis())*
+            terrain.tiles_per_axis()*terrain_tile_bytes();
+    sections[1].tag = SECTION_FLUID;
+    sections[1].length = fluid_cells_offset(fluid_block_count) +
+            std::uint64_t(fluid_block_count)*fluid_block_bytes();
+    sections[2].tag = SECTION_FLUID_SOURCES;
+    sections[2].length = sizeof(CountHeader) +
+            sources.size()*sizeof(FluidSourceRecord);
+    sections[3].tag = SECTION_GRAPH;
+    sections[3].length = sizeof(CountHeader) +
+            nodes.size()*sizeof(NodeRecord) +
+            bundles.size()*sizeof(BundleRecord);
+
+    std::size_t offset = align_section(sizeof(FileHeader) + sizeof(sections));
+    for (SectionEntry &section: sections) {
+        section.offset = offset;
+        offset = align_section(offset + section.length);
+    }
+
+    FileHeader header{};
+    std::memcpy(header.magic, SAVEGAME_MAGIC, sizeof(header.magic));
+    header.byte_order = SAVEGAME_BYTE_ORDER;
+    header.version = SAVEGAME_VERSION;
+    header.section_count = 4;
+    header.terrain_size = terrain.size();
+    header.terrain_tile_size = Terrain::LOCK_TILE_SIZE;
+    header.fluid_block_size = IFluidSim::block_size;
+    header.fluid_blocks_per_axis = fluid_blocks.blocks_per_axis();
+    write_record(dest, header);
+    write_bytes(dest, sections, sizeof(sections));
+
+    std::size_t pos = sizeof(FileHeader) + sizeof(sections);
+    for (const SectionEntry &section: sections) {
+        write_padding(dest, section.offset - pos);
+        switch (section.tag)
+        {
+        case SECTION_TERRAIN:
+        {
+            save_terrain(dest, terrain);
+            break;
+        }
+        case SECTION_FLUID:
+        {
+            save_fluid(dest, state.fluid());
+            break;
+        }
+        case SECTION_FLUID_SOURCES:
+        {
+            save_fluid_sources(dest, sources);
+            break;
+        }
+        case SECTION_GRAPH:
+        {
+            save_graph(dest, nodes, bundles);
+            break;
+        }
+        }
+        pos = section.offset + section.length;
+    }
+}
+
+
+/* loading */
+
+namespace {
+
+/**
+ * Bounds checked view of a section of the mapped file.
+ */
+class SectionReader
+{
+public:
+    SectionReader():
+        m_data(nullptr),
+        m_length(0),
+        m_pos(0)
+    {
+
+    }
+
+    SectionReader(const std::uint8_t *data, const std::size_t length):
+        m_data(data),
+        m_length(length),
+        m_pos(0)
+    {
+
+    }
+
+private:
+    const std::uint8_t *m_data;
+    std::size_t m_length;
+    std::size_t m_pos;
+
+public:
+    inline const std::uint8_t *data() const
+    {
+        return m_data;
+    }
+
+    inline std::size_t length() const
+    {
+        return m_length;
+    }
+
+    template <typename T>
+    T read()
+    {
+        if (m_length - m_pos < sizeof(T)) {
+            throw SaveGameError("section truncated");
+        }
+        T result;
+        std::memcpy(&result, &m_data[m_pos], sizeof(T));
+        m_pos += sizeof(T);
+        return result;
+    }
+
+    /**
+     * Require the section to have exactly \a expected bytes.
+     */
+    void expect_length(const std::size_t expected) const
+    {
+        if (m_length != expected) {
+            throw SaveGameError("section has unexpected length");
+        }
+    }
+
+};
+
+}
+
+static void load_terrain(const SectionReader &section, Terrain &terrain)
+{
+    const unsigned int size = terrain.size();
+    const unsigned int tile_size = Terrain::LOCK_TILE_SIZE;
+    const unsigned int tiles_per_axis = (size + tile_size - 1) / tile_size;
+
+    Terrain::Field *field = nullptr;
+    auto lock = terrain.writable_field(field);
+    ffe::parallel_for(
+                ffe::scheduler(), 0, tiles_per_axis*tiles_per_axis, 1,
+                [&](const unsigned int first, const unsigned int last)
+    {
+        for (unsigned int i = first; i < last; ++i) {
+            const unsigned int tx = i % tiles_per_axis;
+            const unsigned int ty = i / tiles_per_axis;
+            const Vector3f *tile = reinterpret_cast<const Vector3f*>(
+                        section.data() + i*terrain_tile_bytes());
+            const unsigned int x0 = tx*tile_size;
+            const unsigned int y0 = ty*tile_size;
+            const unsigned int width = std::min(tile_size, size-x0);
+            const unsigned int height = std::min(tile_size, size-y0);
+            for (unsigned int y = 0; y < height; ++y) {
+                std::memcpy(&(*field)[(y0+y)*size+x0],
+                            &tile[y*tile_size],
+                            width*sizeof(Vector3f));
+            }
+        }
+    });
+    lock.unlock();
+    terrain.notify_heightmap_changed();
+}
+
+static void load_fluid(const SectionReader &section, Fluid &fluid)
+{
+    FluidBlocks &blocks = fluid.blocks();
+    const unsigned int blocks_per_axis = blocks.blocks_per_axis();
+    const unsigned int block_count = blocks_per_axis*blocks_per_axis;
+    const unsigned int size = IFluidSim::block_size;
+
+    SectionReader reader(section);
+    const FluidHeader header = reader.read<FluidHeader>();
+    std::vector<FluidBlockRecord> records;
+    records.reserve(block_count);
+    for (unsigned int i = 0; i < block_count; ++i) {
+        records.emplace_back(reader.read<FluidBlockRecord>());
+    }
+
+    fluid.set_ocean_level(header.ocean_level);
+    blocks.expand_all();
+
+    const std::uint8_t *cells = section.data() +
+            fluid_cells_offset(block_count);
+    ffe::parallel_for(
+                ffe::scheduler(), 0, block_count, 1,
+                [&](const unsigned int first, const unsigned int last)
+    {
+        for (unsigned int i = first; i < last; ++i) {
+            FluidBlock &block = *blocks.block(i % blocks_per_axis,
+                                              i / blocks_per_axis);
+            const std::uint8_t *src = cells + i*fluid_block_bytes();
+            for (unsigned int yl = 0; yl < size; ++yl) {
+                for (unsigned int xl = 0; xl < size; ++xl) {
+                    FluidCellRecord record;
+                    std::memcpy(&record,
+                                src + (yl*size+xl)*sizeof(FluidCellRecord),
+                                sizeof(FluidCellRecord));
+                    FluidCell cell;
+                    cell.fluid_height = record.fluid_height;
+                    cell.fluid_flow[0] = record.fluid_flow[0];
+                    cell.fluid_flow[1] = record.fluid_flow[1];
+                    *block.local_cell_front(xl, yl) = cell;
+                    *block.local_cell_back(xl, yl) = cell;
+                }
+            }
+            block.front_meta().change = records[i].change;
+            block.back_meta().change = records[i].change;
+            block.set_active(records[i].active != 0);
+        }
+    });
+}
+
+static void load_fluid_sources(const SectionReader &section,
+                               WorldState &state)
+{
+    SectionReader reader(section);
+    const CountHeader counts = reader.read<CountHeader>();
+    for (unsigned int i = 0; i < counts.first; ++i) {
+        const FluidSourceRecord record = reader.read<FluidSourceRecord>();
+        Fluid::Source &obj = state.objects().emplace<Fluid::Source>(
+                    record.object_id,
+                    Vector2f(record.x, record.y),
+                    record.radius,
+                    record.absolute_height,
+                    record.capacity);
+        state.fluid().add_source(&obj);
+        state.fluid_source_added()(state.objects().share(obj));
+    }
+}
+
+static void load_graph(const SectionReader &section, WorldState &state)
+{
+    SectionReader reader(section);
+    const CountHeader counts = reader.read<CountHeader>();
+    for (unsigned int i = 0; i < counts.first; ++i) {
+        const NodeRecord record = reader.read<NodeRecord>();
+        PhysicalNode &node = state.graph().create_node(
+                    *EDGE_CLASSES[record.edge_class],
+                    Vector3f(record.x, record.y, record.z),
+                    record.object_id);
+        node.mark_for_reshape();
+    }
+    for (unsigned int i = 0; i < counts.second; ++i) {
+        const BundleRecord record = reader.read<BundleRecord>();
+        PhysicalNode *start = state.objects().get_safe<PhysicalNode>(
+                    record.start_node);
+        PhysicalNode *end = state.objects().get_safe<PhysicalNode>(
+                    record.end_node);
+        if (!start || !end) {
+            throw SaveGameError("edge bundle refers to unknown node");
+        }
+        state.graph().create_bundle(
+                    *start,
+                    Vector3f(record.cx, record.cy, record.cz),
+                    *end,
+                    *EDGE_TYPES[record.edge_type],
+                    record.object_id);
+    }
+    state.graph().reshape();
+}
+
+/**
+ * Record \a object_id as used by the file; object IDs must be unique across
+ * all sections.
+ */
+static void claim_object_id(std::unordered_set<Object::ID> &ids,
+                            const Object::ID object_id)
+{
+    if (object_id == Object::NULL_OBJECT_ID) {
+        throw SaveGameError("object without ID");
+    }
+    if (!ids.emplace(object_id).second) {
+        throw SaveGameError("duplicate object ID " +
+                            std::to_string(object_id));
+    }
+}
+
+static void validate_fluid_sources(const SectionReader &section,
+                                   std::unordered_set<Object::ID> &ids)
+{
+    SectionReader reader(section);
+    const CountHeader counts = reader.read<CountHeader>();
+    section.expect_length(
+                sizeof(CountHeader) +
+                std::size_t(counts.first)*sizeof(FluidSourceRecord));
+    for (unsigned int i = 0; i < counts.first; ++i) {
+        claim_object_id(ids, reader.read<FluidSourceRecord>().object_id);
+    }
+}
+
+/**
+ * Check the parts of the graph section which cannot be checked while
+ * restoring without leaving a half-restored graph behind.
+ */
+static void validate_graph(const SectionReader &section,
+                           std::unordered_set<Object::ID> &ids)
+{
+    SectionReader reader(section);
+    const CountHeader counts = reader.read<CountHeader>();
+    section.expect_length(sizeof(CountHeader) +
+                          std::size_t(counts.first)*sizeof(NodeRecord) +
+                          std::size_t(counts.second)*sizeof(BundleRecord));
+    std::unordered_set<Object::ID> node_ids;
+    for (unsigned int i = 0; i < counts.first; ++i) {
+        const NodeRecord record = reader.read<NodeRecord>();
+        if (record.edge_class >= sizeof(EDGE_CLASSES)/sizeof(EDGE_CLASSES[0])) {
+            throw SaveGameError("unknown edge class");
+        }
+        claim_object_id(ids, record.object_id);
+        node_ids.emplace(record.object_id);
+    }
+    for (unsigned int i = 0; i < counts.second; ++i) {
+        const BundleRecord record = reader.read<BundleRecord>();
+        if (record.edge_type >= sizeof(EDGE_TYPES)/sizeof(EDGE_TYPES[0])) {
+            throw SaveGameError("unknown edge type");
+        }
+        if (node_ids.count(record.start_node) == 0 ||
+                node_ids.count(record.end_node) == 0) {
+            throw SaveGameError("edge bundle refers to unknown node");
+        }
+        claim_object_id(ids, record.object_id);
+    }
+}
+
+void load_world(const io::MappedFile &src, WorldState &state)
+{
+    SectionReader file(src.data(), src.size());
+    const FileHeader header = file.read<FileHeader>();
+    if (std::memcmp(header.magic, SAVEGAME_MAGIC, sizeof(header.magic)) != 0) {
+        throw SaveGameError("not a world save file");
+    }
+    if (header.byte_order != SAVEGAME_BYTE_ORDER) {
+        throw SaveGameError("world save file has foreign byte order");
+    }
+    if (header.version != SAVEGAME_VERSION) {
+        throw SaveGameError("unsupported world save file version " +
+                            std::to_string(header.version));
+    }
+
+    const Terrain &terrain = state.terrain();
+    const FluidBlocks &fluid_blocks = state.fluid().blocks();
+    if (header.terrain_size != terrain.size() ||
+            header.terrain_tile_size != Terrain::LOCK_TILE_SIZE ||
+            header.fluid_block_size != IFluidSim::block_size ||
+            header.fluid_blocks_per_axis != fluid_blocks.blocks_per_axis())
+    {
+        throw SaveGameError("world save file does not match the world size");
+    }
+
+    SectionReader terrain_section, fluid_section, sources_section,
+            graph_section;
+    for (unsigned int i = 0; i < header.section_count; ++i) {
+        const SectionEntry entry = file.read<SectionEntry>();
+        if (entry.offset > src.size() ||
+                entry.length > src.size() - entry.offset ||
+                entry.offset % SECTION_ALIGNMENT != 0)
+        {
+            throw SaveGameError("section out of bounds");
+        }
+        const SectionReader section(src.data() + entry.offset, entry.length);
+        switch (entry.tag)
+        {
+        case SECTION_TERRAIN:
+        {
+            terrain_section = section;
+            break;
+        }
+        case SECTION_FLUID:
+        {
+            fluid_section = section;
+            break;
+        }
+        case SECTION_FLUID_SOURCES:
+        {
+            sources_section = section;
+            break;
+        }
+        case SECTION_GRAPH:
+        {
+            graph_section = section;
+            break;
+        }
+        default:
+            logger.logf(io::LOG_WARNING, "skipping unknown section %u",
+                        entry.tag);
+        }
+    }
+
+    if (!terrain_section.data() || !fluid_section.data()) {
+        throw SaveGameError("world save file lacks terrain or fluid");
+    }
+
+    // start reading the bulk data ahead while we validate the rest
+    src.will_need(terrain_section.data() - src.data(),
+                  terrain_section.length());
+    src.will_need(fluid_section.data() - src.data(),
+                  fluid_section.length());
+
+    const unsigned int tiles_per_axis =
+            (terrain.size() + Terrain::LOCK_TILE_SIZE - 1) /
+            Terrain::LOCK_TILE_SIZE;
+    terrain_section.expect_length(
+                std::size_t(tiles_per_axis)*tiles_per_axis*terrain_tile_bytes());
+    const unsigned int fluid_block_count =
+            fluid_blocks.blocks_per_axis()*fluid_blocks.blocks_per_axis();
+    fluid_section.expect_length(
+                fluid_cells_offset(fluid_block_count) +
+                std::size_t(fluid_block_count)*fluid_block_bytes());
+    std::unordered_set<Object::ID> object_ids;
+    if (sources_section.data()) {
+        validate_fluid_sources(sources_section, object_ids);
+    }
+    if (graph_section.data()) {
+        validate_graph(graph_section, object_ids);
+    }
+
+    load_terrain(terrain_section, state.terrain());
+    load_fluid(fluid_section, state.fluid());
+    if (sources_section.data()) {
+        load_fluid_sources(sources_section, state);
+    }
+    if (graph_section.data()) {
+        load_graph(graph_section, state);
+    }
+}
+
+void load_world(const std::string &filename, WorldState &state)
+{
+    const io::MappedFile file(filename);
+    load_world(file, state);
+}
+
+
+/* sim::SaveGameError */
+
+SaveGameError::SaveGameError(const std::string &message):
+    std::runtime_error(message)
+{
+
+}
+
+SaveGameError::SaveGameError(const char *message):
+    std::runtime_error(message)
+{
+
+}
+
+}
@@ -23,7 +23,12 @@ the AUTHORS file.
 **********************************************************************/
 #include "server.moc"
 
+#include "ffengine/common/scheduler.hpp"
+
 #include "world_command.pb.h"
+#include "world_snapshot.pb.h"
+
+#include <algorithm>
 
 
 namespace sim {
@@ -41,6 +46,24 @@ bool IMessageHandler::msg_world_command(std::unique_ptr<messages::WorldCommand>
     return msg_unhandled(std::move(cmd));
 }
 
+bool IMessageHandler::msg_world_command_response(
+        std::unique_ptr<messages::WorldCommandResponse> &&resp)
+{
+    return msg_unhandled(std::move(resp));
+}
+
+bool IMessageHandler::msg_world_snapshot_chunk(
+        std::unique_ptr<messages::WorldSnapshotChunk> &&chunk)
+{
+    return msg_unhandled(std::move(chunk));
+}
+
+bool IMessageHandler::msg_terrain_delta(
+        std::unique_ptr<messages::TerrainDelta> &&delta)
+{
+    return msg_unhandled(std::move(delta));
+}
+
 
 /* sim::RejectingMessageHandler */
 
@@ -60,13 +83,17 @@ ServerClientBase::~ServerClientBase()
 
 /* sim::Server */
 
+const std::chrono::microseconds Server::game_frame_duration(16000);
+const unsigned int Server::snapshot_chunks_per_frame = 16;
+
 Server::Server():
     m_state(),
     m_terminated(false),
-    m_game_thread(std::bind(&Server::game_thread, this)),
-    m_sandifier(m_state.terrain(), m_state.fluid())
+    m_sandifier(m_state.terrain(), m_state.fluid()),
+    m_terrain_journal(m_state.terrain())
 {
-
+    // only start the game loop once all members it uses are constructed
+    m_game_thread = std::thread(std::bind(&Server::game_thread, this));
 }
 
 Server::~Server()
@@ -82,26 +109,29 @@ void Server::game_frame()
     // wait for the fluid sim to finish _without_ holding the lock!
     // this allows the UI to render even while the fluid sim is stuck
     std::lock_guard<std::shared_timed_mutex> lock(m_interframe_mutex);
-    {
-        std::lock_guard<std::mutex> lock(m_op_queue_mutex);
-        m_op_queue.swap(m_op_buffer);
-    }
-
-    for (auto &op: m_op_buffer)
-    {
-        op->execute(m_state);
-    }
+    m_op_queue.pop_all(m_op_buffer);
+    execute_ops();
     m_state.graph().reshape();
     m_sandifier.run_steps();
 
     m_op_buffer.clear();
-;
+
+    replicate_terrain();
+    stream_snapshots();
+
+    // everything which has been produced during this frame is sent at once
+    {
+        std::lock_guard<std::mutex> lock(m_clients_mutex);
+        for (ServerClientBase *client: m_client_interfaces) {
+            QMetaObject::invokeMethod(client, "flush", Qt::QueuedConnection);
+        }
+    }
+
     m_state.fluid().start();
 }
 
 void Server::game_thread()
 {
-    static const std::chrono::microseconds game_frame_duration(16000);
     static const std::chrono::microseconds busywait(100);
 
     m_state.fluid().start();
@@ -125,10 +155,187 @@ void Server::game_thread()
     }
 }
 
+void Server::execute_ops()
+{
+    const std::size_t nops = m_op_buffer.size();
+    m_op_footprints.clear();
+    m_op_footprints.reserve(nops);
+    for (auto &op: m_op_buffer) {
+        m_op_footprints.emplace_back(op->footprint(m_state));
+    }
+    const unsigned int nwaves = partition_into_waves(m_op_footprints,
+                                                     m_op_waves);
+
+    // stable counting sort of the operations by wave
+    m_wave_offsets.assign(nwaves+1, 0);
+    for (const unsigned int wave: m_op_waves) {
+        ++m_wave_offsets[wave+1];
+    }
+    for (unsigned int wave = 0; wave < nwaves; ++wave) {
+        m_wave_offsets[wave+1] += m_wave_offsets[wave];
+    }
+    m_wave_order.resize(nops);
+    {
+        std::vector<std::size_t> fill(m_wave_offsets.begin(),
+                                      m_wave_offsets.end()-1);
+        for (std::size_t i = 0; i < nops; ++i) {
+            m_wave_order[fill[m_op_waves[i]]++] = i;
+        }
+    }
+    m_op_results.resize(nops);
+
+    for (unsigned int wave = 0; wave < nwaves; ++wave) {
+        const std::size_t begin = m_wave_offsets[wave];
+        const std::size_t end = m_wave_offsets[wave+1];
+        if (end - begin == 1) {
+            const std::size_t i = m_wave_order[begin];
+            m_op_results[i] = m_op_buffer[i]->execute(m_state);
+        } else {
+            ffe::parallel_for(
+                        ffe::scheduler(), begin, end, 1,
+                        [this](const unsigned int first, const unsigned int last)
+            {
+                for (unsigned int j = first; j < last; ++j) {
+                    const std::size_t i = m_wave_order[j];
+                    m_op_results[i] = m_op_buffer[i]->execute(m_state);
+                }
+            });
+        }
+
+        // signal handlers expect to be called from the game thread only
+        for (std::size_t j = begin; j < end; ++j) {
+            const std::size_t i = m_wave_order[j];
+            const WorldOperationFootprint &footprint = m_op_footprints[i];
+            if (m_op_results[i] == NO_ERROR && !footprint.exclusive &&
+                    !footprint.terrain.empty())
+            {
+                m_state.terrain().notify_heightmap_changed(footprint.terrain);
+            }
+        }
+    }
+}
+
 void Server::enqueue_op(std::unique_ptr<WorldOperation> &&op)
 {
-    std::unique_lock<std::mutex> lock(m_op_queue_mutex);
-    m_op_queue.emplace_back(std::move(op));
+    m_op_queue.push(std::move(op));
+}
+
+WorldOperationResult Server::submit_command(
+        const messages::WorldCommand &cmd,
+        messages::WorldCommandResponse &response)
+{
+    response.set_token(cmd.token());
+
+    if (cmd.has_brush_register()) {
+        const messages::BrushRegister &reg = cmd.brush_register();
+        const BrushID id = m_brushes.intern(
+                    reg.brush_size(),
+                    std::vector<float>(reg.density_map().begin(),
+                                       reg.density_map().end()));
+        if (id == BrushDictionary::INVALID_BRUSH_ID) {
+            response.set_result(INVALID_ARGUMENT);
+            return INVALID_ARGUMENT;
+        }
+        response.set_brush_id(id);
+        response.set_result(NO_ERROR);
+        return NO_ERROR;
+    }
+
+    std::unique_ptr<WorldOperation> op = WorldOperation::from_message(
+                cmd, m_brushes);
+    if (!op) {
+        response.set_result(INVALID_ARGUMENT);
+        return INVALID_ARGUMENT;
+    }
+    enqueue_op(std::move(op));
+    return NO_ERROR;
+}
+
+void Server::replicate_terrain()
+{
+    // all strokes of this frame are merged into one delta per block
+    if (m_terrain_journal.collect(m_terrain_deltas) == 0) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_clients_mutex);
+        for (ServerClientBase *client: m_client_interfaces) {
+            for (const messages::TerrainDelta &delta: m_terrain_deltas) {
+                client->msg_terrain_delta(
+                            std::make_unique<messages::TerrainDelta>(delta));
+            }
+        }
+    }
+    m_terrain_deltas.clear();
+}
+
+void Server::stream_snapshots()
+{
+    std::lock_guard<std::mutex> lock(m_clients_mutex);
+    for (SnapshotStream &stream: m_snapshot_streams) {
+        for (unsigned int i = 0; i < snapshot_chunks_per_frame; ++i) {
+            auto chunk = std::make_unique<messages::WorldSnapshotChunk>();
+            if (!stream.encoder->encode_next(*chunk)) {
+                break;
+            }
+            stream.client->msg_world_snapshot_chunk(std::move(chunk));
+        }
+    }
+
+    m_snapshot_streams.erase(
+                std::remove_if(m_snapshot_streams.begin(),
+                               m_snapshot_streams.end(),
+                               [](const SnapshotStream &stream)
+                               {
+                                   return stream.encoder->done();
+                               }),
+                m_snapshot_streams.end());
+}
+
+void Server::add_client(ServerClientBase *client)
+{
+    std::lock_guard<std::mutex> lock(m_clients_mutex);
+    m_client_interfaces.push_back(client);
+}
+
+void Server::remove_client(ServerClientBase *client)
+{
+    std::lock_guard<std::mutex> lock(m_clients_mutex);
+    auto iter = std::find(m_client_interfaces.begin(),
+                          m_client_interfaces.end(),
+                          client);
+    if (iter != m_client_interfaces.end()) {
+        m_client_interfaces.erase(iter);
+    }
+
+    m_snapshot_streams.erase(
+                std::remove_if(m_snapshot_streams.begin(),
+                               m_snapshot_streams.end(),
+                               [client](const SnapshotStream &stream)
+                               {
+                                   return stream.client == client;
+                               }),
+                m_snapshot_streams.end());
+}
+
+void Server::send_snapshot(ServerClientBase *client)
+{
+    std::lock_guard<std::mutex> lock(m_clients_mutex);
+    m_snapshot_streams.emplace_back(SnapshotStream{
+        client,
+        std::make_unique<WorldSnapshotEncoder>(m_state.terrain(),
+                                               m_state.fluid().blocks())});
+}
+
+void Server::set_fluid_substeps(const unsigned int substeps,
+                                const bool adaptive)
+{
+    FluidStepConfig config;
+    config.substeps = substeps;
+    config.adaptive = adaptive;
+    config.frame_budget = game_frame_duration;
+    m_state.fluid().set_step_config(config);
 }
 
 Server::SyncSafeLock Server::sync_safe_point()
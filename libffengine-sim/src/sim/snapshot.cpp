@@ -0,0 +1,670 @@
+/**********************************************************************
+File name: snapshot.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include "ffengine/sim/snapshot.hpp"
+
+#include <zlib.h>
+
+#include "world_snapshot.pb.h"
+
+#include <cmath>
+
+
+namespace sim {
+
+static io::Logger &logger = io::logging().get_logger("sim.snapshot");
+
+static const unsigned int TERRAIN_PLANES = 2;
+static const unsigned int FLUID_PLANES = 3;
+
+// a varint of a 32 bit value takes at most five bytes
+static const unsigned int MAX_VARINT_SIZE = 5;
+
+static const std::int32_t QUANTISED_LIMIT = 1 << 30;
+
+
+static inline std::int32_t quantise(const float value, const float step)
+{
+    const float scaled = std::round(value / step);
+    if (!(scaled > -QUANTISED_LIMIT)) {
+        return -QUANTISED_LIMIT;
+    }
+    if (scaled > QUANTISED_LIMIT) {
+        return QUANTISED_LIMIT;
+    }
+    return std::int32_t(scaled);
+}
+
+static inline float dequantise(const std::int32_t value, const float step)
+{
+    return value * step;
+}
+
+/**
+ * Median edge detector prediction of the value at (x, y) from its left,
+ * upper and upper-left neighbours. Missing neighbours are replaced so that
+ * the first row predicts from the left and the first column from above.
+ */
+static inline std::int32_t predict(const std::int32_t *plane,
+                                   const unsigned int width,
+                                   const unsigned int x,
+                                   const unsigned int y)
+{
+    if (y == 0) {
+        return (x > 0 ? plane[x-1] : 0);
+    }
+    const std::int32_t *row = &plane[y*width];
+    const std::int32_t *prev_row = row - width;
+    if (x == 0) {
+        return prev_row[0];
+    }
+
+    const std::int32_t a = row[x-1];
+    const std::int32_t b = prev_row[x];
+    const std::int32_t c = prev_row[x-1];
+    if (c >= std::max(a, b)) {
+        return std::min(a, b);
+    } else if (c <= std::min(a, b)) {
+        return std::max(a, b);
+    }
+    return a + b - c;
+}
+
+static void encode_plane(const std::int32_t *plane,
+                         const unsigned int width,
+                         const unsigned int height,
+                         std::string &dest)
+{
+    for (unsigned int y = 0; y < height; ++y) {
+        for (unsigned int x = 0; x < width; ++x) {
+            const std::int32_t residual = plane[y*width+x] -
+                    predict(plane, width, x, y);
+            // zig-zag encoding keeps small negative residuals small
+            std::uint32_t value = (std::uint32_t(residual) << 1) ^
+                    std::uint32_t(residual >> 31);
+            while (value >= 0x80) {
+                dest.push_back(char((value & 0x7f) | 0x80));
+                value >>= 7;
+            }
+            dest.push_back(char(value));
+        }
+    }
+}
+
+static bool decode_plane(const std::string &src,
+                         std::size_t &offset,
+                         const unsigned int width,
+                         const unsigned int height,
+                         std::int32_t *plane)
+{
+    for (unsigned int y = 0; y < height; ++y) {
+        for (unsigned int x = 0; x < width; ++x) {
+            std::uint32_t value = 0;
+            unsigned int shift = 0;
+            while (true) {
+                if (offset >= src.size() || shift >= 7*MAX_VARINT_SIZE) {
+                    return false;
+                }
+                const std::uint8_t byte = src[offset++];
+                value |= std::uint32_t(byte & 0x7f) << shift;
+                shift += 7;
+                if (!(byte & 0x80)) {
+                    break;
+                }
+            }
+            const std::int32_t residual = std::int32_t(value >> 1) ^
+                    -std::int32_t(value & 1);
+            plane[y*width+x] = residual + predict(plane, width, x, y);
+        }
+    }
+    return true;
+}
+
+static bool compress_raw(const std::string &raw, std::string &dest)
+{
+    uLongf dest_size = compressBound(raw.size());
+    dest.resize(dest_size);
+    const int result = compress2(reinterpret_cast<Bytef*>(&dest[0]),
+                                 &dest_size,
+                                 reinterpret_cast<const Bytef*>(raw.data()),
+                                 raw.size(),
+                                 Z_BEST_SPEED);
+    if (result != Z_OK) {
+        return false;
+    }
+    dest.resize(dest_size);
+    return true;
+}
+
+static bool decompress_raw(const std::string &src,
+                           const std::size_t raw_size,
+                           std::string &dest)
+{
+    uLongf dest_size = raw_size;
+    dest.resize(raw_size);
+    const int result = uncompress(reinterpret_cast<Bytef*>(&dest[0]),
+                                  &dest_size,
+                                  reinterpret_cast<const Bytef*>(src.data()),
+                                  src.size());
+    return result == Z_OK && dest_size == raw_size;
+}
+
+static inline unsigned int block_extent(const unsigned int block,
+                                        const unsigned int size)
+{
+    return std::min(IFluidSim::block_size,
+                    size - block*IFluidSim::block_size);
+}
+
+
+/* sim::WorldSnapshotEncoder */
+
+const float WorldSnapshotEncoder::TERRAIN_HEIGHT_STEP = 1.f / 256.f;
+const float WorldSnapshotEncoder::TERRAIN_SAND_STEP = 1.f / 256.f;
+const float WorldSnapshotEncoder::FLUID_HEIGHT_STEP = 1.f / 1024.f;
+const float WorldSnapshotEncoder::FLUID_FLOW_STEP = 1.f / 1024.f;
+
+WorldSnapshotEncoder::WorldSnapshotEncoder(const Terrain &terrain,
+                                           const FluidBlocks &fluid):
+    m_terrain(terrain),
+    m_fluid(fluid),
+    m_terrain_blocks_per_axis((terrain.size() + IFluidSim::block_size - 1) /
+                              IFluidSim::block_size),
+    m_chunk_count(m_terrain_blocks_per_axis*m_terrain_blocks_per_axis +
+                  fluid.blocks_per_axis()*fluid.blocks_per_axis()),
+    m_next_chunk(0),
+    m_plane(IFluidSim::block_size*IFluidSim::block_size)
+{
+
+}
+
+void WorldSnapshotEncoder::encode_terrain_block(const unsigned int x,
+                                                const unsigned int y)
+{
+    const unsigned int size = m_terrain.size();
+    const unsigned int x0 = x*IFluidSim::block_size;
+    const unsigned int y0 = y*IFluidSim::block_size;
+    const unsigned int width = block_extent(x, size);
+    const unsigned int height = block_extent(y, size);
+
+    const Terrain::Field *field = nullptr;
+    auto lock = m_terrain.readonly_rect(
+                TerrainRect(x0, y0, x0+width, y0+height), field);
+
+    for (unsigned int yl = 0; yl < height; ++yl) {
+        const Vector3f *src = &(*field)[(y0+yl)*size+x0];
+        for (unsigned int xl = 0; xl < width; ++xl) {
+            m_plane[yl*width+xl] = quantise(src[xl][Terrain::HEIGHT_ATTR],
+                                            TERRAIN_HEIGHT_STEP);
+        }
+    }
+    encode_plane(m_plane.data(), width, height, m_raw);
+
+    for (unsigned int yl = 0; yl < height; ++yl) {
+        const Vector3f *src = &(*field)[(y0+yl)*size+x0];
+        for (unsigned int xl = 0; xl < width; ++xl) {
+            m_plane[yl*width+xl] = quantise(src[xl][Terrain::SAND_ATTR],
+                                            TERRAIN_SAND_STEP);
+        }
+    }
+    encode_plane(m_plane.data(), width, height, m_raw);
+}
+
+void WorldSnapshotEncoder::encode_fluid_block(const unsigned int x,
+                                              const unsigned int y)
+{
+    static const unsigned int size = IFluidSim::block_size;
+
+    auto lock = m_fluid.read_frontbuffer();
+    const FluidBlock &block = *m_fluid.block(x, y);
+
+    // the cell values of collapsed blocks are only available by value
+    for (unsigned int plane = 0; plane < FLUID_PLANES; ++plane) {
+        for (unsigned int yl = 0; yl < size; ++yl) {
+            for (unsigned int xl = 0; xl < size; ++xl) {
+                const FluidCell cell = block.local_cell_front_value(xl, yl);
+                m_plane[yl*size+xl] = (
+                            plane == 0
+                            ? quantise(cell.fluid_height, FLUID_HEIGHT_STEP)
+                            : quantise(cell.fluid_flow[plane-1], FLUID_FLOW_STEP));
+            }
+        }
+        encode_plane(m_plane.data(), size, size, m_raw);
+    }
+}
+
+bool WorldSnapshotEncoder::encode_next(messages::WorldSnapshotChunk &dest)
+{
+    if (done()) {
+        return false;
+    }
+
+    const unsigned int terrain_chunks =
+            m_terrain_blocks_per_axis*m_terrain_blocks_per_axis;
+
+    m_raw.clear();
+    dest.Clear();
+    dest.set_index(m_next_chunk);
+    dest.set_count(m_chunk_count);
+    dest.set_terrain_size(m_terrain.size());
+    if (m_next_chunk < terrain_chunks) {
+        const unsigned int x = m_next_chunk % m_terrain_blocks_per_axis;
+        const unsigned int y = m_next_chunk / m_terrain_blocks_per_axis;
+        encode_terrain_block(x, y);
+        dest.set_layer(messages::WorldSnapshotChunk::TERRAIN);
+        dest.set_x(x);
+        dest.set_y(y);
+    } else {
+        const unsigned int index = m_next_chunk - terrain_chunks;
+        const unsigned int x = index % m_fluid.blocks_per_axis();
+        const unsigned int y = index / m_fluid.blocks_per_axis();
+        encode_fluid_block(x, y);
+        dest.set_layer(messages::WorldSnapshotChunk::FLUID);
+        dest.set_x(x);
+        dest.set_y(y);
+    }
+
+    dest.set_raw_size(m_raw.size());
+    if (!compress_raw(m_raw, *dest.mutable_data())) {
+        // compression of an in-memory buffer with enough room cannot fail
+        // for other reasons than running out of memory
+        throw std::bad_alloc();
+    }
+
+    m_next_chunk += 1;
+    return true;
+}
+
+
+/* sim::WorldSnapshotDecoder */
+
+WorldSnapshotDecoder::WorldSnapshotDecoder(Terrain &terrain,
+                                           FluidBlocks &fluid):
+    m_terrain(terrain),
+    m_fluid(fluid),
+    m_terrain_blocks_per_axis((terrain.size() + IFluidSim::block_size - 1) /
+                              IFluidSim::block_size),
+    m_chunks_applied(0),
+    m_chunk_count(0),
+    m_unpublished(NotARect),
+    m_plane(IFluidSim::block_size*IFluidSim::block_size*
+            std::max(TERRAIN_PLANES, FLUID_PLANES))
+{
+
+}
+
+WorldSnapshotDecoder::~WorldSnapshotDecoder()
+{
+    publish_terrain();
+}
+
+void WorldSnapshotDecoder::publish_terrain()
+{
+    if (!m_unpublished.is_a_rect()) {
+        return;
+    }
+    const TerrainRect rect = m_unpublished;
+    m_unpublished = NotARect;
+    m_terrain.publish_rect(rect);
+    m_terrain.notify_heightmap_changed(rect);
+    m_terrain.notify_attributes_changed(rect);
+}
+
+bool WorldSnapshotDecoder::decode_terrain_block(const unsigned int x,
+                                                const unsigned int y)
+{
+    const unsigned int size = m_terrain.size();
+    const unsigned int x0 = x*IFluidSim::block_size;
+    const unsigned int y0 = y*IFluidSim::block_size;
+    const unsigned int width = block_extent(x, size);
+    const unsigned int height = block_extent(y, size);
+    const unsigned int plane_size = width*height;
+
+    std::size_t offset = 0;
+    for (unsigned int plane = 0; plane < TERRAIN_PLANES; ++plane) {
+        if (!decode_plane(m_raw, offset, width, height,
+                          &m_plane[plane*plane_size])) {
+            return false;
+        }
+    }
+    if (offset != m_raw.size()) {
+        return false;
+    }
+
+    const TerrainRect rect(x0, y0, x0+width, y0+height);
+    {
+        Terrain::Field *field = nullptr;
+        auto lock = m_terrain.writable_rect(rect, field, false);
+        for (unsigned int yl = 0; yl < height; ++yl) {
+            Vector3f *dest = &(*field)[(y0+yl)*size+x0];
+            for (unsigned int xl = 0; xl < width; ++xl) {
+                dest[xl][Terrain::HEIGHT_ATTR] = dequantise(
+                            m_plane[yl*width+xl],
+                            WorldSnapshotEncoder::TERRAIN_HEIGHT_STEP);
+                dest[xl][Terrain::SAND_ATTR] = dequantise(
+                            m_plane[plane_size+yl*width+xl],
+                            WorldSnapshotEncoder::TERRAIN_SAND_STEP);
+            }
+        }
+    }
+    // announced once published, see publish_terrain()
+    m_unpublished = bounds(m_unpublished, rect);
+    return true;
+}
+
+bool WorldSnapshotDecoder::decode_fluid_block(const unsigned int x,
+                                              const unsigned int y)
+{
+    static const unsigned int size = IFluidSim::block_size;
+    static const unsigned int plane_size = size*size;
+
+    std::size_t offset = 0;
+    for (unsigned int plane = 0; plane < FLUID_PLANES; ++plane) {
+        if (!decode_plane(m_raw, offset, size, size,
+                          &m_plane[plane*plane_size])) {
+            return false;
+        }
+    }
+    if (offset != m_raw.size()) {
+        return false;
+    }
+
+    // readers of the front buffer must not see a half-written block
+    auto lock = m_fluid.write_frontbuffer();
+    FluidBlock &block = *m_fluid.block(x, y);
+    block.expand();
+    for (unsigned int yl = 0; yl < size; ++yl) {
+        for (unsigned int xl = 0; xl < size; ++xl) {
+            const unsigned int i = yl*size+xl;
+            FluidCell cell;
+            cell.fluid_height = dequantise(
+                        m_plane[i],
+                        WorldSnapshotEncoder::FLUID_HEIGHT_STEP);
+            cell.fluid_flow[0] = dequantise(
+                        m_plane[plane_size+i],
+                        WorldSnapshotEncoder::FLUID_FLOW_STEP);
+            cell.fluid_flow[1] = dequantise(
+                        m_plane[2*plane_size+i],
+                        WorldSnapshotEncoder::FLUID_FLOW_STEP);
+            *block.local_cell_front(xl, yl) = cell;
+            *block.local_cell_back(xl, yl) = cell;
+        }
+    }
+    block.set_active(true);
+    return true;
+}
+
+bool WorldSnapshotDecoder::apply(const messages::WorldSnapshotChunk &chunk)
+{
+    if (chunk.terrain_size() != m_terrain.size()) {
+        logger.logf(io::LOG_ERROR, "snapshot for terrain size %u, "
+                                   "but terrain has size %u",
+                    chunk.terrain_size(), m_terrain.size());
+        return false;
+    }
+    if (m_chunk_count != 0 && chunk.count() != m_chunk_count) {
+        logger.logf(io::LOG_ERROR, "inconsistent snapshot chunk count");
+        return false;
+    }
+
+    unsigned int blocks_per_axis = 0;
+    unsigned int max_raw_size = 0;
+    switch (chunk.layer())
+    {
+    case messages::WorldSnapshotChunk::TERRAIN:
+    {
+        blocks_per_axis = m_terrain_blocks_per_axis;
+        max_raw_size = IFluidSim::block_size*IFluidSim::block_size*
+                TERRAIN_PLANES*MAX_VARINT_SIZE;
+        break;
+    }
+    case messages::WorldSnapshotChunk::FLUID:
+    {
+        blocks_per_axis = m_fluid.blocks_per_axis();
+        max_raw_size = IFluidSim::block_size*IFluidSim::block_size*
+                FLUID_PLANES*MAX_VARINT_SIZE;
+        break;
+    }
+    }
+
+    if (chunk.x() >= blocks_per_axis || chunk.y() >= blocks_per_axis) {
+        logger.logf(io::LOG_ERROR, "snapshot chunk out of bounds");
+        return false;
+    }
+    if (chunk.raw_size() > max_raw_size ||
+            !decompress_raw(chunk.data(), chunk.raw_size(), m_raw))
+    {
+        logger.logf(io::LOG_ERROR, "failed to decompress snapshot chunk");
+        return false;
+    }
+
+    bool success = false;
+    switch (chunk.layer())
+    {
+    case messages::WorldSnapshotChunk::TERRAIN:
+    {
+        success = decode_terrain_block(chunk.x(), chunk.y());
+        break;
+    }
+    case messages::WorldSnapshotChunk::FLUID:
+    {
+        success = decode_fluid_block(chunk.x(), chunk.y());
+        break;
+    }
+    }
+
+    if (!success) {
+        logger.logf(io::LOG_ERROR, "malformed snapshot chunk");
+        return false;
+    }
+
+    m_chunk_count = chunk.count();
+    m_chunks_applied += 1;
+    if (complete()) {
+        publish_terrain();
+    }
+    return true;
+}
+
+bool WorldSnapshotDecoder::apply(const messages::TerrainDelta &delta)
+{
+    const unsigned int size = m_terrain.size();
+    if (delta.terrain_size() != size) {
+        logger.logf(io::LOG_ERROR, "terrain delta for terrain size %u, "
+                                   "but terrain has size %u",
+                    delta.terrain_size(), size);
+        return false;
+    }
+
+    const unsigned int x0 = delta.x0();
+    const unsigned int y0 = delta.y0();
+    const unsigned int width = delta.width();
+    const unsigned int height = delta.height();
+    if (width == 0 || height == 0 ||
+            width > IFluidSim::block_size || height > IFluidSim::block_size ||
+            x0 >= size || y0 >= size ||
+            width > size - x0 || height > size - y0)
+    {
+        logger.logf(io::LOG_ERROR, "terrain delta out of bounds");
+        return false;
+    }
+
+    if (delta.raw_size() > width*height*MAX_VARINT_SIZE ||
+            !decompress_raw(delta.data(), delta.raw_size(), m_raw))
+    {
+        logger.logf(io::LOG_ERROR, "failed to decompress terrain delta");
+        return false;
+    }
+
+    std::size_t offset = 0;
+    if (!decode_plane(m_raw, offset, width, height, m_plane.data()) ||
+            offset != m_raw.size())
+    {
+        logger.logf(io::LOG_ERROR, "malformed terrain delta");
+        return false;
+    }
+
+    const TerrainRect rect(x0, y0, x0+width, y0+height);
+    {
+        Terrain::Field *field = nullptr;
+        auto lock = m_terrain.writable_rect(rect, field);
+        for (unsigned int yl = 0; yl < height; ++yl) {
+            Vector3f *dest = &(*field)[(y0+yl)*size+x0];
+            for (unsigned int xl = 0; xl < width; ++xl) {
+                const std::int32_t prev = quantise(
+                            dest[xl][Terrain::HEIGHT_ATTR],
+                            WorldSnapshotEncoder::TERRAIN_HEIGHT_STEP);
+                dest[xl][Terrain::HEIGHT_ATTR] = dequantise(
+                            prev + m_plane[yl*width+xl],
+                            WorldSnapshotEncoder::TERRAIN_HEIGHT_STEP);
+            }
+        }
+    }
+
+    m_terrain.notify_heightmap_changed(rect);
+    return true;
+}
+
+
+/* sim::TerrainJournal */
+
+TerrainJournal::TerrainJournal(const Terrain &terrain):
+    m_terrain(terrain),
+    m_blocks_per_axis((terrain.size() + IFluidSim::block_size - 1) /
+                      IFluidSim::block_size),
+    m_dirty_rects(m_blocks_per_axis*m_blocks_per_axis, NotARect),
+    m_replicated(terrain.size()*terrain.size()),
+    m_plane(IFluidSim::block_size*IFluidSim::block_size)
+{
+    {
+        const Terrain::Field *field = nullptr;
+        auto lock = m_terrain.readonly_field(field);
+        for (unsigned int i = 0; i < m_replicated.size(); ++i) {
+            m_replicated[i] = quantise(
+                        (*field)[i][Terrain::HEIGHT_ATTR],
+                        WorldSnapshotEncoder::TERRAIN_HEIGHT_STEP);
+        }
+    }
+
+    m_heightmap_updated_conn = m_terrain.heightmap_updated().connect(
+                sigc::mem_fun(*this, &TerrainJournal::heightmap_updated));
+}
+
+TerrainJournal::~TerrainJournal()
+{
+    m_heightmap_updated_conn.disconnect();
+}
+
+void TerrainJournal::heightmap_updated(TerrainRect r)
+{
+    const unsigned int size = m_terrain.size();
+    r &= TerrainRect(0, 0, size, size);
+    if (r.empty()) {
+        return;
+    }
+
+    const unsigned int bx0 = r.x0() / IFluidSim::block_size;
+    const unsigned int by0 = r.y0() / IFluidSim::block_size;
+    const unsigned int bx1 = (r.x1() - 1) / IFluidSim::block_size + 1;
+    const unsigned int by1 = (r.y1() - 1) / IFluidSim::block_size + 1;
+
+    std::lock_guard<std::mutex> lock(m_dirty_mutex);
+    for (unsigned int by = by0; by < by1; ++by) {
+        for (unsigned int bx = bx0; bx < bx1; ++bx) {
+            const TerrainRect block_rect(bx*IFluidSim::block_size,
+                                         by*IFluidSim::block_size,
+                                         (bx+1)*IFluidSim::block_size,
+                                         (by+1)*IFluidSim::block_size);
+            const unsigned int index = by*m_blocks_per_axis+bx;
+            TerrainRect &dirty = m_dirty_rects[index];
+            if (!dirty.is_a_rect()) {
+                m_dirty_blocks.push_back(index);
+            }
+            dirty = bounds(dirty, r & block_rect);
+        }
+    }
+}
+
+unsigned int TerrainJournal::collect(std::vector<messages::TerrainDelta> &dest)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_dirty_mutex);
+        m_collect_blocks.swap(m_dirty_blocks);
+        for (const unsigned int index: m_collect_blocks) {
+            m_collect_rects.push_back(m_dirty_rects[index]);
+            m_dirty_rects[index] = NotARect;
+        }
+    }
+
+    const unsigned int size = m_terrain.size();
+    unsigned int count = 0;
+
+    for (const TerrainRect &rect: m_collect_rects) {
+        const unsigned int width = rect.x1() - rect.x0();
+        const unsigned int height = rect.y1() - rect.y0();
+
+        const Terrain::Field *field = nullptr;
+        auto lock = m_terrain.readonly_rect(rect, field);
+
+        bool changed = false;
+        for (unsigned int yl = 0; yl < height; ++yl) {
+            const unsigned int row = (rect.y0()+yl)*size + rect.x0();
+            for (unsigned int xl = 0; xl < width; ++xl) {
+                const std::int32_t value = quantise(
+                            (*field)[row+xl][Terrain::HEIGHT_ATTR],
+                            WorldSnapshotEncoder::TERRAIN_HEIGHT_STEP);
+                const std::int32_t diff = value - m_replicated[row+xl];
+                m_plane[yl*width+xl] = diff;
+                m_replicated[row+xl] = value;
+                changed = changed || diff != 0;
+            }
+        }
+        lock.unlock();
+
+        if (!changed) {
+            continue;
+        }
+
+        m_raw.clear();
+        encode_plane(m_plane.data(), width, height, m_raw);
+
+        dest.emplace_back();
+        messages::TerrainDelta &delta = dest.back();
+        delta.set_terrain_size(size);
+        delta.set_x0(rect.x0());
+        delta.set_y0(rect.y0());
+        delta.set_width(width);
+        delta.set_height(height);
+        delta.set_raw_size(m_raw.size());
+        if (!compress_raw(m_raw, *delta.mutable_data())) {
+            throw std::bad_alloc();
+        }
+        count += 1;
+    }
+
+    m_collect_blocks.clear();
+    m_collect_rects.clear();
+    return count;
+}
+
+}
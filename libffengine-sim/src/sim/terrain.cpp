@@ -23,6 +23,7 @@ the AUTHORS file.
 **********************************************************************/
 #include "ffengine/sim/terrain.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <iostream>
@@ -49,16 +50,115 @@ const Terrain::height_t Terrain::max_height = 500.f;
 const vector_component_x_t Terrain::HEIGHT_ATTR = eX;
 const vector_component_y_t Terrain::SAND_ATTR = eY;
 
+constexpr unsigned int Terrain::LOCK_TILE_SIZE;
+
+
+/* sim::Terrain::FieldLock */
+
+Terrain::FieldLock::FieldLock():
+    m_terrain(nullptr),
+    m_tiles(NotARect),
+    m_exclusive(false),
+    m_publish(false)
+{
+
+}
+
+Terrain::FieldLock::FieldLock(const Terrain &terrain,
+                              const TerrainRect &tiles,
+                              const bool exclusive,
+                              const bool publish):
+    m_terrain(&terrain),
+    m_tiles(tiles),
+    m_exclusive(exclusive),
+    m_publish(publish)
+{
+    const unsigned int tiles_per_axis = terrain.m_tiles_per_axis;
+    for (unsigned int y = tiles.y0(); y < tiles.y1(); ++y) {
+        for (unsigned int x = tiles.x0(); x < tiles.x1(); ++x) {
+            std::shared_timed_mutex &mutex =
+                    terrain.m_tile_mutexes[y*tiles_per_axis+x];
+            if (exclusive) {
+                mutex.lock();
+            } else {
+                mutex.lock_shared();
+            }
+        }
+    }
+}
+
+Terrain::FieldLock::FieldLock(FieldLock &&src):
+    m_terrain(src.m_terrain),
+    m_tiles(src.m_tiles),
+    m_exclusive(src.m_exclusive),
+    m_publish(src.m_publish)
+{
+    src.m_terrain = nullptr;
+}
+
+Terrain::FieldLock &Terrain::FieldLock::operator=(FieldLock &&src)
+{
+    if (&src == this) {
+        return *this;
+    }
+    unlock();
+    m_terrain = src.m_terrain;
+    m_tiles = src.m_tiles;
+    m_exclusive = src.m_exclusive;
+    m_publish = src.m_publish;
+    src.m_terrain = nullptr;
+    return *this;
+}
+
+Terrain::FieldLock::~FieldLock()
+{
+    unlock();
+}
+
+void Terrain::FieldLock::unlock()
+{
+    if (!m_terrain) {
+        return;
+    }
+
+    const unsigned int tiles_per_axis = m_terrain->m_tiles_per_axis;
+    for (unsigned int y = m_tiles.y1(); y > m_tiles.y0(); --y) {
+        for (unsigned int x = m_tiles.x1(); x > m_tiles.x0(); --x) {
+            std::shared_timed_mutex &mutex =
+                    m_terrain->m_tile_mutexes[(y-1)*tiles_per_axis+(x-1)];
+            if (m_exclusive) {
+                mutex.unlock();
+            } else {
+                mutex.unlock_shared();
+            }
+        }
+    }
+
+    const Terrain *terrain = m_terrain;
+    m_terrain = nullptr;
+    if (m_publish) {
+        // copy under a shared lock only, so that readers of the tiles are
+        // not blocked by the copy
+        terrain->publish_rect_tiles(m_tiles);
+    }
+}
+
+
+/* sim::Terrain */
+
 Terrain::Terrain(const unsigned int size):
     m_size(size),
-    m_field(m_size*m_size, Vector3f(default_height, 0, 0))
+    m_tiles_per_axis((size + LOCK_TILE_SIZE - 1) / LOCK_TILE_SIZE),
+    m_tile_mutexes(new std::shared_timed_mutex[m_tiles_per_axis*m_tiles_per_axis]),
+    m_field(m_size*m_size, Vector3f(default_height, 0, 0)),
+    m_current_version(nullptr)
 {
-
+    publish_tiles(TerrainRect(0, 0, m_tiles_per_axis, m_tiles_per_axis));
 }
 
 Terrain::~Terrain()
 {
-
+    delete m_current_version.load();
 }
 
 void Terrain::notify_heightmap_changed() const
@@ -76,23 +176,117 @@ void Terrain::notify_attributes_changed(TerrainRect at) const
     m_attributes_updated.emit(at);
 }
 
-std::shared_lock<std::shared_timed_mutex> Terrain::readonly_field(
+TerrainRect Terrain::tiles_for_rect(const TerrainRect &rect) const
+{
+    const unsigned int x0 = std::min(rect.x0(), m_size);
+    const unsigned int y0 = std::min(rect.y0(), m_size);
+    const unsigned int x1 = std::min(rect.x1(), m_size);
+    const unsigned int y1 = std::min(rect.y1(), m_size);
+    if (x1 <= x0 || y1 <= y0) {
+        return TerrainRect(0, 0, 0, 0);
+    }
+    return TerrainRect(x0 / LOCK_TILE_SIZE,
+                       y0 / LOCK_TILE_SIZE,
+                       (x1 + LOCK_TILE_SIZE - 1) / LOCK_TILE_SIZE,
+                       (y1 + LOCK_TILE_SIZE - 1) / LOCK_TILE_SIZE);
+}
+
+void Terrain::publish_tiles(const TerrainRect &tiles) const
+{
+    if (tiles.empty()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_publish_mutex);
+    const std::shared_ptr<const TerrainVersion> *prev_holder =
+            m_current_version.load();
+
+    auto version = std::make_shared<TerrainVersion>();
+    version->size = m_size;
+    version->tiles_per_axis = m_tiles_per_axis;
+    if (prev_holder) {
+        version->serial = (*prev_holder)->serial + 1;
+        version->tiles = (*prev_holder)->tiles;
+    } else {
+        version->serial = 0;
+        version->tiles.resize(m_tiles_per_axis*m_tiles_per_axis);
+    }
+
+    for (unsigned int ty = tiles.y0(); ty < tiles.y1(); ++ty) {
+        for (unsigned int tx = tiles.x0(); tx < tiles.x1(); ++tx) {
+            auto tile = std::make_shared<TerrainVersion::Tile>(
+                        LOCK_TILE_SIZE*LOCK_TILE_SIZE);
+            const unsigned int x0 = tx*LOCK_TILE_SIZE;
+            const unsigned int y0 = ty*LOCK_TILE_SIZE;
+            const unsigned int width = std::min(LOCK_TILE_SIZE, m_size-x0);
+            const unsigned int height = std::min(LOCK_TILE_SIZE, m_size-y0);
+            for (unsigned int y = 0; y < height; ++y) {
+                std::copy(&m_field[(y0+y)*m_size+x0],
+                          &m_field[(y0+y)*m_size+x0] + width,
+                          &(*tile)[y*LOCK_TILE_SIZE]);
+            }
+            version->tiles[ty*m_tiles_per_axis+tx] = std::move(tile);
+        }
+    }
+
+    m_current_version.store(
+                new std::shared_ptr<const TerrainVersion>(std::move(version)));
+    if (prev_holder) {
+        m_version_epochs.retire([prev_holder](){ delete prev_holder; });
+    }
+    m_version_epochs.collect();
+}
+
+TerrainSnapshot Terrain::snapshot() const
+{
+    auto guard = m_version_epochs.pin();
+    return TerrainSnapshot(*m_current_version.load());
+}
+
+Terrain::FieldLock Terrain::readonly_field(
         const Terrain::Field *&heightmap) const
 {
-    heightmap = &m_field;
-    return std::shared_lock<std::shared_timed_mutex>(m_field_mutex);
+    return readonly_rect(TerrainRect(0, 0, m_size, m_size), heightmap);
 }
 
-std::unique_lock<std::shared_timed_mutex> Terrain::writable_field(
+Terrain::FieldLock Terrain::writable_field(
         Terrain::Field *&heightmap)
+{
+    return writable_rect(TerrainRect(0, 0, m_size, m_size), heightmap);
+}
+
+Terrain::FieldLock Terrain::readonly_rect(
+        const TerrainRect &rect,
+        const Terrain::Field *&heightmap) const
 {
     heightmap = &m_field;
-    return std::unique_lock<std::shared_timed_mutex>(m_field_mutex);
+    return FieldLock(*this, tiles_for_rect(rect), false, false);
+}
+
+Terrain::FieldLock Terrain::writable_rect(
+        const TerrainRect &rect,
+        Terrain::Field *&heightmap,
+        const bool publish)
+{
+    heightmap = &m_field;
+    return FieldLock(*this, tiles_for_rect(rect), true, publish);
+}
+
+void Terrain::publish_rect(const TerrainRect &rect) const
+{
+    publish_rect_tiles(tiles_for_rect(rect));
+}
+
+void Terrain::publish_rect_tiles(const TerrainRect &tiles) const
+{
+    FieldLock lock(*this, tiles, false, false);
+    publish_tiles(tiles);
 }
 
 void Terrain::from_perlin(const PerlinNoiseGenerator &gen)
 {
-    std::unique_lock<std::shared_timed_mutex> lock(m_field_mutex);
+    Field *field = nullptr;
+    FieldLock lock = writable_field(field);
     for (unsigned int y = 0; y < m_size; y++) {
         for (unsigned int x = 0; x < m_size; x++) {
             m_field[y*m_size+x][HEIGHT_ATTR] = gen.get(Vector2(x, y));
@@ -105,7 +299,8 @@ void Terrain::from_perlin(const PerlinNoiseGenerator &gen)
 void Terrain::from_sincos(const Vector3f scale)
 {
     const float offset = scale[eZ];
-    std::unique_lock<std::shared_timed_mutex> lock(m_field_mutex);
+    Field *field = nullptr;
+    FieldLock lock = writable_field(field);
     for (unsigned int y = 0; y < m_size; y++) {
         for (unsigned int x = 0; x < m_size; x++) {
             m_field[y*m_size+x][HEIGHT_ATTR] = (sin(x*scale[eX]) + cos(y*scale[eY])) * scale[eZ] + offset;
@@ -116,9 +311,25 @@ void Terrain::from_sincos(const Vector3f scale)
 }
 
 
+/* sim::TerrainSnapshot */
+
+TerrainSnapshot::TerrainSnapshot()
+{
+
+}
+
+TerrainSnapshot::TerrainSnapshot(std::shared_ptr<const TerrainVersion> version):
+    m_version(std::move(version))
+{
+
+}
+
+
 TerrainWorker::TerrainWorker():
     m_updated_rect(NotARect),
-    m_terminated(false)
+    m_running(false),
+    m_task_scheduled(false),
+    m_tasks(ffe::scheduler())
 {
 
 }
@@ -128,22 +339,30 @@ TerrainWorker::~TerrainWorker()
     tear_down();
 }
 
+void TerrainWorker::schedule_task(std::unique_lock<std::mutex> &state_lock)
+{
+    if (!m_running || m_task_scheduled || !m_updated_rect.is_a_rect()) {
+        return;
+    }
+    m_task_scheduled = true;
+    state_lock.unlock();
+
+    tw_logger.log(io::LOG_DEBUG) << "scheduling worker "
+                                 << this
+                                 << io::submit;
+    m_tasks.run(std::bind(&TerrainWorker::worker, this));
+}
+
 void TerrainWorker::worker()
 {
     std::unique_lock<std::mutex> lock(m_state_mutex);
-    while (!m_terminated) {
-        while (!m_updated_rect.is_a_rect()) {
-            m_wakeup.wait(lock);
-            if (m_terminated) {
-                return;
-            }
-        }
+    while (m_running && m_updated_rect.is_a_rect()) {
         TerrainRect updated_rect = m_updated_rect;
         m_updated_rect = NotARect;
         lock.unlock();
 
-        tw_logger.log(io::LOG_DEBUG) << "woke worker "
-                                     << m_worker_thread.get_id()
+        tw_logger.log(io::LOG_DEBUG) << "running worker "
+                                     << this
                                      << " with rect "
                                      << updated_rect
                                      << io::submit;
@@ -152,45 +371,50 @@ void TerrainWorker::worker()
 
         lock.lock();
     }
+    m_task_scheduled = false;
 }
 
 void TerrainWorker::start()
 {
-    if (m_worker_thread.joinable()) {
+    std::unique_lock<std::mutex> lock(m_state_mutex);
+    if (m_running) {
         throw std::logic_error("Worker already running!");
     }
-    m_worker_thread = std::thread(std::bind(&TerrainWorker::worker,
-                                            this));
+    m_running = true;
     tw_logger.log(io::LOG_INFO) << "new worker: "
-                                << m_worker_thread.get_id()
+                                << this
                                 << io::submit;
+    schedule_task(lock);
 }
 
 void TerrainWorker::tear_down()
 {
-    if (m_worker_thread.joinable()) {
-        {
-            std::unique_lock<std::mutex> lock(m_state_mutex);
-            m_terminated = true;
+    {
+        std::unique_lock<std::mutex> lock(m_state_mutex);
+        if (!m_running) {
+            return;
         }
-        m_wakeup.notify_all();
-        tw_logger.log(io::LOG_INFO) << "tearing down worker "
-                                    << m_worker_thread.get_id()
-                                    << io::submit;
-        m_worker_thread.join();
+        m_running = false;
+    }
+    tw_logger.log(io::LOG_INFO) << "tearing down worker "
+                                << this
+                                << io::submit;
+    try {
+        m_tasks.wait();
+    } catch (const std::exception &exc) {
+        tw_logger.log(io::LOG_ERROR) << "worker "
+                                     << this
+                                     << " failed: "
+                                     << exc.what()
+                                     << io::submit;
     }
 }
 
 void TerrainWorker::notify_update(const TerrainRect &at)
 {
-    {
-        std::unique_lock<std::mutex> lock(m_state_mutex);
-        m_updated_rect = bounds(m_updated_rect, at);
-    }
-    tw_logger.log(io::LOG_DEBUG) << "notifying worker "
-                                 << m_worker_thread.get_id()
-                                 << io::submit;
-    m_wakeup.notify_all();
+    std::unique_lock<std::mutex> lock(m_state_mutex);
+    m_updated_rect = bounds(m_updated_rect, at);
+    schedule_task(lock);
 }
 
 
@@ -215,17 +439,19 @@ std::pair<bool, float> lookup_height(
 
 const float Sandifier::SAND_FILTER_CONSTANT = 0.4f;
 const float Sandifier::SAND_FILTER_CUTOFF = 1e-2;
+const unsigned int Sandifier::MAX_ROWS_PER_RUN = 5;
 
 
 Sandifier::Sandifier(Terrain &terrain, const Fluid &fluid):
     m_terrain(terrain),
     m_fluid(fluid),
     m_curr_y(0),
-    m_dest_row(m_terrain.size())
+    m_prev_row(m_terrain.size()+2),
+    m_rows(MAX_ROWS_PER_RUN+2, std::vector<Vector3f>(m_terrain.size()+2)),
+    m_dest_rows(MAX_ROWS_PER_RUN, std::vector<float>(m_terrain.size())),
+    m_changed_ranges(MAX_ROWS_PER_RUN)
 {
-    m_rows[0].resize(m_terrain.size()+2);
-    m_rows[1].resize(m_rows[0].size());
-    m_rows[2].resize(m_rows[0].size());
+
 }
 
 void Sandifier::fetch_fluid_info(const unsigned int x,
@@ -257,47 +483,28 @@ void Sandifier::fetch_row(const unsigned int y,
     dest[m_terrain.size()] = dest[m_terrain.size()-1];
 }
 
-std::tuple<unsigned int, unsigned int> Sandifier::step()
+std::tuple<unsigned int, unsigned int> Sandifier::step(
+        const unsigned int y,
+        const std::vector<Vector3f> *rows,
+        std::vector<float> &dest_row) const
 {
-    {
-        const Terrain::Field *field;
-        auto lock = m_terrain.readonly_field(field);
-        if (m_curr_y == 0) {
-            // load first row and copy it in the prev buffer
-            fetch_row(m_curr_y, *field, m_rows[1]);
-            m_rows[0] = m_rows[1];
-        } else {
-            //m_rows[0].swap(m_rows[1]);  // move 1st to 0th
-            //m_rows[1].swap(m_rows[2]);  // move 2nd to 1st
-            m_rows[0] = std::move(m_rows[1]);
-            m_rows[1] = std::move(m_rows[2]);
-            m_rows[2].resize(m_rows[0].size());
-        }
-        if (m_curr_y < m_terrain.size()-1) {
-            fetch_row(m_curr_y+1, *field, m_rows[2]);  // load next row
-        } else {
-            // copy last row
-            m_rows[2] = m_rows[1];
-        }
-    }
-
     unsigned int min_changed_x = m_terrain.size();
     unsigned int max_changed_x = 0;
     bool changed = false;
 
     for (unsigned int xc = 0; xc < m_terrain.size(); ++xc) {
-        const FluidCell &center_cell = *m_fluid.blocks().clamped_cell_front(xc, m_curr_y);
+        const FluidCell center_cell = m_fluid.blocks().clamped_cell_front_value(xc, y);
 
         /*std::array<const FluidCell*, 9> neighbourhood;
         fetch_fluid_info(x, neighbourhood);*/
 
 
-        std::vector<Vector3f> *row = &m_rows[0];
+        const std::vector<Vector3f> *row = &rows[0];
         //const FluidCell **cells = &neighbourhood[0];
 
-        const float prev_sandiness = m_rows[1][xc+1][Terrain::SAND_ATTR];
-        const float local_height = m_rows[1][xc+1][Terrain::HEIGHT_ATTR];
-        m_dest_row[xc] = prev_sandiness;
+        const float prev_sandiness = rows[1][xc+1][Terrain::SAND_ATTR];
+        const float local_height = rows[1][xc+1][Terrain::HEIGHT_ATTR];
+        dest_row[xc] = prev_sandiness;
 
         float new_value = 0.f;
 
@@ -347,46 +554,96 @@ std::tuple<unsigned int, unsigned int> Sandifier::step()
                 std::cout << prev_sandiness << " " << new_value << std::endl;
             }*/
             if (std::fabs(prev_sandiness - new_value) < SAND_FILTER_CUTOFF) {
-                m_dest_row[xc] = new_value;
+                dest_row[xc] = new_value;
             } else {
-                m_dest_row[xc] = SAND_FILTER_CONSTANT * new_value + prev_sandiness * (1-SAND_FILTER_CONSTANT);
+                dest_row[xc] = SAND_FILTER_CONSTANT * new_value + prev_sandiness * (1-SAND_FILTER_CONSTANT);
             }
         }
     }
 
-    if (min_changed_x <= max_changed_x) {
-        Terrain::Field *field;
-        auto lock = m_terrain.writable_field(field);
-        for (unsigned int x = min_changed_x; x <= max_changed_x; ++x) {
-            (*field)[m_curr_y*m_terrain.size() + x][Terrain::SAND_ATTR] = m_dest_row[x];
-        }
-    }
-
-    m_curr_y += 1;
-    if (m_curr_y == m_terrain.size()) {
-        m_curr_y = 0;
-    }
-
     return std::make_tuple(min_changed_x, max_changed_x);
 }
 
 void Sandifier::run_steps()
 {
-    unsigned int start_y = m_curr_y;
-    unsigned int min_changed_x = m_terrain.size(), max_changed_x = 0;
+    const unsigned int size = m_terrain.size();
+    const unsigned int start_y = m_curr_y;
+    const unsigned int rows = std::min(
+                start_y == size-MAX_ROWS_PER_RUN ? MAX_ROWS_PER_RUN : 4U,
+                size - start_y);
+
+    // m_rows[i] holds terrain row start_y+i-1; each row is computed from the
+    // values before this run, so the rows are independent of each other
+    {
+        const Terrain::Field *field;
+        auto lock = m_terrain.readonly_rect(
+                    TerrainRect(0, start_y, size, start_y+rows+1), field);
+        for (unsigned int i = 0; i < rows; ++i) {
+            fetch_row(start_y+i, *field, m_rows[i+1]);
+        }
+        if (start_y+rows < size) {
+            fetch_row(start_y+rows, *field, m_rows[rows+1]);
+        } else {
+            // copy last row
+            m_rows[rows+1] = m_rows[rows];
+        }
+    }
+    if (start_y == 0) {
+        // copy first row into the prev buffer
+        m_rows[0] = m_rows[1];
+    } else {
+        m_rows[0].swap(m_prev_row);
+    }
 
-    const unsigned int rows = (start_y == m_terrain.size()-5 ? 5 : 4);
+    {
+        // step() reads the fluid front buffer
+        auto fluid_lock = m_fluid.blocks().read_frontbuffer();
+        ffe::parallel_for(ffe::scheduler(), 0, rows, 1,
+                          [this, start_y](const unsigned int first,
+                                          const unsigned int last)
+        {
+            for (unsigned int i = first; i < last; ++i) {
+                m_changed_ranges[i] = step(start_y+i, &m_rows[i], m_dest_rows[i]);
+            }
+        });
+    }
 
+    unsigned int min_changed_x = size, max_changed_x = 0;
     for (unsigned int i = 0; i < rows; ++i) {
         unsigned int this_min_changed_x, this_max_changed_x;
-        std::tie(this_min_changed_x, this_max_changed_x) = step();
+        std::tie(this_min_changed_x, this_max_changed_x) = m_changed_ranges[i];
+        if (this_min_changed_x > this_max_changed_x) {
+            continue;
+        }
+        min_changed_x = std::min(min_changed_x, this_min_changed_x);
+        max_changed_x = std::max(max_changed_x, this_max_changed_x);
+    }
 
-        if (this_min_changed_x <= this_max_changed_x) {
-            min_changed_x = std::min(min_changed_x, this_min_changed_x);
-            max_changed_x = std::max(max_changed_x, this_max_changed_x);
+    if (min_changed_x <= max_changed_x) {
+        // only the changed columns are locked and published
+        Terrain::Field *field;
+        auto lock = m_terrain.writable_rect(
+                    TerrainRect(min_changed_x, start_y,
+                                max_changed_x+1, start_y+rows), field);
+        for (unsigned int i = 0; i < rows; ++i) {
+            unsigned int this_min_changed_x, this_max_changed_x;
+            std::tie(this_min_changed_x, this_max_changed_x) = m_changed_ranges[i];
+
+            const std::vector<float> &dest_row = m_dest_rows[i];
+            for (unsigned int x = this_min_changed_x; x <= this_max_changed_x; ++x) {
+                (*field)[(start_y+i)*size + x][Terrain::SAND_ATTR] = dest_row[x];
+            }
         }
     }
 
+    // keep the unmodified last row for the next run
+    m_prev_row.swap(m_rows[rows]);
+
+    m_curr_y = start_y + rows;
+    if (m_curr_y == size) {
+        m_curr_y = 0;
+    }
+
     if (min_changed_x <= max_changed_x) {
         const TerrainRect changed_rect(min_changed_x, start_y, max_changed_x + 1, start_y+rows);
         std::cout << changed_rect << std::endl;
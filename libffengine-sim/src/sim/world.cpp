@@ -23,6 +23,8 @@ the AUTHORS file.
 **********************************************************************/
 #include "ffengine/sim/world.hpp"
 
+#include <algorithm>
+
 #include "world_command.pb.h"
 
 namespace sim {
@@ -38,6 +40,36 @@ WorldState::WorldState():
 }
 
 
+static inline bool rects_overlap(TerrainRect r1, const TerrainRect &r2)
+{
+    if (r1.empty() || r2.empty()) {
+        return false;
+    }
+    return r1.overlaps(r2);
+}
+
+
+/* sim::WorldOperationFootprint */
+
+WorldOperationFootprint::WorldOperationFootprint():
+    exclusive(true),
+    terrain(NotARect),
+    fluid(NotARect)
+{
+
+}
+
+bool WorldOperationFootprint::conflicts_with(
+        const WorldOperationFootprint &other) const
+{
+    if (exclusive || other.exclusive) {
+        return true;
+    }
+    return rects_overlap(terrain, other.terrain) ||
+            rects_overlap(fluid, other.fluid);
+}
+
+
 /* sim::WorldOperation */
 
 WorldOperation::~WorldOperation()
@@ -45,6 +77,40 @@ WorldOperation::~WorldOperation()
 
 }
 
+WorldOperationFootprint WorldOperation::footprint(const WorldState &) const
+{
+    return WorldOperationFootprint();
+}
+
+
+unsigned int partition_into_waves(
+        const std::vector<WorldOperationFootprint> &footprints,
+        std::vector<unsigned int> &waves)
+{
+    waves.resize(footprints.size());
+    unsigned int nwaves = 0;
+    // operations before the last exclusive one are all in earlier waves
+    // than anything which follows, so they need not be checked
+    std::size_t barrier = 0;
+    for (std::size_t i = 0; i < footprints.size(); ++i) {
+        const WorldOperationFootprint &footprint = footprints[i];
+        unsigned int wave = 0;
+        if (footprint.exclusive) {
+            wave = nwaves;
+            barrier = i;
+        } else {
+            for (std::size_t j = barrier; j < i; ++j) {
+                if (waves[j] >= wave && footprint.conflicts_with(footprints[j])) {
+                    wave = waves[j]+1;
+                }
+            }
+        }
+        waves[i] = wave;
+        nwaves = std::max(nwaves, wave+1);
+    }
+    return nwaves;
+}
+
 
 /* sim::AbstractClient */
 
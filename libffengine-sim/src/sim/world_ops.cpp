@@ -25,6 +25,8 @@ the AUTHORS file.
 
 #include "ffengine/math/algo.hpp"
 
+#include "world_command.pb.h"
+
 
 namespace sim {
 namespace ops {
@@ -117,6 +119,12 @@ void apply_brush_masked_tool(FluidBlocks &field,
     const int fluid_xbase = std::round(x0 - radius);
     const int fluid_ybase = std::round(y0 - radius);
 
+    // collapsed blocks have no cell buffers to write to
+    field.expand_cells(TerrainRect(std::max(fluid_xbase, 0),
+                                   std::max(fluid_ybase, 0),
+                                   std::max(std::min(fluid_xbase + size, fluid_size), 0),
+                                   std::max(std::min(fluid_ybase + size, fluid_size), 0)));
+
     for (int y = 0; y < size; y++) {
         const int yfluid = y + fluid_ybase;
         if (yfluid < 0) {
@@ -224,32 +232,6 @@ struct fluid_raise_tool
 };
 
 
-void notify_update_terrain_rect(const Terrain &terrain,
-                                const float xc, const float yc,
-                                const unsigned int brush_size)
-{
-    const float brush_radius = brush_size/2.f;
-    sim::TerrainRect r(xc, yc, std::ceil(xc+brush_radius), std::ceil(yc+brush_radius));
-    if (xc < std::ceil(brush_radius)) {
-        r.set_x0(0);
-    } else {
-        r.set_x0(xc-std::ceil(brush_radius));
-    }
-    if (yc < std::ceil(brush_radius)) {
-        r.set_y0(0);
-    } else {
-        r.set_y0(yc-std::ceil(brush_radius));
-    }
-    if (r.x1() > terrain.size()) {
-        r.set_x1(terrain.size());
-    }
-    if (r.y1() > terrain.size()) {
-        r.set_y1(terrain.size());
-    }
-    terrain.notify_heightmap_changed(r);
-}
-
-
 /* sim::ops::BrushWorldOperation */
 
 BrushWorldOperation::BrushWorldOperation(
@@ -257,15 +239,51 @@ BrushWorldOperation::BrushWorldOperation(
         const unsigned int brush_size,
         const std::vector<float> &density_map,
         const float brush_strength):
+    BrushWorldOperation(xc, yc, brush_size,
+                        std::make_shared<const std::vector<float> >(density_map),
+                        brush_strength)
+{
+
+}
+
+BrushWorldOperation::BrushWorldOperation(
+        const float xc, const float yc,
+        const unsigned int brush_size,
+        SharedDensityMap density_map,
+        const float brush_strength):
     m_xc(xc),
     m_yc(yc),
     m_brush_size(brush_size),
-    m_density_map(density_map),
+    m_density_map(std::move(density_map)),
     m_brush_strength(brush_strength)
 {
 
 }
 
+TerrainRect BrushWorldOperation::brush_rect(const unsigned int grid_size,
+                                            const unsigned int margin) const
+{
+    // must match the placement in apply_brush_masked_tool
+    const int base_x = std::round(m_xc - m_brush_size / 2.f);
+    const int base_y = std::round(m_yc - m_brush_size / 2.f);
+    const int grid_max = grid_size;
+    const int x0 = std::max(0, std::min(base_x - (int)margin, grid_max));
+    const int y0 = std::max(0, std::min(base_y - (int)margin, grid_max));
+    const int x1 = std::max(x0, std::min(base_x + (int)(m_brush_size + margin), grid_max));
+    const int y1 = std::max(y0, std::min(base_y + (int)(m_brush_size + margin), grid_max));
+    return TerrainRect(x0, y0, x1, y1);
+}
+
+WorldOperationFootprint BrushWorldOperation::terrain_footprint(
+        const WorldState &state,
+        const unsigned int margin) const
+{
+    WorldOperationFootprint result;
+    result.exclusive = false;
+    result.terrain = brush_rect(state.terrain().size(), margin);
+    return result;
+}
+
 /* sim::ops::ObjectWorldOperation */
 
 ObjectWorldOperation::ObjectWorldOperation(const Object::ID object_id):
@@ -280,17 +298,23 @@ WorldOperationResult TerraformRaise::execute(WorldState &state)
 {
     {
         sim::Terrain::Field *field = nullptr;
-        auto lock = state.terrain().writable_field(field);
+        auto lock = state.terrain().writable_rect(
+                    brush_rect(state.terrain().size()), field);
         apply_brush_masked_tool(*field,
-                                m_brush_size, m_density_map, m_brush_strength,
+                                m_brush_size, *m_density_map, m_brush_strength,
                                 state.terrain().size(),
                                 m_xc, m_yc,
                                 raise_tool());
     }
-    notify_update_terrain_rect(state.terrain(), m_xc, m_yc, m_brush_size);
     return NO_ERROR;
 }
 
+WorldOperationFootprint TerraformRaise::footprint(
+        const WorldState &state) const
+{
+    return terrain_footprint(state);
+}
+
 
 /* sim::ops::TerraformLevel */
 
@@ -306,24 +330,45 @@ TerraformLevel::TerraformLevel(
 
 }
 
+TerraformLevel::TerraformLevel(
+        const float xc, const float yc,
+        const unsigned int brush_size,
+        SharedDensityMap density_map,
+        const float brush_strength,
+        const float reference_height):
+    BrushWorldOperation(xc, yc, brush_size, std::move(density_map),
+                        brush_strength),
+    m_reference_height(reference_height)
+{
+
+}
+
 WorldOperationResult TerraformLevel::execute(WorldState &state)
 {
     {
         sim::Terrain::Field *field = nullptr;
-        auto lock = state.terrain().writable_field(field);
+        auto lock = state.terrain().writable_rect(
+                    brush_rect(state.terrain().size()), field);
         apply_brush_masked_tool(*field,
-                                m_brush_size, m_density_map, m_brush_strength,
+                                m_brush_size, *m_density_map, m_brush_strength,
                                 state.terrain().size(),
                                 m_xc, m_yc,
                                 flatten_tool(m_reference_height));
     }
-    notify_update_terrain_rect(state.terrain(), m_xc, m_yc, m_brush_size);
     return NO_ERROR;
 }
 
+WorldOperationFootprint TerraformLevel::footprint(
+        const WorldState &state) const
+{
+    return terrain_footprint(state);
+}
+
 
 /* sim::ops::TerraformSmooth */
 
+constexpr unsigned int TerraformSmooth::parzen_radius;
+
 Terrain::height_t TerraformSmooth::sample_parzen_rect(
         const Terrain::Field &field,
         const unsigned int terrain_size,
@@ -374,7 +419,8 @@ WorldOperationResult TerraformSmooth::execute(WorldState &state)
 {
     {
         sim::Terrain::Field *field = nullptr;
-        auto lock = state.terrain().writable_field(field);
+        auto lock = state.terrain().writable_rect(
+                    brush_rect(state.terrain().size(), parzen_radius), field);
 
         // we cannot use apply_brush_masked_tool here, because we need
         // information about our surroundings
@@ -404,7 +450,8 @@ WorldOperationResult TerraformSmooth::execute(WorldState &state)
                 Terrain::height_t &h = (*field)[yterrain*terrain_size+xterrain][Terrain::HEIGHT_ATTR];
 
                 Terrain::height_t new_h = sample_parzen_rect(
-                            *field, terrain_size, xterrain, yterrain, 3);
+                            *field, terrain_size, xterrain, yterrain,
+                            parzen_radius);
                 if (std::isnan(new_h)) {
                     continue;
                 }
@@ -415,14 +462,20 @@ WorldOperationResult TerraformSmooth::execute(WorldState &state)
                                 sim::Terrain::max_height,
                                 interp_linear(
                                     h, new_h,
-                                    m_brush_strength*m_density_map[y*size+x])));
+                                    m_brush_strength*(*m_density_map)[y*size+x])));
             }
         }
     }
-    notify_update_terrain_rect(state.terrain(), m_xc, m_yc, m_brush_size);
     return NO_ERROR;
 }
 
+WorldOperationFootprint TerraformSmooth::footprint(
+        const WorldState &state) const
+{
+    // sample_parzen_rect reads the surroundings of each vertex
+    return terrain_footprint(state, parzen_radius);
+}
+
 
 /* sim::ops::TerraformRamp */
 
@@ -443,6 +496,24 @@ TerraformRamp::TerraformRamp(const float xc, const float yc,
 
 }
 
+TerraformRamp::TerraformRamp(const float xc, const float yc,
+                             const unsigned int brush_size,
+                             SharedDensityMap density_map,
+                             const float brush_strength,
+                             const Vector2f source_point,
+                             const Terrain::height_t source_height,
+                             const Vector2f destination_point,
+                             const Terrain::height_t destination_height):
+    BrushWorldOperation(xc, yc, brush_size, std::move(density_map),
+                        brush_strength),
+    m_source_point(source_point),
+    m_source_height(source_height),
+    m_destination_point(destination_point),
+    m_destination_height(destination_height)
+{
+
+}
+
 WorldOperationResult TerraformRamp::execute(WorldState &state)
 {
     if ((m_destination_point - m_source_point).length() < 1) {
@@ -450,31 +521,57 @@ WorldOperationResult TerraformRamp::execute(WorldState &state)
     }
     {
         sim::Terrain::Field *field = nullptr;
-        auto lock = state.terrain().writable_field(field);
+        auto lock = state.terrain().writable_rect(
+                    brush_rect(state.terrain().size()), field);
         apply_brush_masked_tool(*field,
-                                m_brush_size, m_density_map, m_brush_strength,
+                                m_brush_size, *m_density_map, m_brush_strength,
                                 state.terrain().size(),
                                 m_xc, m_yc,
                                 ramp_tool(m_source_point, m_source_height,
                                           m_destination_point, m_destination_height));
     }
-    notify_update_terrain_rect(state.terrain(), m_xc, m_yc, m_brush_size);
     return NO_ERROR;
 }
 
+WorldOperationFootprint TerraformRamp::footprint(
+        const WorldState &state) const
+{
+    return terrain_footprint(state);
+}
+
 
 /* sim::ops::FluidRaise */
 
 WorldOperationResult FluidRaise::execute(WorldState &state)
 {
     apply_brush_masked_tool(state.fluid().blocks(),
-                            m_brush_size, m_density_map,
+                            m_brush_size, *m_density_map,
                             m_brush_strength,
                             m_xc, m_yc,
                             fluid_raise_tool());
     return NO_ERROR;
 }
 
+WorldOperationFootprint FluidRaise::footprint(const WorldState &state) const
+{
+    const FluidBlocks &blocks = state.fluid().blocks();
+    const TerrainRect cells = brush_rect(blocks.cells_per_axis());
+
+    WorldOperationFootprint result;
+    result.exclusive = false;
+    result.fluid = cells;
+    if (!cells.empty()) {
+        // set_active and expand_cells work on whole blocks
+        const unsigned int block_size = IFluidSim::block_size;
+        result.fluid = TerrainRect(
+                    cells.x0() / block_size * block_size,
+                    cells.y0() / block_size * block_size,
+                    (cells.x1() + block_size - 1) / block_size * block_size,
+                    (cells.y1() + block_size - 1) / block_size * block_size);
+    }
+    return result;
+}
+
 
 /* sim::ops::FluidSourceCreate */
 
@@ -677,4 +774,65 @@ WorldOperationResult ConstructNewCurve::execute(WorldState &state)
 
 
 }
+
+
+/* sim::WorldOperation */
+
+/**
+ * Resolve the brush of a brush command message, either by looking up its
+ * brush_id in \a brushes or by copying the density map sent inline.
+ *
+ * @return true if the message refers to a valid brush, false otherwise.
+ */
+template <typename msg_t>
+static bool resolve_brush(const msg_t &msg,
+                          const BrushDictionary &brushes,
+                          BrushDictionary::Brush &dest)
+{
+    if (msg.has_brush_id()) {
+        return brushes.lookup(msg.brush_id(), dest);
+    }
+
+    const unsigned int size = msg.brush_size();
+    if (size == 0 || size > BrushDictionary::MAX_BRUSH_SIZE ||
+            (unsigned int)msg.density_map_size() != size*size)
+    {
+        return false;
+    }
+    dest.size = size;
+    dest.density_map = std::make_shared<const std::vector<float> >(
+                msg.density_map().begin(), msg.density_map().end());
+    return true;
+}
+
+std::unique_ptr<WorldOperation> WorldOperation::from_message(
+        const messages::WorldCommand &msg,
+        const BrushDictionary &brushes)
+{
+    BrushDictionary::Brush brush;
+    if (msg.has_tf_raise()) {
+        const messages::TerraformRaise &cmd = msg.tf_raise();
+        if (!resolve_brush(cmd, brushes, brush)) {
+            return nullptr;
+        }
+        return std::make_unique<ops::TerraformRaise>(
+                    cmd.xc(), cmd.yc(),
+                    brush.size, std::move(brush.density_map),
+                    cmd.brush_strength());
+    } else if (msg.has_tf_level()) {
+        const messages::TerraformLevel &cmd = msg.tf_level();
+        if (!resolve_brush(cmd, brushes, brush)) {
+            return nullptr;
+        }
+        return std::make_unique<ops::TerraformLevel>(
+                    cmd.xc(), cmd.yc(),
+                    brush.size, std::move(brush.density_map),
+                    cmd.brush_strength(),
+                    cmd.reference_height());
+    }
+
+    return nullptr;
+}
+
+
 }
@@ -0,0 +1,77 @@
+#include "ffengine/common/barrier.hpp"
+
+#include <catch.hpp>
+
+#include <thread>
+#include <vector>
+
+
+using namespace ffe;
+
+
+TEST_CASE("common/SpinBarrier/rounds")
+{
+    static const unsigned int threads = 4;
+    static const unsigned int rounds = 200;
+
+    SpinBarrier barrier(threads, 100);
+    CHECK(barrier.participants() == threads);
+
+    // each thread increments its slot once per round; after each barrier,
+    // all slots must have been incremented for that round
+    std::vector<std::atomic<unsigned int> > slots(threads);
+    for (auto &slot: slots) {
+        slot = 0;
+    }
+    std::atomic<unsigned int> last_arrivals(0);
+    std::atomic<unsigned int> errors(0);
+
+    auto worker = [&](const unsigned int index)
+    {
+        for (unsigned int round = 0; round < rounds; ++round) {
+            slots[index].fetch_add(1);
+            if (barrier.arrive_and_wait()) {
+                last_arrivals.fetch_add(1);
+            }
+            for (auto &slot: slots) {
+                if (slot.load() < round+1) {
+                    errors.fetch_add(1);
+                }
+            }
+            // nobody may run ahead into the next round before everyone has
+            // checked
+            barrier.arrive_and_wait();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned int i = 1; i < threads; ++i) {
+        pool.emplace_back(worker, i);
+    }
+    worker(0);
+    for (auto &thread: pool) {
+        thread.join();
+    }
+
+    CHECK(errors.load() == 0);
+    CHECK(last_arrivals.load() == rounds);
+}
+
+TEST_CASE("common/barrier/wait_while_equal")
+{
+    std::atomic<std::uint32_t> word(0);
+    std::atomic<std::uint32_t> sleepers(0);
+
+    std::thread waker([&word, &sleepers]()
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        word.store(1);
+        wake_all(word, sleepers);
+    });
+
+    wait_while_equal(word, 0, sleepers, 10);
+    CHECK(word.load() == 1);
+    CHECK(sleepers.load() == 0);
+
+    waker.join();
+}
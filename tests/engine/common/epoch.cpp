@@ -0,0 +1,87 @@
+/**********************************************************************
+File name: epoch.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include <catch.hpp>
+
+#include "ffengine/common/epoch.hpp"
+
+using namespace ffe;
+
+
+TEST_CASE("common/epoch/unpinned")
+{
+    EpochDomain domain;
+    unsigned int deleted = 0;
+
+    domain.retire([&deleted](){ deleted += 1; });
+    domain.retire([&deleted](){ deleted += 1; });
+    CHECK(domain.pending() == 2);
+    CHECK(domain.collect() == 2);
+    CHECK(deleted == 2);
+    CHECK(domain.pending() == 0);
+}
+
+TEST_CASE("common/epoch/pinned")
+{
+    EpochDomain domain;
+    unsigned int deleted_before = 0;
+    unsigned int deleted_after = 0;
+
+    domain.retire([&deleted_before](){ deleted_before += 1; });
+
+    EpochDomain::Guard guard = domain.pin();
+    domain.retire([&deleted_after](){ deleted_after += 1; });
+
+    // objects retired before the reader pinned are not reachable by it
+    CHECK(domain.collect() == 1);
+    CHECK(deleted_before == 1);
+    CHECK(deleted_after == 0);
+
+    SECTION("moving the guard keeps the domain pinned")
+    {
+        EpochDomain::Guard moved(std::move(guard));
+        CHECK(domain.collect() == 0);
+        moved.release();
+        CHECK(domain.collect() == 1);
+        CHECK(deleted_after == 1);
+    }
+
+    SECTION("releasing the guard allows reclamation")
+    {
+        guard.release();
+        CHECK(domain.collect() == 1);
+        CHECK(deleted_after == 1);
+    }
+}
+
+TEST_CASE("common/epoch/destructor")
+{
+    unsigned int deleted = 0;
+    {
+        EpochDomain domain;
+        auto guard = domain.pin();
+        domain.retire([&deleted](){ deleted += 1; });
+        guard.release();
+    }
+    CHECK(deleted == 1);
+}
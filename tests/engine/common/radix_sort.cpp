@@ -0,0 +1,95 @@
+/**********************************************************************
+File name: radix_sort.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include <catch.hpp>
+
+#include <algorithm>
+#include <random>
+
+#include "ffengine/common/radix_sort.hpp"
+
+using namespace ffe;
+
+
+TEST_CASE("common/radix_sort/sorts_by_key")
+{
+    std::mt19937_64 rng(42);
+    std::vector<RadixSortEntry> entries;
+    for (std::uint32_t i = 0; i < 1000; ++i) {
+        entries.push_back(RadixSortEntry{rng(), i});
+    }
+    std::vector<RadixSortEntry> expected(entries);
+    std::sort(expected.begin(), expected.end(),
+              [](const RadixSortEntry &a, const RadixSortEntry &b) { return a.key < b.key; });
+
+    std::vector<RadixSortEntry> scratch;
+    radix_sort(entries, scratch);
+
+    REQUIRE(entries.size() == expected.size());
+    for (std::size_t i = 0; i < entries.size(); ++i) {
+        CHECK(entries[i].key == expected[i].key);
+        CHECK(entries[i].index == expected[i].index);
+    }
+}
+
+TEST_CASE("common/radix_sort/stable")
+{
+    std::vector<RadixSortEntry> entries{
+        {0x0300000000000000ULL, 0},
+        {0x0100000000000001ULL, 1},
+        {0x0300000000000000ULL, 2},
+        {0x0100000000000001ULL, 3},
+        {0x0100000000000000ULL, 4},
+        {0x0300000000000000ULL, 5},
+    };
+
+    std::vector<RadixSortEntry> scratch;
+    radix_sort(entries, scratch);
+
+    std::vector<std::uint32_t> order;
+    for (const RadixSortEntry &entry: entries) {
+        order.push_back(entry.index);
+    }
+    CHECK(order == (std::vector<std::uint32_t>{4, 1, 3, 0, 2, 5}));
+}
+
+TEST_CASE("common/radix_sort/trivial")
+{
+    std::vector<RadixSortEntry> scratch;
+
+    SECTION("empty")
+    {
+        std::vector<RadixSortEntry> entries;
+        radix_sort(entries, scratch);
+        CHECK(entries.empty());
+    }
+
+    SECTION("equal keys keep their order")
+    {
+        std::vector<RadixSortEntry> entries{{7, 0}, {7, 1}, {7, 2}};
+        radix_sort(entries, scratch);
+        CHECK(entries[0].index == 0);
+        CHECK(entries[1].index == 1);
+        CHECK(entries[2].index == 2);
+    }
+}
@@ -0,0 +1,177 @@
+#include "ffengine/common/scheduler.hpp"
+
+#include <catch.hpp>
+
+#include <stdexcept>
+#include <thread>
+
+
+using namespace ffe;
+
+
+TEST_CASE("common/TaskScheduler/parallel_for")
+{
+    TaskScheduler scheduler(3);
+    CHECK(scheduler.workers() == 3);
+
+    std::vector<std::atomic<unsigned int> > hits(1000);
+    for (auto &hit: hits) {
+        hit = 0;
+    }
+
+    // Catch assertions are not thread-safe, so we only count in the tasks
+    std::atomic<unsigned int> oversized_chunks(0);
+    parallel_for(scheduler, 0, hits.size(), 7,
+                 [&](const unsigned int begin, const unsigned int end)
+    {
+        if (end - begin > 7) {
+            oversized_chunks.fetch_add(1);
+        }
+        for (unsigned int i = begin; i < end; ++i) {
+            hits[i].fetch_add(1);
+        }
+    });
+
+    CHECK(oversized_chunks.load() == 0);
+    for (unsigned int i = 0; i < hits.size(); ++i) {
+        INFO(i);
+        CHECK(hits[i].load() == 1);
+    }
+
+    TaskSchedulerStats stats = scheduler.stats();
+    REQUIRE(stats.workers.size() == 3);
+    std::uint64_t total_tasks = stats.tasks_executed_external;
+    for (const TaskWorkerStats &worker: stats.workers) {
+        total_tasks += worker.tasks_executed;
+    }
+    CHECK(total_tasks == (1000 + 6) / 7);
+
+    scheduler.reset_stats();
+    stats = scheduler.stats();
+    CHECK(stats.tasks_executed_external == 0);
+    for (const TaskWorkerStats &worker: stats.workers) {
+        CHECK(worker.tasks_executed == 0);
+        CHECK(worker.busy_time.count() == 0);
+    }
+}
+
+TEST_CASE("common/TaskScheduler/parallel_for_rect")
+{
+    TaskScheduler scheduler(2);
+
+    const GenericRect<unsigned int> rect(3, 5, 40, 23);
+    std::vector<std::atomic<unsigned int> > hits(50*50);
+    for (auto &hit: hits) {
+        hit = 0;
+    }
+
+    std::atomic<unsigned int> oversized_tiles(0);
+    parallel_for_rect(scheduler, rect, 8,
+                      [&](const GenericRect<unsigned int> &tile)
+    {
+        if (tile.x1() - tile.x0() > 8 || tile.y1() - tile.y0() > 8) {
+            oversized_tiles.fetch_add(1);
+        }
+        for (unsigned int y = tile.y0(); y < tile.y1(); ++y) {
+            for (unsigned int x = tile.x0(); x < tile.x1(); ++x) {
+                hits[y*50+x].fetch_add(1);
+            }
+        }
+    });
+
+    CHECK(oversized_tiles.load() == 0);
+    for (unsigned int y = 0; y < 50; ++y) {
+        for (unsigned int x = 0; x < 50; ++x) {
+            const bool inside = x >= rect.x0() && x < rect.x1() &&
+                    y >= rect.y0() && y < rect.y1();
+            INFO(x << ", " << y);
+            CHECK(hits[y*50+x].load() == (inside ? 1 : 0));
+        }
+    }
+}
+
+TEST_CASE("common/TaskScheduler/nested_groups")
+{
+    TaskScheduler scheduler(2);
+
+    std::atomic<unsigned int> counter(0);
+    TaskGroup outer(scheduler);
+    for (unsigned int i = 0; i < 8; ++i) {
+        outer.run([&scheduler, &counter]()
+        {
+            // waiting inside a task must not deadlock, even with more
+            // nested groups than workers
+            TaskGroup inner(scheduler);
+            for (unsigned int j = 0; j < 8; ++j) {
+                inner.run([&counter](){ counter.fetch_add(1); });
+            }
+            inner.wait();
+        });
+    }
+    outer.wait();
+
+    CHECK(counter.load() == 64);
+}
+
+TEST_CASE("common/TaskScheduler/wait_only_runs_own_tasks")
+{
+    TaskScheduler scheduler(1);
+
+    // keep the only worker busy so that everything else stays queued
+    std::atomic<bool> blocker_started(false);
+    std::atomic<bool> release_blocker(false);
+    TaskGroup blocker(scheduler);
+    blocker.run([&blocker_started, &release_blocker]()
+    {
+        blocker_started = true;
+        while (!release_blocker.load()) {
+            std::this_thread::yield();
+        }
+    });
+    while (!blocker_started.load()) {
+        std::this_thread::yield();
+    }
+
+    std::atomic<bool> foreign_executed(false);
+    TaskGroup foreign(scheduler);
+    foreign.run([&foreign_executed](){ foreign_executed = true; });
+
+    std::atomic<unsigned int> counter(0);
+    TaskGroup own(scheduler);
+    for (unsigned int i = 0; i < 4; ++i) {
+        own.run([&counter](){ counter.fetch_add(1); });
+    }
+    own.wait();
+
+    CHECK(counter.load() == 4);
+    CHECK_FALSE(foreign_executed.load());
+
+    release_blocker = true;
+    blocker.wait();
+    foreign.wait();
+    CHECK(foreign_executed.load());
+}
+
+TEST_CASE("common/TaskScheduler/exceptions")
+{
+    TaskScheduler scheduler(2);
+
+    std::atomic<unsigned int> counter(0);
+    TaskGroup group(scheduler);
+    for (unsigned int i = 0; i < 10; ++i) {
+        group.run([&counter, i]()
+        {
+            counter.fetch_add(1);
+            if (i == 5) {
+                throw std::runtime_error("task failed");
+            }
+        });
+    }
+    CHECK_THROWS_AS(group.wait(), std::runtime_error);
+    CHECK(counter.load() == 10);
+
+    // the group is reusable after the exception has been reported
+    group.run([&counter](){ counter.fetch_add(1); });
+    CHECK_NOTHROW(group.wait());
+    CHECK(counter.load() == 11);
+}
@@ -0,0 +1,200 @@
+/**********************************************************************
+File name: block_allocator.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include <catch.hpp>
+
+#include <algorithm>
+#include <random>
+
+#include "ffengine/gl/block_allocator.hpp"
+
+using namespace ffe;
+
+
+TEST_CASE("gl/block_allocator/allocate")
+{
+    GLBlockAllocator alloc;
+    CHECK(alloc.allocate(1) == GLBlockAllocator::NO_REGION);
+
+    alloc.grow(16);
+    CHECK(alloc.total_blocks() == 16);
+    CHECK(alloc.free_blocks() == 16);
+    CHECK(alloc.trailing_free_blocks() == 16);
+
+    GLBlockAllocator::RegionID a = alloc.allocate(4);
+    GLBlockAllocator::RegionID b = alloc.allocate(0);
+    GLBlockAllocator::RegionID c = alloc.allocate(8);
+    REQUIRE(a != GLBlockAllocator::NO_REGION);
+    REQUIRE(b != GLBlockAllocator::NO_REGION);
+    REQUIRE(c != GLBlockAllocator::NO_REGION);
+
+    CHECK(alloc.region_start(a) == 0);
+    CHECK(alloc.region_count(a) == 4);
+    CHECK(alloc.region_start(b) == 4);
+    CHECK(alloc.region_count(b) == 1);
+    CHECK(alloc.region_start(c) == 5);
+    CHECK(alloc.region_count(c) == 8);
+    CHECK(alloc.free_blocks() == 3);
+    CHECK(alloc.trailing_free_blocks() == 3);
+
+    CHECK(alloc.allocate(4) == GLBlockAllocator::NO_REGION);
+
+    SECTION("grow extends the trailing free region")
+    {
+        alloc.grow(32);
+        CHECK(alloc.trailing_free_blocks() == 19);
+        GLBlockAllocator::RegionID d = alloc.allocate(4);
+        REQUIRE(d != GLBlockAllocator::NO_REGION);
+        CHECK(alloc.region_start(d) == 13);
+    }
+
+    SECTION("grow never shrinks")
+    {
+        alloc.grow(8);
+        CHECK(alloc.total_blocks() == 16);
+    }
+}
+
+TEST_CASE("gl/block_allocator/release")
+{
+    GLBlockAllocator alloc;
+    alloc.grow(16);
+
+    GLBlockAllocator::RegionID a = alloc.allocate(4);
+    GLBlockAllocator::RegionID b = alloc.allocate(4);
+    GLBlockAllocator::RegionID c = alloc.allocate(4);
+    GLBlockAllocator::RegionID d = alloc.allocate(4);
+    CHECK(alloc.free_blocks() == 0);
+    CHECK(alloc.trailing_free_blocks() == 0);
+    CHECK(alloc.regions() == 4);
+
+    SECTION("freed space is reused")
+    {
+        alloc.release(b);
+        CHECK(alloc.free_blocks() == 4);
+        GLBlockAllocator::RegionID e = alloc.allocate(3);
+        REQUIRE(e != GLBlockAllocator::NO_REGION);
+        CHECK(alloc.region_start(e) == 4);
+        CHECK(alloc.regions() == 5);
+    }
+
+    SECTION("neighbouring free regions are merged")
+    {
+        alloc.release(a);
+        alloc.release(c);
+        CHECK(alloc.regions() == 4);
+        CHECK(alloc.allocate(8) == GLBlockAllocator::NO_REGION);
+
+        alloc.release(b);
+        CHECK(alloc.regions() == 2);
+        GLBlockAllocator::RegionID e = alloc.allocate(12);
+        REQUIRE(e != GLBlockAllocator::NO_REGION);
+        CHECK(alloc.region_start(e) == 0);
+        CHECK(alloc.region_count(e) == 12);
+    }
+
+    SECTION("releasing the last region makes it trailing")
+    {
+        alloc.release(d);
+        CHECK(alloc.trailing_free_blocks() == 4);
+        alloc.release(c);
+        CHECK(alloc.trailing_free_blocks() == 8);
+        CHECK(alloc.regions() == 3);
+    }
+}
+
+TEST_CASE("gl/block_allocator/deep_size_class")
+{
+    GLBlockAllocator alloc;
+    alloc.grow(57);
+
+    // more too-small fragments than MAX_CLASS_SCAN in the class of the
+    // request, listed before the trailing region which fits
+    const unsigned int fragments = GLBlockAllocator::MAX_CLASS_SCAN + 2;
+    std::vector<GLBlockAllocator::RegionID> small;
+    for (unsigned int i = 0; i < fragments; ++i) {
+        small.push_back(alloc.allocate(4));
+        REQUIRE(alloc.allocate(1) != GLBlockAllocator::NO_REGION);
+    }
+    for (GLBlockAllocator::RegionID id: small) {
+        alloc.release(id);
+    }
+    REQUIRE(alloc.trailing_free_blocks() == 7);
+
+    GLBlockAllocator::RegionID a = alloc.allocate(7);
+    REQUIRE(a != GLBlockAllocator::NO_REGION);
+    CHECK(alloc.region_start(a) == 50);
+    CHECK(alloc.trailing_free_blocks() == 0);
+
+    CHECK(alloc.allocate(5) == GLBlockAllocator::NO_REGION);
+}
+
+TEST_CASE("gl/block_allocator/churn")
+{
+    std::mt19937 rng(1234);
+    std::uniform_int_distribution<unsigned int> size_dist(1, 96);
+
+    GLBlockAllocator alloc;
+    std::vector<GLBlockAllocator::RegionID> live;
+
+    for (unsigned int step = 0; step < 4000; ++step) {
+        if (!live.empty() && rng() % 5 < 2) {
+            const std::size_t index = rng() % live.size();
+            alloc.release(live[index]);
+            live[index] = live.back();
+            live.pop_back();
+        } else {
+            const unsigned int count = size_dist(rng);
+            GLBlockAllocator::RegionID id = alloc.allocate(count);
+            if (id == GLBlockAllocator::NO_REGION) {
+                alloc.grow(std::max(alloc.total_blocks() * 2,
+                                    alloc.total_blocks() + count));
+                id = alloc.allocate(count);
+            }
+            REQUIRE(id != GLBlockAllocator::NO_REGION);
+            REQUIRE(alloc.region_count(id) == count);
+            live.emplace_back(id);
+        }
+    }
+
+    // live regions must not overlap and must account for all used blocks
+    std::vector<std::pair<unsigned int, unsigned int> > spans;
+    unsigned int used = 0;
+    for (GLBlockAllocator::RegionID id: live) {
+        spans.emplace_back(alloc.region_start(id), alloc.region_count(id));
+        used += alloc.region_count(id);
+    }
+    std::sort(spans.begin(), spans.end());
+    for (std::size_t i = 1; i < spans.size(); ++i) {
+        CHECK(spans[i-1].first + spans[i-1].second <= spans[i].first);
+    }
+    CHECK(spans.back().first + spans.back().second <= alloc.total_blocks());
+    CHECK(alloc.free_blocks() == alloc.total_blocks() - used);
+
+    for (GLBlockAllocator::RegionID id: live) {
+        alloc.release(id);
+    }
+    CHECK(alloc.regions() == 1);
+    CHECK(alloc.free_blocks() == alloc.total_blocks());
+    CHECK(alloc.trailing_free_blocks() == alloc.total_blocks());
+}
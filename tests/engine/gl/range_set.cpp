@@ -0,0 +1,127 @@
+/**********************************************************************
+File name: range_set.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include <catch.hpp>
+
+#include "ffengine/gl/range_set.hpp"
+
+using namespace ffe;
+
+
+TEST_CASE("gl/range_set/add")
+{
+    GLBufferRangeSet set;
+    CHECK(set.empty());
+
+    set.add(10, 20);
+    set.add(30, 40);
+    set.add(0, 5);
+    set.add(7, 7);
+    REQUIRE(set.ranges().size() == 3);
+    CHECK(set.ranges()[0] == (GLBufferRange{0, 5}));
+    CHECK(set.ranges()[1] == (GLBufferRange{10, 20}));
+    CHECK(set.ranges()[2] == (GLBufferRange{30, 40}));
+    CHECK(set.covered() == 25);
+
+    SECTION("adjacent ranges are merged")
+    {
+        set.add(5, 10);
+        REQUIRE(set.ranges().size() == 2);
+        CHECK(set.ranges()[0] == (GLBufferRange{0, 20}));
+    }
+
+    SECTION("overlapping ranges are merged")
+    {
+        set.add(15, 35);
+        REQUIRE(set.ranges().size() == 2);
+        CHECK(set.ranges()[1] == (GLBufferRange{10, 40}));
+    }
+
+    SECTION("contained ranges do not change the set")
+    {
+        set.add(12, 18);
+        REQUIRE(set.ranges().size() == 3);
+        CHECK(set.ranges()[1] == (GLBufferRange{10, 20}));
+    }
+
+    SECTION("a range covering everything replaces all ranges")
+    {
+        set.add(1, 100);
+        REQUIRE(set.ranges().size() == 1);
+        CHECK(set.ranges()[0] == (GLBufferRange{0, 100}));
+    }
+
+    SECTION("clear")
+    {
+        set.clear();
+        CHECK(set.empty());
+        CHECK(set.covered() == 0);
+    }
+}
+
+TEST_CASE("gl/range_set/coalesce")
+{
+    GLBufferRangeSet set;
+    set.add(0, 4);
+    set.add(6, 8);
+    set.add(20, 24);
+    set.add(1000, 1001);
+
+    std::vector<GLBufferRange> merged;
+
+    set.coalesce(0, merged);
+    CHECK(merged == set.ranges());
+
+    set.coalesce(3, merged);
+    REQUIRE(merged.size() == 3);
+    CHECK(merged[0] == (GLBufferRange{0, 8}));
+    CHECK(merged[1] == (GLBufferRange{20, 24}));
+
+    set.coalesce(13, merged);
+    REQUIRE(merged.size() == 2);
+    CHECK(merged[0] == (GLBufferRange{0, 24}));
+    CHECK(merged[1] == (GLBufferRange{1000, 1001}));
+
+    set.coalesce(10000, merged);
+    REQUIRE(merged.size() == 1);
+    CHECK(merged[0] == (GLBufferRange{0, 1001}));
+
+    SECTION("gaps of exactly max_gap are merged")
+    {
+        set.coalesce(1, merged);
+        CHECK(merged == set.ranges());
+
+        set.coalesce(2, merged);
+        REQUIRE(merged.size() == 3);
+        CHECK(merged[0] == (GLBufferRange{0, 8}));
+
+        set.coalesce(12, merged);
+        REQUIRE(merged.size() == 2);
+        CHECK(merged[0] == (GLBufferRange{0, 24}));
+
+        set.coalesce(975, merged);
+        CHECK(merged.size() == 2);
+        set.coalesce(976, merged);
+        CHECK(merged.size() == 1);
+    }
+}
@@ -0,0 +1,89 @@
+/**********************************************************************
+File name: half.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include <catch.hpp>
+
+#include <cmath>
+#include <limits>
+
+#include "ffengine/math/half.hpp"
+
+
+TEST_CASE("math/half/exact_values")
+{
+    CHECK(Half(0.f).bits == 0x0000);
+    CHECK(Half(-0.f).bits == 0x8000);
+    CHECK(Half(1.f).bits == 0x3c00);
+    CHECK(Half(-2.f).bits == 0xc000);
+    CHECK(Half(0.5f).bits == 0x3800);
+    CHECK(Half(65504.f).bits == 0x7bff);
+    // smallest normal and smallest subnormal
+    CHECK(Half(std::ldexp(1.f, -14)).bits == 0x0400);
+    CHECK(Half(std::ldexp(1.f, -24)).bits == 0x0001);
+}
+
+TEST_CASE("math/half/roundtrip")
+{
+    for (unsigned int bits = 0; bits < 0x10000; ++bits) {
+        const Half value = Half::from_bits(bits);
+        const unsigned int exponent = (bits >> 10) & 0x1f;
+        if (exponent == 0x1f && (bits & 0x3ff)) {
+            CHECK(std::isnan(float(value)));
+            continue;
+        }
+        INFO("bits " << bits);
+        CHECK(Half(float(value)).bits == bits);
+    }
+}
+
+TEST_CASE("math/half/rounding")
+{
+    // halfway between 1 and the next half, ties to even
+    CHECK(Half(1.f + std::ldexp(1.f, -11)).bits == 0x3c00);
+    CHECK(Half(1.f + 3*std::ldexp(1.f, -11)).bits == 0x3c02);
+    CHECK(Half(1.f + std::ldexp(1.f, -11) + std::ldexp(1.f, -20)).bits == 0x3c01);
+    // halfway between the two smallest subnormals
+    CHECK(Half(std::ldexp(3.f, -25)).bits == 0x0002);
+    CHECK(Half(std::ldexp(1.f, -25)).bits == 0x0000);
+}
+
+TEST_CASE("math/half/special_values")
+{
+    CHECK(Half(65520.f).bits == 0x7c00);
+    CHECK(Half(-1e10f).bits == 0xfc00);
+    CHECK(Half(std::numeric_limits<float>::infinity()).bits == 0x7c00);
+    CHECK(std::isinf(float(Half::from_bits(0xfc00))));
+    CHECK(std::isnan(float(Half(std::numeric_limits<float>::quiet_NaN()))));
+}
+
+TEST_CASE("math/half/arithmetic")
+{
+    Half value(1.5f);
+    value += 2.f;
+    CHECK(float(value) == 3.5f);
+    value -= 0.5f;
+    CHECK(float(value) == 3.f);
+    value *= 0.25f;
+    CHECK(float(value) == 0.75f);
+    CHECK(value > 0.5f);
+}
@@ -26,6 +26,9 @@ the AUTHORS file.
 #include "ffengine/math/octree.hpp"
 
 #include <iostream>
+#include <random>
+
+#include "ffengine/common/scheduler.hpp"
 
 #include "ffengine/math/ray.hpp"
 
@@ -398,3 +401,53 @@ TEST_CASE("math/octree/Octree/select_nodes_by_frustum")
 
     CHECK(hitset == expected_nodes);
 }
+
+TEST_CASE("math/octree/Octree/select_nodes_by_frustum/parallel")
+{
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> coord_dist(-100.f, 100.f);
+    std::uniform_real_distribution<float> radius_dist(0.1f, 2.f);
+
+    ffe::Octree tree;
+    std::vector<std::unique_ptr<TestObject> > objects;
+    for (unsigned int i = 0; i < 2000; ++i) {
+        auto obj = std::make_unique<TestObject>();
+        obj->set_bounding_sphere(Sphere{
+                                     Vector3f(coord_dist(rng),
+                                              coord_dist(rng),
+                                              coord_dist(rng)),
+                                     radius_dist(rng)});
+        tree.insert_object(obj.get());
+        objects.emplace_back(std::move(obj));
+    }
+
+    ffe::TaskScheduler scheduler(3);
+
+    // an axis-aligned box from -extent to extent, except along X, where the
+    // box starts at offset
+    auto box_frustum = [](const float offset, const float extent)
+    {
+        return std::array<Plane, 6>({{
+                                         Plane(Vector4f(1, 0, 0, offset)),
+                                         Plane(Vector4f(-1, 0, 0, -extent)),
+                                         Plane(Vector4f(0, 1, 0, -extent)),
+                                         Plane(Vector4f(0, -1, 0, -extent)),
+                                         Plane(Vector4f(0, 0, 1, -extent)),
+                                         Plane(Vector4f(0, 0, -1, -extent)),
+                                     }});
+    };
+
+    for (const auto &frustum: {box_frustum(-200.f, 200.f),
+                               box_frustum(0.f, 50.f),
+                               box_frustum(-30.f, 30.f),
+                               box_frustum(500.f, 600.f)})
+    {
+        std::vector<ffe::OctreeNode*> expected;
+        tree.select_nodes_by_frustum(frustum, expected);
+
+        std::vector<ffe::OctreeNode*> hitset;
+        tree.select_nodes_by_frustum(frustum, hitset, scheduler);
+
+        CHECK(hitset == expected);
+    }
+}
@@ -0,0 +1,205 @@
+/**********************************************************************
+File name: brush_dictionary.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include <catch.hpp>
+
+#include "ffengine/sim/brush_dictionary.hpp"
+#include "ffengine/sim/world_ops.hpp"
+
+#include "world_command.pb.h"
+
+using namespace sim;
+
+
+static std::vector<float> make_density_map(const unsigned int size,
+                                           const float scale)
+{
+    std::vector<float> result(size*size);
+    for (unsigned int i = 0; i < result.size(); ++i) {
+        result[i] = scale * (i % size) / size;
+    }
+    return result;
+}
+
+
+TEST_CASE("sim/brush_dictionary/intern")
+{
+    BrushDictionary brushes;
+
+    const BrushID id1 = brushes.intern(4, make_density_map(4, 1.f));
+    const BrushID id2 = brushes.intern(4, make_density_map(4, 0.5f));
+    CHECK(id1 != BrushDictionary::INVALID_BRUSH_ID);
+    CHECK(id2 != BrushDictionary::INVALID_BRUSH_ID);
+    CHECK(id1 != id2);
+    CHECK(brushes.size() == 2);
+
+    SECTION("identical brushes are deduplicated")
+    {
+        CHECK(brushes.intern(4, make_density_map(4, 1.f)) == id1);
+        CHECK(brushes.intern(4, make_density_map(4, 0.5f)) == id2);
+        CHECK(brushes.size() == 2);
+    }
+
+    SECTION("lookup")
+    {
+        BrushDictionary::Brush brush;
+        REQUIRE(brushes.lookup(id1, brush));
+        CHECK(brush.size == 4);
+        REQUIRE(brush.density_map);
+        CHECK(*brush.density_map == make_density_map(4, 1.f));
+
+        BrushDictionary::Brush other;
+        REQUIRE(brushes.lookup(id1, other));
+        CHECK(other.density_map == brush.density_map);
+
+        CHECK_FALSE(brushes.lookup(BrushDictionary::INVALID_BRUSH_ID, brush));
+        CHECK_FALSE(brushes.lookup(id2+1, brush));
+    }
+
+    SECTION("invalid brushes are rejected")
+    {
+        CHECK(brushes.intern(0, std::vector<float>()) ==
+              BrushDictionary::INVALID_BRUSH_ID);
+        CHECK(brushes.intern(4, make_density_map(3, 1.f)) ==
+              BrushDictionary::INVALID_BRUSH_ID);
+        CHECK(brushes.intern(BrushDictionary::MAX_BRUSH_SIZE+1,
+                             std::vector<float>()) ==
+              BrushDictionary::INVALID_BRUSH_ID);
+        CHECK(brushes.size() == 2);
+    }
+}
+
+TEST_CASE("sim/brush_dictionary/evict_lru")
+{
+    BrushDictionary brushes;
+
+    const BrushID first = brushes.intern(2, make_density_map(2, 1.f));
+    const BrushID second = brushes.intern(2, make_density_map(2, 2.f));
+    REQUIRE(first != BrushDictionary::INVALID_BRUSH_ID);
+    REQUIRE(second != BrushDictionary::INVALID_BRUSH_ID);
+    for (unsigned int i = 2; i < BrushDictionary::MAX_BRUSHES; ++i) {
+        REQUIRE(brushes.intern(2, make_density_map(2, i+1.f)) !=
+                BrushDictionary::INVALID_BRUSH_ID);
+    }
+    CHECK(brushes.size() == BrushDictionary::MAX_BRUSHES);
+
+    // using the first brush makes the second one the least recently used
+    BrushDictionary::Brush brush;
+    REQUIRE(brushes.lookup(first, brush));
+
+    // a full dictionary still accepts new brushes
+    const BrushID fresh = brushes.intern(2, make_density_map(2, -1.f));
+    CHECK(fresh != BrushDictionary::INVALID_BRUSH_ID);
+    CHECK(brushes.size() == BrushDictionary::MAX_BRUSHES);
+    CHECK(brushes.lookup(first, brush));
+    CHECK(brushes.lookup(fresh, brush));
+    CHECK_FALSE(brushes.lookup(second, brush));
+
+    // evicted brushes can be registered again, under a new ID
+    const BrushID again = brushes.intern(2, make_density_map(2, 2.f));
+    CHECK(again != BrushDictionary::INVALID_BRUSH_ID);
+    CHECK(again != second);
+    REQUIRE(brushes.lookup(again, brush));
+    CHECK(*brush.density_map == make_density_map(2, 2.f));
+    CHECK(brushes.size() == BrushDictionary::MAX_BRUSHES);
+}
+
+TEST_CASE("sim/brush_dictionary/from_message")
+{
+    BrushDictionary brushes;
+    const BrushID id = brushes.intern(4, make_density_map(4, 1.f));
+    REQUIRE(id != BrushDictionary::INVALID_BRUSH_ID);
+
+    messages::WorldCommand msg;
+
+    SECTION("raise with registered brush")
+    {
+        messages::TerraformRaise *cmd = msg.mutable_tf_raise();
+        cmd->set_xc(10.f);
+        cmd->set_yc(10.f);
+        cmd->set_brush_size(4);
+        cmd->set_brush_strength(0.5f);
+        cmd->set_brush_id(id);
+
+        auto op = WorldOperation::from_message(msg, brushes);
+        CHECK(dynamic_cast<ops::TerraformRaise*>(op.get()) != nullptr);
+    }
+
+    SECTION("level with registered brush")
+    {
+        messages::TerraformLevel *cmd = msg.mutable_tf_level();
+        cmd->set_xc(10.f);
+        cmd->set_yc(10.f);
+        cmd->set_brush_size(4);
+        cmd->set_brush_strength(0.5f);
+        cmd->set_reference_height(2.f);
+        cmd->set_brush_id(id);
+
+        auto op = WorldOperation::from_message(msg, brushes);
+        CHECK(dynamic_cast<ops::TerraformLevel*>(op.get()) != nullptr);
+    }
+
+    SECTION("raise with inline density map")
+    {
+        messages::TerraformRaise *cmd = msg.mutable_tf_raise();
+        cmd->set_xc(10.f);
+        cmd->set_yc(10.f);
+        cmd->set_brush_size(4);
+        cmd->set_brush_strength(0.5f);
+        for (float v: make_density_map(4, 1.f)) {
+            cmd->add_density_map(v);
+        }
+
+        auto op = WorldOperation::from_message(msg, brushes);
+        CHECK(dynamic_cast<ops::TerraformRaise*>(op.get()) != nullptr);
+    }
+
+    SECTION("unknown brush")
+    {
+        messages::TerraformRaise *cmd = msg.mutable_tf_raise();
+        cmd->set_xc(10.f);
+        cmd->set_yc(10.f);
+        cmd->set_brush_size(4);
+        cmd->set_brush_strength(0.5f);
+        cmd->set_brush_id(id+1);
+
+        CHECK_FALSE(WorldOperation::from_message(msg, brushes));
+    }
+
+    SECTION("inline density map of wrong size")
+    {
+        messages::TerraformRaise *cmd = msg.mutable_tf_raise();
+        cmd->set_xc(10.f);
+        cmd->set_yc(10.f);
+        cmd->set_brush_size(4);
+        cmd->set_brush_strength(0.5f);
+        cmd->add_density_map(1.f);
+
+        CHECK_FALSE(WorldOperation::from_message(msg, brushes));
+    }
+
+    SECTION("no operation")
+    {
+        CHECK_FALSE(WorldOperation::from_message(msg, brushes));
+    }
+}
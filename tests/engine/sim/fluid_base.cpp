@@ -0,0 +1,229 @@
+/**********************************************************************
+File name: fluid_base.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include <catch.hpp>
+
+#include <atomic>
+#include <thread>
+
+#include "ffengine/sim/fluid.hpp"
+#include "ffengine/sim/fluid_base.hpp"
+#include "ffengine/sim/terrain.hpp"
+
+using namespace sim;
+
+
+TEST_CASE("sim/fluid/FluidBlocks/work_lists")
+{
+    FluidBlocks blocks(5);
+
+    SECTION("all blocks start active")
+    {
+        CHECK(blocks.block_counts().active == 25);
+        CHECK(blocks.block_counts().frontier == 0);
+        CHECK(blocks.block_counts().idle == 0);
+        CHECK(blocks.active_blocks().size() == 25);
+        CHECK(blocks.frontier_blocks().empty());
+    }
+
+    SECTION("single active block")
+    {
+        for (unsigned int y = 0; y < 5; ++y) {
+            for (unsigned int x = 0; x < 5; ++x) {
+                blocks.block(x, y)->set_active(x == 2 && y == 2);
+            }
+        }
+        blocks.swap_active_blocks();
+
+        CHECK(blocks.block_counts().active == 1);
+        CHECK(blocks.block_counts().frontier == 4);
+        CHECK(blocks.block_counts().idle == 20);
+
+        REQUIRE(blocks.active_blocks().size() == 1);
+        CHECK(blocks.active_blocks()[0] == blocks.block(2, 2));
+
+        REQUIRE(blocks.frontier_blocks().size() == 4);
+        CHECK(blocks.frontier_blocks()[0] == blocks.block(2, 1));
+        CHECK(blocks.frontier_blocks()[1] == blocks.block(1, 2));
+        CHECK(blocks.frontier_blocks()[2] == blocks.block(3, 2));
+        CHECK(blocks.frontier_blocks()[3] == blocks.block(2, 3));
+
+        SECTION("frontier follows activation of a corner block")
+        {
+            blocks.block(0, 0)->set_active(true);
+            blocks.swap_active_blocks();
+
+            CHECK(blocks.block_counts().active == 2);
+            CHECK(blocks.block_counts().frontier == 6);
+            CHECK(blocks.block_counts().idle == 17);
+        }
+
+        SECTION("everything becomes idle")
+        {
+            blocks.block(2, 2)->set_active(false);
+            blocks.swap_active_blocks();
+
+            CHECK(blocks.block_counts().active == 0);
+            CHECK(blocks.block_counts().frontier == 0);
+            CHECK(blocks.block_counts().idle == 25);
+        }
+    }
+
+    SECTION("reset deactivates after next swap")
+    {
+        blocks.reset(0.f);
+        blocks.swap_active_blocks();
+
+        CHECK(blocks.block_counts().active == 0);
+        CHECK(blocks.block_counts().idle == 25);
+    }
+}
+
+TEST_CASE("sim/fluid/FluidBlocks/collapse")
+{
+    FluidBlocks blocks(5);
+    for (unsigned int y = 0; y < blocks.cells_per_axis(); ++y) {
+        for (unsigned int x = 0; x < blocks.cells_per_axis(); ++x) {
+            blocks.cell_meta(x, y)->terrain_height = (x < 60 ? -1.f : 1.f);
+        }
+    }
+    blocks.reset(0.5f);
+    blocks.swap_active_blocks();
+
+    SECTION("idle blocks collapse")
+    {
+        CHECK(blocks.block_counts().idle == 25);
+        CHECK(blocks.block_counts().collapsed == 25);
+        for (unsigned int y = 0; y < 5; ++y) {
+            for (unsigned int x = 0; x < 5; ++x) {
+                CHECK(blocks.block(x, y)->collapsed());
+            }
+        }
+
+        // wet and dry blocks keep their fluid heights
+        CHECK(blocks.clamped_cell_front_value(10, 10).fluid_height == 1.5f);
+        CHECK(blocks.clamped_cell_front_value(70, 10).fluid_height == 0.f);
+        CHECK(blocks.clamped_cell_front_value(-3, 400).fluid_height == 1.5f);
+    }
+
+    SECTION("activation expands block and frontier")
+    {
+        blocks.block(2, 2)->set_active(true);
+        blocks.swap_active_blocks();
+
+        CHECK(blocks.block_counts().active == 1);
+        CHECK(blocks.block_counts().frontier == 4);
+        // the diagonal neighbours stay expanded, too
+        CHECK(blocks.block_counts().collapsed == 16);
+        CHECK_FALSE(blocks.block(2, 2)->collapsed());
+        CHECK_FALSE(blocks.block(2, 1)->collapsed());
+        CHECK_FALSE(blocks.block(3, 2)->collapsed());
+        CHECK_FALSE(blocks.block(1, 1)->collapsed());
+        CHECK_FALSE(blocks.block(3, 3)->collapsed());
+        CHECK(blocks.block(0, 0)->collapsed());
+
+        CHECK(blocks.cell_front(130, 130)->fluid_height == 0.f);
+        CHECK(blocks.cell_front(130, 130)->fluid_flow[0] == 0.f);
+
+        SECTION("and collapses again once idle")
+        {
+            blocks.block(2, 2)->set_active(false);
+            blocks.swap_active_blocks();
+
+            CHECK(blocks.block_counts().collapsed == 25);
+        }
+    }
+
+    SECTION("non-flat blocks do not collapse")
+    {
+        blocks.expand_all();
+        blocks.cell_front(10, 10)->fluid_height = 1.6f;
+        blocks.cell_back(10, 10)->fluid_height = 1.6f;
+        blocks.block(0, 0)->set_active(true);
+        blocks.swap_active_blocks();
+        blocks.block(0, 0)->set_active(false);
+        blocks.swap_active_blocks();
+
+        CHECK_FALSE(blocks.block(0, 0)->collapsed());
+        CHECK(blocks.block(4, 4)->collapsed());
+    }
+
+    SECTION("expand_cells expands overlapping blocks")
+    {
+        blocks.expand_cells(TerrainRect(59, 59, 61, 61));
+
+        CHECK_FALSE(blocks.block(0, 0)->collapsed());
+        CHECK_FALSE(blocks.block(1, 1)->collapsed());
+        CHECK_FALSE(blocks.block(0, 1)->collapsed());
+        CHECK(blocks.block(2, 2)->collapsed());
+        CHECK(blocks.cell_front(10, 10)->fluid_height == 1.5f);
+    }
+}
+
+TEST_CASE("sim/fluid/Fluid/copy_block_during_collapse")
+{
+    Terrain terrain(5*IFluidSim::block_size+1);
+    Fluid fluid(terrain);
+    FluidBlocks &blocks = fluid.blocks();
+    blocks.reset(0.5f);
+    blocks.swap_active_blocks();
+    REQUIRE(blocks.block_counts().collapsed == 25);
+
+    const unsigned int size = blocks.cells_per_axis();
+    std::atomic<bool> terminate(false);
+    std::atomic<unsigned int> copies(0);
+    std::atomic<unsigned int> bad_values(0);
+
+    // copy_block must never see a freed or half-built cell buffer while
+    // blocks are expanded and collapsed on another thread
+    std::thread reader([&]()
+    {
+        std::vector<Vector4f> dest(size*size);
+        while (!terminate.load() || copies.load() == 0) {
+            bool used_active;
+            fluid.copy_block(dest.data(), 0, 0, size, size, 1, size,
+                             used_active);
+            for (const Vector4f &value: dest) {
+                if (value[eY] != 0.5f) {
+                    bad_values.fetch_add(1);
+                }
+            }
+            copies.fetch_add(1);
+        }
+    });
+
+    for (unsigned int i = 0; i < 200; ++i) {
+        blocks.block(2, 2)->set_active(true);
+        blocks.swap_active_blocks();
+        blocks.block(2, 2)->set_active(false);
+        blocks.swap_active_blocks();
+        blocks.expand_cells(TerrainRect(0, 0, size, size));
+        blocks.swap_active_blocks();
+    }
+    terminate = true;
+    reader.join();
+
+    CHECK(copies.load() > 0);
+    CHECK(bad_values.load() == 0);
+    CHECK(blocks.block_counts().collapsed == 25);
+}
@@ -0,0 +1,360 @@
+/**********************************************************************
+File name: fluid_native.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include <catch.hpp>
+
+#include "ffengine/sim/fluid_native.hpp"
+
+using namespace sim;
+
+
+static const unsigned int test_blocks_per_axis = 3;
+static const unsigned int test_frames = 64;
+
+
+static void setup_test_terrain(Terrain &terrain)
+{
+    terrain.from_sincos(Vector3f(0.11f, 0.07f, 3.f));
+}
+
+static void setup_test_fluid(FluidBlocks &blocks)
+{
+    blocks.reset(0.f);
+    // a tall column of water in the center block and a source in a corner
+    // block, to get flow across all kinds of seams
+    const unsigned int center = blocks.cells_per_axis() / 2;
+    for (unsigned int y = center-10; y < center+10; ++y) {
+        for (unsigned int x = center-10; x < center+10; ++x) {
+            blocks.cell_front(x, y)->fluid_height = 5.f;
+            blocks.cell_back(x, y)->fluid_height = 5.f;
+        }
+    }
+    for (unsigned int y = 2; y < 6; ++y) {
+        for (unsigned int x = 2; x < 6; ++x) {
+            FluidCellMeta *meta = blocks.cell_meta(x, y);
+            meta->source_height = 10.f;
+            meta->source_capacity = 0.5f;
+        }
+    }
+    for (unsigned int y = 0; y < blocks.blocks_per_axis(); ++y) {
+        for (unsigned int x = 0; x < blocks.blocks_per_axis(); ++x) {
+            blocks.block(x, y)->set_active(true);
+        }
+    }
+}
+
+static void run_frames(NativeFluidSim &sim, const unsigned int frames)
+{
+    for (unsigned int i = 0; i < frames; ++i) {
+        sim.start_frame();
+        sim.wait_for_frame();
+    }
+}
+
+
+static void check_kernel_matches_scalar(
+        const FluidKernel kernel,
+        const FluidDispatch dispatch = FluidDispatch::SCHEDULER,
+        const unsigned int epoch_workers = 0)
+{
+    Terrain terrain(test_blocks_per_axis*IFluidSim::block_size+1);
+    setup_test_terrain(terrain);
+    const TerrainRect full_rect(0, 0, terrain.size(), terrain.size());
+
+    FluidBlocks scalar_blocks(test_blocks_per_axis);
+    FluidBlocks other_blocks(test_blocks_per_axis);
+
+    NativeFluidSim scalar_sim(scalar_blocks, terrain, FluidKernel::SCALAR);
+    NativeFluidSim other_sim(other_blocks, terrain, kernel, dispatch,
+                             epoch_workers);
+    CHECK(scalar_sim.kernel() == FluidKernel::SCALAR);
+#ifdef FFENGINE_FLUID_DOUBLE
+    // the tile kernels only support single precision
+    CHECK(other_sim.kernel() == FluidKernel::SCALAR);
+#else
+    CHECK(other_sim.kernel() != FluidKernel::SCALAR);
+#endif
+    CHECK(other_sim.dispatch() == dispatch);
+
+    // first frame syncs the terrain
+    scalar_sim.terrain_update(full_rect);
+    other_sim.terrain_update(full_rect);
+    scalar_sim.set_ocean_level(1.f);
+    other_sim.set_ocean_level(1.f);
+    run_frames(scalar_sim, 1);
+    run_frames(other_sim, 1);
+
+    setup_test_fluid(scalar_blocks);
+    setup_test_fluid(other_blocks);
+
+    run_frames(scalar_sim, test_frames);
+    run_frames(other_sim, test_frames);
+
+    for (unsigned int y = 0; y < scalar_blocks.cells_per_axis(); ++y) {
+        for (unsigned int x = 0; x < scalar_blocks.cells_per_axis(); ++x) {
+            const FluidCell expected = scalar_blocks.clamped_cell_front_value(x, y);
+            const FluidCell actual = other_blocks.clamped_cell_front_value(x, y);
+            INFO("cell " << x << ", " << y);
+            CHECK(actual.fluid_height == Approx(expected.fluid_height).epsilon(1e-5).margin(1e-6));
+            CHECK(actual.fluid_flow[0] == Approx(expected.fluid_flow[0]).epsilon(1e-5).margin(1e-6));
+            CHECK(actual.fluid_flow[1] == Approx(expected.fluid_flow[1]).epsilon(1e-5).margin(1e-6));
+        }
+    }
+
+    for (unsigned int y = 0; y < scalar_blocks.blocks_per_axis(); ++y) {
+        for (unsigned int x = 0; x < scalar_blocks.blocks_per_axis(); ++x) {
+            INFO("block " << x << ", " << y);
+            CHECK(other_blocks.block(x, y)->front_meta().active ==
+                  scalar_blocks.block(x, y)->front_meta().active);
+        }
+    }
+}
+
+TEST_CASE("sim/fluid/NativeFluidSim/halo_matches_scalar")
+{
+    check_kernel_matches_scalar(FluidKernel::HALO);
+}
+
+TEST_CASE("sim/fluid/NativeFluidSim/simd_matches_scalar")
+{
+    check_kernel_matches_scalar(FluidKernel::SIMD);
+}
+
+TEST_CASE("sim/fluid/NativeFluidSim/epoch_dispatch_matches_scalar")
+{
+    // explicit worker count, so that the dedicated threads are used
+    // independent of the number of cores
+    check_kernel_matches_scalar(FluidKernel::HALO, FluidDispatch::EPOCH, 2);
+}
+
+TEST_CASE("sim/fluid/NativeFluidSim/frame_timings")
+{
+    Terrain terrain(test_blocks_per_axis*IFluidSim::block_size+1);
+    setup_test_terrain(terrain);
+    FluidBlocks blocks(test_blocks_per_axis);
+
+    NativeFluidSim sim(blocks, terrain, FluidKernel::HALO,
+                       FluidDispatch::EPOCH, 2);
+    REQUIRE(sim.dispatch() == FluidDispatch::EPOCH);
+    sim.terrain_update(TerrainRect(0, 0, terrain.size(), terrain.size()));
+    run_frames(sim, 1);
+
+    const FluidFrameTimings &timings = sim.last_frame_timings();
+    CHECK(timings.dispatch.count() >= 0);
+    CHECK(timings.drain.count() >= 0);
+    // all blocks are active after the terrain sync
+    CHECK(timings.work.count() > 0);
+    CHECK(timings.sync_overhead() == timings.dispatch + timings.drain);
+}
+
+TEST_CASE("sim/fluid/NativeFluidSim/substeps_match_frames")
+{
+    static const unsigned int substeps = 4;
+
+    Terrain terrain(test_blocks_per_axis*IFluidSim::block_size+1);
+    setup_test_terrain(terrain);
+    const TerrainRect full_rect(0, 0, terrain.size(), terrain.size());
+
+    FluidBlocks single_blocks(test_blocks_per_axis);
+    FluidBlocks sub_blocks(test_blocks_per_axis);
+
+    NativeFluidSim single_sim(single_blocks, terrain, FluidKernel::HALO);
+    NativeFluidSim sub_sim(sub_blocks, terrain, FluidKernel::HALO);
+
+    single_sim.terrain_update(full_rect);
+    sub_sim.terrain_update(full_rect);
+    run_frames(single_sim, 1);
+    run_frames(sub_sim, 1);
+
+    setup_test_fluid(single_blocks);
+    setup_test_fluid(sub_blocks);
+
+    FluidStepConfig config;
+    config.substeps = substeps;
+    sub_sim.set_step_config(config);
+
+    run_frames(single_sim, test_frames);
+    run_frames(sub_sim, test_frames / substeps);
+    CHECK(sub_sim.last_frame_steps() == substeps);
+
+    for (unsigned int y = 0; y < single_blocks.cells_per_axis(); ++y) {
+        for (unsigned int x = 0; x < single_blocks.cells_per_axis(); ++x) {
+            const FluidCell expected = single_blocks.clamped_cell_front_value(x, y);
+            const FluidCell actual = sub_blocks.clamped_cell_front_value(x, y);
+            INFO("cell " << x << ", " << y);
+            CHECK(actual.fluid_height == Approx(expected.fluid_height).epsilon(1e-5).margin(1e-6));
+            CHECK(actual.fluid_flow[0] == Approx(expected.fluid_flow[0]).epsilon(1e-5).margin(1e-6));
+            CHECK(actual.fluid_flow[1] == Approx(expected.fluid_flow[1]).epsilon(1e-5).margin(1e-6));
+        }
+    }
+}
+
+TEST_CASE("sim/fluid/NativeFluidSim/adaptive_substeps")
+{
+    Terrain terrain(test_blocks_per_axis*IFluidSim::block_size+1);
+    setup_test_terrain(terrain);
+    FluidBlocks blocks(test_blocks_per_axis);
+
+    NativeFluidSim sim(blocks, terrain, FluidKernel::HALO);
+    sim.terrain_update(TerrainRect(0, 0, terrain.size(), terrain.size()));
+
+    FluidStepConfig config;
+    config.substeps = 4;
+    config.adaptive = true;
+    config.frame_budget = std::chrono::microseconds(0);
+    sim.set_step_config(config);
+
+    run_frames(sim, 1);
+    CHECK(sim.last_frame_steps() == 4);
+    CHECK(sim.last_frame_duration().count() > 0);
+
+    // every frame overruns an empty budget
+    run_frames(sim, 1);
+    CHECK(sim.last_frame_steps() == 1);
+
+    config.frame_budget = std::chrono::hours(1);
+    sim.set_step_config(config);
+
+    run_frames(sim, 1);
+    CHECK(sim.last_frame_steps() == 1);
+    run_frames(sim, 1);
+    CHECK(sim.last_frame_steps() == 2);
+    run_frames(sim, 3);
+    CHECK(sim.last_frame_steps() == 4);
+}
+
+TEST_CASE("sim/fluid/NativeFluidSim/terrain_sync_dirty_blocks")
+{
+    Terrain terrain(test_blocks_per_axis*IFluidSim::block_size+1);
+    FluidBlocks blocks(test_blocks_per_axis);
+    NativeFluidSim sim(blocks, terrain, FluidKernel::SCALAR);
+
+    const unsigned int last = terrain.size()-1;
+    const unsigned int center = terrain.size() / 2;
+    {
+        Terrain::Field *field = nullptr;
+        auto lock = terrain.writable_field(field);
+        (*field)[0][Terrain::HEIGHT_ATTR] = 4.f;
+        (*field)[last*terrain.size()+last][Terrain::HEIGHT_ATTR] = 4.f;
+        (*field)[center*terrain.size()+center][Terrain::HEIGHT_ATTR] = 4.f;
+    }
+
+    // the center change is deliberately not announced; it must not be
+    // picked up by syncing the blocks of the corners
+    sim.terrain_update(TerrainRect(0, 0, 1, 1));
+    sim.terrain_update(TerrainRect(last, last, last+1, last+1));
+    run_frames(sim, 1);
+
+    const float raised = (4.f + 3*Terrain::default_height) / 4.f;
+    const unsigned int last_cell = blocks.cells_per_axis()-1;
+    CHECK(blocks.cell_meta(0, 0)->terrain_height == raised);
+    CHECK(blocks.cell_meta(last_cell, last_cell)->terrain_height == raised);
+    // the whole dirty block is synced, not only the changed cells
+    CHECK(blocks.cell_meta(5, 5)->terrain_height == Terrain::default_height);
+    CHECK(blocks.cell_meta(center, center)->terrain_height == 0.f);
+    CHECK(blocks.cell_meta(center-1, center-1)->terrain_height == 0.f);
+
+    sim.terrain_update(TerrainRect(center, center, center+1, center+1));
+    run_frames(sim, 1);
+
+    CHECK(blocks.cell_meta(center, center)->terrain_height == raised);
+    CHECK(blocks.cell_meta(center-1, center-1)->terrain_height == raised);
+}
+
+TEST_CASE("sim/fluid/NativeFluidSim/scalar_next_to_collapsed_diagonal")
+{
+    Terrain terrain(test_blocks_per_axis*IFluidSim::block_size+1);
+    FluidBlocks blocks(test_blocks_per_axis);
+    NativeFluidSim sim(blocks, terrain, FluidKernel::SCALAR);
+    REQUIRE(sim.kernel() == FluidKernel::SCALAR);
+
+    sim.terrain_update(TerrainRect(0, 0, terrain.size(), terrain.size()));
+    run_frames(sim, 1);
+    blocks.reset(1.f);
+    run_frames(sim, 1);
+    REQUIRE(blocks.block_counts().collapsed ==
+            test_blocks_per_axis*test_blocks_per_axis);
+
+    // only the center block is active; its corner cells read the collapsed
+    // diagonal blocks
+    blocks.block(1, 1)->set_active(true);
+    blocks.swap_active_blocks();
+    CHECK_FALSE(blocks.block(0, 0)->collapsed());
+    CHECK_FALSE(blocks.block(2, 2)->collapsed());
+
+    const unsigned int x0 = IFluidSim::block_size;
+    for (unsigned int y = x0; y < x0+5; ++y) {
+        for (unsigned int x = x0; x < x0+5; ++x) {
+            blocks.cell_front(x, y)->fluid_height += 5.f;
+            blocks.cell_back(x, y)->fluid_height += 5.f;
+        }
+    }
+
+    run_frames(sim, 4);
+    CHECK(blocks.block_counts().active >= 1);
+    // water flows out of the corner of the center block
+    CHECK(blocks.clamped_cell_front_value(x0-1, x0).fluid_height >
+          blocks.clamped_cell_front_value(0, 0).fluid_height);
+}
+
+TEST_CASE("sim/fluid/FluidTile/vectorised_matches_portable")
+{
+    FluidTileKernel best_kernel = select_fluid_tile_kernel();
+    if (!best_kernel) {
+        // nothing to compare against
+        return;
+    }
+
+    FluidBlocks blocks(test_blocks_per_axis);
+    setup_test_fluid(blocks);
+    for (unsigned int y = 0; y < blocks.cells_per_axis(); ++y) {
+        for (unsigned int x = 0; x < blocks.cells_per_axis(); ++x) {
+            blocks.cell_meta(x, y)->terrain_height = float(x % 7) - float(y % 5);
+            blocks.cell_front(x, y)->fluid_flow[0] = float(y % 3) * 0.1f;
+            blocks.cell_front(x, y)->fluid_flow[1] = float(x % 3) * -0.1f;
+        }
+    }
+
+    FluidTile portable_tile;
+    FluidTile best_tile;
+
+    for (unsigned int y = 0; y < blocks.blocks_per_axis(); ++y) {
+        for (unsigned int x = 0; x < blocks.blocks_per_axis(); ++x) {
+            INFO("block " << x << ", " << y);
+            const FluidBlock &block = *blocks.block(x, y);
+            portable_tile.load(blocks, block);
+            best_tile.load(blocks, block);
+            fluid_tile_step_portable(portable_tile, 0.f);
+            best_kernel(best_tile, 0.f);
+
+            for (unsigned int cy = 0; cy < IFluidSim::block_size; ++cy) {
+                for (unsigned int cx = 0; cx < IFluidSim::block_size; ++cx) {
+                    const unsigned int i = portable_tile.index(cx, cy);
+                    CHECK(best_tile.new_fluid_height[i] == portable_tile.new_fluid_height[i]);
+                    CHECK(best_tile.new_fluid_flow_x[i] == portable_tile.new_fluid_flow_x[i]);
+                    CHECK(best_tile.new_fluid_flow_y[i] == portable_tile.new_fluid_flow_y[i]);
+                }
+            }
+        }
+    }
+}
@@ -34,13 +34,15 @@ using namespace sim;
 
 struct NetMessageParserTest: public IMessageHandler
 {
-    NetMessageParserTest():
+    explicit NetMessageParserTest(
+            NetMessageParser::BufferMode mode = NetMessageParser::BUFFER_TO_BARRIER):
         m_parser(std::bind(&NetMessageParserTest::on_link_control,
                            this,
                            std::placeholders::_1),
                  std::bind(&NetMessageParserTest::on_error,
                            this),
-                 0),
+                 0,
+                 mode),
         m_had_error(false),
         m_pass_unhandled(true)
     {
@@ -75,6 +77,37 @@ protected:
 const auto HEADER_SIZE = NetMessageParser::HEADER_SIZE;
 
 
+static void append_message(std::string &dest,
+                           NetMessageClass msgclass,
+                           const google::protobuf::Message &msg)
+{
+    const std::string payload = msg.SerializeAsString();
+    uint8_t header[HEADER_SIZE];
+    google::protobuf::io::CodedOutputStream::WriteLittleEndian32ToArray(
+                msgclass, &header[0]);
+    google::protobuf::io::CodedOutputStream::WriteLittleEndian32ToArray(
+                payload.size(), &header[4]);
+    dest.append(reinterpret_cast<const char*>(header), HEADER_SIZE);
+    dest.append(payload);
+}
+
+static void feed(NetMessageParser &parser, const std::string &src,
+                 const size_t max_chunk)
+{
+    char *dest;
+    size_t size;
+    size_t offset = 0;
+    while (offset < src.size()) {
+        std::tie(dest, size) = parser.next_buffer();
+        REQUIRE(size > 0);
+        size = std::min(size, std::min(max_chunk, src.size() - offset));
+        memcpy(dest, &src[offset], size);
+        parser.written(size);
+        offset += size;
+    }
+}
+
+
 TEST_CASE("sim/networld/NetMessageParser/barriers_and_emission")
 {
     char *dest;
@@ -323,3 +356,225 @@ TEST_CASE("sim/networld/NetMessageParser/set_message_handler(nullptr)")
     CHECK(test.m_found.size() == 0);
     CHECK(test.m_had_error);
 }
+
+TEST_CASE("sim/networld/NetMessageParser/stream_back_to_back_messages")
+{
+    // enough data to wrap around the ring buffer a few times
+    static const unsigned int message_count = 80;
+    static const unsigned int density_map_size = 4096;
+
+    std::string src;
+    for (unsigned int i = 0; i < message_count; ++i) {
+        messages::WorldCommand msg;
+        msg.set_token(i);
+        messages::TerraformRaise *raise = msg.mutable_tf_raise();
+        raise->set_xc(i);
+        raise->set_yc(0);
+        raise->set_brush_size(64);
+        raise->set_brush_strength(1.f);
+        for (unsigned int j = 0; j < density_map_size; ++j) {
+            raise->add_density_map(j);
+        }
+        append_message(src, MSGCLASS_WORLD_COMMAND, msg);
+    }
+    REQUIRE(src.size() > 2*NetMessageParser::RING_BUFFER_SIZE);
+
+    NetMessageParserTest test(NetMessageParser::BUFFER_STREAM);
+    feed(test.m_parser, src, 12345);
+
+    CHECK_FALSE(test.m_had_error);
+    REQUIRE(test.m_found.size() == message_count);
+    for (unsigned int i = 0; i < message_count; ++i) {
+        messages::WorldCommand *msg = dynamic_cast<messages::WorldCommand*>(
+                    test.m_found[i].get());
+        REQUIRE(msg);
+        CHECK(msg->token() == i);
+        REQUIRE(msg->has_tf_raise());
+        CHECK(msg->tf_raise().xc() == i);
+        REQUIRE(msg->tf_raise().density_map_size() == (int)density_map_size);
+        CHECK(msg->tf_raise().density_map(density_map_size-1) == density_map_size-1);
+    }
+}
+
+TEST_CASE("sim/networld/NetMessageParser/stream_many_small_messages_in_one_write")
+{
+    std::string src;
+    for (unsigned int i = 0; i < 100; ++i) {
+        messages::WorldCommand msg;
+        if (i % 2 == 0) {
+            // an empty payload, to check zero-length messages within a batch
+            msg.set_token(i);
+        }
+        append_message(src, MSGCLASS_WORLD_COMMAND, msg);
+    }
+
+    NetMessageParserTest test(NetMessageParser::BUFFER_STREAM);
+    char *dest;
+    size_t size;
+    std::tie(dest, size) = test.m_parser.next_buffer();
+    REQUIRE(size >= src.size());
+    memcpy(dest, src.data(), src.size());
+    test.m_parser.written(src.size());
+
+    CHECK_FALSE(test.m_had_error);
+    CHECK(test.m_found.size() == 100);
+}
+
+TEST_CASE("sim/networld/NetMessageParser/recycle_messages")
+{
+    messages::NetWorldControl msg;
+    msg.mutable_ping()->set_token(0x1234);
+    msg.mutable_ping()->set_payload(0x5678);
+    std::string src;
+    append_message(src, MSGCLASS_LINK_CONTROL, msg);
+
+    NetMessageParserTest test(NetMessageParser::BUFFER_STREAM);
+    feed(test.m_parser, src, src.size());
+    REQUIRE(test.m_found.size() == 1);
+
+    google::protobuf::Message *const first = test.m_found[0].get();
+    test.m_parser.recycle(std::unique_ptr<messages::NetWorldControl>(
+                              static_cast<messages::NetWorldControl*>(
+                                  test.m_found[0].release())));
+    test.m_found.clear();
+
+    msg.mutable_ping()->set_token(0x4321);
+    src.clear();
+    append_message(src, MSGCLASS_LINK_CONTROL, msg);
+    feed(test.m_parser, src, src.size());
+    REQUIRE(test.m_found.size() == 1);
+
+    CHECK(test.m_found[0].get() == first);
+    messages::NetWorldControl *received =
+            dynamic_cast<messages::NetWorldControl*>(test.m_found[0].get());
+    REQUIRE(received);
+    CHECK(received->ping().token() == 0x4321);
+    CHECK(received->ping().payload() == 0x5678);
+}
+
+TEST_CASE("sim/networld/NetMessageWriter/coalesce_and_parse")
+{
+    NetMessageWriter writer;
+
+    for (unsigned int i = 0; i < 10; ++i) {
+        messages::WorldCommand msg;
+        msg.set_token(i);
+        CHECK(writer.append(MSGCLASS_WORLD_COMMAND, msg));
+    }
+    {
+        messages::NetWorldControl msg;
+        msg.mutable_ping()->set_token(0x1234);
+        msg.mutable_ping()->set_payload(0x5678);
+        CHECK(writer.append(MSGCLASS_LINK_CONTROL, msg));
+    }
+    {
+        messages::WorldCommandResponse msg;
+        msg.set_token(42);
+        CHECK(writer.append(MSGCLASS_WORLD_COMMAND_RESPONSE, msg));
+    }
+
+    std::string sent;
+    unsigned int writes = 0;
+    auto write = [&sent, &writes](const char *data, std::size_t size)
+    {
+        sent.append(data, size);
+        writes += 1;
+        return true;
+    };
+
+    CHECK(writer.flush(write));
+    // all small messages end up in the same chunk
+    CHECK(writes == 1);
+
+    NetSendStats stats = writer.stats();
+    CHECK(stats.flushes == 1);
+    CHECK(stats.messages == 12);
+    CHECK(stats.bytes == sent.size());
+    CHECK(stats.last_flush_messages == 12);
+    CHECK(stats.last_flush_bytes == sent.size());
+
+    // nothing to send: no write and no change in the statistics
+    CHECK(writer.flush(write));
+    CHECK(writes == 1);
+    CHECK(writer.stats().flushes == 1);
+
+    NetMessageParserTest test(NetMessageParser::BUFFER_STREAM);
+    feed(test.m_parser, sent, sent.size());
+    CHECK_FALSE(test.m_had_error);
+    REQUIRE(test.m_found.size() == 12);
+    for (unsigned int i = 0; i < 10; ++i) {
+        messages::WorldCommand *msg = dynamic_cast<messages::WorldCommand*>(
+                    test.m_found[i].get());
+        REQUIRE(msg);
+        CHECK(msg->token() == i);
+    }
+    messages::NetWorldControl *ctrl = dynamic_cast<messages::NetWorldControl*>(
+                test.m_found[10].get());
+    REQUIRE(ctrl);
+    CHECK(ctrl->ping().token() == 0x1234);
+    messages::WorldCommandResponse *resp =
+            dynamic_cast<messages::WorldCommandResponse*>(test.m_found[11].get());
+    REQUIRE(resp);
+    CHECK(resp->token() == 42);
+}
+
+TEST_CASE("sim/networld/NetMessageWriter/large_messages")
+{
+    NetMessageWriter writer;
+
+    // larger than a chunk, so that every message needs its own
+    messages::WorldCommand msg;
+    messages::TerraformRaise *raise = msg.mutable_tf_raise();
+    raise->set_xc(0);
+    raise->set_yc(0);
+    raise->set_brush_size(64);
+    raise->set_brush_strength(1.f);
+    for (unsigned int i = 0; i < NetMessageWriter::CHUNK_SIZE / sizeof(float); ++i) {
+        raise->add_density_map(i);
+    }
+    CHECK(writer.append(MSGCLASS_WORLD_COMMAND, msg));
+    CHECK(writer.append(MSGCLASS_WORLD_COMMAND, msg));
+
+    std::string sent;
+    unsigned int writes = 0;
+    auto write = [&sent, &writes](const char *data, std::size_t size)
+    {
+        sent.append(data, size);
+        writes += 1;
+        return true;
+    };
+    CHECK(writer.flush(write));
+    CHECK(writes == 2);
+
+    // the chunks are reused for the next frame
+    CHECK(writer.append(MSGCLASS_WORLD_COMMAND, msg));
+    CHECK(writer.flush(write));
+    CHECK(writes == 3);
+    CHECK(writer.stats().messages == 3);
+
+    NetMessageParserTest test(NetMessageParser::BUFFER_STREAM);
+    feed(test.m_parser, sent, 4096);
+    CHECK_FALSE(test.m_had_error);
+    CHECK(test.m_found.size() == 3);
+
+    for (unsigned int i = 0; i < NetMessageParser::MAX_MESSAGE_SIZE / sizeof(float); ++i) {
+        raise->add_density_map(i);
+    }
+    CHECK_FALSE(writer.append(MSGCLASS_WORLD_COMMAND, msg));
+}
+
+TEST_CASE("sim/networld/NetMessageWriter/failed_write")
+{
+    NetMessageWriter writer;
+    messages::WorldCommand msg;
+    msg.set_token(1);
+    CHECK(writer.append(MSGCLASS_WORLD_COMMAND, msg));
+
+    CHECK_FALSE(writer.flush([](const char*, std::size_t) { return false; }));
+    CHECK(writer.stats().bytes == 0);
+
+    // the data is gone after a failed flush
+    unsigned int writes = 0;
+    CHECK(writer.flush([&writes](const char*, std::size_t) { ++writes; return true; }));
+    CHECK(writes == 0);
+}
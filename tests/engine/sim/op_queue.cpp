@@ -0,0 +1,144 @@
+/**********************************************************************
+File name: op_queue.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include <catch.hpp>
+
+#include <thread>
+
+#include "ffengine/sim/op_queue.hpp"
+
+using namespace sim;
+
+
+class TaggedOperation: public WorldOperation
+{
+public:
+    TaggedOperation(unsigned int producer, unsigned int seq):
+        producer(producer),
+        seq(seq)
+    {
+
+    }
+
+public:
+    const unsigned int producer;
+    const unsigned int seq;
+
+public:
+    WorldOperationResult execute(WorldState &) override
+    {
+        return NO_ERROR;
+    }
+
+};
+
+static const TaggedOperation &tagged(const WorldOperationPtr &op)
+{
+    return static_cast<const TaggedOperation&>(*op);
+}
+
+
+TEST_CASE("sim/op_queue/fifo")
+{
+    WorldOperationQueue queue(4);
+    std::vector<WorldOperationPtr> ops;
+
+    CHECK(queue.pop_all(ops) == 0);
+
+    for (unsigned int i = 0; i < 3; ++i) {
+        queue.push(std::make_unique<TaggedOperation>(0, i));
+    }
+    REQUIRE(queue.pop_all(ops) == 3);
+    for (unsigned int i = 0; i < 3; ++i) {
+        CHECK(tagged(ops[i]).seq == i);
+    }
+
+    SECTION("nodes are recycled")
+    {
+        for (unsigned int round = 0; round < 10; ++round) {
+            ops.clear();
+            for (unsigned int i = 0; i < 4; ++i) {
+                queue.push(std::make_unique<TaggedOperation>(0, i));
+            }
+            REQUIRE(queue.pop_all(ops) == 4);
+            CHECK(tagged(ops.back()).seq == 3);
+        }
+        CHECK(queue.overflows() == 0);
+    }
+
+    SECTION("pool overflow")
+    {
+        ops.clear();
+        for (unsigned int i = 0; i < 10; ++i) {
+            queue.push(std::make_unique<TaggedOperation>(0, i));
+        }
+        CHECK(queue.overflows() == 6);
+        REQUIRE(queue.pop_all(ops) == 10);
+        for (unsigned int i = 0; i < 10; ++i) {
+            CHECK(tagged(ops[i]).seq == i);
+        }
+    }
+}
+
+TEST_CASE("sim/op_queue/multi_producer")
+{
+    static const unsigned int producers = 4;
+    static const unsigned int ops_per_producer = 20000;
+
+    WorldOperationQueue queue(64);
+    std::vector<std::thread> threads;
+    for (unsigned int p = 0; p < producers; ++p) {
+        threads.emplace_back([&queue, p]()
+        {
+            for (unsigned int i = 0; i < ops_per_producer; ++i) {
+                queue.push(std::make_unique<TaggedOperation>(p, i));
+            }
+        });
+    }
+
+    std::vector<WorldOperationPtr> ops;
+    std::vector<unsigned int> next_seq(producers, 0);
+    bool in_order = true;
+    while (ops.size() < producers*ops_per_producer) {
+        const std::size_t offset = ops.size();
+        queue.pop_all(ops);
+        for (std::size_t i = offset; i < ops.size(); ++i) {
+            const TaggedOperation &op = tagged(ops[i]);
+            if (op.seq != next_seq[op.producer]) {
+                in_order = false;
+            }
+            next_seq[op.producer] = op.seq+1;
+        }
+    }
+
+    for (std::thread &thread: threads) {
+        thread.join();
+    }
+
+    CHECK(in_order);
+    CHECK(queue.pop_all(ops) == 0);
+    CHECK(ops.size() == producers*ops_per_producer);
+    for (unsigned int p = 0; p < producers; ++p) {
+        CHECK(next_seq[p] == ops_per_producer);
+    }
+}
@@ -0,0 +1,308 @@
+/**********************************************************************
+File name: savegame.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include <catch.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <unistd.h>
+
+#include "ffengine/io/filestream.hpp"
+
+#include "ffengine/sim/savegame.hpp"
+#include "ffengine/sim/world.hpp"
+
+using namespace sim;
+
+
+class TemporaryFile
+{
+public:
+    TemporaryFile():
+        m_path("/tmp/ffe-savegame-XXXXXX")
+    {
+        const int fd = mkstemp(&m_path[0]);
+        REQUIRE(fd >= 0);
+        ::close(fd);
+    }
+
+    ~TemporaryFile()
+    {
+        std::remove(m_path.c_str());
+    }
+
+private:
+    std::string m_path;
+
+public:
+    inline const std::string &path() const
+    {
+        return m_path;
+    }
+
+};
+
+
+/**
+ * Stream which discards everything and fails a single write call.
+ */
+class FailingStream: public io::Stream
+{
+public:
+    explicit FailingStream(const unsigned int failing_call):
+        m_failing_call(failing_call),
+        m_calls(0)
+    {
+
+    }
+
+private:
+    const unsigned int m_failing_call;
+    unsigned int m_calls;
+
+public:
+    void close() override
+    {
+
+    }
+
+    bool is_readable() const override
+    {
+        return false;
+    }
+
+    bool is_seekable() const override
+    {
+        return false;
+    }
+
+    bool is_writable() const override
+    {
+        return true;
+    }
+
+    std::size_t write(const void*, const std::size_t length) override
+    {
+        m_calls += 1;
+        if (m_calls == m_failing_call) {
+            return 0;
+        }
+        return length;
+    }
+
+};
+
+
+static void save_to(const std::string &path, const WorldState &state)
+{
+    io::FileStream stream(path, io::OpenMode::WRITE, io::WriteMode::OVERWRITE);
+    save_world(stream, state);
+}
+
+
+TEST_CASE("sim/savegame/roundtrip")
+{
+    TemporaryFile file;
+
+    WorldState original;
+    {
+        Terrain::Field *field = nullptr;
+        auto lock = original.terrain().writable_field(field);
+        const unsigned int size = original.terrain().size();
+        for (unsigned int y = 0; y < size; y += 7) {
+            for (unsigned int x = 0; x < size; x += 3) {
+                (*field)[y*size+x] = Vector3f(x % 50, y % 13, 0);
+            }
+        }
+    }
+
+    FluidBlocks &blocks = original.fluid().blocks();
+    blocks.expand_all();
+    FluidBlock &wet_block = *blocks.block(2, 3);
+    wet_block.local_cell_front(5, 6)->fluid_height = 1.5f;
+    wet_block.local_cell_front(5, 6)->fluid_flow[1] = -0.25f;
+    wet_block.set_active(true);
+    wet_block.swap_buffers();
+    wet_block.local_cell_front(5, 6)->fluid_height = 1.5f;
+    wet_block.local_cell_front(5, 6)->fluid_flow[1] = -0.25f;
+    original.fluid().set_ocean_level(12.f);
+
+    Fluid::Source &source = original.objects().allocate<Fluid::Source>(
+                100.f, 200.f, 5.f, 30.f, 2.f);
+    original.fluid().add_source(&source);
+
+    PhysicalNode &start = original.graph().create_node(
+                EDGE_CLASS_ROAD, Vector3f(10, 10, 20));
+    PhysicalNode &end = original.graph().create_node(
+                EDGE_CLASS_ROAD, Vector3f(50, 10, 20));
+    original.graph().construct_curve(start, Vector3f(30, 10, 20), end,
+                                     EDGE_TYPE_BIDIRECTIONAL_THREE_LANES);
+    original.graph().reshape();
+
+    save_to(file.path(), original);
+
+    WorldState restored;
+    unsigned int sources_added = 0;
+    auto conn = sig11::connect(
+                restored.fluid_source_added(),
+                [&sources_added](object_ptr<Fluid::Source>)
+    {
+        sources_added += 1;
+    });
+    load_world(file.path(), restored);
+
+    SECTION("terrain")
+    {
+        const TerrainSnapshot a = original.terrain().snapshot();
+        const TerrainSnapshot b = restored.terrain().snapshot();
+        bool equal = true;
+        for (unsigned int y = 0; y < a.size(); ++y) {
+            for (unsigned int x = 0; x < a.size(); ++x) {
+                equal = equal && a.vertex(x, y) == b.vertex(x, y);
+            }
+        }
+        CHECK(equal);
+    }
+
+    SECTION("fluid")
+    {
+        CHECK(restored.fluid().ocean_level() == 12.f);
+        const FluidBlock &block = *restored.fluid().blocks().block(2, 3);
+        CHECK(block.local_cell_front_value(5, 6).fluid_height == 1.5f);
+        CHECK(block.local_cell_front_value(5, 6).fluid_flow[1] == -0.25f);
+        CHECK(block.local_cell_front_value(6, 6).fluid_height == 0.f);
+    }
+
+    SECTION("fluid sources keep their IDs")
+    {
+        REQUIRE(restored.fluid().sources().size() == 1);
+        const Fluid::Source &restored_source =
+                *restored.fluid().sources()[0];
+        CHECK(restored_source.object_id() == source.object_id());
+        CHECK(restored_source.m_pos == source.m_pos);
+        CHECK(restored_source.m_radius == source.m_radius);
+        CHECK(restored_source.m_absolute_height == source.m_absolute_height);
+        CHECK(restored_source.m_capacity == source.m_capacity);
+        CHECK(sources_added == 1);
+    }
+
+    SECTION("graph keeps its IDs")
+    {
+        REQUIRE(restored.graph().nodes().size() ==
+                original.graph().nodes().size());
+        REQUIRE(restored.graph().bundles().size() ==
+                original.graph().bundles().size());
+        for (const auto &bundle: original.graph().bundles()) {
+            const PhysicalEdgeBundle *copy =
+                    restored.objects().get_safe<PhysicalEdgeBundle>(
+                        bundle.object_id());
+            REQUIRE(copy);
+            CHECK(copy->start_node().object_id() ==
+                  bundle->start_node().object_id());
+            CHECK(copy->end_node().object_id() ==
+                  bundle->end_node().object_id());
+            CHECK(copy->control_point() == bundle->control_point());
+            CHECK(&copy->type() == &bundle->type());
+        }
+    }
+}
+
+TEST_CASE("sim/savegame/rejects_malformed")
+{
+    TemporaryFile file;
+    {
+        WorldState original;
+        save_to(file.path(), original);
+    }
+
+    SECTION("bad magic")
+    {
+        FILE *f = fopen(file.path().c_str(), "r+b");
+        REQUIRE(f);
+        fputc('X', f);
+        fclose(f);
+    }
+
+    SECTION("truncated")
+    {
+        REQUIRE(truncate(file.path().c_str(), 100000) == 0);
+    }
+
+    WorldState restored;
+    CHECK_THROWS_AS(load_world(file.path(), restored), SaveGameError);
+    CHECK(restored.fluid().sources().empty());
+    CHECK(restored.terrain().snapshot().height(0, 0) == Terrain::default_height);
+}
+
+TEST_CASE("sim/savegame/rejects_duplicate_ids")
+{
+    TemporaryFile file;
+    Object::ID source_id;
+    {
+        WorldState original;
+        Fluid::Source &source = original.objects().allocate<Fluid::Source>(
+                    100.f, 200.f, 5.f, 30.f, 2.f);
+        original.fluid().add_source(&source);
+        source_id = source.object_id();
+        original.graph().create_node(EDGE_CLASS_ROAD, Vector3f(10, 10, 20));
+        save_to(file.path(), original);
+    }
+
+    // give the node the ID of the fluid source
+    {
+        FILE *f = fopen(file.path().c_str(), "r+b");
+        REQUIRE(f);
+        // the section table follows the 40 byte file header; each entry
+        // holds the tag, padding, offset and length
+        for (unsigned int i = 0; i < 4; ++i) {
+            std::uint32_t tag = 0;
+            std::uint64_t offset = 0;
+            REQUIRE(fseek(f, 40 + i*24, SEEK_SET) == 0);
+            REQUIRE(fread(&tag, sizeof(tag), 1, f) == 1);
+            REQUIRE(fseek(f, 4, SEEK_CUR) == 0);
+            REQUIRE(fread(&offset, sizeof(offset), 1, f) == 1);
+            if (tag == 4) {
+                // behind the count header is the first node record
+                const std::uint64_t id = source_id;
+                REQUIRE(fseek(f, offset + 8, SEEK_SET) == 0);
+                REQUIRE(fwrite(&id, sizeof(id), 1, f) == 1);
+            }
+        }
+        fclose(f);
+    }
+
+    WorldState restored;
+    CHECK_THROWS_AS(load_world(file.path(), restored), SaveGameError);
+    CHECK(restored.fluid().sources().empty());
+    CHECK(restored.graph().nodes().empty());
+}
+
+TEST_CASE("sim/savegame/save_fails_on_short_padding_write")
+{
+    WorldState original;
+    // the file header and the section table are the first two writes, the
+    // padding up to the first section follows
+    FailingStream stream(3);
+    CHECK_THROWS_AS(save_world(stream, original), io::StreamWriteError);
+}
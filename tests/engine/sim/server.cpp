@@ -0,0 +1,155 @@
+/**********************************************************************
+File name: server.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#define QT_NO_EMIT
+
+#include <catch.hpp>
+
+#include <chrono>
+#include <thread>
+
+#include <QCoreApplication>
+
+#include "ffengine/sim/server.hpp"
+
+#include "world_command.pb.h"
+
+using namespace sim;
+
+
+class RecordingClient: public ServerClientBase
+{
+public:
+    RecordingClient():
+        m_pending(0),
+        m_flushed(0),
+        m_flushes(0)
+    {
+
+    }
+
+private:
+    std::mutex m_mutex;
+    unsigned int m_pending;
+    unsigned int m_flushed;
+    unsigned int m_flushes;
+
+protected:
+    bool msg_unhandled(AbstractMessagePtr &&) override
+    {
+        return false;
+    }
+
+public:
+    bool msg_world_command_response(
+            std::unique_ptr<messages::WorldCommandResponse> &&) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending += 1;
+        return true;
+    }
+
+    void flush() override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_flushed += m_pending;
+        m_pending = 0;
+        m_flushes += 1;
+    }
+
+    void terminate() override
+    {
+
+    }
+
+    void set_message_handler(IMessageHandler *) override
+    {
+
+    }
+
+    unsigned int pending()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_pending;
+    }
+
+    unsigned int flushed()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_flushed;
+    }
+
+    unsigned int flushes()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_flushes;
+    }
+};
+
+
+TEST_CASE("sim/server/Server/game_frame_flushes_clients")
+{
+    // the flush requests are delivered as queued calls, which need an
+    // application object to be processed
+    int argc = 1;
+    char arg0[] = "tests";
+    char *argv[] = {arg0, nullptr};
+    std::unique_ptr<QCoreApplication> app;
+    if (!QCoreApplication::instance()) {
+        app.reset(new QCoreApplication(argc, argv));
+    }
+
+    Server server;
+    RecordingClient client;
+    server.add_client(&client);
+
+    client.msg_world_command_response(
+                std::make_unique<messages::WorldCommandResponse>());
+    CHECK(client.pending() == 1);
+
+    const std::chrono::steady_clock::time_point deadline =
+            std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (client.flushed() == 0 &&
+           std::chrono::steady_clock::now() < deadline)
+    {
+        QCoreApplication::sendPostedEvents(&client);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    CHECK(client.flushed() == 1);
+    CHECK(client.pending() == 0);
+
+    SECTION("removed clients are not flushed anymore")
+    {
+        server.remove_client(&client);
+        // drop flush requests which were issued before the removal
+        QCoreApplication::sendPostedEvents(&client);
+        const unsigned int flushes = client.flushes();
+
+        std::this_thread::sleep_for(Server::game_frame_duration*4);
+        QCoreApplication::sendPostedEvents(&client);
+        CHECK(client.flushes() == flushes);
+    }
+
+    server.remove_client(&client);
+}
@@ -0,0 +1,279 @@
+/**********************************************************************
+File name: snapshot.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include <catch.hpp>
+
+#include "ffengine/sim/snapshot.hpp"
+
+#include "world_snapshot.pb.h"
+
+using namespace sim;
+
+
+static const unsigned int test_blocks_per_axis = 3;
+
+
+static void setup_test_state(Terrain &terrain, FluidBlocks &fluid)
+{
+    terrain.from_sincos(Vector3f(0.11f, 0.07f, 3.f));
+    {
+        Terrain::Field *field = nullptr;
+        auto lock = terrain.writable_field(field);
+        for (unsigned int i = 0; i < field->size(); ++i) {
+            (*field)[i][Terrain::SAND_ATTR] = (i % 7) / 7.f;
+        }
+    }
+
+    fluid.reset(0.f);
+    for (unsigned int y = 0; y < fluid.cells_per_axis(); ++y) {
+        for (unsigned int x = 0; x < fluid.cells_per_axis(); ++x) {
+            FluidCell *cell = fluid.cell_front(x, y);
+            cell->fluid_height = (x + y < 64 ? 2.5f + x*0.01f : 0.f);
+            cell->fluid_flow[0] = (x + y < 64 ? 0.1f*std::sin(x*0.3f) : 0.f);
+            cell->fluid_flow[1] = (x + y < 64 ? -0.05f*y : 0.f);
+        }
+    }
+}
+
+
+TEST_CASE("sim/snapshot/roundtrip")
+{
+    const unsigned int terrain_size = test_blocks_per_axis*IFluidSim::block_size+1;
+    Terrain src_terrain(terrain_size);
+    FluidBlocks src_fluid(test_blocks_per_axis);
+    setup_test_state(src_terrain, src_fluid);
+
+    Terrain dest_terrain(terrain_size);
+    FluidBlocks dest_fluid(test_blocks_per_axis);
+    dest_fluid.reset(0.f);
+
+    // handlers must see the new terrain in the snapshot
+    unsigned int heightmap_updates = 0;
+    TerrainSnapshot seen_by_handler;
+    dest_terrain.heightmap_updated().connect(
+                [&heightmap_updates, &seen_by_handler, &dest_terrain](TerrainRect){
+        ++heightmap_updates;
+        seen_by_handler = dest_terrain.snapshot();
+    });
+
+    WorldSnapshotEncoder encoder(src_terrain, src_fluid);
+    WorldSnapshotDecoder decoder(dest_terrain, dest_fluid);
+
+    // the terrain has one more vertex than there are cells, which leaves a
+    // one vertex wide row and column of terrain blocks
+    CHECK(encoder.chunk_count() == 4*4 + test_blocks_per_axis*test_blocks_per_axis);
+
+    const std::uint64_t initial_serial = dest_terrain.snapshot().serial();
+
+    std::size_t compressed_size = 0;
+    messages::WorldSnapshotChunk chunk;
+    while (encoder.encode_next(chunk)) {
+        compressed_size += chunk.ByteSizeLong();
+        CHECK_FALSE(decoder.complete());
+        CHECK(heightmap_updates == 0);
+        REQUIRE(decoder.apply(chunk));
+    }
+    CHECK(encoder.done());
+    CHECK(decoder.complete());
+    CHECK(heightmap_updates == 1);
+
+    // the terrain is published once for the whole snapshot, not per chunk
+    const TerrainSnapshot published = dest_terrain.snapshot();
+    CHECK(published.serial() == initial_serial + 1);
+    REQUIRE(seen_by_handler.valid());
+    CHECK(seen_by_handler.serial() == published.serial());
+
+    const std::size_t raw_size =
+            terrain_size*terrain_size*sizeof(Vector3f) +
+            src_fluid.cells_per_axis()*src_fluid.cells_per_axis()*sizeof(FluidCell);
+    CHECK(compressed_size < raw_size / 4);
+
+    {
+        const Terrain::Field *src = nullptr;
+        const Terrain::Field *dest = nullptr;
+        auto src_lock = src_terrain.readonly_field(src);
+        auto dest_lock = dest_terrain.readonly_field(dest);
+        for (unsigned int i = 0; i < src->size(); ++i) {
+            INFO("vertex " << i);
+            CHECK(published.height(i % terrain_size, i / terrain_size) == (*dest)[i][Terrain::HEIGHT_ATTR]);
+            CHECK(seen_by_handler.height(i % terrain_size, i / terrain_size) == (*dest)[i][Terrain::HEIGHT_ATTR]);
+            CHECK((*dest)[i][Terrain::HEIGHT_ATTR] == Approx((*src)[i][Terrain::HEIGHT_ATTR]).margin(WorldSnapshotEncoder::TERRAIN_HEIGHT_STEP));
+            CHECK((*dest)[i][Terrain::SAND_ATTR] == Approx((*src)[i][Terrain::SAND_ATTR]).margin(WorldSnapshotEncoder::TERRAIN_SAND_STEP));
+        }
+    }
+
+    for (unsigned int y = 0; y < src_fluid.cells_per_axis(); ++y) {
+        for (unsigned int x = 0; x < src_fluid.cells_per_axis(); ++x) {
+            INFO("cell " << x << ", " << y);
+            const FluidCell expected = src_fluid.clamped_cell_front_value(x, y);
+            const FluidCell front = dest_fluid.clamped_cell_front_value(x, y);
+            const FluidCell back = *dest_fluid.cell_back(x, y);
+            CHECK(FluidFloat(front.fluid_height) == Approx(FluidFloat(expected.fluid_height)).margin(WorldSnapshotEncoder::FLUID_HEIGHT_STEP));
+            CHECK(FluidFloat(front.fluid_flow[0]) == Approx(FluidFloat(expected.fluid_flow[0])).margin(WorldSnapshotEncoder::FLUID_FLOW_STEP));
+            CHECK(FluidFloat(front.fluid_flow[1]) == Approx(FluidFloat(expected.fluid_flow[1])).margin(WorldSnapshotEncoder::FLUID_FLOW_STEP));
+            CHECK(FluidFloat(back.fluid_height) == FluidFloat(front.fluid_height));
+        }
+    }
+}
+
+TEST_CASE("sim/snapshot/reject_mismatching_chunks")
+{
+    const unsigned int terrain_size = test_blocks_per_axis*IFluidSim::block_size+1;
+    Terrain src_terrain(terrain_size);
+    FluidBlocks src_fluid(test_blocks_per_axis);
+    setup_test_state(src_terrain, src_fluid);
+
+    WorldSnapshotEncoder encoder(src_terrain, src_fluid);
+    messages::WorldSnapshotChunk chunk;
+    REQUIRE(encoder.encode_next(chunk));
+
+    SECTION("terrain size")
+    {
+        Terrain dest_terrain(terrain_size + IFluidSim::block_size);
+        FluidBlocks dest_fluid(test_blocks_per_axis+1);
+        WorldSnapshotDecoder decoder(dest_terrain, dest_fluid);
+        CHECK_FALSE(decoder.apply(chunk));
+    }
+
+    SECTION("corrupted data")
+    {
+        Terrain dest_terrain(terrain_size);
+        FluidBlocks dest_fluid(test_blocks_per_axis);
+        WorldSnapshotDecoder decoder(dest_terrain, dest_fluid);
+
+        std::string data = chunk.data();
+        data.resize(data.size() / 2);
+        chunk.set_data(data);
+        CHECK_FALSE(decoder.apply(chunk));
+
+        {
+            const Terrain::Field *field = nullptr;
+            auto lock = dest_terrain.readonly_field(field);
+            CHECK((*field)[0][Terrain::HEIGHT_ATTR] == Terrain::default_height);
+        }
+    }
+
+    SECTION("out of bounds")
+    {
+        Terrain dest_terrain(terrain_size);
+        FluidBlocks dest_fluid(test_blocks_per_axis);
+        WorldSnapshotDecoder decoder(dest_terrain, dest_fluid);
+        chunk.set_x(4);
+        CHECK_FALSE(decoder.apply(chunk));
+    }
+}
+
+TEST_CASE("sim/snapshot/TerrainJournal/replicate_deltas")
+{
+    const unsigned int terrain_size = test_blocks_per_axis*IFluidSim::block_size+1;
+    Terrain src_terrain(terrain_size);
+    FluidBlocks src_fluid(test_blocks_per_axis);
+    setup_test_state(src_terrain, src_fluid);
+
+    // the client starts from a snapshot
+    Terrain dest_terrain(terrain_size);
+    FluidBlocks dest_fluid(test_blocks_per_axis);
+    WorldSnapshotDecoder decoder(dest_terrain, dest_fluid);
+    {
+        WorldSnapshotEncoder encoder(src_terrain, src_fluid);
+        messages::WorldSnapshotChunk chunk;
+        while (encoder.encode_next(chunk)) {
+            REQUIRE(decoder.apply(chunk));
+        }
+    }
+
+    TerrainJournal journal(src_terrain);
+    std::vector<messages::TerrainDelta> deltas;
+    CHECK(journal.collect(deltas) == 0);
+
+    auto stroke = [&src_terrain](unsigned int xc, unsigned int yc, float amount)
+    {
+        {
+            Terrain::Field *field = nullptr;
+            auto lock = src_terrain.writable_rect(
+                        TerrainRect(xc-3, yc-3, xc+4, yc+4), field);
+            for (unsigned int y = yc-3; y <= yc+3; ++y) {
+                for (unsigned int x = xc-3; x <= xc+3; ++x) {
+                    (*field)[y*src_terrain.size()+x][Terrain::HEIGHT_ATTR] += amount;
+                }
+            }
+        }
+        src_terrain.notify_heightmap_changed(
+                    TerrainRect(xc-3, yc-3, xc+4, yc+4));
+    };
+
+    SECTION("strokes on one block are merged")
+    {
+        stroke(20, 20, 1.f);
+        stroke(22, 21, 0.5f);
+        stroke(24, 30, -0.25f);
+        CHECK(journal.collect(deltas) == 1);
+        REQUIRE(deltas.size() == 1);
+        CHECK(deltas[0].x0() == 17);
+        CHECK(deltas[0].y0() == 17);
+        CHECK(deltas[0].width() == 11);
+        CHECK(deltas[0].height() == 17);
+    }
+
+    SECTION("strokes across block borders are split")
+    {
+        stroke(IFluidSim::block_size, IFluidSim::block_size, 2.f);
+        CHECK(journal.collect(deltas) == 4);
+    }
+
+    SECTION("unchanged notifications produce no delta")
+    {
+        src_terrain.notify_heightmap_changed(TerrainRect(0, 0, 10, 10));
+        CHECK(journal.collect(deltas) == 0);
+    }
+
+    SECTION("undone strokes produce no delta")
+    {
+        stroke(20, 20, 1.f);
+        stroke(20, 20, -1.f);
+        CHECK(journal.collect(deltas) == 0);
+    }
+
+    stroke(100, 100, 1.5f);
+    journal.collect(deltas);
+    const TerrainSnapshot before_deltas = dest_terrain.snapshot();
+    for (const messages::TerrainDelta &delta: deltas) {
+        REQUIRE(decoder.apply(delta));
+    }
+
+    // deltas only republish the tiles they touch
+    const TerrainSnapshot after_deltas = dest_terrain.snapshot();
+    CHECK(after_deltas.serial() > before_deltas.serial());
+    CHECK(after_deltas.tile_data(1, 1) != before_deltas.tile_data(1, 1));
+    CHECK(after_deltas.tile_data(2, 0) == before_deltas.tile_data(2, 0));
+    CHECK(after_deltas.height(100, 100) == Approx(before_deltas.height(100, 100) + 1.5f).margin(WorldSnapshotEncoder::TERRAIN_HEIGHT_STEP));
+
+    const Terrain::Field *src = nullptr;
+    const Terrain::Field *dest = nullptr;
+    auto src_lock = src_terrain.readonly_field(src);
+    auto dest_lock = dest_terrain.readonly_field(dest);
+    for (unsigned int i = 0; i < src->size(); ++i) {
+        INFO("vertex " << i);
+        CHECK((*dest)[i][Terrain::HEIGHT_ATTR] == Approx((*src)[i][Terrain::HEIGHT_ATTR]).margin(WorldSnapshotEncoder::TERRAIN_HEIGHT_STEP));
+    }
+}
@@ -0,0 +1,249 @@
+/**********************************************************************
+File name: terrain.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include <catch.hpp>
+
+#include <atomic>
+#include <future>
+
+#include "ffengine/sim/fluid.hpp"
+#include "ffengine/sim/terrain.hpp"
+
+using namespace sim;
+
+
+static const unsigned int test_terrain_size = 4*Terrain::LOCK_TILE_SIZE+1;
+
+
+TEST_CASE("sim/terrain/rect_locks/disjoint")
+{
+    Terrain terrain(test_terrain_size);
+
+    Terrain::Field *field = nullptr;
+    auto write_lock = terrain.writable_rect(TerrainRect(0, 0, 10, 10), field);
+    REQUIRE(write_lock.owns_lock());
+
+    // readers and writers on the other end of the terrain are not blocked
+    auto future = std::async(std::launch::async, [&terrain]()
+    {
+        const Terrain::Field *field = nullptr;
+        {
+            auto lock = terrain.readonly_rect(
+                        TerrainRect(test_terrain_size-10, test_terrain_size-10,
+                                    test_terrain_size, test_terrain_size),
+                        field);
+        }
+        {
+            Terrain::Field *wfield = nullptr;
+            auto lock = terrain.writable_rect(
+                        TerrainRect(0, test_terrain_size-10,
+                                    10, test_terrain_size),
+                        wfield);
+        }
+    });
+    CHECK(future.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+}
+
+TEST_CASE("sim/terrain/rect_locks/overlapping")
+{
+    Terrain terrain(test_terrain_size);
+
+    Terrain::Field *field = nullptr;
+    auto write_lock = terrain.writable_rect(
+                TerrainRect(Terrain::LOCK_TILE_SIZE-1, 0,
+                            Terrain::LOCK_TILE_SIZE+1, 1),
+                field);
+
+    // touches only the second tile of the write lock
+    auto future = std::async(std::launch::async, [&terrain]()
+    {
+        const Terrain::Field *field = nullptr;
+        auto lock = terrain.readonly_rect(
+                    TerrainRect(Terrain::LOCK_TILE_SIZE+10, 10,
+                                Terrain::LOCK_TILE_SIZE+20, 20),
+                    field);
+    });
+    CHECK(future.wait_for(std::chrono::milliseconds(100)) == std::future_status::timeout);
+
+    write_lock.unlock();
+    CHECK_FALSE(write_lock.owns_lock());
+    CHECK(future.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+}
+
+TEST_CASE("sim/terrain/rect_locks/whole_field")
+{
+    Terrain terrain(test_terrain_size);
+
+    const Terrain::Field *field = nullptr;
+    Terrain::FieldLock lock;
+    CHECK_FALSE(lock.owns_lock());
+    lock = terrain.readonly_rect(TerrainRect(100, 100, 110, 110), field);
+    CHECK(lock.owns_lock());
+
+    // a whole-field writer waits for all rect readers
+    auto future = std::async(std::launch::async, [&terrain]()
+    {
+        Terrain::Field *field = nullptr;
+        auto lock = terrain.writable_field(field);
+    });
+    CHECK(future.wait_for(std::chrono::milliseconds(100)) == std::future_status::timeout);
+
+    Terrain::FieldLock moved(std::move(lock));
+    CHECK_FALSE(lock.owns_lock());
+    CHECK(moved.owns_lock());
+    CHECK(future.wait_for(std::chrono::milliseconds(100)) == std::future_status::timeout);
+
+    moved = Terrain::FieldLock();
+    CHECK(future.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+
+    SECTION("rects outside of the field lock nothing")
+    {
+        Terrain::Field *wfield = nullptr;
+        auto lock1 = terrain.writable_rect(
+                    TerrainRect(test_terrain_size, 0, test_terrain_size+10, 10),
+                    wfield);
+        auto lock2 = terrain.writable_field(wfield);
+        CHECK(lock2.owns_lock());
+    }
+}
+
+TEST_CASE("sim/terrain/snapshot")
+{
+    Terrain terrain(test_terrain_size);
+
+    TerrainSnapshot before = terrain.snapshot();
+    REQUIRE(before.valid());
+    CHECK(before.size() == test_terrain_size);
+    CHECK(before.height(10, 10) == Terrain::default_height);
+    CHECK(before.height(test_terrain_size-1, test_terrain_size-1) ==
+          Terrain::default_height);
+
+    {
+        Terrain::Field *field = nullptr;
+        auto lock = terrain.writable_rect(TerrainRect(10, 10, 11, 11), field);
+        (*field)[10*test_terrain_size+10][Terrain::HEIGHT_ATTR] = 42.f;
+
+        SECTION("writes are not visible before the lock is released")
+        {
+            CHECK(terrain.snapshot().serial() == before.serial());
+            CHECK(terrain.snapshot().height(10, 10) == Terrain::default_height);
+        }
+    }
+
+    TerrainSnapshot after = terrain.snapshot();
+    CHECK(after.serial() > before.serial());
+    CHECK(after.height(10, 10) == 42.f);
+
+    // older snapshots are immutable
+    CHECK(before.height(10, 10) == Terrain::default_height);
+
+    // only the modified tile has been copied
+    CHECK(after.tile_data(0, 0) != before.tile_data(0, 0));
+    CHECK(after.tile_data(1, 0) == before.tile_data(1, 0));
+    CHECK(after.tile_data(3, 3) == before.tile_data(3, 3));
+
+    SECTION("deferred publishing")
+    {
+        {
+            Terrain::Field *field = nullptr;
+            auto lock = terrain.writable_rect(TerrainRect(10, 10, 11, 11),
+                                              field, false);
+            (*field)[10*test_terrain_size+10][Terrain::HEIGHT_ATTR] = 23.f;
+        }
+        CHECK(terrain.snapshot().serial() == after.serial());
+        CHECK(terrain.snapshot().height(10, 10) == 42.f);
+
+        terrain.publish_rect(TerrainRect(10, 10, 11, 11));
+        CHECK(terrain.snapshot().serial() > after.serial());
+        CHECK(terrain.snapshot().height(10, 10) == 23.f);
+        CHECK(terrain.snapshot().tile_data(1, 0) == after.tile_data(1, 0));
+    }
+
+    SECTION("read-only locks do not publish")
+    {
+        const Terrain::Field *field = nullptr;
+        terrain.readonly_field(field);
+        CHECK(terrain.snapshot().serial() == after.serial());
+    }
+}
+
+TEST_CASE("sim/terrain/snapshot/concurrent")
+{
+    Terrain terrain(test_terrain_size);
+
+    std::atomic_bool done(false);
+    auto reader = std::async(std::launch::async, [&terrain, &done]()
+    {
+        std::uint64_t prev_serial = 0;
+        bool ordered = true;
+        while (!done) {
+            TerrainSnapshot snapshot = terrain.snapshot();
+            // each version has the same height everywhere in the written row
+            const Terrain::height_t h = snapshot.height(0, 0);
+            ordered = ordered && snapshot.serial() >= prev_serial &&
+                    snapshot.height(Terrain::LOCK_TILE_SIZE*2, 0) == h;
+            prev_serial = snapshot.serial();
+        }
+        return ordered;
+    });
+
+    for (unsigned int i = 0; i < 200; ++i) {
+        Terrain::Field *field = nullptr;
+        auto lock = terrain.writable_rect(
+                    TerrainRect(0, 0, test_terrain_size, 1), field);
+        for (unsigned int x = 0; x < test_terrain_size; ++x) {
+            (*field)[x][Terrain::HEIGHT_ATTR] = i;
+        }
+    }
+    done = true;
+    CHECK(reader.get());
+    CHECK(terrain.snapshot().height(test_terrain_size-1, 0) == 199.f);
+}
+
+TEST_CASE("sim/terrain/Sandifier/publishes_changed_tiles")
+{
+    Terrain terrain(5*IFluidSim::block_size+1);
+    Fluid fluid(terrain);
+    fluid.blocks().reset(0.f);
+    Sandifier sandifier(terrain, fluid);
+
+    // nothing is wet and there is no sand yet
+    const TerrainSnapshot before = terrain.snapshot();
+    sandifier.run_steps();
+    CHECK(terrain.snapshot().serial() == before.serial());
+
+    {
+        Terrain::Field *field = nullptr;
+        auto lock = terrain.writable_rect(TerrainRect(200, 6, 201, 7), field);
+        (*field)[6*terrain.size()+200][Terrain::SAND_ATTR] = 1.f;
+    }
+    const TerrainSnapshot with_sand = terrain.snapshot();
+
+    // the second run covers the rows around the sand
+    sandifier.run_steps();
+    const TerrainSnapshot after = terrain.snapshot();
+    CHECK(after.serial() > with_sand.serial());
+    CHECK(after.tile_data(3, 0) != with_sand.tile_data(3, 0));
+    CHECK(after.tile_data(0, 0) == with_sand.tile_data(0, 0));
+    CHECK(after.tile_data(4, 0) == with_sand.tile_data(4, 0));
+}
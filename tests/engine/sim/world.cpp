@@ -0,0 +1,117 @@
+/**********************************************************************
+File name: world.cpp
+This file is part of: SCC (working title)
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about SCC please e-mail one of the authors named in
+the AUTHORS file.
+**********************************************************************/
+#include <catch.hpp>
+
+#include "ffengine/sim/world.hpp"
+
+using namespace sim;
+
+
+static WorldOperationFootprint terrain_footprint(const TerrainRect &rect)
+{
+    WorldOperationFootprint result;
+    result.exclusive = false;
+    result.terrain = rect;
+    return result;
+}
+
+static WorldOperationFootprint fluid_footprint(const TerrainRect &rect)
+{
+    WorldOperationFootprint result;
+    result.exclusive = false;
+    result.fluid = rect;
+    return result;
+}
+
+
+TEST_CASE("sim/world/footprint/conflicts")
+{
+    const WorldOperationFootprint exclusive;
+    const WorldOperationFootprint t1 = terrain_footprint(TerrainRect(0, 0, 10, 10));
+    const WorldOperationFootprint t2 = terrain_footprint(TerrainRect(10, 0, 20, 10));
+    const WorldOperationFootprint t3 = terrain_footprint(TerrainRect(5, 5, 15, 15));
+    const WorldOperationFootprint f1 = fluid_footprint(TerrainRect(0, 0, 10, 10));
+    const WorldOperationFootprint empty = terrain_footprint(TerrainRect(5, 5, 5, 5));
+
+    CHECK(exclusive.exclusive);
+    CHECK(exclusive.conflicts_with(exclusive));
+    CHECK(exclusive.conflicts_with(t1));
+    CHECK(t1.conflicts_with(exclusive));
+
+    CHECK_FALSE(t1.conflicts_with(t2));
+    CHECK(t1.conflicts_with(t3));
+    CHECK(t2.conflicts_with(t3));
+
+    // terrain and fluid are independent
+    CHECK_FALSE(t1.conflicts_with(f1));
+    CHECK(f1.conflicts_with(f1));
+
+    CHECK_FALSE(empty.conflicts_with(t1));
+    CHECK_FALSE(empty.conflicts_with(empty));
+}
+
+TEST_CASE("sim/world/partition_into_waves")
+{
+    std::vector<WorldOperationFootprint> footprints;
+    std::vector<unsigned int> waves;
+
+    SECTION("empty")
+    {
+        CHECK(partition_into_waves(footprints, waves) == 0);
+        CHECK(waves.empty());
+    }
+
+    SECTION("disjoint operations share a wave")
+    {
+        for (unsigned int i = 0; i < 4; ++i) {
+            footprints.emplace_back(terrain_footprint(
+                                        TerrainRect(i*10, 0, i*10+10, 10)));
+        }
+        CHECK(partition_into_waves(footprints, waves) == 1);
+        CHECK(waves == std::vector<unsigned int>({0, 0, 0, 0}));
+    }
+
+    SECTION("overlapping operations keep their order")
+    {
+        footprints.emplace_back(terrain_footprint(TerrainRect(0, 0, 10, 10)));
+        footprints.emplace_back(terrain_footprint(TerrainRect(20, 0, 30, 10)));
+        footprints.emplace_back(terrain_footprint(TerrainRect(5, 0, 15, 10)));
+        footprints.emplace_back(terrain_footprint(TerrainRect(12, 0, 22, 10)));
+        footprints.emplace_back(fluid_footprint(TerrainRect(0, 0, 64, 64)));
+        CHECK(partition_into_waves(footprints, waves) == 3);
+        CHECK(waves == std::vector<unsigned int>({0, 0, 1, 2, 0}));
+    }
+
+    SECTION("exclusive operations are alone in their wave")
+    {
+        footprints.emplace_back(terrain_footprint(TerrainRect(0, 0, 10, 10)));
+        footprints.emplace_back(terrain_footprint(TerrainRect(20, 0, 30, 10)));
+        footprints.emplace_back(WorldOperationFootprint());
+        footprints.emplace_back(terrain_footprint(TerrainRect(40, 0, 50, 10)));
+        footprints.emplace_back(terrain_footprint(TerrainRect(0, 0, 10, 10)));
+        footprints.emplace_back(WorldOperationFootprint());
+        CHECK(partition_into_waves(footprints, waves) == 4);
+        CHECK(waves == std::vector<unsigned int>({0, 0, 1, 2, 2, 3}));
+    }
+}